@@ -0,0 +1,91 @@
+/*
+ * Filename: bench.h
+ * Project: rpc-mt
+ * Brief: Definitions shared by the benchmark server and load client
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>      // Import size_t
+#include <stdint.h>      // Import uint64_t
+#include <time.h>        // Import clock_gettime()
+
+/*
+ * The benchmark program, in the range set aside for local use.
+ *
+ *   BENCH_NULL  void -> void
+ *   BENCH_ECHO  opaque<> -> the same opaque<>
+ *   BENCH_SINK  opaque<> -> u_int, the length received
+ *   BENCH_SPIN  u_int microseconds of busy work -> void
+ */
+
+#define BENCH_PROG  0x20000b0bU
+#define BENCH_VERS  1
+#define BENCH_NULL  0
+#define BENCH_ECHO  1
+#define BENCH_SINK  2
+#define BENCH_SPIN  3
+
+#define BENCH_PORT  40111
+#define BENCH_MAXPAYLOAD (1024 * 1024)
+
+static inline uint64_t
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+/*
+ * Latency histogram
+ * -----------------
+ * Log-linear buckets: values below 64 have a bucket each; above that,
+ * each power of 2 is split into 32 buckets, so any value is known
+ * to within about 3%, over the whole range of uint64_t, in a fixed
+ * 15 KiB.  Histograms of several threads can simply be added.
+ */
+
+#define HIST_SUB_BITS 6
+#define HIST_SUB      (1U << HIST_SUB_BITS)
+#define HIST_NBUCKETS (HIST_SUB + (64 - HIST_SUB_BITS) * (HIST_SUB / 2))
+
+struct bench_hist {
+    uint64_t h_count;
+    uint64_t h_max;
+    uint64_t h_sum;
+    uint64_t h_buckets[HIST_NBUCKETS];
+};
+
+extern void     hist_init(struct bench_hist *h);
+extern void     hist_add(struct bench_hist *h, uint64_t v);
+extern void     hist_merge(struct bench_hist *dst, const struct bench_hist *src);
+extern uint64_t hist_percentile(const struct bench_hist *h, double p);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _BENCH_H */
@@ -0,0 +1,650 @@
+/*
+ * Filename: bench_client.c
+ * Project: rpc-mt
+ * Brief: Multi-threaded load generator for the benchmark server
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: bench_client [options]
+ *
+ *   -h host       server IPv4 address (default 127.0.0.1)
+ *   -p port       server port (default 40111)
+ *   -P proto      tcp or udp (default tcp)
+ *   -t threads    client threads, each with its own socket (default 4)
+ *   -d seconds    length of the measured run (default 10)
+ *   -W seconds    warm-up, not measured (default 1)
+ *   -x proc       null, echo, sink or spin (default echo)
+ *   -s size       payload bytes, N or MIN-MAX, uniformly random (default 64)
+ *   -u usec       microseconds of work per call, for spin (default 10)
+ *   -o window     calls outstanding per thread, closed loop (default 1)
+ *   -R rate       calls per second, all threads together; open loop
+ *   -T msec       UDP: a call with no reply after this long is lost
+ *   -l label      prefix for the result line
+ *
+ * Closed loop: each thread keeps @var{window} calls outstanding, and
+ * sends the next call as soon as a reply comes back.  Throughput is
+ * what the server can sustain.
+ *
+ * Open loop: calls are sent on a fixed schedule, at @var{rate},
+ * whether or not replies have come back.  Latency is measured from
+ * when a call was scheduled to be sent, not from when it was sent,
+ * so a server that falls behind shows it in the latency, instead
+ * of slowing down the client (no "coordinated omission").
+ * A call that comes due while a thread already has WINDOW_MAX calls
+ * outstanding is not dropped; it is sent as soon as there is room,
+ * still stamped with its scheduled time.  Such calls are counted
+ * as "behind"; calls that came due, but were never sent before
+ * the end of the run, are counted as "unsent".
+ *
+ * Calls are encoded by hand, with AUTH_NONE; the client needs
+ * neither librpc nor a client-side RPC library.
+ *
+ * The result is one line of key=value pairs, for scripts.
+ */
+
+#include <stdio.h>
+    // Import fprintf(), printf()
+#include <stdlib.h>
+    // Import exit(), calloc(), free(), atoi(), strtoul()
+#include <string.h>
+    // Import memset(), memcpy(), memmove(), strcmp(), strerror()
+#include <unistd.h>
+    // Import getopt(), close(), write()
+#include <errno.h>
+    // Import errno
+#include <poll.h>
+    // Import ppoll()
+#include <pthread.h>
+    // Import pthread_create(), pthread_join()
+#include <sys/socket.h>
+    // Import socket(), connect(), send(), recv()
+#include <netinet/in.h>
+    // Import struct sockaddr_in
+#include <netinet/tcp.h>
+    // Import TCP_NODELAY
+#include <arpa/inet.h>
+    // Import inet_pton(), htonl(), ntohl()
+
+#include "bench.h"
+
+#define WINDOW_MAX  4096        /* power of 2 */
+#define RBUF_SIZE   (4 * 1024 * 1024)
+#define CALL_HDR_WORDS 10       /* xid .. verifier */
+
+enum { PROTO_TCP, PROTO_UDP };
+
+static struct sockaddr_in server;
+static int opt_proto = PROTO_TCP;
+static int opt_threads = 4;
+static double opt_seconds = 10.0;
+static double opt_warmup = 1.0;
+static uint32_t opt_proc = BENCH_ECHO;
+static u_int opt_size_min = 64;
+static u_int opt_size_max = 64;
+static u_int opt_usec = 10;
+static int opt_window = 1;
+static double opt_rate = 0.0;
+static int opt_timeout_ms = 200;
+static const char *opt_label = NULL;
+
+static const char *progname = "bench_client";
+
+static uint64_t t_start;
+static uint64_t t_measure;      /* end of warm-up */
+static uint64_t t_end;
+
+struct slot {
+    uint32_t s_xid;             /* 0, if free */
+    uint64_t s_stamp;           /* when it was sent, or scheduled */
+};
+
+struct client {
+    pthread_t         c_thread;
+    int               c_id;
+    int               c_sock;
+    uint32_t          c_seq;
+    uint32_t          c_rand;
+    int               c_outstanding;
+    struct slot       c_slots[WINDOW_MAX];
+    unsigned char    *c_sbuf;
+    unsigned char    *c_rbuf;
+    size_t            c_rlen;
+    uint64_t          c_sent;
+    uint64_t          c_done;
+    uint64_t          c_errors;
+    uint64_t          c_lost;
+    uint64_t          c_behind;     /* open loop: sent late, window full */
+    uint64_t          c_unsent;     /* open loop: due, but never sent */
+    uint64_t          c_full;       /* open loop: last time calls were due, window full */
+    uint64_t          c_bytes;
+    struct bench_hist c_hist;
+};
+
+static void
+die(const char *what)
+{
+    fprintf(stderr, "%s: %s: %s\n", progname, what, strerror(errno));
+    exit(2);
+}
+
+static inline uint32_t
+xorshift(uint32_t *s)
+{
+    uint32_t x;
+
+    x = *s;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *s = x;
+    return (x);
+}
+
+static inline unsigned char *
+put32(unsigned char *p, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(p, &v, sizeof (v));
+    return (p + sizeof (v));
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof (v));
+    return (ntohl(v));
+}
+
+static void
+connect_client(struct client *c)
+{
+    int type;
+    int on;
+
+    type = (opt_proto == PROTO_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+    c->c_sock = socket(AF_INET, type, 0);
+    if (c->c_sock < 0) {
+        die("socket");
+    }
+    if (connect(c->c_sock, (struct sockaddr *)&server, sizeof (server)) != 0) {
+        die("connect");
+    }
+    if (opt_proto == PROTO_TCP) {
+        on = 1;
+        (void) setsockopt(c->c_sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+    }
+}
+
+/*
+ * Encode and send one call, stamped @var{stamp}.
+ * The header words never change, but the xid and the payload size.
+ */
+static void
+send_call(struct client *c, uint64_t stamp)
+{
+    struct slot *s;
+    unsigned char *p;
+    unsigned char *body;
+    uint32_t xid;
+    u_int size;
+    size_t len;
+
+    xid = ((uint32_t)(c->c_id + 1) << 24) | (++c->c_seq & 0xffffff);
+    if (xid == 0) {
+        xid = 1;
+    }
+    s = &c->c_slots[xid & (WINDOW_MAX - 1)];
+    if (s->s_xid != 0) {
+        // Wrapped around onto a call that never got a reply.
+        ++c->c_lost;
+        --c->c_outstanding;
+    }
+
+    body = c->c_sbuf + 4;
+    p = put32(body, xid);
+    p = put32(p, 0);                    /* CALL */
+    p = put32(p, 2);                    /* RPC version */
+    p = put32(p, BENCH_PROG);
+    p = put32(p, BENCH_VERS);
+    p = put32(p, opt_proc);
+    p = put32(p, 0);                    /* AUTH_NONE credential */
+    p = put32(p, 0);
+    p = put32(p, 0);                    /* AUTH_NONE verifier */
+    p = put32(p, 0);
+    switch (opt_proc) {
+    case BENCH_ECHO:
+    case BENCH_SINK:
+        size = opt_size_min;
+        if (opt_size_max > opt_size_min) {
+            size += xorshift(&c->c_rand) % (opt_size_max - opt_size_min + 1);
+        }
+        p = put32(p, size);
+        p += (size + 3) & ~3U;          /* the bytes themselves do not matter */
+        break;
+    case BENCH_SPIN:
+        p = put32(p, opt_usec);
+        break;
+    default:
+        break;
+    }
+    len = (size_t)(p - body);
+    if (opt_proto == PROTO_TCP) {
+        (void) put32(c->c_sbuf, 0x80000000U | (uint32_t)len);
+        body = c->c_sbuf;
+        len += 4;
+    }
+
+    s->s_xid = xid;
+    s->s_stamp = stamp;
+    ++c->c_outstanding;
+    ++c->c_sent;
+    while (len > 0) {
+        ssize_t n = send(c->c_sock, body, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (opt_proto == PROTO_UDP && (errno == ENOBUFS || errno == ECONNREFUSED)) {
+                break;          // counted as lost, later
+            }
+            die("send");
+        }
+        body += n;
+        len -= (size_t)n;
+    }
+}
+
+/*
+ * Account for one reply, of @var{len} bytes, with the body of its
+ * first fragment at @var{p}.
+ */
+static void
+got_reply(struct client *c, const unsigned char *p, size_t len, uint64_t now)
+{
+    struct slot *s;
+    uint32_t xid;
+    uint32_t verflen;
+
+    if (len < 24) {
+        ++c->c_errors;
+        return;
+    }
+    xid = get32(p);
+    s = &c->c_slots[xid & (WINDOW_MAX - 1)];
+    if (s->s_xid != xid) {
+        return;                 // already given up on, as lost
+    }
+    s->s_xid = 0;
+    --c->c_outstanding;
+
+    // REPLY, MSG_ACCEPTED, verifier, SUCCESS
+    verflen = get32(p + 16);
+    if (get32(p + 4) != 1 || get32(p + 8) != 0
+        || 24 + ((verflen + 3) & ~3U) > len
+        || get32(p + 20 + ((verflen + 3) & ~3U)) != 0) {
+        ++c->c_errors;
+        return;
+    }
+    if (s->s_stamp >= t_measure && now <= t_end) {
+        ++c->c_done;
+        c->c_bytes += len;
+        hist_add(&c->c_hist, now - s->s_stamp);
+    }
+}
+
+/*
+ * Take complete records out of the TCP receive buffer.
+ */
+static void
+parse_tcp(struct client *c, uint64_t now)
+{
+    size_t pos;
+    size_t end;
+    size_t frag;
+    uint32_t mark;
+    int last;
+
+    pos = 0;
+    for (;;) {
+        // Find the end of the record that starts at @var{pos}.
+        end = pos;
+        last = 0;
+        while (!last) {
+            if (c->c_rlen - end < 4) {
+                goto incomplete;
+            }
+            mark = get32(c->c_rbuf + end);
+            last = (mark & 0x80000000U) != 0;
+            frag = mark & 0x7fffffffU;
+            if (c->c_rlen - end - 4 < frag) {
+                goto incomplete;
+            }
+            end += 4 + frag;
+        }
+        got_reply(c, c->c_rbuf + pos + 4, end - pos - 4, now);
+        pos = end;
+    }
+
+  incomplete:
+    if (pos > 0) {
+        memmove(c->c_rbuf, c->c_rbuf + pos, c->c_rlen - pos);
+        c->c_rlen -= pos;
+    }
+    if (c->c_rlen == RBUF_SIZE) {
+        fprintf(stderr, "%s: reply too big\n", progname);
+        exit(2);
+    }
+}
+
+static void
+receive(struct client *c)
+{
+    ssize_t n;
+    uint64_t now;
+
+    for (;;) {
+        if (opt_proto == PROTO_TCP) {
+            n = recv(c->c_sock, c->c_rbuf + c->c_rlen, RBUF_SIZE - c->c_rlen, MSG_DONTWAIT);
+        }
+        else {
+            n = recv(c->c_sock, c->c_rbuf, RBUF_SIZE, MSG_DONTWAIT);
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            if (errno == EINTR || (opt_proto == PROTO_UDP && errno == ECONNREFUSED)) {
+                continue;
+            }
+            die("recv");
+        }
+        if (n == 0) {
+            if (opt_proto == PROTO_TCP) {
+                fprintf(stderr, "%s: server closed the connection\n", progname);
+                exit(2);
+            }
+            continue;
+        }
+        now = bench_now();
+        if (opt_proto == PROTO_TCP) {
+            c->c_rlen += (size_t)n;
+            parse_tcp(c, now);
+        }
+        else {
+            got_reply(c, c->c_rbuf, (size_t)n, now);
+        }
+    }
+}
+
+/*
+ * UDP: give up on calls that have waited too long for a reply.
+ */
+static void
+expire(struct client *c, uint64_t now)
+{
+    uint64_t limit;
+    size_t i;
+
+    limit = (uint64_t)opt_timeout_ms * 1000000;
+    for (i = 0; i < WINDOW_MAX; ++i) {
+        if (c->c_slots[i].s_xid != 0 && now - c->c_slots[i].s_stamp > limit) {
+            c->c_slots[i].s_xid = 0;
+            --c->c_outstanding;
+            if (c->c_slots[i].s_stamp >= t_measure) {
+                ++c->c_lost;
+            }
+        }
+    }
+}
+
+static void *
+client_thread(void *arg)
+{
+    struct client *c;
+    struct pollfd pfd;
+    uint64_t interval;
+    uint64_t next;
+    uint64_t now;
+    uint64_t last_expire;
+    uint64_t timeout;
+    struct timespec ts;
+
+    c = (struct client *)arg;
+    interval = 0;
+    next = t_start;
+    if (opt_rate > 0) {
+        interval = (uint64_t)(1e9 * opt_threads / opt_rate);
+        next = t_start + interval * (uint64_t)c->c_id / (uint64_t)opt_threads;
+    }
+    last_expire = t_start;
+    pfd.fd = c->c_sock;
+    pfd.events = POLLIN;
+
+    for (;;) {
+        now = bench_now();
+        if (now >= t_end) {
+            break;
+        }
+        if (interval != 0) {
+            while (next <= now && c->c_outstanding < WINDOW_MAX) {
+                if (next <= c->c_full && next >= t_measure) {
+                    ++c->c_behind;
+                }
+                send_call(c, next);
+                next += interval;
+            }
+            if (next <= now) {
+                // Window full; what is due waits for a reply.
+                c->c_full = now;
+                timeout = (uint64_t)opt_timeout_ms * 1000000 / 4;
+            }
+            else {
+                timeout = next - now;
+            }
+        }
+        else {
+            while (c->c_outstanding < opt_window) {
+                send_call(c, now);
+            }
+            timeout = (uint64_t)opt_timeout_ms * 1000000;
+        }
+        ts.tv_sec = (time_t)(timeout / 1000000000);
+        ts.tv_nsec = (long)(timeout % 1000000000);
+        if (ppoll(&pfd, 1, &ts, NULL) > 0) {
+            receive(c);
+        }
+        if (opt_proto == PROTO_UDP) {
+            now = bench_now();
+            if (now - last_expire > (uint64_t)opt_timeout_ms * 1000000 / 4) {
+                expire(c, now);
+                last_expire = now;
+            }
+        }
+    }
+    if (interval != 0) {
+        if (next < t_measure) {
+            next = t_measure;
+        }
+        if (next < t_end) {
+            c->c_unsent = (t_end - next + interval - 1) / interval;
+        }
+    }
+    return (NULL);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: %s [-h host] [-p port] [-P tcp|udp] [-t threads] [-d seconds]\n"
+        "       [-W warmup] [-x null|echo|sink|spin] [-s size|min-max] [-u usec]\n"
+        "       [-o window] [-R rate] [-T msec] [-l label]\n",
+        progname);
+    exit(2);
+}
+
+static void
+parse_size(const char *arg)
+{
+    char *end;
+
+    opt_size_min = (u_int)strtoul(arg, &end, 0);
+    opt_size_max = opt_size_min;
+    if (*end == '-') {
+        opt_size_max = (u_int)strtoul(end + 1, &end, 0);
+    }
+    if (*end != '\0' || opt_size_max < opt_size_min || opt_size_max > BENCH_MAXPAYLOAD) {
+        usage();
+    }
+}
+
+static uint32_t
+parse_proc(const char *arg)
+{
+    if (strcmp(arg, "null") == 0) {
+        return (BENCH_NULL);
+    }
+    if (strcmp(arg, "echo") == 0) {
+        return (BENCH_ECHO);
+    }
+    if (strcmp(arg, "sink") == 0) {
+        return (BENCH_SINK);
+    }
+    if (strcmp(arg, "spin") == 0) {
+        return (BENCH_SPIN);
+    }
+    usage();
+    return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const char *procname[] = { "null", "echo", "sink", "spin" };
+    struct client *cv;
+    struct bench_hist hist;
+    uint64_t sent, done, errors, lost, behind, unsent, bytes;
+    double secs;
+    const char *host;
+    int opt;
+    int i;
+
+    host = "127.0.0.1";
+    memset(&server, 0, sizeof (server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(BENCH_PORT);
+    while ((opt = getopt(argc, argv, "h:p:P:t:d:W:x:s:u:o:R:T:l:")) != -1) {
+        switch (opt) {
+        case 'h': host = optarg; break;
+        case 'p': server.sin_port = htons((uint16_t)atoi(optarg)); break;
+        case 'P':
+            if (strcmp(optarg, "tcp") == 0) {
+                opt_proto = PROTO_TCP;
+            }
+            else if (strcmp(optarg, "udp") == 0) {
+                opt_proto = PROTO_UDP;
+            }
+            else {
+                usage();
+            }
+            break;
+        case 't': opt_threads = atoi(optarg); break;
+        case 'd': opt_seconds = atof(optarg); break;
+        case 'W': opt_warmup = atof(optarg); break;
+        case 'x': opt_proc = parse_proc(optarg); break;
+        case 's': parse_size(optarg); break;
+        case 'u': opt_usec = (u_int)atoi(optarg); break;
+        case 'o': opt_window = atoi(optarg); break;
+        case 'R': opt_rate = atof(optarg); break;
+        case 'T': opt_timeout_ms = atoi(optarg); break;
+        case 'l': opt_label = optarg; break;
+        default: usage();
+        }
+    }
+    if (inet_pton(AF_INET, host, &server.sin_addr) != 1
+        || opt_threads < 1 || opt_window < 1 || opt_window > WINDOW_MAX / 2
+        || opt_seconds <= 0 || opt_timeout_ms < 1) {
+        usage();
+    }
+
+    cv = (struct client *)calloc((size_t)opt_threads, sizeof (*cv));
+    if (cv == NULL) {
+        die("calloc");
+    }
+    for (i = 0; i < opt_threads; ++i) {
+        cv[i].c_id = i;
+        cv[i].c_rand = 0x9e3779b9U * (uint32_t)(i + 1);
+        cv[i].c_sbuf = (unsigned char *)calloc(1, 4 * (CALL_HDR_WORDS + 2) + BENCH_MAXPAYLOAD);
+        cv[i].c_rbuf = (unsigned char *)malloc(RBUF_SIZE);
+        if (cv[i].c_sbuf == NULL || cv[i].c_rbuf == NULL) {
+            die("malloc");
+        }
+        hist_init(&cv[i].c_hist);
+        connect_client(&cv[i]);
+    }
+
+    t_start = bench_now();
+    t_measure = t_start + (uint64_t)(opt_warmup * 1e9);
+    t_end = t_measure + (uint64_t)(opt_seconds * 1e9);
+    for (i = 0; i < opt_threads; ++i) {
+        if (pthread_create(&cv[i].c_thread, NULL, client_thread, &cv[i]) != 0) {
+            die("pthread_create");
+        }
+    }
+
+    hist_init(&hist);
+    sent = done = errors = lost = behind = unsent = bytes = 0;
+    for (i = 0; i < opt_threads; ++i) {
+        pthread_join(cv[i].c_thread, NULL);
+        hist_merge(&hist, &cv[i].c_hist);
+        sent += cv[i].c_sent;
+        done += cv[i].c_done;
+        errors += cv[i].c_errors;
+        lost += cv[i].c_lost;
+        behind += cv[i].c_behind;
+        unsent += cv[i].c_unsent;
+        bytes += cv[i].c_bytes;
+        close(cv[i].c_sock);
+    }
+
+    secs = opt_seconds;
+    if (opt_label != NULL) {
+        printf("%s ", opt_label);
+    }
+    printf("proto=%s proc=%s mode=%s threads=%d window=%d rate=%.0f"
+        " size=%u-%u secs=%.1f sent=%llu calls=%llu errors=%llu lost=%llu"
+        " behind=%llu unsent=%llu tput=%.0f MBps=%.2f"
+        " mean_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n",
+        opt_proto == PROTO_TCP ? "tcp" : "udp", procname[opt_proc],
+        opt_rate > 0 ? "open" : "closed", opt_threads, opt_window, opt_rate,
+        opt_size_min, opt_size_max, secs,
+        (unsigned long long)sent, (unsigned long long)done,
+        (unsigned long long)errors, (unsigned long long)lost,
+        (unsigned long long)behind, (unsigned long long)unsent,
+        (double)done / secs, (double)bytes / secs / 1e6,
+        hist.h_count ? (double)hist.h_sum / (double)hist.h_count / 1e3 : 0.0,
+        hist_percentile(&hist, 50.0) / 1e3,
+        hist_percentile(&hist, 90.0) / 1e3,
+        hist_percentile(&hist, 99.0) / 1e3,
+        hist_percentile(&hist, 99.9) / 1e3,
+        hist.h_max / 1e3);
+    return (errors != 0);
+}
@@ -0,0 +1,122 @@
+/*
+ * Filename: bench_hist.c
+ * Project: rpc-mt
+ * Brief: Log-linear latency histogram, for the benchmarks
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+    // Import memset()
+
+#include "bench.h"
+
+void
+hist_init(struct bench_hist *h)
+{
+    memset(h, 0, sizeof (*h));
+}
+
+/*
+ * Bucket of a value: below HIST_SUB, the value itself.  Otherwise,
+ * with e such that (v >> e) is in [HIST_SUB/2, HIST_SUB), e >= 1,
+ * the buckets for e start at HIST_SUB + (e - 1) * HIST_SUB/2.
+ */
+static inline size_t
+hist_index(uint64_t v)
+{
+    unsigned int e;
+
+    if (v < HIST_SUB) {
+        return ((size_t)v);
+    }
+    e = (unsigned int)(63 - __builtin_clzll(v)) - (HIST_SUB_BITS - 1);
+    return (HIST_SUB + (e - 1) * (HIST_SUB / 2) + ((v >> e) - HIST_SUB / 2));
+}
+
+/*
+ * The middle of the range of values that fall in bucket @var{i}.
+ */
+static inline uint64_t
+hist_value(size_t i)
+{
+    size_t k;
+    unsigned int e;
+    uint64_t m;
+
+    if (i < HIST_SUB) {
+        return ((uint64_t)i);
+    }
+    k = i - HIST_SUB;
+    e = (unsigned int)(k / (HIST_SUB / 2)) + 1;
+    m = (uint64_t)(k % (HIST_SUB / 2)) + HIST_SUB / 2;
+    return ((m << e) + ((1ULL << e) >> 1));
+}
+
+void
+hist_add(struct bench_hist *h, uint64_t v)
+{
+    ++h->h_buckets[hist_index(v)];
+    ++h->h_count;
+    h->h_sum += v;
+    if (v > h->h_max) {
+        h->h_max = v;
+    }
+}
+
+void
+hist_merge(struct bench_hist *dst, const struct bench_hist *src)
+{
+    size_t i;
+
+    for (i = 0; i < HIST_NBUCKETS; ++i) {
+        dst->h_buckets[i] += src->h_buckets[i];
+    }
+    dst->h_count += src->h_count;
+    dst->h_sum += src->h_sum;
+    if (src->h_max > dst->h_max) {
+        dst->h_max = src->h_max;
+    }
+}
+
+/*
+ * Return the value at percentile @var{p}, 0 < p <= 100.
+ */
+uint64_t
+hist_percentile(const struct bench_hist *h, double p)
+{
+    uint64_t rank;
+    uint64_t seen;
+    size_t i;
+
+    if (h->h_count == 0) {
+        return (0);
+    }
+    rank = (uint64_t)(p / 100.0 * (double)h->h_count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    seen = 0;
+    for (i = 0; i < HIST_NBUCKETS; ++i) {
+        seen += h->h_buckets[i];
+        if (seen >= rank) {
+            uint64_t v = hist_value(i);
+            return (v < h->h_max ? v : h->h_max);
+        }
+    }
+    return (h->h_max);
+}
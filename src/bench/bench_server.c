@@ -0,0 +1,354 @@
+/*
+ * Filename: bench_server.c
+ * Project: rpc-mt
+ * Brief: Sample RPC server, linked against librpc.so, for load testing
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: bench_server [options]
+ *
+ *   -p port       TCP and UDP port to serve on (default 40111)
+ *   -m mtmode     0, 1, or 2
+ *   -T method     wait method for TCP: mutex or futex
+ *   -U method     wait method for UDP: mutex or futex
+ *   -r reactors   number of event-loop threads
+ *   -i engine     poll or uring
+ *   -w workers    worker threads; 0 runs each call in the dispatcher
+ *   -c config     any other svc_config() command; may be repeated
+ *
+ * It serves the program described in bench.h, over TCP and UDP,
+ * and prints "ready" on stdout once it is listening.
+ *
+ * On SIGUSR1, it writes the lock profile (see svc_lockprof.h) on
+ * stdout, and starts counting again from zero.  Unless librpc was
+ * built with LOCK_PROFILE=1, the profile is empty.
+ *
+ * As librpc requires, each call is handed off by the dispatch function
+ * to a worker, which does svc_getargs(), svc_sendreply(), svc_freeargs()
+ * and svc_return().
+ */
+
+#include <stdio.h>
+    // Import fprintf(), printf(), fflush()
+#include <stdlib.h>
+    // Import exit(), malloc(), free(), strtoul()
+#include <string.h>
+    // Import memset(), strerror()
+#include <unistd.h>
+    // Import getopt(), close()
+#include <errno.h>
+    // Import errno
+#include <signal.h>
+    // Import sigwait(), sigemptyset(), sigaddset()
+#include <pthread.h>
+    // Import pthread_create(), pthread_mutex_*, pthread_cond_*
+#include <sys/socket.h>
+    // Import socket(), bind(), setsockopt()
+#include <netinet/in.h>
+    // Import struct sockaddr_in, htons()
+#include <rpc/rpc.h>
+    // Import svctcp_create(), svcudp_create(), svc_register(), xdr_bytes()
+
+#include "bench.h"
+
+extern int  svc_config(const char *cmd);
+extern void svc_return(SVCXPRT *xprt);
+extern void svc_lock_profile(FILE *f);
+extern void svc_lock_profile_reset(void);
+
+struct bench_buf {
+    u_int  len;
+    char  *val;
+};
+
+static bool_t
+xdr_bench_buf(XDR *xdrs, struct bench_buf *bp)
+{
+    return (xdr_bytes(xdrs, &bp->val, &bp->len, BENCH_MAXPAYLOAD));
+}
+
+struct job {
+    struct job     *j_next;
+    struct svc_req *j_rqstp;
+    SVCXPRT        *j_xprt;
+};
+
+static struct job *job_head;
+static struct job **job_tailp = &job_head;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static int nworkers = 8;
+
+static const char *progname = "bench_server";
+
+static void
+spin(u_int usec)
+{
+    uint64_t end;
+
+    end = bench_now() + (uint64_t)usec * 1000;
+    while (bench_now() < end) {
+        __asm__ __volatile__("pause");
+    }
+}
+
+static void
+bench_serve(struct svc_req *rqstp, SVCXPRT *xprt)
+{
+    struct bench_buf buf;
+    u_int usec;
+
+    switch (rqstp->rq_proc) {
+    case BENCH_NULL:
+        (void) svc_getargs(xprt, (xdrproc_t)xdr_void, NULL);
+        (void) svc_sendreply(xprt, (xdrproc_t)xdr_void, NULL);
+        break;
+    case BENCH_ECHO:
+    case BENCH_SINK:
+        memset(&buf, 0, sizeof (buf));
+        if (!svc_getargs(xprt, (xdrproc_t)xdr_bench_buf, (caddr_t)&buf)) {
+            svcerr_decode(xprt);
+            break;
+        }
+        if (rqstp->rq_proc == BENCH_ECHO) {
+            (void) svc_sendreply(xprt, (xdrproc_t)xdr_bench_buf, (caddr_t)&buf);
+        }
+        else {
+            (void) svc_sendreply(xprt, (xdrproc_t)xdr_u_int, (caddr_t)&buf.len);
+        }
+        (void) svc_freeargs(xprt, (xdrproc_t)xdr_bench_buf, (caddr_t)&buf);
+        break;
+    case BENCH_SPIN:
+        usec = 0;
+        if (!svc_getargs(xprt, (xdrproc_t)xdr_u_int, (caddr_t)&usec)) {
+            svcerr_decode(xprt);
+            break;
+        }
+        spin(usec);
+        (void) svc_sendreply(xprt, (xdrproc_t)xdr_void, NULL);
+        break;
+    default:
+        (void) svc_getargs(xprt, (xdrproc_t)xdr_void, NULL);
+        svcerr_noproc(xprt);
+        break;
+    }
+    svc_return(xprt);
+}
+
+static void *
+worker(void *arg)
+{
+    struct job *j;
+
+    (void) arg;
+    for (;;) {
+        pthread_mutex_lock(&job_lock);
+        while (job_head == NULL) {
+            pthread_cond_wait(&job_cond, &job_lock);
+        }
+        j = job_head;
+        job_head = j->j_next;
+        if (job_head == NULL) {
+            job_tailp = &job_head;
+        }
+        pthread_mutex_unlock(&job_lock);
+        bench_serve(j->j_rqstp, j->j_xprt);
+        free(j);
+    }
+    return (NULL);
+}
+
+static void
+bench_dispatch(struct svc_req *rqstp, SVCXPRT *xprt)
+{
+    struct job *j;
+
+    if (nworkers == 0) {
+        bench_serve(rqstp, xprt);
+        return;
+    }
+    j = (struct job *)malloc(sizeof (*j));
+    if (j == NULL) {
+        fprintf(stderr, "%s: out of memory\n", progname);
+        exit(2);
+    }
+    j->j_next = NULL;
+    j->j_rqstp = rqstp;
+    j->j_xprt = xprt;
+    pthread_mutex_lock(&job_lock);
+    *job_tailp = j;
+    job_tailp = &j->j_next;
+    pthread_cond_signal(&job_cond);
+    pthread_mutex_unlock(&job_lock);
+}
+
+static void *
+profile_reporter(void *arg)
+{
+    sigset_t *sigs;
+    int sig;
+
+    sigs = (sigset_t *)arg;
+    for (;;) {
+        if (sigwait(sigs, &sig) != 0) {
+            continue;
+        }
+        svc_lock_profile(stdout);
+        svc_lock_profile_reset();
+    }
+    return (NULL);
+}
+
+static int
+bind_socket(int type, int port)
+{
+    struct sockaddr_in addr;
+    int sock;
+    int on;
+
+    sock = socket(AF_INET, type, 0);
+    if (sock < 0) {
+        fprintf(stderr, "%s: socket: %s\n", progname, strerror(errno));
+        exit(2);
+    }
+    on = 1;
+    (void) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+    memset(&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof (addr)) != 0) {
+        fprintf(stderr, "%s: bind port %d: %s\n",
+            progname, port, strerror(errno));
+        exit(2);
+    }
+    return (sock);
+}
+
+static void
+config(const char *cmd)
+{
+    int rv;
+
+    rv = svc_config(cmd);
+    if (rv != 0) {
+        fprintf(stderr, "%s: svc_config(\"%s\"): %s\n",
+            progname, cmd, strerror(rv));
+        exit(2);
+    }
+}
+
+static void
+config2(const char *name, const char *arg)
+{
+    char cmd[128];
+
+    snprintf(cmd, sizeof (cmd), "%s=%s", name, arg);
+    config(cmd);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: %s [-p port] [-m mtmode] [-T mutex|futex] [-U mutex|futex]\n"
+        "       [-r reactors] [-i poll|uring] [-w workers] [-c config]...\n",
+        progname);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    static sigset_t sigs;
+    SVCXPRT *tcp;
+    SVCXPRT *udp;
+    pthread_t tid;
+    int port;
+    int opt;
+    int i;
+
+    // Block SIGUSR1 in every thread, but the one that waits for it.
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    if (pthread_create(&tid, NULL, profile_reporter, &sigs) != 0) {
+        fprintf(stderr, "%s: pthread_create failed\n", progname);
+        exit(2);
+    }
+    (void) pthread_detach(tid);
+
+    port = BENCH_PORT;
+    while ((opt = getopt(argc, argv, "p:m:T:U:r:i:w:c:")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'm':
+            config2("mtmode", optarg);
+            break;
+        case 'T':
+            config2("wait-tcp", optarg);
+            break;
+        case 'U':
+            config2("wait-udp", optarg);
+            break;
+        case 'r':
+            config2("reactors", optarg);
+            break;
+        case 'i':
+            config2("io", optarg);
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        case 'c':
+            config(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+
+    tcp = svctcp_create(bind_socket(SOCK_STREAM, port), 0, 0);
+    udp = svcudp_create(bind_socket(SOCK_DGRAM, port));
+    if (tcp == NULL || udp == NULL) {
+        fprintf(stderr, "%s: cannot create transports\n", progname);
+        exit(2);
+    }
+    // Protocol 0: do not register with the portmapper.
+    if (!svc_register(tcp, BENCH_PROG, BENCH_VERS, bench_dispatch, 0)
+        || !svc_register(udp, BENCH_PROG, BENCH_VERS, bench_dispatch, 0)) {
+        fprintf(stderr, "%s: svc_register failed\n", progname);
+        exit(2);
+    }
+
+    for (i = 0; i < nworkers; ++i) {
+        if (pthread_create(&tid, NULL, worker, NULL) != 0) {
+            fprintf(stderr, "%s: pthread_create failed\n", progname);
+            exit(2);
+        }
+        (void) pthread_detach(tid);
+    }
+
+    printf("ready\n");
+    fflush(stdout);
+    svc_run();
+    return (1);
+}
@@ -0,0 +1,697 @@
+/*
+ * Filename: bench_xdr.c
+ * Project: rpc-mt
+ * Brief: Microbenchmark of the XDR primitives, over xdrmem and xdrrec
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: bench_xdr [options]
+ *
+ *   -c cpu        pin to this CPU (default: the one it starts on;
+ *                 -1: do not pin)
+ *   -t seconds    minimum time of each measurement (default 0.05)
+ *   -r rounds     measure each case this many times, keep the best
+ *                 (default 3)
+ *   -f pattern    run only cases whose name contains @var{pattern}
+ *   -l label      prefix for each result line
+ *
+ * Each case is one XDR routine, on one type and size of value,
+ * encoded and decoded over:
+ *
+ *   mem         xdrmem, over one buffer of a batch of values;
+ *   rec         xdrrec, with readit and writeit that copy to and
+ *               from memory, so there are no system calls;
+ *   rec-record  the same, in record mode (xdr_rec.h), if the
+ *               benchmark is linked with the bundled XDR code;
+ *   sizeof      xdr_sizeof(), encode only.
+ *
+ * Decoding is into storage that is already allocated, so the
+ * measurements are of the XDR code, not of malloc.
+ *
+ * The result is one line of key=value pairs per case, stream and
+ * direction, for scripts.  ns_op is the time of one call of the XDR
+ * routine; GBps counts the bytes of XDR data, not record marks.
+ *
+ * bench_xdr is built twice: against the XDR code bundled with rpc-mt
+ * (impl=bundled), and against the XDR code of the system C library
+ * or libtirpc (impl=system).
+ */
+
+#include <stdio.h>
+    // Import fprintf(), printf()
+#include <stdlib.h>
+    // Import exit(), malloc(), calloc(), atoi(), atof()
+#include <string.h>
+    // Import memset(), memcpy(), strstr(), strerror()
+#include <unistd.h>
+    // Import getopt()
+#include <errno.h>
+    // Import errno
+#include <sched.h>
+    // Import sched_setaffinity(), sched_getcpu(), CPU_SET()
+#include <rpc/rpc.h>
+    // Import XDR, xdrmem_create(), xdrrec_create(), xdr_*()
+
+#ifdef BENCH_XDR_BUNDLED
+#include "xdr_rec.h"
+    // Import xdrrec_recordmode(), xdrrec_getrecord()
+#define BENCH_XDR_IMPL "bundled"
+#else
+#define BENCH_XDR_IMPL "system"
+#endif
+
+#include "bench.h"
+
+#define MAXLEN      (4 * 1024 * 1024)   /* limit given to xdr_bytes() etc. */
+#define BATCH_BYTES (64 * 1024)         /* XDR data per batch, about */
+#define BATCH_MAX   1024                /* values per batch, at most */
+#define STR_ELEM    16                  /* length of each string in array-string */
+
+typedef bool_t (*codec_t)(XDR *, void *);
+
+/*
+ * A case: what to encode, where to decode it, and how.
+ */
+struct xcase {
+    char     xc_name[32];
+    u_int    xc_count;          /* bytes or elements, for the result line */
+    codec_t  xc_codec;
+    void    *xc_src;            /* the value that is encoded */
+    void    *xc_dst;            /* where it is decoded */
+    u_int    xc_size;           /* bytes of XDR data, per value */
+};
+
+struct xbuf {
+    char  *val;
+    u_int  len;
+};
+
+static const char *progname = "bench_xdr";
+static double opt_seconds = 0.05;
+static int opt_rounds = 3;
+static const char *opt_filter = NULL;
+static const char *opt_label = NULL;
+static int cpu = -1;
+
+static void
+die(const char *what)
+{
+    fprintf(stderr, "%s: %s: %s\n", progname, what, strerror(errno));
+    exit(2);
+}
+
+static void *
+zalloc(size_t size)
+{
+    void *p;
+
+    p = calloc(1, size);
+    if (p == NULL) {
+        die("calloc");
+    }
+    return (p);
+}
+
+/*
+ * Codecs
+ * ------
+ * One signature for all, so that a case is just a function and two
+ * pointers.  Each is a single call of the routine under test.
+ */
+
+static u_int cur_count;         /* xc_count of the case being run */
+
+static bool_t
+c_int(XDR *xdrs, void *p)
+{
+    return (xdr_int(xdrs, (int *)p));
+}
+
+static bool_t
+c_hyper(XDR *xdrs, void *p)
+{
+    return (xdr_hyper(xdrs, (quad_t *)p));
+}
+
+static bool_t
+c_string(XDR *xdrs, void *p)
+{
+    return (xdr_string(xdrs, (char **)p, MAXLEN));
+}
+
+static bool_t
+c_bytes(XDR *xdrs, void *p)
+{
+    struct xbuf *b = (struct xbuf *)p;
+
+    return (xdr_bytes(xdrs, &b->val, &b->len, MAXLEN));
+}
+
+static bool_t
+c_opaque(XDR *xdrs, void *p)
+{
+    struct xbuf *b = (struct xbuf *)p;
+
+    return (xdr_opaque(xdrs, b->val, b->len));
+}
+
+static bool_t
+xdr_elem_string(XDR *xdrs, char **sp)
+{
+    return (xdr_string(xdrs, sp, MAXLEN));
+}
+
+#define ARRAY_CODEC(name, type, proc) \
+static bool_t \
+c_array_##name(XDR *xdrs, void *p) \
+{ \
+    struct xbuf *b = (struct xbuf *)p; \
+    return (xdr_array(xdrs, &b->val, &b->len, MAXLEN, \
+        sizeof (type), (xdrproc_t)(proc))); \
+} \
+static bool_t \
+c_vector_##name(XDR *xdrs, void *p) \
+{ \
+    struct xbuf *b = (struct xbuf *)p; \
+    return (xdr_vector(xdrs, b->val, cur_count, \
+        sizeof (type), (xdrproc_t)(proc))); \
+}
+
+ARRAY_CODEC(int, int, xdr_int)
+ARRAY_CODEC(hyper, quad_t, xdr_hyper)
+ARRAY_CODEC(double, double, xdr_double)
+ARRAY_CODEC(char, char, xdr_char)
+ARRAY_CODEC(string, char *, xdr_elem_string)
+
+/*
+ * Cases
+ * -----
+ */
+
+#define MAXCASES 64
+
+static struct xcase cases[MAXCASES];
+static size_t ncases;
+
+static struct xcase *
+new_case(const char *name, u_int count, codec_t codec, u_int size)
+{
+    struct xcase *xc;
+
+    if (ncases >= MAXCASES) {
+        fprintf(stderr, "%s: too many cases\n", progname);
+        exit(2);
+    }
+    xc = &cases[ncases++];
+    snprintf(xc->xc_name, sizeof (xc->xc_name), "%s", name);
+    xc->xc_count = count;
+    xc->xc_codec = codec;
+    xc->xc_size = size;
+    return (xc);
+}
+
+static u_int
+rndup(u_int n)
+{
+    return ((n + BYTES_PER_XDR_UNIT - 1) & ~(BYTES_PER_XDR_UNIT - 1));
+}
+
+static char *
+new_string(u_int len)
+{
+    char *s;
+    u_int i;
+
+    s = (char *)zalloc(len + 1);
+    for (i = 0; i < len; ++i) {
+        s[i] = (char)('a' + i % 26);
+    }
+    return (s);
+}
+
+static struct xbuf *
+new_xbuf(u_int len, u_int elemsize, int fill)
+{
+    struct xbuf *b;
+    u_int i;
+
+    b = (struct xbuf *)zalloc(sizeof (*b));
+    b->len = len;
+    b->val = (char *)zalloc((size_t)len * elemsize + 1);
+    if (fill) {
+        for (i = 0; i < len * elemsize; ++i) {
+            b->val[i] = (char)(i * 7);
+        }
+    }
+    return (b);
+}
+
+static void
+add_array_cases(const char *kind, u_int n)
+{
+    static const struct {
+        const char *name;
+        u_int       elemsize;
+        u_int       xdrsize;
+        codec_t     array;
+        codec_t     vector;
+    } elem[] = {
+        { "int",    sizeof (int),    4,  c_array_int,    c_vector_int },
+        { "hyper",  sizeof (quad_t), 8,  c_array_hyper,  c_vector_hyper },
+        { "double", sizeof (double), 8,  c_array_double, c_vector_double },
+        { "char",   sizeof (char),   4,  c_array_char,   c_vector_char },
+        { "string", sizeof (char *), 4 + STR_ELEM, c_array_string, c_vector_string },
+    };
+    struct xcase *xc;
+    struct xbuf *src, *dst;
+    char name[32];
+    int is_array;
+    size_t e;
+    u_int i;
+
+    is_array = (strcmp(kind, "array") == 0);
+    for (e = 0; e < sizeof (elem) / sizeof (elem[0]); ++e) {
+        snprintf(name, sizeof (name), "%s-%s", kind, elem[e].name);
+        xc = new_case(name, n, is_array ? elem[e].array : elem[e].vector,
+            (is_array ? 4 : 0) + n * elem[e].xdrsize);
+        src = new_xbuf(n, elem[e].elemsize, 1);
+        dst = new_xbuf(n, elem[e].elemsize, 0);
+        if (strcmp(elem[e].name, "string") == 0) {
+            for (i = 0; i < n; ++i) {
+                ((char **)src->val)[i] = new_string(STR_ELEM);
+                ((char **)dst->val)[i] = (char *)zalloc(STR_ELEM + 1);
+            }
+        }
+        xc->xc_src = src;
+        xc->xc_dst = dst;
+    }
+}
+
+static void
+make_cases(void)
+{
+    static const u_int bufsizes[] = { 16, 256, 4096, 65536 };
+    static const u_int arraysizes[] = { 16, 1024 };
+    static int int_src = 0x12345678, int_dst;
+    static quad_t hyper_src = 0x123456789abcdefLL, hyper_dst;
+    struct xcase *xc;
+    char **sp;
+    u_int n;
+    size_t i;
+
+    xc = new_case("int", 1, c_int, 4);
+    xc->xc_src = &int_src;
+    xc->xc_dst = &int_dst;
+    xc = new_case("hyper", 1, c_hyper, 8);
+    xc->xc_src = &hyper_src;
+    xc->xc_dst = &hyper_dst;
+
+    for (i = 0; i < sizeof (bufsizes) / sizeof (bufsizes[0]); ++i) {
+        n = bufsizes[i];
+        xc = new_case("string", n, c_string, 4 + rndup(n));
+        sp = (char **)zalloc(sizeof (char *));
+        *sp = new_string(n);
+        xc->xc_src = sp;
+        sp = (char **)zalloc(sizeof (char *));
+        *sp = (char *)zalloc(n + 1);
+        xc->xc_dst = sp;
+
+        xc = new_case("bytes", n, c_bytes, 4 + rndup(n));
+        xc->xc_src = new_xbuf(n, 1, 1);
+        xc->xc_dst = new_xbuf(n, 1, 0);
+
+        xc = new_case("opaque", n, c_opaque, rndup(n));
+        xc->xc_src = new_xbuf(n, 1, 1);
+        xc->xc_dst = new_xbuf(n, 1, 0);
+    }
+
+    for (i = 0; i < sizeof (arraysizes) / sizeof (arraysizes[0]); ++i) {
+        add_array_cases("array", arraysizes[i]);
+        add_array_cases("vector", arraysizes[i]);
+    }
+}
+
+/*
+ * In-memory readit and writeit, for xdrrec
+ * ----------------------------------------
+ * writeit copies into @var{m_buf}; while @var{m_capture} is set, it
+ * appends, so that an encoded record can be kept, to be decoded.
+ * readit reads what was kept, over and over.
+ */
+
+struct memio {
+    char   *m_buf;
+    size_t  m_size;
+    size_t  m_len;
+    size_t  m_pos;
+    int     m_capture;
+};
+
+static int
+mem_writeit(char *handle, char *buf, int len)
+{
+    struct memio *m = (struct memio *)handle;
+
+    if (m->m_capture) {
+        if (m->m_len + (size_t)len > m->m_size) {
+            return (-1);
+        }
+        memcpy(m->m_buf + m->m_len, buf, (size_t)len);
+        m->m_len += (size_t)len;
+    }
+    else {
+        memcpy(m->m_buf, buf, (size_t)len < m->m_size ? (size_t)len : m->m_size);
+    }
+    return (len);
+}
+
+static int
+mem_readit(char *handle, char *buf, int len)
+{
+    struct memio *m = (struct memio *)handle;
+    size_t n;
+
+    n = m->m_len - m->m_pos;
+    if (n > (size_t)len) {
+        n = (size_t)len;
+    }
+    memcpy(buf, m->m_buf + m->m_pos, n);
+    m->m_pos += n;
+    if (m->m_pos == m->m_len) {
+        m->m_pos = 0;
+    }
+    return ((int)n);
+}
+
+/*
+ * Streams
+ * -------
+ */
+
+enum stream_kind { S_MEM, S_REC, S_RECORD, S_SIZEOF };
+
+static const char *stream_name[] = { "mem", "rec", "rec-record", "sizeof" };
+
+struct run {
+    struct xcase     *r_case;
+    enum stream_kind  r_kind;
+    enum xdr_op       r_op;
+    u_int             r_batch;
+    XDR               r_xdrs;
+    char             *r_buf;
+    size_t            r_bufsize;
+    struct memio      r_io;
+};
+
+static void
+fail(struct run *r, const char *what)
+{
+    fprintf(stderr, "%s: %s %s %s: %s failed\n", progname,
+        r->r_case->xc_name, stream_name[r->r_kind],
+        r->r_op == XDR_ENCODE ? "encode" : "decode", what);
+    exit(2);
+}
+
+static void
+encode_batch(struct run *r, XDR *xdrs)
+{
+    u_int i;
+
+    for (i = 0; i < r->r_batch; ++i) {
+        if (!r->r_case->xc_codec(xdrs, r->r_case->xc_src)) {
+            fail(r, "encode");
+        }
+    }
+}
+
+static void
+run_batch(struct run *r)
+{
+    XDR *xdrs;
+    struct xcase *xc;
+    u_int i;
+
+    xdrs = &r->r_xdrs;
+    xc = r->r_case;
+    switch (r->r_kind) {
+    case S_MEM:
+        (void) XDR_SETPOS(xdrs, 0);
+        break;
+    case S_REC:
+    case S_RECORD:
+        if (r->r_op == XDR_DECODE) {
+            if (!xdrrec_skiprecord(xdrs)) {
+                fail(r, "xdrrec_skiprecord");
+            }
+#ifdef BENCH_XDR_BUNDLED
+            if (r->r_kind == S_RECORD && !xdrrec_getrecord(xdrs)) {
+                fail(r, "xdrrec_getrecord");
+            }
+#endif
+        }
+        break;
+    case S_SIZEOF:
+        for (i = 0; i < r->r_batch; ++i) {
+            if (xdr_sizeof((xdrproc_t)xc->xc_codec, xc->xc_src) != xc->xc_size) {
+                fail(r, "xdr_sizeof");
+            }
+        }
+        return;
+    }
+
+    if (r->r_op == XDR_ENCODE) {
+        encode_batch(r, xdrs);
+        if (r->r_kind != S_MEM && !xdrrec_endofrecord(xdrs, TRUE)) {
+            fail(r, "xdrrec_endofrecord");
+        }
+    }
+    else {
+        for (i = 0; i < r->r_batch; ++i) {
+            if (!xc->xc_codec(xdrs, xc->xc_dst)) {
+                fail(r, "decode");
+            }
+        }
+    }
+}
+
+static void
+run_setup(struct run *r)
+{
+    XDR *xdrs;
+    XDR enc;
+
+    xdrs = &r->r_xdrs;
+    r->r_bufsize = (size_t)r->r_batch * r->r_case->xc_size;
+    r->r_bufsize += r->r_bufsize / 8 + 1024;   /* room for record marks */
+    r->r_buf = (char *)zalloc(r->r_bufsize);
+
+    switch (r->r_kind) {
+    case S_MEM:
+        if (r->r_op == XDR_DECODE) {
+            xdrmem_create(&enc, r->r_buf, (u_int)r->r_bufsize, XDR_ENCODE);
+            encode_batch(r, &enc);
+            XDR_DESTROY(&enc);
+        }
+        xdrmem_create(xdrs, r->r_buf, (u_int)r->r_bufsize, r->r_op);
+        break;
+    case S_REC:
+    case S_RECORD:
+        memset(&r->r_io, 0, sizeof (r->r_io));
+        r->r_io.m_buf = r->r_buf;
+        r->r_io.m_size = r->r_bufsize;
+        if (r->r_op == XDR_DECODE) {
+            // Keep one encoded record; the decoder reads it over and over.
+            r->r_io.m_capture = 1;
+            xdrrec_create(&enc, 0, 0, (caddr_t)&r->r_io, mem_readit, mem_writeit);
+            enc.x_op = XDR_ENCODE;
+            encode_batch(r, &enc);
+            if (!xdrrec_endofrecord(&enc, TRUE)) {
+                fail(r, "xdrrec_endofrecord");
+            }
+            XDR_DESTROY(&enc);
+            r->r_io.m_capture = 0;
+        }
+        xdrrec_create(xdrs, 0, 0, (caddr_t)&r->r_io, mem_readit, mem_writeit);
+        xdrs->x_op = r->r_op;
+#ifdef BENCH_XDR_BUNDLED
+        if (r->r_kind == S_RECORD) {
+            xdrrec_recordmode(xdrs, (u_int)r->r_bufsize);
+        }
+#endif
+        break;
+    case S_SIZEOF:
+        break;
+    }
+}
+
+static void
+run_teardown(struct run *r)
+{
+    if (r->r_kind != S_SIZEOF) {
+        XDR_DESTROY(&r->r_xdrs);
+    }
+    free(r->r_buf);
+}
+
+/*
+ * Time batches of calls until at least @var{opt_seconds} have gone by;
+ * return nanoseconds per call.
+ */
+static double
+measure(struct run *r, uint64_t *opsp)
+{
+    uint64_t start;
+    uint64_t now;
+    uint64_t limit;
+    uint64_t ops;
+
+    limit = (uint64_t)(opt_seconds * 1e9);
+    ops = 0;
+    start = bench_now();
+    do {
+        run_batch(r);
+        ops += r->r_batch;
+        now = bench_now();
+    } while (now - start < limit);
+    *opsp = ops;
+    return ((double)(now - start) / (double)ops);
+}
+
+static void
+run_case(struct xcase *xc, enum stream_kind kind, enum xdr_op op)
+{
+    struct run r;
+    double ns, best;
+    uint64_t ops;
+    int round;
+
+    memset(&r, 0, sizeof (r));
+    r.r_case = xc;
+    r.r_kind = kind;
+    r.r_op = op;
+    r.r_batch = BATCH_BYTES / xc->xc_size;
+    if (r.r_batch == 0) {
+        r.r_batch = 1;
+    }
+    if (r.r_batch > BATCH_MAX) {
+        r.r_batch = BATCH_MAX;
+    }
+    cur_count = xc->xc_count;
+    run_setup(&r);
+
+    // Warm up caches and branch predictors, then keep the best round.
+    run_batch(&r);
+    best = 0;
+    ops = 0;
+    for (round = 0; round < opt_rounds; ++round) {
+        ns = measure(&r, &ops);
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    run_teardown(&r);
+
+    if (opt_label != NULL) {
+        printf("%s ", opt_label);
+    }
+    printf("impl=%s cpu=%d case=%s count=%u stream=%s op=%s"
+        " xdr_bytes=%u batch=%u ops=%llu ns_op=%.2f Mops=%.3f GBps=%.3f\n",
+        BENCH_XDR_IMPL, cpu, xc->xc_name, xc->xc_count, stream_name[kind],
+        op == XDR_ENCODE ? "encode" : "decode",
+        xc->xc_size, r.r_batch, (unsigned long long)ops,
+        best, 1e3 / best, (double)xc->xc_size / best);
+    fflush(stdout);
+}
+
+static void
+pin(int want)
+{
+    cpu_set_t set;
+
+    if (want < 0) {
+        want = sched_getcpu();
+        if (want < 0) {
+            return;
+        }
+    }
+    CPU_ZERO(&set);
+    CPU_SET(want, &set);
+    if (sched_setaffinity(0, sizeof (set), &set) != 0) {
+        die("sched_setaffinity");
+    }
+    cpu = want;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+        "usage: %s [-c cpu] [-t seconds] [-r rounds] [-f pattern] [-l label]\n",
+        progname);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const enum stream_kind kinds[] = {
+        S_MEM, S_REC,
+#ifdef BENCH_XDR_BUNDLED
+        S_RECORD,
+#endif
+    };
+    char fullname[64];
+    struct xcase *xc;
+    int opt_cpu;
+    int opt;
+    size_t i, k;
+
+    opt_cpu = -2;
+    while ((opt = getopt(argc, argv, "c:t:r:f:l:")) != -1) {
+        switch (opt) {
+        case 'c': opt_cpu = atoi(optarg); break;
+        case 't': opt_seconds = atof(optarg); break;
+        case 'r': opt_rounds = atoi(optarg); break;
+        case 'f': opt_filter = optarg; break;
+        case 'l': opt_label = optarg; break;
+        default: usage();
+        }
+    }
+    if (opt_seconds <= 0 || opt_rounds < 1 || optind != argc) {
+        usage();
+    }
+    if (opt_cpu != -1) {
+        pin(opt_cpu < 0 ? -1 : opt_cpu);
+    }
+
+    make_cases();
+    for (i = 0; i < ncases; ++i) {
+        xc = &cases[i];
+        snprintf(fullname, sizeof (fullname), "%.31s-%u", xc->xc_name, xc->xc_count);
+        if (opt_filter != NULL && strstr(fullname, opt_filter) == NULL) {
+            continue;
+        }
+        for (k = 0; k < sizeof (kinds) / sizeof (kinds[0]); ++k) {
+            run_case(xc, kinds[k], XDR_ENCODE);
+            run_case(xc, kinds[k], XDR_DECODE);
+        }
+        run_case(xc, S_SIZEOF, XDR_ENCODE);
+    }
+    return (0);
+}
@@ -0,0 +1,71 @@
+#! /bin/bash
+#
+# Filename: run-bench.sh
+# Project: rpc-mt
+# Brief: Run the load client against every mtmode / wait-method combination
+#
+# Usage: run-bench.sh [client options]
+#
+# For each combination of mtmode, TCP wait method and UDP wait method,
+# start bench_server, run bench_client over TCP and then over UDP,
+# and print one result line per run, prefixed with the server settings.
+# Options are passed through to bench_client, for example:
+#
+#   run-bench.sh -t 16 -d 5 -s 64-4096
+#   run-bench.sh -R 50000 -x spin -u 20
+#
+# The environment variables MTMODES, WAIT_METHODS, PROTOS and
+# SERVER_OPTS override what is swept and how the server is started.
+#
+
+cmd=$(basename "$0")
+dir=$(dirname "$0")
+server="${dir}/bench_server"
+client="${dir}/bench_client"
+port=${PORT:-40111}
+
+mtmodes=${MTMODES:-"0 1 2"}
+wait_methods=${WAIT_METHODS:-"mutex futex"}
+protos=${PROTOS:-"tcp udp"}
+
+for prog in "${server}" "${client}" ; do
+    if [[ ! -x "${prog}" ]] ; then
+        echo "${cmd}: ${prog} not built; run make in ${dir}" 1>&2
+        exit 2
+    fi
+done
+
+server_pid=
+cleanup() {
+    if [[ -n "${server_pid}" ]] ; then
+        kill "${server_pid}" 2>/dev/null
+        wait "${server_pid}" 2>/dev/null
+        server_pid=
+    fi
+}
+trap cleanup EXIT
+
+rv=0
+for mtmode in ${mtmodes} ; do
+    for wait_tcp in ${wait_methods} ; do
+        for wait_udp in ${wait_methods} ; do
+            coproc SERVER { exec "${server}" -p "${port}" -m "${mtmode}" \
+                -T "${wait_tcp}" -U "${wait_udp}" ${SERVER_OPTS} ; }
+            server_pid=${SERVER_PID}
+            if ! read -r -t 10 line <&"${SERVER[0]}" || [[ "${line}" != ready ]] ; then
+                echo "${cmd}: server did not start" \
+                    "(mtmode=${mtmode} wait_tcp=${wait_tcp} wait_udp=${wait_udp})" 1>&2
+                cleanup
+                rv=1
+                continue
+            fi
+            for proto in ${protos} ; do
+                "${client}" -p "${port}" -P "${proto}" \
+                    -l "mtmode=${mtmode} wait_tcp=${wait_tcp} wait_udp=${wait_udp}" \
+                    "$@" || rv=1
+            done
+            cleanup
+        done
+    done
+done
+exit ${rv}
@@ -0,0 +1,106 @@
+#! /bin/bash
+#
+# Filename: run-scaling.sh
+# Project: rpc-mt
+# Brief: Throughput as client threads are added, with time spent waiting on each lock
+#
+# Usage: run-scaling.sh [client options]
+#
+# Start one bench_server, then run bench_client with 1, 2, 4, ...
+# threads, up to twice the number of CPUs.  For each run, print the
+# client result line, then one line per lock, from the lock profile
+# of the server, and then a summary line:
+#
+#   threads=8 tput=81234 p99_us=310.4 poll_lock=61.2% io_lock=20.3% ...
+#
+# where each percentage is that lock's share of all the time that
+# server threads spent waiting for locks.  The lock profile is empty
+# unless librpc was built with:
+#
+#   ( cd ../librpc && make clean && make LOCK_PROFILE=1 )
+#
+# Options are passed through to bench_client.  The environment
+# variables PROTO (tcp or udp), MAX_THREADS and SERVER_OPTS override
+# the defaults.
+#
+
+cmd=$(basename "$0")
+dir=$(dirname "$0")
+server="${dir}/bench_server"
+client="${dir}/bench_client"
+port=${PORT:-40111}
+proto=${PROTO:-tcp}
+max_threads=${MAX_THREADS:-$(( 2 * $(nproc) ))}
+
+for prog in "${server}" "${client}" ; do
+    if [[ ! -x "${prog}" ]] ; then
+        echo "${cmd}: ${prog} not built; run make in ${dir}" 1>&2
+        exit 2
+    fi
+done
+
+coproc SERVER { exec "${server}" -p "${port}" ${SERVER_OPTS} ; }
+server_pid=${SERVER_PID}
+server_out=${SERVER[0]}
+trap 'kill ${server_pid} 2>/dev/null' EXIT
+
+if ! read -r -t 10 line <&"${server_out}" || [[ "${line}" != ready ]] ; then
+    echo "${cmd}: server did not start" 1>&2
+    exit 2
+fi
+
+# Ask the server for its lock profile, which also resets it;
+# print the "lock" lines, prefixed with @var{prefix}.
+lock_profile() {
+    local prefix="$1"
+    local line
+
+    kill -USR1 "${server_pid}"
+    while read -r -t 10 line <&"${server_out}" ; do
+        case "${line}" in
+        end)
+            return 0
+            ;;
+        'lockprof enabled=0')
+            if [[ -z "${warned}" ]] ; then
+                echo "${cmd}: librpc was built without LOCK_PROFILE" 1>&2
+                warned=1
+            fi
+            ;;
+        lock\ *)
+            [[ -n "${prefix}" ]] && echo "${prefix} ${line}"
+            ;;
+        esac
+    done
+    echo "${cmd}: no lock profile from server" 1>&2
+    return 1
+}
+
+field() {
+    local key="$1"
+    local line="$2"
+
+    sed -n -e "s/.* ${key}=\([^ ]*\).*/\1/p" <<< " ${line}"
+}
+
+threads=1
+while (( threads <= max_threads )) ; do
+    lock_profile ""
+    result=$("${client}" -p "${port}" -P "${proto}" -t "${threads}" "$@")
+    echo "${result}"
+    summary="threads=${threads} tput=$(field tput "${result}") p99_us=$(field p99_us "${result}")"
+    locks=$(lock_profile "threads=${threads}")
+    if [[ -n "${locks}" ]] ; then
+        echo "${locks}"
+        while read -r line ; do
+            summary="${summary} $(field lock "${line}")=$(field wait_share "${line}")%"
+        done <<< "${locks}"
+    fi
+    echo "${summary}"
+
+    if (( threads < max_threads && 2 * threads > max_threads )) ; then
+        threads=${max_threads}
+    else
+        threads=$(( 2 * threads ))
+    fi
+done
@@ -0,0 +1,38 @@
+/*
+ * Filename: cache-align.h
+ * Project: rpc-mt
+ * Brief: Cache line size, and alignment to it
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CACHE_ALIGN_H
+#define _CACHE_ALIGN_H 1
+
+/*
+ * Size of a cache line, for the purpose of keeping fields that are
+ * written by different threads from sharing a cache line.
+ * 64 bytes is right for all x86_64 and most aarch64 processors.
+ * Build with -DCACHE_LINE_SIZE=128 for processors with bigger lines.
+ */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+
+#endif  /* _CACHE_ALIGN_H */
@@ -0,0 +1,303 @@
+/*
+ * Filename: xdr_inline.h
+ * Project: rpc-mt
+ * Brief: Inline XDR primitives, for codecs generated by xdrgen
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _XDR_INLINE_H
+#define _XDR_INLINE_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>      // Import uint32_t, uint64_t
+#include <stdlib.h>      // Import calloc(), free()
+#include <string.h>      // Import memcpy(), memset()
+#include <arpa/inet.h>   // Import htonl(), ntohl()
+#include <rpc/rpc.h>     // Import XDR, XDR_INLINE(), xdr_u_int(), ...
+
+/*
+ * rpcgen makes one call of a generic XDR routine per field,
+ * and each of those goes through @member{x_ops} of the stream,
+ * once per 4 bytes.  xdrgen (see src/bin/xdrgen) makes codecs that,
+ * instead, ask the stream for a whole run of fixed-size fields at once,
+ * with XDR_INLINE(), and then encode or decode the run with the
+ * functions here, with no more bounds checks and no calls through
+ * @member{x_ops}.
+ *
+ * If the stream cannot hand out that much contiguous memory, for
+ * example, xdrrec, when the run straddles a fragment or the end of
+ * its buffer, XDR_INLINE() returns NULL, and the codec does the run
+ * the slow way, with the generic routines.  The bytes are the same,
+ * either way.
+ *
+ * Each xdri_put*() and xdri_get*() moves the cursor, @var{*bufp},
+ * past what it encoded or decoded.  The cursor need not be aligned.
+ *
+ * xdri_vec32() and xdri_vec64() do variable-length arrays of 4-byte
+ * and 8-byte elements (int, u_int, enum, float; hyper, double).
+ * They are drop-in replacements for xdr_array() with the matching
+ * element routine: same allocation (calloc), same XDR_FREE.
+ *
+ * All of this is plain C, which is also legal C++.
+ */
+
+/*
+ * Ask for @var{nbytes} of contiguous stream memory, or NULL.
+ * Never ask an XDR_FREE stream; it may not be a real stream at all.
+ */
+static inline char *
+xdri_inline(XDR *xdrs, u_int nbytes)
+{
+    if (xdrs->x_op == XDR_FREE) {
+        return (NULL);
+    }
+    return ((char *)XDR_INLINE(xdrs, nbytes));
+}
+
+static inline void
+xdri_put32(char **bufp, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(*bufp, &v, sizeof (v));
+    *bufp += sizeof (v);
+}
+
+static inline uint32_t
+xdri_get32(char **bufp)
+{
+    uint32_t v;
+
+    memcpy(&v, *bufp, sizeof (v));
+    *bufp += sizeof (v);
+    return (ntohl(v));
+}
+
+/*
+ * Hyper integers are two words, most significant first.
+ */
+static inline void
+xdri_put64(char **bufp, uint64_t v)
+{
+    xdri_put32(bufp, (uint32_t)(v >> 32));
+    xdri_put32(bufp, (uint32_t)v);
+}
+
+static inline uint64_t
+xdri_get64(char **bufp)
+{
+    uint64_t v;
+
+    v = (uint64_t)xdri_get32(bufp) << 32;
+    v |= xdri_get32(bufp);
+    return (v);
+}
+
+static inline void
+xdri_put_bool(char **bufp, bool_t b)
+{
+    xdri_put32(bufp, b ? 1 : 0);
+}
+
+/*
+ * Like xdr_bool(), anything but 0 is TRUE.
+ */
+static inline bool_t
+xdri_get_bool(char **bufp)
+{
+    return (xdri_get32(bufp) != 0 ? TRUE : FALSE);
+}
+
+/*
+ * float and double are IEEE, big-endian, as xdr_float()
+ * and xdr_double() do them on Linux.
+ */
+static inline void
+xdri_put_float(char **bufp, float f)
+{
+    uint32_t v;
+
+    memcpy(&v, &f, sizeof (v));
+    xdri_put32(bufp, v);
+}
+
+static inline float
+xdri_get_float(char **bufp)
+{
+    uint32_t v;
+    float f;
+
+    v = xdri_get32(bufp);
+    memcpy(&f, &v, sizeof (f));
+    return (f);
+}
+
+static inline void
+xdri_put_double(char **bufp, double d)
+{
+    uint64_t v;
+
+    memcpy(&v, &d, sizeof (v));
+    xdri_put64(bufp, v);
+}
+
+static inline double
+xdri_get_double(char **bufp)
+{
+    uint64_t v;
+    double d;
+
+    v = xdri_get64(bufp);
+    memcpy(&d, &v, sizeof (d));
+    return (d);
+}
+
+/*
+ * Fixed-length opaque data, padded with zeros to a multiple of 4 bytes.
+ */
+static inline void
+xdri_put_opaque(char **bufp, const void *p, u_int n)
+{
+    u_int pad;
+
+    memcpy(*bufp, p, n);
+    *bufp += n;
+    pad = (BYTES_PER_XDR_UNIT - (n % BYTES_PER_XDR_UNIT)) % BYTES_PER_XDR_UNIT;
+    memset(*bufp, 0, pad);
+    *bufp += pad;
+}
+
+static inline void
+xdri_get_opaque(char **bufp, void *p, u_int n)
+{
+    memcpy(p, *bufp, n);
+    *bufp += RNDUP(n);
+}
+
+/*
+ * Common part of xdri_vec32() and xdri_vec64():
+ * the length, and, when decoding, the allocation.
+ * Return the number of elements to do, or -1 on failure.
+ */
+static inline long
+xdri_vec_begin(XDR *xdrs, char **valp, u_int *lenp, u_int maxlen,
+    u_int elsize)
+{
+    u_int n;
+
+    if (!xdr_u_int(xdrs, lenp)) {
+        return (-1);
+    }
+    n = *lenp;
+    if (n > maxlen || n > (u_int)-1 / elsize) {
+        return (-1);
+    }
+    if (xdrs->x_op == XDR_DECODE && n != 0 && *valp == NULL) {
+        *valp = (char *)calloc(n, elsize);
+        if (*valp == NULL) {
+            return (-1);
+        }
+    }
+    return ((long)n);
+}
+
+static inline bool_t
+xdri_vec32(XDR *xdrs, char **valp, u_int *lenp, u_int maxlen)
+{
+    uint32_t *v;
+    char *buf;
+    long n;
+    long i;
+
+    if (xdrs->x_op == XDR_FREE) {
+        free(*valp);
+        *valp = NULL;
+        return (TRUE);
+    }
+    n = xdri_vec_begin(xdrs, valp, lenp, maxlen, 4);
+    if (n <= 0) {
+        return (n == 0);
+    }
+    v = (uint32_t *)(void *)*valp;
+    buf = xdri_inline(xdrs, (u_int)n * 4);
+    if (buf == NULL) {
+        for (i = 0; i < n; ++i) {
+            if (!xdr_u_int(xdrs, (u_int *)&v[i])) {
+                return (FALSE);
+            }
+        }
+    }
+    else if (xdrs->x_op == XDR_ENCODE) {
+        for (i = 0; i < n; ++i) {
+            xdri_put32(&buf, v[i]);
+        }
+    }
+    else {
+        for (i = 0; i < n; ++i) {
+            v[i] = xdri_get32(&buf);
+        }
+    }
+    return (TRUE);
+}
+
+static inline bool_t
+xdri_vec64(XDR *xdrs, char **valp, u_int *lenp, u_int maxlen)
+{
+    uint64_t *v;
+    char *buf;
+    long n;
+    long i;
+
+    if (xdrs->x_op == XDR_FREE) {
+        free(*valp);
+        *valp = NULL;
+        return (TRUE);
+    }
+    n = xdri_vec_begin(xdrs, valp, lenp, maxlen, 8);
+    if (n <= 0) {
+        return (n == 0);
+    }
+    v = (uint64_t *)(void *)*valp;
+    buf = xdri_inline(xdrs, (u_int)n * 8);
+    if (buf == NULL) {
+        for (i = 0; i < n; ++i) {
+            if (!xdr_uint64_t(xdrs, &v[i])) {
+                return (FALSE);
+            }
+        }
+    }
+    else if (xdrs->x_op == XDR_ENCODE) {
+        for (i = 0; i < n; ++i) {
+            xdri_put64(&buf, v[i]);
+        }
+    }
+    else {
+        for (i = 0; i < n; ++i) {
+            v[i] = xdri_get64(&buf);
+        }
+    }
+    return (TRUE);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _XDR_INLINE_H */
@@ -36,7 +36,7 @@ extern void svc_die(void);
 
 // bitmask to restrict the value of a shift within a single |bvword_t|
 //
-const size_t bvword_mask = sizeof (bvword_t) - 1;
+const size_t bvword_mask = BIT_SIZE(bvword_t) - 1;
 
 void
 bitvec_init(bitvec_t *bv, size_t nbits)
@@ -69,7 +69,7 @@ bitvec_set_bit(bitvec_t *bv, size_t idx)
     if (idx >= bv->sz) {
         svc_die();
     }
-    wpos = (idx + BIT_SIZE(bvword_t) - 1) / BIT_SIZE(bvword_t);
+    wpos = idx / BIT_SIZE(bvword_t);
     bpos = idx & bvword_mask;
     bv->vec[wpos] |= (bvword_t)1 << bpos;
 }
@@ -83,7 +83,7 @@ bitvec_clr_bit(bitvec_t *bv, size_t idx)
     if (idx >= bv->sz) {
         svc_die();
     }
-    wpos = (idx + BIT_SIZE(bvword_t) - 1) / BIT_SIZE(bvword_t);
+    wpos = idx / BIT_SIZE(bvword_t);
     bpos = idx & bvword_mask;
     bv->vec[wpos] &= ~((bvword_t)1 << bpos);
 }
@@ -97,7 +97,66 @@ bitvec_get_bit(bitvec_t *bv, size_t idx)
     if (idx >= bv->sz) {
         svc_die();
     }
-    wpos = (idx + BIT_SIZE(bvword_t) - 1) / BIT_SIZE(bvword_t);
+    wpos = idx / BIT_SIZE(bvword_t);
     bpos = idx & bvword_mask;
     return ((bv->vec[wpos] & (bvword_t)1 << bpos) != 0);
 }
+
+size_t
+bitvec_find_first_clear(bitvec_t *bv, size_t start)
+{
+    size_t nwords;
+    size_t wpos;
+    size_t idx;
+    bvword_t w;
+
+    if (start >= bv->sz) {
+        return (bv->sz);
+    }
+    nwords = (bv->sz + BIT_SIZE(bvword_t) - 1) / BIT_SIZE(bvword_t);
+    wpos = start / BIT_SIZE(bvword_t);
+    w = ~bv->vec[wpos] & (~(bvword_t)0 << (start & bvword_mask));
+    for (;;) {
+        if (w != 0) {
+            idx = wpos * BIT_SIZE(bvword_t) + (size_t)__builtin_ctzl(w);
+            return ((idx < bv->sz) ? idx : bv->sz);
+        }
+        ++wpos;
+        if (wpos >= nwords) {
+            return (bv->sz);
+        }
+        w = ~bv->vec[wpos];
+    }
+}
+
+size_t
+bitvec_find_last_clear(bitvec_t *bv, size_t start)
+{
+    size_t wpos;
+    size_t bpos;
+    bvword_t w;
+
+    if (bv->sz == 0) {
+        return (bv->sz);
+    }
+    if (start >= bv->sz) {
+        start = bv->sz - 1;
+    }
+    wpos = start / BIT_SIZE(bvword_t);
+    bpos = start & bvword_mask;
+    w = ~bv->vec[wpos];
+    if (bpos != bvword_mask) {
+        w &= ((bvword_t)1 << (bpos + 1)) - 1;
+    }
+    for (;;) {
+        if (w != 0) {
+            return (wpos * BIT_SIZE(bvword_t)
+                + (BIT_SIZE(bvword_t) - 1) - (size_t)__builtin_clzl(w));
+        }
+        if (wpos == 0) {
+            return (bv->sz);
+        }
+        --wpos;
+        w = ~bv->vec[wpos];
+    }
+}
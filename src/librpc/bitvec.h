@@ -87,6 +87,25 @@ extern void bitvec_clr_bit(bitvec_t *bv, size_t idx);
 */
 extern bool bitvec_get_bit(bitvec_t *bv, size_t idx);
 
+/*
+ * Find the lowest-numbered clear bit at or above bit-index |start|.
+ * Whole words are skipped at a time.
+ *
+ * @param bv     the bitvec_t to search
+ * @param start  the bit-index at which to start
+ * @return       the index of the clear bit, or |bv->sz| if there is none
+ */
+extern size_t bitvec_find_first_clear(bitvec_t *bv, size_t start);
+
+/*
+ * Find the highest-numbered clear bit at or below bit-index |start|.
+ *
+ * @param bv     the bitvec_t to search
+ * @param start  the bit-index at which to start, searching downward
+ * @return       the index of the clear bit, or |bv->sz| if there is none
+ */
+extern size_t bitvec_find_last_clear(bitvec_t *bv, size_t start);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -0,0 +1,758 @@
+/*
+ * Filename: clnt_mt.c
+ * Project: rpc-mt
+ * Brief: Thread-safe, pipelined RPC client over one TCP connection
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * See clnt_mt.h for what this is.
+ *
+ * How it works
+ * ------------
+ * Each call is put in the table of calls waiting for a reply,
+ * keyed by xid, before it is sent, so that a reply can never come
+ * back before its call is in the table.  Then the call is encoded
+ * into the output xdrrec stream, under @var{ct_send_lock}, and the
+ * caller waits on its own condition variable.
+ *
+ * The reader thread loads each reply record into memory
+ * (xdrrec_recordmode), and decodes it with xdr_replymsg().  The
+ * xid comes first; the results come last, and are decoded by
+ * clntmt_results(), which looks up the call by the xid that has
+ * just been decoded, and decodes the results with the caller's
+ * own @var{xdr_results} and @var{results_ptr}.  So the results
+ * are decoded once, straight into the caller's structure, by the
+ * reader, while the caller is asleep.
+ *
+ * A call goes through three states:
+ *
+ *   CALL_PENDING   in the table, waiting for a reply;
+ *   CALL_DECODING  taken out of the table by the reader, which is
+ *                  decoding the reply into the caller's results;
+ *   CALL_DONE      finished, with its status in @var{mc_err}.
+ *
+ * A caller whose deadline has passed gives up only if its call is
+ * still pending.  If the reader has started to decode the reply,
+ * the caller waits for it to finish, which does not take long,
+ * because the whole record is already in memory.  That way,
+ * the reader never writes into results that have been abandoned.
+ */
+
+#include <stdlib.h>
+    // Import calloc(), free()
+#include <string.h>
+    // Import memset()
+#include <unistd.h>
+    // Import read(), write(), close(), getpid()
+#include <errno.h>
+    // Import errno
+#include <time.h>
+    // Import clock_gettime()
+#include <pthread.h>
+    // Import pthread_create(), pthread_join(), pthread_mutex_*, pthread_cond_*
+#include <sys/time.h>
+    // Import gettimeofday(), struct timeval
+#include <sys/socket.h>
+    // Import socket(), connect(), shutdown(), setsockopt()
+#include <netinet/in.h>
+    // Import IPPROTO_TCP, htonl(), htons()
+#include <netinet/tcp.h>
+    // Import TCP_NODELAY
+#include <rpc/rpc.h>
+    // Import CLIENT, xdr_callhdr(), xdr_replymsg(), _seterr_reply()
+#include <rpc/pmap_clnt.h>
+    // Import pmap_getport()
+#include <cache-align.h>
+    // Import CACHE_ALIGNED
+
+#include "clnt_mt.h"
+#include "xdr_rec.h"
+
+#define MCALL_MSG_SIZE 24
+
+/*
+ * Largest reply record that is loaded into memory before it is decoded.
+ * A bigger one is decoded as it is read, which is just as correct.
+ */
+#define CLNTMT_MAXREC (1024 * 1024)
+
+#define CLNTMT_SHARDS  16       /* power of 2 */
+#define CLNTMT_BUCKETS 16       /* per shard, power of 2 */
+
+enum call_state { CALL_PENDING, CALL_DECODING, CALL_DONE };
+
+struct mt_call {
+    struct mt_call  *mc_next;
+    uint32_t         mc_xid;
+    int              mc_state;
+    struct rpc_err   mc_err;
+    xdrproc_t        mc_xresults;
+    caddr_t          mc_resultsp;
+    pthread_cond_t  *mc_cond;
+};
+
+struct mt_shard {
+    pthread_mutex_t  sh_lock;
+    struct mt_call  *sh_bucket[CLNTMT_BUCKETS];
+} CACHE_ALIGNED;
+
+struct ct_data {
+    int                 ct_sock;
+    bool_t              ct_closeit;
+    struct timeval      ct_wait;
+    bool_t              ct_waitset;
+    struct sockaddr_in  ct_addr;
+    uint32_t            ct_xid;
+    int                 ct_dead;        /* enum clnt_stat, once it has failed */
+    int                 ct_errno;
+
+    // Sending
+    pthread_mutex_t     ct_send_lock;
+    int                 ct_send_waiters;
+    char                ct_mcall[MCALL_MSG_SIZE];
+    u_int               ct_mpos;
+    XDR                 ct_xdrs_out;
+
+    // Receiving
+    CLIENT             *ct_client;
+    pthread_t           ct_reader;
+    XDR                 ct_xdrs_in;
+    struct mt_shard     ct_shards[CLNTMT_SHARDS];
+};
+
+/*
+ * What clntmt_results() needs to find the call that a reply is for.
+ */
+struct reply_ctx {
+    struct ct_data  *rc_ct;
+    struct rpc_msg  *rc_msg;
+    struct mt_call  *rc_call;
+};
+
+static enum clnt_stat clntmt_call(CLIENT *, u_long, xdrproc_t, caddr_t,
+                          xdrproc_t, caddr_t, struct timeval);
+static void clntmt_abort(void);
+static void clntmt_geterr(CLIENT *, struct rpc_err *);
+static bool_t clntmt_freeres(CLIENT *, xdrproc_t, caddr_t);
+static bool_t clntmt_control(CLIENT *, int, char *);
+static void clntmt_destroy(CLIENT *);
+
+static const struct clnt_ops clntmt_ops = {
+    clntmt_call,
+    clntmt_abort,
+    clntmt_geterr,
+    clntmt_freeres,
+    clntmt_destroy,
+    clntmt_control
+};
+
+static int readtcp(char *, char *, int);
+static int writetcp(char *, char *, int);
+static void *clntmt_reader(void *);
+
+/*
+ * The error of the last call made by this thread; see clnt_geterr().
+ */
+static __thread struct rpc_err clntmt_err;
+
+/*
+ * Each thread waits for its replies on its own condition variable,
+ * made once, and used for every call, on every handle.
+ */
+static __thread pthread_cond_t clntmt_cond;
+static __thread int clntmt_cond_ready;
+
+static pthread_cond_t *
+thread_cond(void)
+{
+    pthread_condattr_t attr;
+
+    if (!clntmt_cond_ready) {
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&clntmt_cond, &attr);
+        pthread_condattr_destroy(&attr);
+        clntmt_cond_ready = 1;
+    }
+    return (&clntmt_cond);
+}
+
+static inline struct mt_shard *
+xid_shard(struct ct_data *ct, uint32_t xid)
+{
+    return (&ct->ct_shards[xid & (CLNTMT_SHARDS - 1)]);
+}
+
+static inline struct mt_call **
+xid_bucket(struct mt_shard *shard, uint32_t xid)
+{
+    return (&shard->sh_bucket[(xid / CLNTMT_SHARDS) & (CLNTMT_BUCKETS - 1)]);
+}
+
+/*
+ * Unlink @var{call} from its bucket.  Caller holds the shard lock.
+ */
+static void
+call_unlink(struct mt_shard *shard, struct mt_call *call)
+{
+    struct mt_call **pp;
+
+    for (pp = xid_bucket(shard, call->mc_xid); *pp != NULL; pp = &(*pp)->mc_next) {
+        if (*pp == call) {
+            *pp = call->mc_next;
+            return;
+        }
+    }
+}
+
+/*
+ * Take the call waiting for @var{xid}, if there is one, and mark it
+ * as being decoded.  Return NULL, if no one is waiting for it;
+ * that is, it timed out.
+ */
+static struct mt_call *
+call_take(struct ct_data *ct, uint32_t xid)
+{
+    struct mt_shard *shard;
+    struct mt_call **pp;
+    struct mt_call *call;
+
+    shard = xid_shard(ct, xid);
+    pthread_mutex_lock(&shard->sh_lock);
+    for (pp = xid_bucket(shard, xid); (call = *pp) != NULL; pp = &call->mc_next) {
+        if (call->mc_xid == xid) {
+            *pp = call->mc_next;
+            call->mc_state = CALL_DECODING;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard->sh_lock);
+    return (call);
+}
+
+static void
+call_done(struct ct_data *ct, struct mt_call *call, const struct rpc_err *errp)
+{
+    struct mt_shard *shard;
+
+    shard = xid_shard(ct, call->mc_xid);
+    pthread_mutex_lock(&shard->sh_lock);
+    call->mc_err = *errp;
+    call->mc_state = CALL_DONE;
+    pthread_cond_signal(call->mc_cond);
+    pthread_mutex_unlock(&shard->sh_lock);
+}
+
+/*
+ * The connection is no good.  Fail every call that is waiting
+ * for a reply, and every call made from now on.
+ */
+static void
+clntmt_fail(struct ct_data *ct, enum clnt_stat stat, int err)
+{
+    struct mt_shard *shard;
+    struct mt_call *call;
+    size_t i, b;
+    int zero;
+
+    zero = 0;
+    if (__atomic_compare_exchange_n(&ct->ct_dead, &zero, (int)stat, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        ct->ct_errno = err;
+    }
+
+    for (i = 0; i < CLNTMT_SHARDS; ++i) {
+        shard = &ct->ct_shards[i];
+        pthread_mutex_lock(&shard->sh_lock);
+        for (b = 0; b < CLNTMT_BUCKETS; ++b) {
+            while ((call = shard->sh_bucket[b]) != NULL) {
+                shard->sh_bucket[b] = call->mc_next;
+                call->mc_err.re_status = (enum clnt_stat)ct->ct_dead;
+                call->mc_err.re_errno = ct->ct_errno;
+                call->mc_state = CALL_DONE;
+                pthread_cond_signal(call->mc_cond);
+            }
+        }
+        pthread_mutex_unlock(&shard->sh_lock);
+    }
+}
+
+/*
+ * Create a client handle for a tcp/ip connection.
+ * If *sockp < 0, *sockp is set to a newly created TCP socket, and it is
+ * connected to raddr.  If *sockp >= 0, then the caller has already
+ * connected it.  If raddr->sin_port is 0, then the portmapper is
+ * asked for the port.  Sendsz and recvsz are the sizes of the send
+ * and receive buffers; 0 chooses a suitable default.
+ */
+CLIENT *
+clntmt_create(struct sockaddr_in *raddr, u_long prog, u_long vers,
+    int *sockp, u_int sendsz, u_int recvsz)
+{
+    CLIENT *h;
+    struct ct_data *ct;
+    struct rpc_msg call_msg;
+    struct timeval now;
+    XDR xdrs;
+    u_short port;
+    size_t i;
+    int on;
+    int err;
+
+    h = (CLIENT *) calloc(1, sizeof (*h));
+    ct = (struct ct_data *) calloc(1, sizeof (*ct));
+    if (h == NULL || ct == NULL) {
+        rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+        rpc_createerr.cf_error.re_errno = ENOMEM;
+        goto fooy;
+    }
+    ct->ct_sock = -1;
+
+    if (raddr->sin_port == 0) {
+        port = pmap_getport(raddr, prog, vers, IPPROTO_TCP);
+        if (port == 0) {
+            goto fooy;
+        }
+        raddr->sin_port = htons(port);
+    }
+
+    if (*sockp < 0) {
+        *sockp = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        (void) bindresvport(*sockp, (struct sockaddr_in *) 0);
+        if (*sockp < 0
+            || connect(*sockp, (struct sockaddr *) raddr, sizeof (*raddr)) < 0) {
+            rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+            rpc_createerr.cf_error.re_errno = errno;
+            if (*sockp >= 0) {
+                (void) close(*sockp);
+            }
+            goto fooy;
+        }
+        ct->ct_closeit = TRUE;
+    }
+    else {
+        ct->ct_closeit = FALSE;
+    }
+    ct->ct_sock = *sockp;
+
+    // We do our own coalescing of small calls; see clntmt_call().
+    on = 1;
+    (void) setsockopt(ct->ct_sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+
+    ct->ct_wait.tv_usec = 0;
+    ct->ct_waitset = FALSE;
+    ct->ct_addr = *raddr;
+    (void) gettimeofday(&now, (struct timezone *) 0);
+    ct->ct_xid = (uint32_t)(getpid() ^ now.tv_sec ^ now.tv_usec);
+
+    // Pre-serialize the static part of the call msg, as clnttcp does.
+    memset(&call_msg, 0, sizeof (call_msg));
+    call_msg.rm_xid = 0;
+    call_msg.rm_direction = CALL;
+    call_msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+    call_msg.rm_call.cb_prog = prog;
+    call_msg.rm_call.cb_vers = vers;
+    xdrmem_create(&xdrs, ct->ct_mcall, MCALL_MSG_SIZE, XDR_ENCODE);
+    if (!xdr_callhdr(&xdrs, &call_msg)) {
+        if (ct->ct_closeit) {
+            (void) close(*sockp);
+        }
+        goto fooy;
+    }
+    ct->ct_mpos = XDR_GETPOS(&xdrs);
+    XDR_DESTROY(&xdrs);
+
+    pthread_mutex_init(&ct->ct_send_lock, NULL);
+    for (i = 0; i < CLNTMT_SHARDS; ++i) {
+        pthread_mutex_init(&ct->ct_shards[i].sh_lock, NULL);
+    }
+
+    /*
+     * One stream for each direction, because callers encode and
+     * the reader decodes at the same time.
+     */
+    xdrrec_create(&ct->ct_xdrs_out, sendsz, 0,
+        (caddr_t) ct, readtcp, writetcp);
+    ct->ct_xdrs_out.x_op = XDR_ENCODE;
+    xdrrec_create(&ct->ct_xdrs_in, 0, recvsz,
+        (caddr_t) ct, readtcp, writetcp);
+    ct->ct_xdrs_in.x_op = XDR_DECODE;
+    xdrrec_recordmode(&ct->ct_xdrs_in, CLNTMT_MAXREC);
+
+    h->cl_ops = (struct clnt_ops *) &clntmt_ops;
+    h->cl_private = (caddr_t) ct;
+    h->cl_auth = authnone_create();
+    ct->ct_client = h;
+
+    err = pthread_create(&ct->ct_reader, NULL, clntmt_reader, ct);
+    if (err != 0) {
+        rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+        rpc_createerr.cf_error.re_errno = err;
+        XDR_DESTROY(&ct->ct_xdrs_out);
+        XDR_DESTROY(&ct->ct_xdrs_in);
+        if (ct->ct_closeit) {
+            (void) close(*sockp);
+        }
+        goto fooy;
+    }
+    return (h);
+
+fooy:
+    free(ct);
+    free(h);
+    return ((CLIENT *) NULL);
+}
+
+static enum clnt_stat
+clntmt_call(CLIENT *h, u_long proc, xdrproc_t xdr_args, caddr_t args_ptr,
+    xdrproc_t xdr_results, caddr_t results_ptr, struct timeval timeout)
+{
+    struct ct_data *ct = (struct ct_data *) h->cl_private;
+    XDR *xdrs = &(ct->ct_xdrs_out);
+    struct mt_shard *shard;
+    struct mt_call call;
+    struct timespec deadline;
+    bool_t shipnow;
+    bool_t wait;
+    uint32_t xid;
+    int dead;
+    int rv;
+
+    if (ct->ct_waitset) {
+        timeout = ct->ct_wait;
+    }
+    wait = (timeout.tv_sec > 0 || timeout.tv_usec > 0);
+
+    do {
+        xid = __atomic_add_fetch(&ct->ct_xid, 1, __ATOMIC_RELAXED);
+    } while (xid == 0);
+
+    memset(&call, 0, sizeof (call));
+    call.mc_xid = xid;
+    call.mc_state = CALL_PENDING;
+    call.mc_xresults = xdr_results;
+    call.mc_resultsp = results_ptr;
+    call.mc_cond = thread_cond();
+
+    // In the table before it is sent; the reply can come back at once.
+    shard = xid_shard(ct, xid);
+    if (wait) {
+        pthread_mutex_lock(&shard->sh_lock);
+        call.mc_next = *xid_bucket(shard, xid);
+        *xid_bucket(shard, xid) = &call;
+        pthread_mutex_unlock(&shard->sh_lock);
+    }
+
+    /*
+     * If other threads are waiting to send, leave this call in the
+     * send buffer; the last of them to send flushes it.
+     */
+    __atomic_add_fetch(&ct->ct_send_waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&ct->ct_send_lock);
+    __atomic_sub_fetch(&ct->ct_send_waiters, 1, __ATOMIC_SEQ_CST);
+
+    dead = __atomic_load_n(&ct->ct_dead, __ATOMIC_SEQ_CST);
+    if (dead != 0) {
+        call.mc_err.re_status = (enum clnt_stat) dead;
+        call.mc_err.re_errno = ct->ct_errno;
+    }
+    else {
+        *(uint32_t *) (void *) ct->ct_mcall = htonl(xid);
+        if (!XDR_PUTBYTES(xdrs, ct->ct_mcall, ct->ct_mpos)
+            || !XDR_PUTLONG(xdrs, (long *) &proc)
+            || !AUTH_MARSHALL(h->cl_auth, xdrs)
+            || !(*xdr_args) (xdrs, args_ptr)) {
+            call.mc_err.re_status = RPC_CANTENCODEARGS;
+            (void) xdrrec_endofrecord(xdrs, TRUE);
+        }
+        else {
+            shipnow = (xdr_results != NULL || wait)
+                && __atomic_load_n(&ct->ct_send_waiters, __ATOMIC_SEQ_CST) == 0;
+            if (!xdrrec_endofrecord(xdrs, shipnow)) {
+                call.mc_err.re_status = RPC_CANTSEND;
+                call.mc_err.re_errno = ct->ct_errno;
+            }
+        }
+    }
+    pthread_mutex_unlock(&ct->ct_send_lock);
+
+    if (!wait) {
+        // As with clnttcp, a zero timeout means do not wait for a reply.
+        clntmt_err = call.mc_err;
+        if (clntmt_err.re_status == RPC_SUCCESS) {
+            clntmt_err.re_status = RPC_TIMEDOUT;
+        }
+        return (clntmt_err.re_status);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout.tv_sec;
+    deadline.tv_nsec += timeout.tv_usec * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_nsec -= 1000000000;
+        ++deadline.tv_sec;
+    }
+
+    pthread_mutex_lock(&shard->sh_lock);
+    if (call.mc_err.re_status != RPC_SUCCESS && call.mc_state == CALL_PENDING) {
+        // Never sent.
+        call_unlink(shard, &call);
+        call.mc_state = CALL_DONE;
+    }
+    while (call.mc_state != CALL_DONE) {
+        if (call.mc_state == CALL_DECODING) {
+            pthread_cond_wait(call.mc_cond, &shard->sh_lock);
+            continue;
+        }
+        rv = pthread_cond_timedwait(call.mc_cond, &shard->sh_lock, &deadline);
+        if (rv == ETIMEDOUT && call.mc_state == CALL_PENDING) {
+            call_unlink(shard, &call);
+            call.mc_err.re_status = RPC_TIMEDOUT;
+            call.mc_state = CALL_DONE;
+        }
+    }
+    pthread_mutex_unlock(&shard->sh_lock);
+
+    clntmt_err = call.mc_err;
+    return (clntmt_err.re_status);
+}
+
+/*
+ * Decode the results of a reply, for xdr_replymsg().
+ * By now, the xid of the reply has been decoded, so we know
+ * whose results these are.
+ */
+static bool_t
+clntmt_results(XDR *xdrs, caddr_t where)
+{
+    struct reply_ctx *rc = (struct reply_ctx *) where;
+    struct mt_call *call;
+
+    call = call_take(rc->rc_ct, rc->rc_msg->rm_xid);
+    if (call == NULL) {
+        // No one is waiting for it, any more.  Skip it.
+        return (TRUE);
+    }
+    rc->rc_call = call;
+    if (call->mc_xresults == NULL) {
+        return (TRUE);
+    }
+    return ((*call->mc_xresults) (xdrs, call->mc_resultsp));
+}
+
+static void *
+clntmt_reader(void *arg)
+{
+    struct ct_data *ct = (struct ct_data *) arg;
+    XDR *xdrs = &(ct->ct_xdrs_in);
+    struct rpc_msg reply_msg;
+    struct reply_ctx rc;
+    struct rpc_err err;
+    bool_t ok;
+
+    for (;;) {
+        if (!xdrrec_skiprecord(xdrs) || !xdrrec_getrecord(xdrs)) {
+            break;
+        }
+        memset(&reply_msg, 0, sizeof (reply_msg));
+        reply_msg.acpted_rply.ar_verf = _null_auth;
+        reply_msg.acpted_rply.ar_results.where = (caddr_t) &rc;
+        reply_msg.acpted_rply.ar_results.proc = (xdrproc_t) clntmt_results;
+        rc.rc_ct = ct;
+        rc.rc_msg = &reply_msg;
+        rc.rc_call = NULL;
+
+        ok = xdr_replymsg(xdrs, &reply_msg);
+        if (rc.rc_call == NULL && reply_msg.rm_xid != 0) {
+            // An error reply, which has no results.
+            rc.rc_call = call_take(ct, reply_msg.rm_xid);
+        }
+        if (rc.rc_call != NULL) {
+            memset(&err, 0, sizeof (err));
+            if (!ok) {
+                err.re_status = RPC_CANTDECODERES;
+            }
+            else {
+                _seterr_reply(&reply_msg, &err);
+                if (err.re_status == RPC_SUCCESS
+                    && !AUTH_VALIDATE(ct->ct_client->cl_auth,
+                           &reply_msg.acpted_rply.ar_verf)) {
+                    err.re_status = RPC_AUTHERROR;
+                    err.re_why = AUTH_INVALIDRESP;
+                }
+            }
+            call_done(ct, rc.rc_call, &err);
+        }
+        if (reply_msg.acpted_rply.ar_verf.oa_base != NULL) {
+            xdrs->x_op = XDR_FREE;
+            (void) xdr_opaque_auth(xdrs, &(reply_msg.acpted_rply.ar_verf));
+            xdrs->x_op = XDR_DECODE;
+        }
+    }
+    clntmt_fail(ct, RPC_CANTRECV, ct->ct_errno);
+    return (NULL);
+}
+
+static void
+clntmt_geterr(CLIENT *h, struct rpc_err *errp)
+{
+    (void) h;
+    *errp = clntmt_err;
+}
+
+static bool_t
+clntmt_freeres(CLIENT *cl, xdrproc_t xdr_res, caddr_t res_ptr)
+{
+    XDR xdrs;
+
+    (void) cl;
+    memset(&xdrs, 0, sizeof (xdrs));
+    xdrs.x_op = XDR_FREE;
+    return ((*xdr_res) (&xdrs, res_ptr));
+}
+
+static void
+clntmt_abort(void)
+{
+}
+
+static bool_t
+clntmt_control(CLIENT *cl, int request, char *info)
+{
+    struct ct_data *ct = (struct ct_data *) cl->cl_private;
+    uint32_t v;
+
+    switch (request) {
+    case CLSET_FD_CLOSE:
+        ct->ct_closeit = TRUE;
+        break;
+    case CLSET_FD_NCLOSE:
+        ct->ct_closeit = FALSE;
+        break;
+    case CLSET_TIMEOUT:
+        ct->ct_wait = *(struct timeval *) info;
+        ct->ct_waitset = TRUE;
+        break;
+    case CLGET_TIMEOUT:
+        *(struct timeval *) info = ct->ct_wait;
+        break;
+    case CLGET_SERVER_ADDR:
+        *(struct sockaddr_in *) info = ct->ct_addr;
+        break;
+    case CLGET_FD:
+        *(int *) info = ct->ct_sock;
+        break;
+    case CLGET_XID:
+        *(u_long *) info = __atomic_load_n(&ct->ct_xid, __ATOMIC_RELAXED);
+        break;
+    case CLGET_VERS:
+    case CLGET_PROG:
+        memcpy(&v, ct->ct_mcall + (request == CLGET_VERS ? 16 : 12), sizeof (v));
+        *(u_long *) info = ntohl(v);
+        break;
+    case CLSET_VERS:
+    case CLSET_PROG:
+        v = htonl((uint32_t) *(u_long *) info);
+        pthread_mutex_lock(&ct->ct_send_lock);
+        memcpy(ct->ct_mcall + (request == CLSET_VERS ? 16 : 12), &v, sizeof (v));
+        pthread_mutex_unlock(&ct->ct_send_lock);
+        break;
+    default:
+        return (FALSE);
+    }
+    return (TRUE);
+}
+
+static void
+clntmt_destroy(CLIENT *h)
+{
+    struct ct_data *ct = (struct ct_data *) h->cl_private;
+    size_t i;
+
+    // Wake up the reader, and wait for it to fail what is left.
+    (void) shutdown(ct->ct_sock, SHUT_RDWR);
+    (void) pthread_join(ct->ct_reader, NULL);
+    if (ct->ct_closeit) {
+        (void) close(ct->ct_sock);
+    }
+    XDR_DESTROY(&(ct->ct_xdrs_out));
+    XDR_DESTROY(&(ct->ct_xdrs_in));
+    pthread_mutex_destroy(&ct->ct_send_lock);
+    for (i = 0; i < CLNTMT_SHARDS; ++i) {
+        pthread_mutex_destroy(&ct->ct_shards[i].sh_lock);
+    }
+    free(ct);
+    free(h);
+}
+
+/*
+ * Interface between xdr serializer and tcp connection.
+ * Behaves like the system calls, read & write, but keeps some error state
+ * around for the rpc level.  The reader thread is the only one that
+ * reads; it blocks until there is something to read.
+ */
+static int
+readtcp(char *ctptr, char *buf, int len)
+{
+    struct ct_data *ct = (struct ct_data *) ctptr;
+    ssize_t n;
+
+    if (len == 0) {
+        return (0);
+    }
+    for (;;) {
+        n = read(ct->ct_sock, buf, (size_t) len);
+        if (n > 0) {
+            return ((int) n);
+        }
+        if (n == 0) {
+            ct->ct_errno = ECONNRESET;
+            return (-1);
+        }
+        if (errno != EINTR) {
+            ct->ct_errno = errno;
+            return (-1);
+        }
+    }
+}
+
+/*
+ * Callers hold @var{ct_send_lock}.
+ */
+static int
+writetcp(char *ctptr, char *buf, int len)
+{
+    struct ct_data *ct = (struct ct_data *) ctptr;
+    ssize_t n;
+    int cnt;
+
+    for (cnt = len; cnt > 0; cnt -= (int) n, buf += n) {
+        n = write(ct->ct_sock, buf, (size_t) cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            clntmt_fail(ct, RPC_CANTSEND, errno);
+            (void) shutdown(ct->ct_sock, SHUT_RDWR);
+            return (-1);
+        }
+    }
+    return (len);
+}
@@ -0,0 +1,73 @@
+/*
+ * Filename: clnt_mt.h
+ * Project: rpc-mt
+ * Brief: Thread-safe, pipelined RPC client over one TCP connection
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CLNT_MT_H
+#define _CLNT_MT_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>  // Import struct sockaddr_in
+#include <rpc/rpc.h>     // Import CLIENT, u_long, u_int
+
+/*
+ * Pipelined client
+ * ----------------
+ * clntmt_create() takes the same arguments as clnttcp_create(),
+ * and returns an ordinary CLIENT handle, used with clnt_call(),
+ * clnt_freeres(), clnt_control() and clnt_destroy().
+ *
+ * Unlike a clnttcp handle, which carries one call at a time,
+ * a clntmt handle can be used by any number of threads at once.
+ * Each call is sent as soon as the connection is free to write,
+ * without waiting for replies to earlier calls.  A reader thread,
+ * one per handle, matches each reply to its call by xid, decodes
+ * the results, right into the caller's @var{resultsp}, and wakes
+ * up the caller.  Replies can come back in any order.
+ *
+ * Timeouts are per call: a call that has no reply by its deadline
+ * returns RPC_TIMEDOUT, and a reply that comes later is dropped.
+ * CLSET_TIMEOUT sets one timeout for all calls, which overrides
+ * the timeout given to clnt_call(), as it does for clnttcp.
+ *
+ * When several threads are waiting to send, the calls of all but
+ * the last are left in the send buffer, and go out together, in
+ * as few writes as fit.
+ *
+ * clnt_geterr() reports the error of the last call made by the
+ * calling thread.  If the connection fails, every call waiting
+ * for a reply, and every later call, fails with RPC_CANTRECV or
+ * RPC_CANTSEND.
+ *
+ * clnt_destroy() must not be called while other threads are still
+ * using the handle.
+ */
+
+extern CLIENT *clntmt_create(struct sockaddr_in *raddr, u_long prog,
+                   u_long vers, int *sockp, u_int sendsz, u_int recvsz);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _CLNT_MT_H */
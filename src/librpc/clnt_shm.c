@@ -0,0 +1,530 @@
+/*
+ * Filename: clnt_shm.c
+ * Project: rpc-mt
+ * Brief: Client side of the shared-memory ring transport
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * See svc_shm.h.
+ *
+ * A call is encoded straight into the next slot of the call ring,
+ * and the reply is decoded straight out of its slot in the reply ring,
+ * into the caller's results.  While waiting for a reply, we spin
+ * for a little while, before we ask for the doorbell and sleep;
+ * a short call is usually answered within the spin.
+ */
+
+#include <stdlib.h>
+    // Import calloc(), free()
+#include <string.h>
+    // Import memcpy(), memset(), strlen()
+#include <stddef.h>
+    // Import offsetof()
+#include <unistd.h>
+    // Import close(), read(), getpid()
+#include <errno.h>
+    // Import errno
+#include <time.h>
+    // Import clock_gettime()
+#include <poll.h>
+    // Import ppoll()
+#include <sched.h>
+    // Import sched_yield()
+#include <pthread.h>
+    // Import pthread_mutex_*
+#include <sys/mman.h>
+    // Import mmap(), munmap()
+#include <sys/socket.h>
+    // Import socket(), connect(), recvmsg()
+#include <sys/un.h>
+    // Import struct sockaddr_un
+#include <sys/time.h>
+    // Import gettimeofday()
+#include <rpc/rpc.h>
+    // Import CLIENT, xdr_callhdr(), xdr_replymsg(), _seterr_reply()
+
+#include "svc_shm.h"
+
+#define MCALL_MSG_SIZE 24
+
+/*
+ * How many times to look at the reply ring, before going to sleep.
+ */
+#define SHM_SPIN 4096
+
+struct cs_data {
+    pthread_mutex_t     cs_lock;
+    int                 cs_sock;
+    int                 cs_call_efd;
+    int                 cs_reply_efd;
+    struct shm_region  *cs_region;
+    size_t              cs_maplen;
+    uint32_t            cs_nslots;
+    uint32_t            cs_slotsize;
+    struct timeval      cs_wait;
+    bool_t              cs_waitset;
+    uint32_t            cs_xid;
+    struct rpc_err      cs_error;
+    char                cs_mcall[MCALL_MSG_SIZE];
+    u_int               cs_mpos;
+};
+
+static enum clnt_stat clntshm_call(CLIENT *, u_long, xdrproc_t, caddr_t,
+                          xdrproc_t, caddr_t, struct timeval);
+static void clntshm_abort(void);
+static void clntshm_geterr(CLIENT *, struct rpc_err *);
+static bool_t clntshm_freeres(CLIENT *, xdrproc_t, caddr_t);
+static bool_t clntshm_control(CLIENT *, int, char *);
+static void clntshm_destroy(CLIENT *);
+
+static const struct clnt_ops clntshm_ops = {
+    clntshm_call,
+    clntshm_abort,
+    clntshm_geterr,
+    clntshm_freeres,
+    clntshm_destroy,
+    clntshm_control
+};
+
+/*
+ * Receive the hello, and the memfd and doorbells, from the server.
+ */
+static int
+shm_receive_hello(int sock, struct shm_hello *hello, int *fds)
+{
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof (int))];
+    } cmsg;
+    struct cmsghdr *cm;
+    ssize_t n;
+
+    iov.iov_base = hello;
+    iov.iov_len = sizeof (*hello);
+    memset(&mh, 0, sizeof (mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cmsg.buf;
+    mh.msg_controllen = sizeof (cmsg.buf);
+    do {
+        n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof (*hello)) {
+        return (-1);
+    }
+    cm = CMSG_FIRSTHDR(&mh);
+    if (cm == NULL || cm->cmsg_level != SOL_SOCKET
+        || cm->cmsg_type != SCM_RIGHTS
+        || cm->cmsg_len != CMSG_LEN(3 * sizeof (int))) {
+        return (-1);
+    }
+    memcpy(fds, CMSG_DATA(cm), 3 * sizeof (int));
+    return (0);
+}
+
+/*
+ * Connect to the shared-memory server listening on @var{path},
+ * for program @var{prog}, version @var{vers}.
+ * On failure, set rpc_createerr, and return NULL.
+ */
+CLIENT *
+clntshm_create(const char *path, u_long prog, u_long vers)
+{
+    CLIENT *h;
+    struct cs_data *cs;
+    struct sockaddr_un addr;
+    struct shm_hello hello;
+    struct rpc_msg call_msg;
+    struct timeval now;
+    XDR xdrs;
+    size_t pathlen;
+    void *base;
+    int fds[3];
+    int sock;
+
+    h = (CLIENT *) calloc(1, sizeof (*h));
+    cs = (struct cs_data *) calloc(1, sizeof (*cs));
+    sock = -1;
+    fds[0] = fds[1] = fds[2] = -1;
+    if (h == NULL || cs == NULL) {
+        rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+        rpc_createerr.cf_error.re_errno = ENOMEM;
+        goto fooy;
+    }
+
+    pathlen = strlen(path);
+    if (pathlen >= sizeof (addr.sun_path)) {
+        rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+        rpc_createerr.cf_error.re_errno = ENAMETOOLONG;
+        goto fooy;
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, pathlen + 1);
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0
+        || connect(sock, (struct sockaddr *) &addr,
+               (socklen_t) (offsetof(struct sockaddr_un, sun_path) + pathlen + 1)) < 0) {
+        rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+        rpc_createerr.cf_error.re_errno = errno;
+        goto fooy;
+    }
+
+    if (shm_receive_hello(sock, &hello, fds) != 0
+        || hello.sh_magic != SHM_MAGIC || hello.sh_version != SHM_VERSION
+        || hello.sh_nslots < 2 || hello.sh_nslots > SHM_NSLOTS_MAX
+        || (hello.sh_nslots & (hello.sh_nslots - 1)) != 0
+        || hello.sh_slotsize < SHM_SLOTSIZE_MIN
+        || hello.sh_slotsize > SHM_SLOTSIZE_MAX) {
+        rpc_createerr.cf_stat = RPC_CANTRECV;
+        rpc_createerr.cf_error.re_errno = EPROTO;
+        goto fooy;
+    }
+
+    cs->cs_nslots = hello.sh_nslots;
+    cs->cs_slotsize = hello.sh_slotsize;
+    cs->cs_maplen = shm_region_size(cs->cs_nslots, cs->cs_slotsize);
+    base = mmap(NULL, cs->cs_maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fds[0], 0);
+    if (base == MAP_FAILED) {
+        rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+        rpc_createerr.cf_error.re_errno = errno;
+        goto fooy;
+    }
+    (void) close(fds[0]);
+    cs->cs_region = (struct shm_region *) base;
+    cs->cs_sock = sock;
+    cs->cs_call_efd = fds[1];
+    cs->cs_reply_efd = fds[2];
+
+    // Pre-serialize the static part of the call msg, as clnttcp does.
+    memset(&call_msg, 0, sizeof (call_msg));
+    call_msg.rm_direction = CALL;
+    call_msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+    call_msg.rm_call.cb_prog = prog;
+    call_msg.rm_call.cb_vers = vers;
+    xdrmem_create(&xdrs, cs->cs_mcall, MCALL_MSG_SIZE, XDR_ENCODE);
+    (void) xdr_callhdr(&xdrs, &call_msg);
+    cs->cs_mpos = XDR_GETPOS(&xdrs);
+    XDR_DESTROY(&xdrs);
+
+    (void) gettimeofday(&now, (struct timezone *) 0);
+    cs->cs_xid = (uint32_t)(getpid() ^ now.tv_sec ^ now.tv_usec);
+    cs->cs_waitset = FALSE;
+    pthread_mutex_init(&cs->cs_lock, NULL);
+
+    h->cl_ops = (struct clnt_ops *) &clntshm_ops;
+    h->cl_private = (caddr_t) cs;
+    h->cl_auth = authnone_create();
+    return (h);
+
+fooy:
+    if (fds[0] >= 0) {
+        (void) close(fds[0]);
+        (void) close(fds[1]);
+        (void) close(fds[2]);
+    }
+    if (sock >= 0) {
+        (void) close(sock);
+    }
+    free(cs);
+    free(h);
+    return ((CLIENT *) NULL);
+}
+
+static inline int
+timespec_cmp(const struct timespec *a, const struct timespec *b)
+{
+    if (a->tv_sec != b->tv_sec) {
+        return (a->tv_sec < b->tv_sec ? -1 : 1);
+    }
+    if (a->tv_nsec != b->tv_nsec) {
+        return (a->tv_nsec < b->tv_nsec ? -1 : 1);
+    }
+    return (0);
+}
+
+/*
+ * Time left until @var{deadline}, in @var{left}.
+ * Return false if there is none.
+ */
+static bool
+time_left(const struct timespec *deadline, struct timespec *left)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_cmp(&now, deadline) >= 0) {
+        return (false);
+    }
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left->tv_nsec < 0) {
+        left->tv_nsec += 1000000000;
+        --left->tv_sec;
+    }
+    return (true);
+}
+
+/*
+ * Encode a call into the next slot of the call ring, and publish it.
+ */
+static enum clnt_stat
+shm_send_call(CLIENT *h, struct cs_data *cs, uint32_t xid, u_long proc,
+    xdrproc_t xdr_args, caddr_t args_ptr, const struct timespec *deadline)
+{
+    struct shm_ring *r;
+    struct timespec left;
+    XDR xdrs;
+    char *slot;
+    uint32_t tail;
+    uint32_t len;
+    bool_t ok;
+
+    r = &(cs->cs_region->sh_ring[SHM_CALL]);
+    tail = r->sr_tail;
+
+    // There is always room, unless the server has fallen far behind.
+    while (tail - __atomic_load_n(&r->sr_head, __ATOMIC_ACQUIRE) >= cs->cs_nslots) {
+        if (__atomic_load_n(&cs->cs_region->sh_closed, __ATOMIC_ACQUIRE)) {
+            return (RPC_CANTSEND);
+        }
+        if (!time_left(deadline, &left)) {
+            return (RPC_TIMEDOUT);
+        }
+        sched_yield();
+    }
+
+    slot = shm_slot(cs->cs_region, cs->cs_nslots, cs->cs_slotsize,
+        SHM_CALL, tail);
+    xdrmem_create(&xdrs, slot + SHM_SLOT_HDR,
+        cs->cs_slotsize - SHM_SLOT_HDR, XDR_ENCODE);
+    *(uint32_t *) (void *) cs->cs_mcall = htonl(xid);
+    ok = XDR_PUTBYTES(&xdrs, cs->cs_mcall, cs->cs_mpos)
+        && XDR_PUTLONG(&xdrs, (long *) &proc)
+        && AUTH_MARSHALL(h->cl_auth, &xdrs)
+        && (*xdr_args) (&xdrs, args_ptr);
+    len = XDR_GETPOS(&xdrs);
+    XDR_DESTROY(&xdrs);
+    if (!ok) {
+        // Too big for a slot, or the arguments would not encode.
+        return (RPC_CANTENCODEARGS);
+    }
+    memcpy(slot, &len, sizeof (len));
+    shm_ring_publish(r, tail + 1, cs->cs_call_efd);
+    return (RPC_SUCCESS);
+}
+
+/*
+ * Wait for the reply to call @var{xid}, and decode it into @var{results_ptr}.
+ * Replies to calls that have timed out, earlier, are skipped.
+ */
+static enum clnt_stat
+shm_recv_reply(CLIENT *h, struct cs_data *cs, uint32_t xid,
+    xdrproc_t xdr_results, caddr_t results_ptr,
+    const struct timespec *deadline)
+{
+    struct shm_ring *r;
+    struct rpc_msg reply_msg;
+    struct timespec left;
+    struct pollfd pfd;
+    XDR xdrs;
+    char *slot;
+    uint32_t head;
+    uint32_t len;
+    uint32_t rxid;
+    uint64_t count;
+    bool_t ok;
+    int spin;
+
+    r = &(cs->cs_region->sh_ring[SHM_REPLY]);
+    spin = 0;
+    for (;;) {
+        head = r->sr_head;
+        if (__atomic_load_n(&r->sr_tail, __ATOMIC_ACQUIRE) != head) {
+            slot = shm_slot(cs->cs_region, cs->cs_nslots, cs->cs_slotsize,
+                SHM_REPLY, head);
+            memcpy(&len, slot, sizeof (len));
+            memcpy(&rxid, slot + SHM_SLOT_HDR, sizeof (rxid));
+            if (len < sizeof (rxid) || len > cs->cs_slotsize - SHM_SLOT_HDR
+                || ntohl(rxid) != xid) {
+                // Not ours: a late reply to an earlier call.
+                __atomic_store_n(&r->sr_head, head + 1, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            memset(&reply_msg, 0, sizeof (reply_msg));
+            reply_msg.acpted_rply.ar_verf = _null_auth;
+            reply_msg.acpted_rply.ar_results.where = results_ptr;
+            reply_msg.acpted_rply.ar_results.proc = xdr_results;
+            xdrmem_create(&xdrs, slot + SHM_SLOT_HDR, len, XDR_DECODE);
+            ok = xdr_replymsg(&xdrs, &reply_msg);
+            if (!ok) {
+                cs->cs_error.re_status = RPC_CANTDECODERES;
+            }
+            else {
+                _seterr_reply(&reply_msg, &(cs->cs_error));
+                if (cs->cs_error.re_status == RPC_SUCCESS
+                    && !AUTH_VALIDATE(h->cl_auth,
+                           &reply_msg.acpted_rply.ar_verf)) {
+                    cs->cs_error.re_status = RPC_AUTHERROR;
+                    cs->cs_error.re_why = AUTH_INVALIDRESP;
+                }
+            }
+            if (reply_msg.acpted_rply.ar_verf.oa_base != NULL) {
+                xdrs.x_op = XDR_FREE;
+                (void) xdr_opaque_auth(&xdrs, &(reply_msg.acpted_rply.ar_verf));
+            }
+            XDR_DESTROY(&xdrs);
+            __atomic_store_n(&r->sr_head, head + 1, __ATOMIC_RELEASE);
+            return (cs->cs_error.re_status);
+        }
+
+        if (__atomic_load_n(&cs->cs_region->sh_closed, __ATOMIC_ACQUIRE)) {
+            return (RPC_CANTRECV);
+        }
+        if (spin < SHM_SPIN) {
+            ++spin;
+            __asm__ __volatile__ ("" ::: "memory");
+            continue;
+        }
+        if (!time_left(deadline, &left)) {
+            return (RPC_TIMEDOUT);
+        }
+        if (!shm_ring_arm(r, head)) {
+            continue;
+        }
+        pfd.fd = cs->cs_reply_efd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (ppoll(&pfd, 1, &left, NULL) > 0) {
+            (void) read(cs->cs_reply_efd, &count, sizeof (count));
+        }
+    }
+}
+
+static enum clnt_stat
+clntshm_call(CLIENT *h, u_long proc, xdrproc_t xdr_args, caddr_t args_ptr,
+    xdrproc_t xdr_results, caddr_t results_ptr, struct timeval timeout)
+{
+    struct cs_data *cs = (struct cs_data *) h->cl_private;
+    struct timespec deadline;
+    enum clnt_stat stat;
+    uint32_t xid;
+
+    pthread_mutex_lock(&cs->cs_lock);
+    if (cs->cs_waitset) {
+        timeout = cs->cs_wait;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout.tv_sec;
+    deadline.tv_nsec += timeout.tv_usec * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_nsec -= 1000000000;
+        ++deadline.tv_sec;
+    }
+
+    memset(&cs->cs_error, 0, sizeof (cs->cs_error));
+    do {
+        xid = ++cs->cs_xid;
+    } while (xid == 0);
+
+    stat = shm_send_call(h, cs, xid, proc, xdr_args, args_ptr, &deadline);
+    if (stat == RPC_SUCCESS) {
+        if (xdr_results == NULL && timeout.tv_sec == 0 && timeout.tv_usec == 0) {
+            // A batched call, as with clnttcp.  No reply is wanted.
+            stat = RPC_TIMEDOUT;
+        }
+        else {
+            stat = shm_recv_reply(h, cs, xid, xdr_results, results_ptr,
+                &deadline);
+        }
+    }
+    cs->cs_error.re_status = stat;
+    pthread_mutex_unlock(&cs->cs_lock);
+    return (stat);
+}
+
+static void
+clntshm_geterr(CLIENT *h, struct rpc_err *errp)
+{
+    struct cs_data *cs = (struct cs_data *) h->cl_private;
+
+    *errp = cs->cs_error;
+}
+
+static bool_t
+clntshm_freeres(CLIENT *cl, xdrproc_t xdr_res, caddr_t res_ptr)
+{
+    XDR xdrs;
+
+    (void) cl;
+    memset(&xdrs, 0, sizeof (xdrs));
+    xdrs.x_op = XDR_FREE;
+    return ((*xdr_res) (&xdrs, res_ptr));
+}
+
+static void
+clntshm_abort(void)
+{
+}
+
+static bool_t
+clntshm_control(CLIENT *cl, int request, char *info)
+{
+    struct cs_data *cs = (struct cs_data *) cl->cl_private;
+
+    switch (request) {
+    case CLSET_TIMEOUT:
+        cs->cs_wait = *(struct timeval *) info;
+        cs->cs_waitset = TRUE;
+        break;
+    case CLGET_TIMEOUT:
+        *(struct timeval *) info = cs->cs_wait;
+        break;
+    case CLGET_FD:
+        *(int *) info = cs->cs_sock;
+        break;
+    case CLGET_XID:
+        *(u_long *) info = cs->cs_xid;
+        break;
+    default:
+        return (FALSE);
+    }
+    return (TRUE);
+}
+
+static void
+clntshm_destroy(CLIENT *h)
+{
+    struct cs_data *cs = (struct cs_data *) h->cl_private;
+
+    // The server notices the hang-up, and takes down its end.
+    __atomic_store_n(&cs->cs_region->sh_closed, 1, __ATOMIC_RELEASE);
+    (void) close(cs->cs_sock);
+    (void) munmap(cs->cs_region, cs->cs_maplen);
+    (void) close(cs->cs_call_efd);
+    (void) close(cs->cs_reply_efd);
+    pthread_mutex_destroy(&cs->cs_lock);
+    free(cs);
+    free(h);
+}
@@ -0,0 +1,91 @@
+/*
+ * Filename: futex.h
+ * Project: rpc-mt
+ * Brief: Interface and inline implementation of futex wait/wake
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FUTEX_H
+#define _FUTEX_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <limits.h>
+    // Import constant INT_MAX
+#include <time.h>
+    // Import type struct timespec
+#include <unistd.h>
+    // Import syscall()
+#include <sys/syscall.h>
+    // Import constant SYS_futex
+#include <linux/futex.h>
+    // Import constant FUTEX_WAIT_PRIVATE
+    // Import constant FUTEX_WAKE_PRIVATE
+
+/*
+ * Thin wrappers around the Linux futex(2) system call.
+ *
+ * We only ever use futexes on words that are private to this process,
+ * so we always use the _PRIVATE variants, which are cheaper, because
+ * the kernel does not have to look up a shared mapping.
+ *
+ * futex_wait() sleeps only if *uaddr still contains @var{val}.
+ * A return value of -1 with errno EAGAIN, EINTR or ETIMEDOUT is normal;
+ * the caller is expected to re-examine the word and decide for itself.
+ */
+
+static inline int
+futex_wait(int *uaddr, int val, const struct timespec *timeout)
+{
+    return ((int) syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val,
+        timeout, NULL, 0));
+}
+
+static inline int
+futex_wake(int *uaddr, int nwake)
+{
+    return ((int) syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, nwake,
+        NULL, NULL, 0));
+}
+
+static inline int
+futex_wake_all(int *uaddr)
+{
+    return (futex_wake(uaddr, INT_MAX));
+}
+
+/*
+ * Hint to the processor that we are in a spin-wait loop.
+ */
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__ ("pause" ::: "memory");
+#else
+    __asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _FUTEX_H */
@@ -59,6 +59,10 @@
 #include "pthread_util.h"
 #include "bitvec.h"
 #include "int_limits.h"
+#include "futex.h"
+#include "svc_reactor.h"
+#include "svc_uring.h"
+#include "svc_embed.h"
 
 static inline void
 incr_counter(size_t *countp)
@@ -80,6 +84,10 @@ extern void show_rate_limit_stats(void);
 
 extern void *svc_l1_alloc(size_t sz);
 
+extern int svctcp_release_idle(SVCXPRT *xprt, time_t now);
+extern bool svcunix_authenticate(SVCXPRT *xprt, struct svc_req *rqstp,
+    struct rpc_msg *msgp);
+
 /*
  * Extended scope declarations.
  *
@@ -195,7 +203,6 @@ static void show_xport(SVCXPRT **xprtv, size_t id, size_t indent);
  * a single UDP connection.
  */
 
-static bitvec_t xprtgc_idset;
 static bitvec_t xports_idset;
 
 static size_t xports_size;    // Capacity of xports array
@@ -225,15 +232,16 @@ pthread_t xports_owner;
 
 pthread_mutex_t xports_view_lock = PTHREAD_MUTEX_INITIALIZER;
 /*
- * @var{xprtgc_lock} does for the bitmap of @type{SVCXPRT}s to be
- * garbage collect, what @var{xports_lock} does for @type{SVCXPRT}s,
- * in general.  Any mark(), unmark(), or actual removal (and unmark)
- * operations must be protected by this one lock, because they can
- * modify the bitmap that accounts for the entire set of @type{SVCXPRT}s.
+ * @var{xprtgc_lock} is held by whoever is destroying retired
+ * @type{SVCXPRT}s, normally the reaper thread, so that there is
+ * only ever one consumer of the retire stack.
+ * Retiring an @type{SVCXPRT} does not take it.  See xprt_gc_mark().
  */
 
 pthread_mutex_t xprtgc_lock = PTHREAD_MUTEX_INITIALIZER;
 
+extern pthread_mutex_t poll_lock;
+
 // Control allocation of socket file descriptors for svc_tcp.
 //
 extern struct fd_region socket_fd_region;
@@ -258,7 +266,7 @@ extern int mtmode;
 extern int wait_method_tcp;
 extern int wait_method_udp;
 extern int wait_trace_interval;
-extern long jiffy;
+extern int wait_spin;
 
 /*
  * A production system should simply return status,
@@ -371,11 +379,13 @@ decode_xprt_progress(SVCXPRT *xprt, size_t id)
         return ("_<NULL>_");
     }
 
+    (void) id;
     mtxprt = xprt_to_mtxprt(xprt);
-    xst = mtxprt->mtxp_progress;
-    xprt_gc = bitvec_get_bit(&xprtgc_idset, id);
+    xst = __sync_or_and_fetch(&(mtxprt->mtxp_progress), 0);
+    xprt_gc = __sync_or_and_fetch(&(mtxprt->mtxp_retired), 0) != 0;
     snprintf(buf, sizeof (buf),
-            "%c%c%c%c%c%c%c%c%c",
+            "%c%c%c%c%c%c%c%c%c%c",
+            (xst & XPRT_BUSY)       ? 'B' : 'b',
             (xst & XPRT_DISPATCH)   ? 'D' : 'd',
             (xst & XPRT_WAIT)       ? 'W' : 'w',
             (xst & XPRT_DONE_RECV)  ? 'R' : 'r',
@@ -431,14 +441,14 @@ svc_backtrace(void)
 LIBRARY void
 xports_global_lock(void)
 {
-    pthread_mutex_lock(&xports_lock);
+    svc_mutex_lock(&xports_lock);
     xports_owner = pthread_self();
 }
 
 LIBRARY void
 xports_global_unlock(void)
 {
-    pthread_mutex_unlock(&xports_lock);
+    svc_mutex_unlock(&xports_lock);
 }
 
 LIBRARY void
@@ -451,44 +461,227 @@ xports_snapshot()
         return;
     }
     count = xports_maxid + 1;
-    pthread_mutex_lock(&xports_view_lock);
+    svc_mutex_lock(&xports_view_lock);
     memcpy(xports_view, xports, count * sizeof (SVCXPRT *));
     xports_view_count = count;
-    pthread_mutex_unlock(&xports_view_lock);
+    svc_mutex_unlock(&xports_view_lock);
 }
 
 /*
  * Allocate memory for a @type{SVCXPRT}.  Allocate enough contiguous memory
- * for a "standard" SVCXPRT followed by the @type{mtxprt} extension.
+ * for a "standard" SVCXPRT followed by the @type{mtxprt} extension,
+ * followed by a credentials area of @var{credsz} bytes.
+ * Align on a cache line boundary, so that the cache line alignment
+ * of fields within @type{mtxprt} means something.
+ *
+ * The caller must call xprt_ext_attach(), with the same @var{credsz},
+ * once it has done any shallow copying of another @type{SVCXPRT}.
  */
 LIBRARY SVCXPRT *
-alloc_xprt(void)
+alloc_xprt(size_t credsz)
 {
     void *mem;
-    size_t xprt_size;
 
-    xprt_size = sizeof (SVCXPRT) + sizeof (mtxprt_t);
-    mem = guard_malloc(xprt_size);
+    mem = guard_memalign(CACHE_LINE_SIZE, XPRT_ALLOC_SIZE + credsz);
     return ((SVCXPRT *)mem);
 }
 
 /*
- * Given the address of a standard @type{SVCXPRT}, return a pointer to its
- * @type{mtxprt}.  Don't do any checking, because this is a new SVCXPRT,
- * under construction.
+ * Total number of bytes owned by all SVCXPRTs, including clones.
  */
-LIBRARY mtxprt_t *
-xprt_to_mtxprt_nocheck(SVCXPRT *xprt)
+size_t xprt_footprint_total;
+
+/*
+ * Account for @var{nbytes} more memory owned by a given @type{SVCXPRT}.
+ */
+LIBRARY void
+xprt_footprint_add(SVCXPRT *xprt, size_t nbytes)
+{
+    mtxprt_t *mtxprt;
+
+    mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    mtxprt->mtxp_footprint += nbytes;
+    __sync_fetch_and_add(&xprt_footprint_total, nbytes);
+}
+
+/*
+ * A @type{SVCXPRT} is about to be freed.
+ * Take all its memory off the books.
+ */
+LIBRARY void
+xprt_footprint_release(SVCXPRT *xprt)
+{
+    mtxprt_t *mtxprt;
+
+    mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    __sync_fetch_and_sub(&xprt_footprint_total, mtxprt->mtxp_footprint);
+    mtxprt->mtxp_footprint = 0;
+}
+
+/*
+ * Hook up the credentials area that follows the @type{mtxprt}
+ * of a newly allocated @type{SVCXPRT}, and start keeping track
+ * of the memory it owns.
+ */
+LIBRARY void
+xprt_ext_attach(SVCXPRT *xprt, size_t credsz)
 {
-    return ((mtxprt_t *)((char *)xprt + sizeof (SVCXPRT)));
+    mtxprt_t *mtxprt;
+
+    mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    if (credsz != 0) {
+        mtxprt->mtxp_cred = (char *)mtxprt + sizeof (mtxprt_t);
+    }
+    else {
+        mtxprt->mtxp_cred = NULL;
+    }
+    mtxprt->mtxp_credsz = credsz;
+    mtxprt->mtxp_reactor = NO_REACTOR;
+    mtxprt->mtxp_paused = 0;
+#ifdef CHECK_CREDENTIALS
+    if (credsz != 0) {
+        memset(mtxprt->mtxp_cred, 0, credsz);
+    }
+#endif
+    mtxprt->mtxp_footprint = 0;
+    mtxprt->mtxp_retired = 0;
+    mtxprt->mtxp_retire_next = NULL;
+    mtxprt->mtxp_workers = 0;
+    xprt_footprint_add(xprt, XPRT_ALLOC_SIZE + credsz);
 }
 
+#define CRED_ALIGN(n) \
+    (((n) + sizeof (void *) - 1) & ~(sizeof (void *) - 1))
+
+/*
+ * How many bytes of credentials area does a clone of @var{xprt}
+ * need, in order to have a private copy of the credentials of
+ * the request that @var{xprt} has just received and authenticated?
+ *
+ * AUTH_NULL needs nothing.
+ * AUTH_UNIX needs room for a compact copy of the raw credentials,
+ * the raw verifier, and a struct authunix_parms, with its group list
+ * and machine name, but no slack.
+ * Any other flavor gets a full-size area, copied as is.
+ */
+LIBRARY size_t
+xprt_cred_clone_size(SVCXPRT *xprt)
+{
+    mtxprt_t *mtxprt;
+    struct svc_req *rqstp;
+    struct rpc_msg *msgp;
+    const struct authunix_parms *aup;
+    size_t credsz;
+
+    mtxprt = xprt_to_mtxprt(xprt);
+    if (mtxprt->mtxp_cred == NULL) {
+        return (0);
+    }
+    rqstp = &(mtxprt->mtxp_rqst);
+    msgp = &(mtxprt->mtxp_msg);
+    switch (rqstp->rq_cred.oa_flavor) {
+    case AUTH_NULL:
+        credsz = 0;
+        break;
+    case AUTH_UNIX:
+        aup = (const struct authunix_parms *)rqstp->rq_clntcred;
+        credsz = sizeof (struct authunix_parms);
+        credsz += CRED_ALIGN(aup->aup_len * sizeof (gid_t));
+        credsz += CRED_ALIGN(msgp->rm_call.cb_cred.oa_length);
+        credsz += CRED_ALIGN(msgp->rm_call.cb_verf.oa_length);
+        credsz += strlen(aup->aup_machname) + 1;
+        break;
+    default:
+        credsz = mtxprt->mtxp_credsz;
+        break;
+    }
+
+    return (credsz);
+}
+
+/*
+ * Given a clone, @var{xprt2}, that is a shallow copy of @var{xprt1},
+ * and whose credentials area was sized by xprt_cred_clone_size(),
+ * copy the credentials of the current request into the credentials
+ * area of the clone, and make the @type{struct svc_req} and the
+ * @type{struct rpc_msg} of the clone point there, instead of into
+ * the credentials area of @var{xprt1}, which will be overwritten
+ * by the next request received.
+ */
+LIBRARY void
+xprt_cred_clone(SVCXPRT *xprt2, SVCXPRT *xprt1)
+{
+    mtxprt_t *mtxprt1;
+    mtxprt_t *mtxprt2;
+    struct svc_req *rqstp2;
+    struct rpc_msg *msgp2;
+    struct opaque_auth *cred2;
+    struct opaque_auth *verf2;
+    const struct authunix_parms *aup1;
+    struct authunix_parms *aup2;
+    char *area;
+    size_t pos;
+    size_t len;
+
+    mtxprt1 = xprt_to_mtxprt(xprt1);
+    mtxprt2 = xprt_to_mtxprt_nocheck(xprt2);
+    rqstp2 = &(mtxprt2->mtxp_rqst);
+    msgp2 = &(mtxprt2->mtxp_msg);
+    cred2 = &(msgp2->rm_call.cb_cred);
+    verf2 = &(msgp2->rm_call.cb_verf);
+    area = mtxprt2->mtxp_cred;
+
+    if (area == NULL) {
+        cred2->oa_base = NULL;
+        verf2->oa_base = NULL;
+        rqstp2->rq_cred.oa_base = NULL;
+        rqstp2->rq_clntcred = NULL;
+        return;
+    }
+
+    switch (rqstp2->rq_cred.oa_flavor) {
+    case AUTH_UNIX:
+        aup1 = (const struct authunix_parms *)mtxprt1->mtxp_rqst.rq_clntcred;
+        aup2 = (struct authunix_parms *)area;
+        *aup2 = *aup1;
+        pos = sizeof (struct authunix_parms);
+        len = aup1->aup_len * sizeof (gid_t);
+        aup2->aup_gids = (gid_t *)(area + pos);
+        memcpy(aup2->aup_gids, aup1->aup_gids, len);
+        pos += CRED_ALIGN(len);
+        memcpy(area + pos, cred2->oa_base, cred2->oa_length);
+        cred2->oa_base = area + pos;
+        pos += CRED_ALIGN(cred2->oa_length);
+        memcpy(area + pos, verf2->oa_base, verf2->oa_length);
+        verf2->oa_base = area + pos;
+        pos += CRED_ALIGN(verf2->oa_length);
+        len = strlen(aup1->aup_machname) + 1;
+        memcpy(area + pos, aup1->aup_machname, len);
+        aup2->aup_machname = area + pos;
+        rqstp2->rq_clntcred = (caddr_t)aup2;
+        break;
+    default:
+        // Same layout as the parent.  Copy the whole thing.
+        memcpy(area, mtxprt1->mtxp_cred, mtxprt2->mtxp_credsz);
+        cred2->oa_base = area;
+        verf2->oa_base = area + MAX_AUTH_BYTES;
+        rqstp2->rq_clntcred = area + 2 * MAX_AUTH_BYTES;
+        break;
+    }
+
+    rqstp2->rq_cred = *cred2;
+}
+
+#ifdef CHECK_MTXPRT
+
 /*
  * Given the address of a standard @type{SVCXPRT}, return a pointer to its
  * @type{mtxprt}, which is appended to the end of the libc @type{SVCXPRT}.
  * Check that the given pointer points to a properly constructed
  * @type{SVCXPRT}, including the @type{mtxprt}.
  *
+ * This is only for debug builds.  Otherwise, xprt_to_mtxprt()
+ * is an inline function, in svc_mtxprt.h, that does no checking.
  */
 LIBRARY mtxprt_t *
 xprt_to_mtxprt(SVCXPRT *xprt)
@@ -496,7 +689,7 @@ xprt_to_mtxprt(SVCXPRT *xprt)
     mtxprt_t *mtxprt;
     size_t id;
 
-    mtxprt = (mtxprt_t *)((char *)xprt + sizeof (SVCXPRT));
+    mtxprt = xprt_to_mtxprt_nocheck(xprt);
     id = mtxprt->mtxp_id;
     tprintf(9, "xprt=%s, id=%zu, mtxprt=%s, fd=%d\n",
         decode_addr(xprt), id, decode_addr(mtxprt), xprt->xp_sock);
@@ -518,6 +711,8 @@ xprt_to_mtxprt(SVCXPRT *xprt)
     return (mtxprt);
 }
 
+#endif /* CHECK_MTXPRT */
+
 
 /*
  * Every @type{SVCXPRT} has its own lock, which protects access to
@@ -530,31 +725,40 @@ LIBRARY void
 xprt_lock(SVCXPRT *xprt)
 {
     mtxprt_t        *mtxprt;
-    pthread_mutex_t *lockp;
     int ret;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    lockp = &mtxprt->mtxp_lock;
     tprintf(9, "xprt=%s, xprt_id=%zu, fd=%d\n",
         decode_addr(xprt), mtxprt->mtxp_id, xprt->xp_sock);
-    ret = pthread_mutex_lock(lockp);
+    ret = svc_mutex_lock(&mtxprt->mtxp_lock);
     if (ret != 0) {
         svc_die();
     }
 }
 
+/*
+ * Lock @var{xprt}, only if no one else has it.
+ * Return 1 if we got it, 0 if not.
+ */
+LIBRARY int
+xprt_trylock(SVCXPRT *xprt)
+{
+    mtxprt_t        *mtxprt;
+
+    mtxprt = xprt_to_mtxprt(xprt);
+    return (pthread_mutex_trylock(&mtxprt->mtxp_lock) == 0);
+}
+
 LIBRARY void
 xprt_unlock(SVCXPRT *xprt)
 {
     mtxprt_t        *mtxprt;
-    pthread_mutex_t *lockp;
     int ret;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    lockp = &mtxprt->mtxp_lock;
     tprintf(9, "xprt=%s, xprt_id=%zu, fd=%d\n",
         decode_addr(xprt), mtxprt->mtxp_id, xprt->xp_sock);
-    ret = pthread_mutex_unlock(lockp);
+    ret = svc_mutex_unlock(&mtxprt->mtxp_lock);
     if (ret != 0) {
         svc_die();
     }
@@ -571,145 +775,74 @@ xprt_is_locked(SVCXPRT *xprt)
     return (pthread_mutex_is_locked(lockp));
 }
 
-#ifdef USE_PROGRESS_LOCK
-
 /*
- * xprt_progress_setbits()
- * Set some bits in progress field.  Return new value of progress.
+ * Atomically clear the bits @var{clr} and then set the bits @var{set}
+ * in the state word of the given @type{mtxprt}, using compare-and-swap.
+ * Return the old value of the state word.
+ *
+ * If the dispatcher has announced that it is waiting (XPRT_WAIT),
+ * and any bit has just been newly set, then wake it up.
+ * See milestone_wait().
  */
-
-LIBRARY int
-xprt_progress_setbits(SVCXPRT *xprt, int value)
+static inline int
+mtxprt_progress_update(mtxprt_t *mtxprt, int clr, int set)
 {
-    mtxprt_t *mtxprt;
-    size_t id;
-    pthread_mutex_t *lockp;
-    int ret;
-    int progress;
-    char *vprogress;
+    int old_progress;
+    int new_progress;
+    int cur_progress;
 
-    mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    lockp = &mtxprt->mtxp_progress_lock;
-    ret = pthread_mutex_lock(lockp);
-    if (ret != 0) {
-        svc_die();
-    }
-    progress = __sync_fetch_and_or(&(mtxprt->mtxp_progress), value);
-    ret = pthread_mutex_unlock(lockp);
-    if (ret != 0) {
-        svc_die();
-    }
-    vprogress = decode_xprt_progress(xprt, size_t id);
-    tprintf(8, "xprt=%s, id=%zu, value=%d, progress=0x%x=%s, fd=%d\n",
-        decode_addr(xprt), id, value, progress, vprogress, xprt->xp_sock);
-    return (progress);
-}
-
-/*
- * xprt_progress_clrbits()
- * Clear some bits in progress field.  Return new value of progress.
- */
-
-LIBRARY int
-xprt_progress_clrbits(SVCXPRT *xprt, int value)
-{
-    mtxprt_t *mtxprt;
-    size_t id;
-    pthread_mutex_t *lockp;
-    int ret;
-    int progress;
-    char *vprogress;
-
-    mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    lockp = &mtxprt->mtxp_progress_lock;
-    ret = pthread_mutex_lock(lockp);
-    if (ret != 0) {
-        svc_die();
-    }
-    progress = __sync_fetch_and_and(&(mtxprt->mtxp_progress), ~value);
-    ret = pthread_mutex_unlock(lockp);
-    if (ret != 0) {
-        svc_die();
+    old_progress = mtxprt->mtxp_progress;
+    for (;;) {
+        new_progress = (old_progress & ~clr) | set;
+        cur_progress = __sync_val_compare_and_swap(&(mtxprt->mtxp_progress),
+            old_progress, new_progress);
+        if (cur_progress == old_progress) {
+            break;
+        }
+        old_progress = cur_progress;
     }
-    vprogress = decode_xprt_progress(xprt, size_t id);
-    tprintf(8, "xprt=%s, id=%zu, value=%d, progress=0x%x=%s, fd=%d\n",
-        decode_addr(xprt), id, value, progress, vprogress, xprt->xp_sock);
-    return (progress);
-}
 
-LIBRARY int
-xprt_get_progress(SVCXPRT *xprt)
-{
-    mtxprt_t *mtxprt;
-    size_t id;
-    pthread_mutex_t *lockp;
-    int ret;
-    int progress;
-    char *vprogress;
-
-    mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    lockp = &mtxprt->mtxp_progress_lock;
-    ret = pthread_mutex_lock(lockp);
-    if (ret != 0) {
-        svc_die();
-    }
-    progress = __sync_or_and_fetch(&(mtxprt->mtxp_progress), 0);
-    ret = pthread_mutex_unlock(lockp);
-    if (ret != 0) {
-        svc_die();
+    if ((old_progress & XPRT_WAIT) != 0 && (new_progress & ~old_progress) != 0) {
+        futex_wake_all(&(mtxprt->mtxp_progress));
     }
-    vprogress = decode_xprt_progress(xprt, size_t id);
-    tprintf(8, "xprt=%s, id=%zu, progress=0x%x=%s, fd=%d\n",
-        decode_addr(xprt), id, progress, vprogress, xprt->xp_sock);
-    return (progress);
+    return (old_progress);
 }
 
-#else /* USE_PROGRESS_LOCK */
-
 /*
  * xprt_progress_setbits()
- * Set some bits in progress field.  Return new value of progress.
+ * Set some bits in progress field.  Return old value of progress.
  */
 
 LIBRARY int
 xprt_progress_setbits(SVCXPRT *xprt, int value)
 {
     mtxprt_t *mtxprt;
-    size_t id;
     int progress;
-    char *vprogress;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    progress = __sync_fetch_and_or(&(mtxprt->mtxp_progress), value);
-    vprogress = decode_xprt_progress(xprt, id);
+    progress = mtxprt_progress_update(mtxprt, 0, value);
     tprintf(8, "xprt=%s, id=%zu, value=%d, progress=0x%x=%s, fd=%d\n",
-        decode_addr(xprt), id, value, progress, vprogress, xprt->xp_sock);
+        decode_addr(xprt), mtxprt->mtxp_id, value, progress,
+        decode_xprt_progress(xprt, mtxprt->mtxp_id), xprt->xp_sock);
     return (progress);
 }
 
 /*
  * xprt_progress_clrbits()
- * Clear some bits in progress field.  Return new value of progress.
+ * Clear some bits in progress field.  Return old value of progress.
  */
 
 LIBRARY int
 xprt_progress_clrbits(SVCXPRT *xprt, int value)
 {
     mtxprt_t *mtxprt;
-    size_t id;
     int progress;
-    char *vprogress;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    progress = __sync_fetch_and_and(&(mtxprt->mtxp_progress), ~value);
-    vprogress = decode_xprt_progress(xprt, id);
+    progress = mtxprt_progress_update(mtxprt, value, 0);
     tprintf(8, "xprt=%s, id=%zu, value=%d, progress=0x%x=%s, fd=%d\n",
-        decode_addr(xprt), id, value, progress, vprogress, xprt->xp_sock);
+        decode_addr(xprt), mtxprt->mtxp_id, value, progress,
+        decode_xprt_progress(xprt, mtxprt->mtxp_id), xprt->xp_sock);
     return (progress);
 }
 
@@ -722,25 +855,33 @@ LIBRARY int
 xprt_get_progress(SVCXPRT *xprt)
 {
     mtxprt_t *mtxprt;
-    size_t id;
     int progress;
-    char *vprogress;
 
     if (xprt == BAD_SVCXPRT_PTR) {
         return (0);
     }
 
     mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
     progress = __sync_or_and_fetch(&(mtxprt->mtxp_progress), 0);
-    vprogress = decode_xprt_progress(xprt, id);
     tprintf(8, "xprt=%s, id=%zu, progress=0x%x=%s, fd=%d\n",
-        decode_addr(xprt), id, progress, vprogress, xprt->xp_sock);
+        decode_addr(xprt), mtxprt->mtxp_id, progress,
+        decode_xprt_progress(xprt, mtxprt->mtxp_id), xprt->xp_sock);
     return (progress);
 }
 
-#endif /* USE_PROGRESS_LOCK */
+/*
+ * Reset the state word of a given SVCXPRT, so that it can be reused
+ * for another request.  Not busy, and no milestones reached.
+ */
+
+static void
+xprt_progress_reset(SVCXPRT *xprt)
+{
+    mtxprt_t *mtxprt;
 
+    mtxprt = xprt_to_mtxprt(xprt);
+    (void) __sync_lock_test_and_set(&(mtxprt->mtxp_progress), 0);
+}
 
 LIBRARY void
 xprt_set_busy(SVCXPRT *xprt, int value)
@@ -748,9 +889,12 @@ xprt_set_busy(SVCXPRT *xprt, int value)
     mtxprt_t *mtxprt;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    pthread_mutex_lock(&(mtxprt->mtxp_progress_lock));
-    mtxprt->mtxp_busy = value;
-    pthread_mutex_unlock(&(mtxprt->mtxp_progress_lock));
+    if (value) {
+        (void) mtxprt_progress_update(mtxprt, 0, XPRT_BUSY);
+    }
+    else {
+        (void) mtxprt_progress_update(mtxprt, XPRT_BUSY, 0);
+    }
     tprintf(9, "xprt=%s, value=%d, fd=%d\n",
         decode_addr(xprt), value, xprt->xp_sock);
 }
@@ -759,27 +903,13 @@ static void
 xprt_reuse(SVCXPRT *xprt)
 {
     mtxprt_t *mtxprt;
-    pthread_mutex_t *lockp;
     size_t id;
-    int ret;
 
     mtxprt = xprt_to_mtxprt(xprt);
     id = mtxprt->mtxp_id;
     tprintf(7, "id=%zu\n", id);
-    lockp = &mtxprt->mtxp_progress_lock;
-    ret = pthread_mutex_lock(lockp);
-    if (ret != 0) {
-        svc_die();
-    }
-    mtxprt->mtxp_progress = 0;
-    mtxprt->mtxp_busy = 0;
-    ret = pthread_mutex_unlock(lockp);
-    if (ret != 0) {
-        svc_die();
-    }
-
+    xprt_progress_reset(xprt);
     pthread_mutex_init(&(mtxprt->mtxp_mtready), NULL);
-    xprt_set_busy(xprt, 0);
 }
 
 /*
@@ -808,7 +938,7 @@ fsck_busy(void)
         mtxprt = xprt_to_mtxprt(xprt);
         xprt_lock(xprt);
         fd = xprt->xp_sock;
-        busy = mtxprt->mtxp_busy;
+        busy = mtxprt->mtxp_progress & XPRT_BUSY;
         if (busy && !fd_is_open(fd)) {
             eprintf("*** ERROR *** xprt %zu is busy\n"
                    " but its file descriptor, %d, is not open.\n",
@@ -819,93 +949,401 @@ fsck_busy(void)
     }
 }
 
-static void
-fsck_gc(void)
-{
-}
+/*
+ * Count how many SVCXPRT have been dispatched and are busy.
+ * That is, they have unfinished business.
+ * The number of busy transports is a rough measure of load
+ * or concurrency.
+ */
 
-#if 0
 
-static void
-fsck_gc(void)
+LIBRARY size_t
+count_busy(void)
 {
-    SVCXPRT *xprt;
-    mtxprt_t *mtxprt;
+    size_t nbusy;
     size_t id;
-    size_t idset_count;
-    size_t gflag_count;
+    int busy;
 
-    count = 0;
+    nbusy = 0;
     for (id = 0; id <= xports_maxid; ++id) {
-        if (bitvec_get_bit(&xprtgc_idset, id)) {
-            ++idset_count;
-        }
+        SVCXPRT *xprt;
+        mtxprt_t *mtxprt;
+
         xprt = xports[id];
         if (xprt == BAD_SVCXPRT_PTR) {
             continue;
         }
         mtxprt = xprt_to_mtxprt(xprt);
-        if (bitvec_get_bit(&xprtgc_idset, id)) {
-            ++gflag_count;
+        busy = mtxprt->mtxp_progress & XPRT_BUSY;
+        if (busy) {
+           ++nbusy;
         }
     }
+
+    if (nbusy >= 2) {
+        tprintf(7, "nbusy=%zu\n", nbusy);
+    }
+    return (nbusy);
 }
 
-#endif
+/*
+ * Retired @type{SVCXPRT}s
+ * -----------------------
+ * When a worker thread is done with a clone @type{SVCXPRT},
+ * or an @type{SVCXPRT} has died, it is "retired", by xprt_gc_mark().
+ * It is pushed onto @var{xprt_retire_head}, a lock-free stack,
+ * linked through mtxp_retire_next.  Any number of threads can push;
+ * it takes just one compare-and-swap.
+ *
+ * There is only one consumer, the reaper thread.  It takes the whole
+ * stack at once, with an atomic exchange, so there is no ABA problem,
+ * and it destroys what it got, at most XPRT_REAP_BATCH at a time,
+ * letting go of @var{xprtgc_lock} between batches.
+ * An @type{SVCXPRT} that is still busy goes back on the stack,
+ * and the reaper looks at it again a little later.
+ *
+ * When there is nothing to do, the reaper sleeps on the futex word,
+ * @var{xprt_retire_seq}, which is bumped by any push onto an empty stack.
+ *
+ * So, the dispatcher never has to scan @var{xports} looking for
+ * garbage, and never has to destroy anything, itself.
+ *
+ * In mtmode 0, nothing is ever retired; used @type{SVCXPRT}s are
+ * destroyed on the spot, and the reaper thread is never started.
+ *
+ * The reaper also looks for idle connections, once every
+ * XPRT_IDLE_PERIOD, and has them give their stream buffers back
+ * to the pool.  See xprt_idle_sweep().
+ */
+
+#define XPRT_REAP_BATCH  32
+#define XPRT_REAP_DELAY  1000000     // nanoseconds
+#define XPRT_FSCK_PERIOD 1           // seconds
+#define XPRT_IDLE_PERIOD 1           // seconds
+#define XPRT_IDLE_BATCH  64
+
+static SVCXPRT *xprt_retire_head;
+static int xprt_retire_seq;
+static int xprt_reaper_quit;
+static int xprt_reaper_running;
+static pthread_t xprt_reaper_thread;
+static pthread_once_t xprt_reaper_once = PTHREAD_ONCE_INIT;
+
+static int xprt_get_busy(SVCXPRT *xprt);
 
 /*
- * Count how many SVCXPRT have been dispatched and are busy.
- * That is, they have unfinished business.
- * The number of busy transports is a rough measure of load
- * or concurrency.
+ * Push @var{xprt} onto the retire stack.
+ * Return the previous top of the stack.
  */
+static SVCXPRT *
+xprt_retire_link(SVCXPRT *xprt)
+{
+    mtxprt_t *mtxprt;
+    SVCXPRT *head;
 
+    mtxprt = xprt_to_mtxprt(xprt);
+    do {
+        head = xprt_retire_head;
+        mtxprt->mtxp_retire_next = head;
+    } while (!__sync_bool_compare_and_swap(&xprt_retire_head, head, xprt));
+    return (head);
+}
+
+static void
+xprt_retire_push(SVCXPRT *xprt)
+{
+    if (xprt_retire_link(xprt) == NULL) {
+        __sync_fetch_and_add(&xprt_retire_seq, 1);
+        futex_wake(&xprt_retire_seq, 1);
+    }
+}
+
+/*
+ * Destroy one retired @type{SVCXPRT}.
+ * Return 1 if it was destroyed, 0 if a worker still has it and it must wait.
+ * Caller holds @var{xprtgc_lock}.
+ *
+ * The busy bit is no guide, here.  A connection that died
+ * is left busy, so that it is not polled again, and that would keep
+ * it from ever being destroyed.  What matters is whether any worker
+ * has yet to call svc_return().  Nothing else can be in the middle
+ * of I/O, because only the thread that services the fd retires it,
+ * and it does that after its last read.
+ */
+static size_t
+xprt_gc_reap_one(SVCXPRT *xprt)
+{
+    mtxprt_t *mtxprt;
+    size_t id;
+
+    mtxprt = xprt_to_mtxprt(xprt);
+    if (__sync_or_and_fetch(&(mtxprt->mtxp_workers), 0) != 0) {
+        return (0);
+    }
+
+    id = mtxprt->mtxp_id;
+    if (opt_svc_trace >= 2) {
+        tprintf(2, "xprt=%s, id=%zu, fd=%d\n",
+            decode_addr(xprt), id, xprt->xp_sock);
+        show_xports_hdr(4);
+        show_xport(xports, id, 4);
+    }
+    decr_counter(&xprtgc_mark_count);
+
+    /*
+     * mtxprt->mtxp_parent != NO_PARENT  .iff.  it is a clone
+     * of UDP connection, because only UDP connections get cloned.
+     *
+     * mtxprt->mtxp_refcnt == 0  .iff. it is a clone of a UDP
+     * connection, because a parent UDP connection would have
+     * a reference count.
+     *
+     * Anything else stays, and can be retired again, later.
+     */
+    if (mtxprt->mtxp_parent != NO_PARENT || mtxprt->mtxp_refcnt == 0) {
+        SVC_DESTROY(xprt);
+    }
+    else {
+        __sync_lock_release(&(mtxprt->mtxp_retired));
+    }
+    return (1);
+}
+
+/*
+ * Take everything on the retire stack, and destroy it,
+ * in batches of at most XPRT_REAP_BATCH.
+ * Return the number of @type{SVCXPRT}s that are still busy,
+ * and have been put back on the stack.
+ */
+static size_t
+xprt_gc_drain(void)
+{
+    SVCXPRT *list;
+    SVCXPRT *fifo;
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
+    size_t nbatch;
+    size_t ndefer;
+
+    list = __sync_lock_test_and_set(&xprt_retire_head, NULL);
+    if (list == NULL) {
+        return (0);
+    }
+
+    // Oldest first.  They have had the longest time to become idle.
+    fifo = NULL;
+    while (list != NULL) {
+        mtxprt = xprt_to_mtxprt(list);
+        xprt = list;
+        list = mtxprt->mtxp_retire_next;
+        mtxprt->mtxp_retire_next = fifo;
+        fifo = xprt;
+    }
+
+    ndefer = 0;
+    while (fifo != NULL) {
+        svc_mutex_lock(&xprtgc_lock);
+        for (nbatch = 0; fifo != NULL && nbatch < XPRT_REAP_BATCH; ++nbatch) {
+            xprt = fifo;
+            mtxprt = xprt_to_mtxprt(xprt);
+            fifo = mtxprt->mtxp_retire_next;
+            mtxprt->mtxp_retire_next = NULL;
+            if (xprt_gc_reap_one(xprt) == 0) {
+                (void) xprt_retire_link(xprt);
+                ++ndefer;
+            }
+        }
+        svc_mutex_unlock(&xprtgc_lock);
+    }
+    return (ndefer);
+}
+
+/*
+ * Destroy every retired @type{SVCXPRT}, now, on the calling thread.
+ * Only for shutting down; see xprt_reaper_stop().
+ * Wait for any that are still busy.
+ */
+
+int
+xprt_gc_reap_all(void)
+{
+    struct timespec delay;
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = XPRT_REAP_DELAY;
+    while (xprt_gc_drain() != 0) {
+        nanosleep(&delay, NULL);
+    }
+    return (0);
+}
+
+static void fsck_busy(void);
+static void xprt_reaper_start(void);
+
+/*
+ * Idle connections
+ * ----------------
+ * Let each connection that has had no traffic for a while give its
+ * stream buffers back to the pool.  The transport decides what is
+ * idle; see svctcp_release_idle().
+ *
+ * Only the thread that destroys @type{SVCXPRT}s sweeps: the reaper,
+ * or, in mtmode 0, the dispatcher; see xprt_idle_tick().  So, what
+ * was collected under @var{xports_lock} is still there after letting
+ * go of it.  The dispatcher holds @var{poll_lock} while it takes
+ * @var{xports_lock}, so the transport is called with @var{poll_lock},
+ * and without @var{xports_lock}.
+ */
+static void
+xprt_idle_sweep(time_t now)
+{
+    SVCXPRT *batch[XPRT_IDLE_BATCH];
+    SVCXPRT *xprt;
+    size_t id;
+    size_t n;
+    size_t i;
+
+    id = 0;
+    do {
+        n = 0;
+        xports_global_lock();
+        while (id <= xports_maxid && n < XPRT_IDLE_BATCH) {
+            xprt = xports[id];
+            ++id;
+            if (xprt == BAD_SVCXPRT_PTR || xprt_get_busy(xprt)) {
+                continue;
+            }
+            batch[n++] = xprt;
+        }
+        xports_global_unlock();
+        if (n != 0) {
+            svc_mutex_lock(&poll_lock);
+            for (i = 0; i < n; ++i) {
+                (void) svctcp_release_idle(batch[i], now);
+            }
+            svc_mutex_unlock(&poll_lock);
+        }
+    } while (n == XPRT_IDLE_BATCH);
+}
+
+/*
+ * Called by the dispatcher, every time around its loop.
+ * In mtmode 0, sweep for idle connections, once every XPRT_IDLE_PERIOD.
+ * Otherwise, make sure the reaper is running, to do it.
+ */
+LIBRARY void
+xprt_idle_tick(void)
+{
+    static time_t last_sweep;
+    time_t now;
+
+    if (mtmode != 0) {
+        pthread_once(&xprt_reaper_once, xprt_reaper_start);
+        return;
+    }
+    now = time(NULL);
+    if (now - last_sweep >= XPRT_IDLE_PERIOD) {
+        xprt_idle_sweep(now);
+        last_sweep = now;
+    }
+}
 
-LIBRARY size_t
-count_busy(void)
+static void *
+xprt_reaper(void *arg)
 {
-    size_t nbusy;
-    size_t id;
-    int busy;
+    struct timespec delay;
+    struct timespec idle;
+    time_t last_fsck;
+    time_t last_sweep;
+    time_t now;
+    size_t ndefer;
+    int seq;
 
-    nbusy = 0;
-    for (id = 0; id <= xports_maxid; ++id) {
-        SVCXPRT *xprt;
-        mtxprt_t *mtxprt;
+    (void) arg;
+    delay.tv_sec = 0;
+    delay.tv_nsec = XPRT_REAP_DELAY;
+    idle.tv_sec = XPRT_IDLE_PERIOD;
+    idle.tv_nsec = 0;
+    last_fsck = time(NULL);
+    last_sweep = last_fsck;
+    while (!__sync_or_and_fetch(&xprt_reaper_quit, 0)) {
+        seq = __sync_or_and_fetch(&xprt_retire_seq, 0);
+        ndefer = xprt_gc_drain();
+        tprintf(4, "%zu SVCXPRT still to be destroyed\n", xprtgc_mark_count);
 
-        xprt = xports[id];
-        if (xprt == BAD_SVCXPRT_PTR) {
-            continue;
+        /*
+         * Sanity checks cost a system call per busy socket,
+         * so do them here, not on the dispatcher thread,
+         * and not too often.
+         */
+        now = time(NULL);
+        if (now - last_fsck >= XPRT_FSCK_PERIOD) {
+            fsck_busy();
+            last_fsck = now;
         }
-        mtxprt = xprt_to_mtxprt(xprt);
-        busy = mtxprt->mtxp_busy;
-        if (busy) {
-           ++nbusy;
+        if (now - last_sweep >= XPRT_IDLE_PERIOD) {
+            xprt_idle_sweep(now);
+            last_sweep = now;
+        }
+
+        if (ndefer != 0) {
+            (void) futex_wait(&xprt_retire_seq, seq, &delay);
+        }
+        else if (xprt_retire_head == NULL) {
+            (void) futex_wait(&xprt_retire_seq, seq, &idle);
         }
     }
+    return (NULL);
+}
 
-    if (nbusy >= 2) {
-        tprintf(7, "nbusy=%zu\n", nbusy);
+static void
+xprt_reaper_start(void)
+{
+    int rc;
+
+    rc = pthread_create(&xprt_reaper_thread, NULL, xprt_reaper, NULL);
+    if (rc != 0) {
+        svc_perror(rc, "xprt_reaper_start: pthread_create() failed");
+        svc_die();
     }
-    return (nbusy);
+    xprt_reaper_running = 1;
+}
+
+/*
+ * Stop the reaper thread, if it was ever started,
+ * and destroy whatever is left on the retire stack.
+ */
+static void
+xprt_reaper_stop(void)
+{
+    if (xprt_reaper_running) {
+        __sync_lock_test_and_set(&xprt_reaper_quit, 1);
+        __sync_fetch_and_add(&xprt_retire_seq, 1);
+        futex_wake_all(&xprt_retire_seq);
+        pthread_join(xprt_reaper_thread, NULL);
+        xprt_reaper_running = 0;
+    }
+    (void) xprt_gc_reap_all();
 }
 
+/*
+ * Retire an @type{SVCXPRT}.  It will be destroyed by the reaper thread,
+ * as soon as it is no longer busy.
+ */
 static void
 xprt_gc_mark(SVCXPRT *xprt)
 {
     mtxprt_t *mtxprt;
-    size_t id;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    pthread_mutex_lock(&xprtgc_lock);
     tprintf(2, "xprt=%s, id=%zu, fd=%d\n",
-        decode_addr(xprt), id, xprt->xp_sock);
-    if (!bitvec_get_bit(&xprtgc_idset, id)) {
-        bitvec_set_bit(&xprtgc_idset, id);
-        incr_counter(&xprtgc_mark_count);
+        decode_addr(xprt), mtxprt->mtxp_id, xprt->xp_sock);
+    if (__sync_lock_test_and_set(&(mtxprt->mtxp_retired), 1) != 0) {
+        return;
     }
-    pthread_mutex_unlock(&xprtgc_lock);
+    incr_counter(&xprtgc_mark_count);
+    pthread_once(&xprt_reaper_once, xprt_reaper_start);
+    xprt_retire_push(xprt);
 }
 
 void
@@ -985,6 +1423,7 @@ xprt_destroy_all(void)
 {
     size_t id;
 
+    xprt_reaper_stop();
     xprt_destroy_all_udp_clones();
     xprt_destroy_all_tcp_rendezvous();
 
@@ -1003,84 +1442,8 @@ xprt_destroy_all(void)
     }
 }
 
-static size_t
-xprt_gc_reap_one(size_t id)
-{
-    SVCXPRT *xprt;
-    mtxprt_t *mtxprt;
-    size_t count = 0;
-
-    if (!bitvec_get_bit(&xprtgc_idset, id)) {
-        return (0);
-    }
-
-    if (xports[id] == BAD_SVCXPRT_PTR) {
-        return (0);
-    }
-
-    pthread_mutex_lock(&xprtgc_lock);
-    if (bitvec_get_bit(&xprtgc_idset, id)) {
-        xprt = xports[id];
-        mtxprt = xprt_to_mtxprt(xprt);
-        if (opt_svc_trace >= 2) {
-            tprintf(2, "xprt=%s, id=%zu, fd=%d\n",
-                decode_addr(xprt), id, xprt->xp_sock);
-            show_xports_hdr(4);
-            show_xport(xports, id, 4);
-        }
-#if 0
-        (void) mtxprt;
-        SVC_DESTROY(xprt);
-        xports[id] = BAD_SVCXPRT_PTR;
-        count = 1;
-#else
-        /*
-         * mtxprt->mtxp_parent != NO_PARENT  .iff.  it is a clone
-         * of UDP connection, because only UDP connections get cloned.
-         *
-         * mtxprt->mtxp_refcnt == 0  .iff. it is a clone of a UDP
-         * connection, because a parent UDP connection would have
-         * a reference count.
-         */
-        if (mtxprt->mtxp_parent != NO_PARENT || mtxprt->mtxp_refcnt == 0) {
-            SVC_DESTROY(xprt);
-            xports[id] = BAD_SVCXPRT_PTR;
-            count = 1;
-        }
-#endif
-        bitvec_clr_bit(&xprtgc_idset, id);
-        decr_counter(&xprtgc_mark_count);
-    }
-    pthread_mutex_unlock(&xprtgc_lock);
-
-    return (count);
-}
-
-/*
- * Do actual destruction of @type{SVCXPRT}s that have been used,
- * and then marked for garbage collection.
- */
-
-int
-xprt_gc_reap_all(void)
-{
-    size_t id;
-    size_t count;
-
-    fsck_gc();
-    fsck_busy();
-    tprintf(4, "%zu SVCXPRT to be destroyed\n", xprtgc_mark_count);
-    count = 0;
-    for (id = 0; id <= xports_maxid && xprtgc_mark_count != 0; ++id) {
-        if (bitvec_get_bit(&xprtgc_idset, id)) {
-            count += xprt_gc_reap_one(id);
-        }
-    }
-    return (count);
-}
-
 /*
- * Get the current value of the mtxp_busy field for a given SVCXPRT.
+ * Get the current value of the busy bit for a given SVCXPRT.
  * Always use this method to get the value.  Never read the value directly.
  */
 
@@ -1088,20 +1451,12 @@ static int
 xprt_get_busy(SVCXPRT *xprt)
 {
     mtxprt_t *mtxprt;
-    size_t id;
     int busy;
 
     mtxprt = xprt_to_mtxprt(xprt);
-    id = mtxprt->mtxp_id;
-    busy = mtxprt->mtxp_busy;
+    busy = (__sync_or_and_fetch(&(mtxprt->mtxp_progress), 0) & XPRT_BUSY) != 0;
     tprintf(9, "xprt=%s, id=%zu, busy=%d, fd=%d\n",
-        decode_addr(xprt), id, busy, xprt->xp_sock);
-    if (!(busy == 0 || busy == 1)) {
-        teprintf("xprt=%s, id=%zu, busy=%d, fd=%d\n",
-            decode_addr(xprt), id, busy, xprt->xp_sock);
-        teprintf("Invalid value for busy\n");
-        svc_die();
-    }
+        decode_addr(xprt), mtxprt->mtxp_id, busy, xprt->xp_sock);
     return (busy);
 }
 
@@ -1186,13 +1541,16 @@ show_xport(SVCXPRT **xprtv, size_t id, size_t indent)
         eprintf("%4zu ", parent_id);
     }
     busy = xprt_is_busy(xprt);
-    eprintf("%4d %4d %4d %5d ",
+    eprintf("%4d %4d %4d %5d %7zu ",
         mtxprt->mtxp_refcnt,
         busy,
         xprt->xp_sock,
-        xprt->xp_port);
+        xprt->xp_port,
+        mtxprt->mtxp_footprint);
 #ifdef CHECK_CREDENTIALS
-    eprintf("0x%08zx ", qcksum(mtxprt->mtxp_cred, sizeof (mtxprt->mtxp_cred)));
+    if (mtxprt->mtxp_cred != NULL) {
+        eprintf("0x%08zx ", qcksum(mtxprt->mtxp_cred, mtxprt->mtxp_credsz));
+    }
 #endif
     eprintf("%s", decode_xprt_progress(xprt, id));
     eprintf("\n");
@@ -1202,10 +1560,10 @@ static void
 show_xports_hdr(size_t indent)
 {
     eprintf("%*s", (int)indent, "");
-    eprintf("   id    addr        prnt rcnt busy sock  port\n");
+    eprintf("   id    addr        prnt rcnt busy sock  port   bytes\n");
     eprintf("%*s", (int)indent, "");
-    eprintf("----- -------------- ---- ---- ---- ---- -----\n");
-    //       12345 12345678901234 1234 1234 1234 1234 12345
+    eprintf("----- -------------- ---- ---- ---- ---- ----- -------\n");
+    //       12345 12345678901234 1234 1234 1234 1234 12345 1234567
 }
 
 LIBRARY void
@@ -1229,6 +1587,7 @@ show_xportv(SVCXPRT **xprtv, size_t size)
     for (id = 0; id < size; ++id) {
         show_xport(xprtv, id, 0);
     }
+    eprintf("Total bytes: %zu\n", xprt_footprint_total);
     eprintf("\n");
 }
 
@@ -1517,7 +1876,6 @@ create_xports(void)
     init_xports(xports_view, size);
     init_xports(sock_xports, size);
     bitvec_init(&xports_idset, size);
-    bitvec_init(&xprtgc_idset, size);
     xports_version = 0;
     xports_count = 0;
     xports_maxid = (size_t)(-1);
@@ -1544,7 +1902,6 @@ destroy_xports(void)
     }
 
     bitvec_free(&xports_idset);
-    bitvec_free(&xprtgc_idset);
 
 #ifdef SFR_SOCKET
     if (sock_sfr != NULL) {
@@ -1628,11 +1985,7 @@ xprt_id_alloc(void)
         xports_maxid = 0;
     }
     else {
-        for (id = 0; id <= xports_maxid; ++id) {
-            if (!bitvec_get_bit(&xports_idset, id)) {
-                break;
-            }
-        }
+        id = bitvec_find_first_clear(&xports_idset, 0);
         if (id > xports_maxid) {
             xports_maxid = id;
         }
@@ -1718,6 +2071,7 @@ LIBRARY int
 xprt_register_with_lock(SVCXPRT *xprt)
 {
     mtxprt_t *mtxprt;
+    reactor_t *rp;
     size_t xprt_id;
     int sock;
     int err;
@@ -1774,7 +2128,16 @@ xprt_register_with_lock(SVCXPRT *xprt)
         sfr_track_xprt_socket(sock, xprt);
 #endif /* SFR_SOCKET */
 
-        err = init_pollfd(sock);
+        rp = reactor_for_register();
+        if (rp != NULL) {
+            mtxprt->mtxp_reactor = (int)rp->r_id;
+            reactor_add_fd(rp, sock);
+        }
+        else {
+            err = init_pollfd(sock);
+        }
+        uring_watch(sock);
+        embed_watch(sock, (POLLIN | POLLPRI));
     }
     else {
         SVCXPRT *parent_xprt;
@@ -1797,11 +2160,41 @@ xprt_register(SVCXPRT *xprt)
     int err;
 
     check_svcxprt(xprt);
-    pthread_mutex_lock(&io_lock);
+    svc_mutex_lock(&io_lock);
     xports_global_lock();
     err = xprt_register_with_lock(xprt);
     xports_global_unlock();
-    pthread_mutex_unlock(&io_lock);
+    svc_mutex_unlock(&io_lock);
+    if (err) {
+        svc_die();
+    }
+}
+
+/*
+ * Activate a batch of transport handles,
+ * with just one acquisition of the table locks.
+ * Used when many connections are accepted at once.
+ */
+LIBRARY void
+xprt_register_batch(SVCXPRT **xprtv, size_t count)
+{
+    size_t i;
+    int err;
+
+    if (count == 0) {
+        return;
+    }
+    for (i = 0; i < count; ++i) {
+        check_svcxprt(xprtv[i]);
+    }
+    err = 0;
+    svc_mutex_lock(&io_lock);
+    xports_global_lock();
+    for (i = 0; i < count && err == 0; ++i) {
+        err = xprt_register_with_lock(xprtv[i]);
+    }
+    xports_global_unlock();
+    svc_mutex_unlock(&io_lock);
     if (err) {
         svc_die();
     }
@@ -1863,6 +2256,7 @@ LIBRARY int
 xprt_unregister_with_lock(SVCXPRT *xprt)
 {
     mtxprt_t *mtxprt;
+    reactor_t *rp;
     size_t id;
 
     check_svcxprt_exists(xprt);
@@ -1883,9 +2277,24 @@ xprt_unregister_with_lock(SVCXPRT *xprt)
     if (mtxprt->mtxp_parent == NO_PARENT) {
         int sock;
 
+        /*
+         * Let go of the fd only if it is still ours.  If it was closed,
+         * and handed out again, it belongs to someone else, now,
+         * and so does its poll entry.
+         */
         sock = xprt->xp_sock;
-        pollfd_remove(xports_pollfd, xports_max_pollfd, sock);
-        sock_xports[sock] = BAD_SVCXPRT_PTR;
+        if (sock >= 0 && sock_xports[sock] == xprt) {
+            rp = reactor_by_id(mtxprt->mtxp_reactor);
+            if (rp != NULL) {
+                reactor_remove_fd(rp, sock);
+            }
+            else {
+                pollfd_remove(xports_pollfd, xports_max_pollfd, sock);
+            }
+            uring_unwatch(sock);
+            embed_watch(sock, 0);
+            sock_xports[sock] = BAD_SVCXPRT_PTR;
+        }
     }
     else {
         SVCXPRT *parent_xprt;
@@ -2257,18 +2666,36 @@ svc_getreq_poll_mt(struct pollfd *pfdp, nfds_t npoll, int pollretval)
                 break;
         }
     }
+}
 
-    /*
-     * Do xprt garbage collection after all the calls to svc_getreq_common().
-     * We retire xprts at the start of servicing a new request, because
-     * it is safe to do it there, while we are briefly in single-thread
-     * mode, before mtmode dispatch allocates resources and dispatches
-     * a new request.  But, if we do garbage collection _only_ there,
-     * then some leftovers can stay not destroyed for some time,
-     * depending on the arrival of a new request.
-     */
-    if (mtmode != 0) {
-         (void) xprt_gc_reap_all();
+/*
+ * The traditional interface, for an application that runs its own
+ * poll() loop.  @var{pfdp} is the vector that was handed to poll(),
+ * for example, as filled in by svc_pollfds(), and @var{pollretval}
+ * is what poll() returned.  As in glibc, we look only as far as
+ * we need to, to find @var{pollretval} ready fds, but never past
+ * the end of the vector, which can hold no more than
+ * @var{xports_max_pollfd} entries, even if @var{pollretval}
+ * is more than we can find there.
+ */
+PUBLIC void
+svc_getreq_poll(struct pollfd *pfdp, const int pollretval)
+{
+    nfds_t npoll;
+    nfds_t i;
+    int fds_found;
+
+    tprintf(2, "pollretval=%d\n", pollretval);
+    npoll = __atomic_load_n(&xports_max_pollfd, __ATOMIC_RELAXED);
+    fds_found = 0;
+    for (i = 0; i < npoll && fds_found < pollretval; ++i) {
+        struct pollfd *p;
+
+        p = &pfdp[i];
+        if (p->fd != -1 && p->revents) {
+            ++fds_found;
+            svc_embed_ready(p->fd, p->revents);
+        }
     }
 }
 
@@ -2286,28 +2713,115 @@ svc_xprt_clone(SVCXPRT *xprt)
     return ((*(mtxprt->mtxp_clone))(xprt));
 }
 
-#if 0
+/*
+ * Adaptive spin budget, one per thread that waits for milestones
+ * (the dispatcher, or each reactor), so that reactors neither race
+ * on it nor tune it for each other.
+ *
+ * Before going to sleep in the kernel, we spin for a while,
+ * because a worker thread often reaches the milestone
+ * in less time than it takes to do a round trip through futex(2).
+ * The budget is bounded by @var{wait_spin}, which is configurable.
+ * Default is 0, meaning never spin; always sleep on the futex.
+ *
+ * The budget grows each time a milestone is reached while spinning,
+ * and shrinks each time we give up and have to sleep,
+ * so that it tracks the recent behavior of the worker threads.
+ */
+#define SPIN_MIN 16
+
+static __thread int spin_budget;
 
 /*
- * Wait for a given SVCXPRT to get to a certain milestone.
- * Wait for a "jiffy" at a time.
- * The value of a "jiffy" is configurable.
- * Default is 10 microseconds.
+ * Wait until at least one of the bits in @var{mask} is set
+ * in the word at @var{wordp}.  Return the value of the word.
  *
- * If tracing is turned on and trace level >= 8,
+ * The word must be one that is always updated by an atomic operation,
+ * followed by a futex_wake() on that same word, if there may be waiters.
+ *
+ * If tracing is turned on and trace level >= 7,
  * then update waiting message every @var{wait_trace_interval} seconds.
  * Default is 5 seconds.
  */
+static int
+milestone_wait(int *wordp, int mask, const char *what)
+{
+    struct timespec ts_interval;
+    struct timespec *tsp;
+    size_t wait_seconds;
+    int word;
+    int spin;
+    int i;
+
+    if (wait_spin <= 0) {
+        spin = 0;
+    }
+    else {
+        if (spin_budget <= 0 || spin_budget > wait_spin) {
+            spin_budget = wait_spin;
+        }
+        spin = spin_budget;
+    }
+
+    for (i = 0; i < spin; ++i) {
+        word = __sync_or_and_fetch(wordp, 0);
+        if ((word & mask) != 0) {
+            if (spin_budget < wait_spin / 2) {
+                spin_budget *= 2;
+            }
+            else {
+                spin_budget = wait_spin;
+            }
+            return (word);
+        }
+        cpu_relax();
+    }
+
+    if (spin > 0) {
+        spin_budget /= 2;
+        if (spin_budget < SPIN_MIN) {
+            spin_budget = SPIN_MIN;
+        }
+    }
+
+    if (wait_trace_interval > 0) {
+        ts_interval.tv_sec = wait_trace_interval;
+        ts_interval.tv_nsec = 0;
+        tsp = &ts_interval;
+    }
+    else {
+        tsp = NULL;
+    }
+
+    wait_seconds = 0;
+    for (;;) {
+        int rv;
+
+        word = __sync_or_and_fetch(wordp, 0);
+        if ((word & mask) != 0) {
+            return (word);
+        }
+        rv = futex_wait(wordp, word, tsp);
+        if (rv == -1 && errno == ETIMEDOUT) {
+            wait_seconds += wait_trace_interval;
+            tprintf(7, "Waiting on %s for %zu seconds - word=0x%x.\n",
+                what, wait_seconds, word);
+        }
+    }
+}
+
+#if 0
+
+/*
+ * Wait for a given SVCXPRT to become busy, or to return.
+ * Both are bits in the state word, so this is just another milestone.
+ */
 
 static void
 wait_on_busy(SVCXPRT *xprt)
 {
-    const struct timespec ts_jiffy = { 0, jiffy };
-    const long jiffies_per_second = 1000000000 / jiffy;
     mtxprt_t *mtxprt;
     size_t id;
-    long jiffies_per_interval;
-    size_t wait_seconds;
 
     xprt_progress_setbits(xprt, XPRT_WAIT);
     mtxprt = xprt_to_mtxprt(xprt);
@@ -2318,30 +2832,9 @@ wait_on_busy(SVCXPRT *xprt)
         show_xports();
     }
 
-    jiffies_per_interval = wait_trace_interval * jiffies_per_second;
-    wait_seconds = 0;
-    for (;;) {
-        long i;
-
-        for (i = 0; i < jiffies_per_interval; ++i) {
-            int progress;
-            int busy;
-
-            progress = xprt_get_progress(xprt);
-            if ((progress & XPRT_RETURN) != 0) {
-                return;
-            }
-            busy = xprt_get_busy(xprt);
-            if (busy != 0) {
-                xprt_progress_clrbits(xprt, XPRT_WAIT);
-                return;
-            }
-            nanosleep(&ts_jiffy, NULL);
-        }
-
-        wait_seconds += wait_trace_interval;
-        tprintf(8, "Waiting for %zu seconds.\n", wait_seconds);
-    }
+    (void) milestone_wait(&(mtxprt->mtxp_progress),
+        XPRT_BUSY | XPRT_RETURN, "busy");
+    xprt_progress_clrbits(xprt, XPRT_WAIT);
 }
 
 #endif
@@ -2352,24 +2845,17 @@ wait_on_busy(SVCXPRT *xprt)
  * could complete the entire task, quickly, before we even start
  * to wait.
  *
- * Wait for a "jiffy" at a time.
- * The value of a "jiffy" is configurable.
- * Default is 10 microseconds.
- *
- * If tracing is turned on and trace level >= 8,
- * then update waiting message every @var{wait_trace_interval} seconds.
- * Default is 5 seconds.
+ * Announce that we are waiting, by setting XPRT_WAIT,
+ * so that xprt_progress_setbits() knows to wake us,
+ * then wait on the progress word itself, using milestone_wait().
  */
 
 static void
-wait_on_getargs_usleep(SVCXPRT *xprt)
+wait_on_getargs_futex(SVCXPRT *xprt)
 {
-    const struct timespec ts_jiffy = { 0, jiffy };
-    const long jiffies_per_second = 1000000000 / jiffy;
     mtxprt_t *mtxprt;
     size_t id;
-    long jiffies_per_interval;
-    size_t wait_seconds;
+    int progress;
 
     xprt_progress_setbits(xprt, XPRT_WAIT);
     mtxprt = xprt_to_mtxprt(xprt);
@@ -2380,31 +2866,10 @@ wait_on_getargs_usleep(SVCXPRT *xprt)
         show_xports();
     }
 
-    jiffies_per_interval = wait_trace_interval * jiffies_per_second;
-    wait_seconds = 0;
-    for (;;) {
-        int progress = 0;
-        int mask;
-        int progress_of_interest;
-        long i;
-
-        for (i = 0; i < jiffies_per_interval; ++i) {
-            progress = xprt_get_progress(xprt);
-            mask = XPRT_GETARGS | XPRT_RETURN;
-            progress_of_interest = progress & mask;
-            tprintf(9, "progress=0x%x, mask=0x%x, progress_of_interest=0x%x.\n",
-                progress, mask, progress_of_interest);
-            if (progress_of_interest) {
-                xprt_progress_clrbits(xprt, XPRT_WAIT);
-                return;
-            }
-            nanosleep(&ts_jiffy, NULL);
-        }
-
-        wait_seconds += wait_trace_interval;
-        tprintf(7, "Waiting for %zu seconds - progress=0x%x=%s.\n",
-            wait_seconds, progress, decode_xprt_progress(xprt, id));
-    }
+    progress = milestone_wait(&(mtxprt->mtxp_progress),
+        XPRT_GETARGS | XPRT_RETURN, "getargs");
+    tprintf(9, "progress=0x%x.\n", progress);
+    xprt_progress_clrbits(xprt, XPRT_WAIT);
 }
 
 /*
@@ -2484,7 +2949,7 @@ wait_on_getargs(SVCXPRT *xprt)
         wait_on_getargs_mutex(xprt);
     }
     else {
-        wait_on_getargs_usleep(xprt);
+        wait_on_getargs_futex(xprt);
     }
     tprintf(2, "wait done: id=%zu, fd=%d\n", id, sock);
 }
@@ -2492,44 +2957,18 @@ wait_on_getargs(SVCXPRT *xprt)
 /*
  * Wait for the single worker thread to return.
  * This only makes sense in mtmode == 0, that is single-threaded mode.
- *
- * Wait for a "jiffy" at a time.
- * The value of a "jiffy" is configurable.
- * Default is 10 microseconds.
- *
- * If tracing is turned on and trace level >= 8,
- * then update waiting message every @var{wait_trace_interval} seconds.
- * Default is 5 seconds.
+ * svc_return() sets @var{worker_return} and wakes us.
  */
 
 static void
 wait_on_return(void)
 {
-    const struct timespec ts_jiffy = { 0, jiffy };
-    const long jiffies_per_second = 1000000000 / jiffy;
-    long jiffies_per_interval;
-    size_t wait_seconds;
-
     tprintf(8, "Wait for event RETURN.\n");
     if (opt_svc_trace >= 8) {
         show_xports();
     }
 
-    jiffies_per_interval = wait_trace_interval * jiffies_per_second;
-    wait_seconds = 0;
-    for (;;) {
-        long i;
-
-        for (i = 0; i < jiffies_per_interval; ++i) {
-            if (worker_return != 0) {
-                return;
-            }
-            nanosleep(&ts_jiffy, NULL);
-        }
-
-        wait_seconds += wait_trace_interval;
-        tprintf(8, "Waiting for event RETURN for %zu seconds.\n", wait_seconds);
-    }
+    (void) milestone_wait(&worker_return, ~0, "RETURN");
 }
 
 /*
@@ -2625,8 +3064,7 @@ request_dispatch(req_t *reqp, struct svc_callout *s)
             return;
         }
         else if (xprt_is_reusable(xprt)) {
-            mtxprt->mtxp_progress = 0;
-            mtxprt->mtxp_busy = 0;
+            xprt_progress_reset(xprt);
         }
         else {
             xprt_gc_mark(xprt);
@@ -2638,6 +3076,7 @@ request_dispatch(req_t *reqp, struct svc_callout *s)
     tprintf(2, "> dispatch: prog=%d proc=%d fd=%d\n",
         (int)rqstp->rq_prog, (int)rqstp->rq_proc, reqp->fd);
     xprt_progress_setbits(xprt, XPRT_DISPATCH);
+    __sync_fetch_and_add(&(mtxprt->mtxp_workers), 1);
     (*s->sc_dispatch)(xprt_rqstp, xprt);
     tprintf(2, "< dispatch: prog=%d proc=%d fd=%d\n",
         (int)rqstp->rq_prog, (int)rqstp->rq_proc, reqp->fd);
@@ -2657,7 +3096,15 @@ request_dispatch(req_t *reqp, struct svc_callout *s)
         wait_on_getargs(xprt);
         break;
       case 2:
-        // Do not wait
+        /*
+         * Do not wait, unless the worker has no stream of its own.
+         * Only UDP gets clones.  A TCP or shared memory worker reads
+         * its arguments from the one record stream of the connection,
+         * so the next record must not be read until it is done.
+         */
+        if (mtxprt->mtxp_parent == NO_PARENT) {
+            wait_on_getargs(xprt);
+        }
         break;
     }
 }
@@ -2727,11 +3174,12 @@ request_lookup(req_t *reqp)
     reqp->xrv = 0;
 
     rqstp = &(mtxprt->mtxp_rqst);
-#ifdef CHECK_CREDENTIALS
-    rqstp->rq_clntcred = &(mtxprt->mtxp_cred[2 * MAX_AUTH_BYTES]);
-#else
-    rqstp->rq_clntcred = NULL;
-#endif
+    if (mtxprt->mtxp_cred != NULL) {
+        rqstp->rq_clntcred = &(mtxprt->mtxp_cred[2 * MAX_AUTH_BYTES]);
+    }
+    else {
+        rqstp->rq_clntcred = NULL;
+    }
     rqstp->rq_xprt = xprt;
     rqstp->rq_prog = msgp->rm_call.cb_prog;
     rqstp->rq_vers = msgp->rm_call.cb_vers;
@@ -2741,7 +3189,10 @@ request_lookup(req_t *reqp)
     /* first authenticate the message */
     /* Check for null flavor and bypass these calls if possible */
 
-    if (msgp->rm_call.cb_cred.oa_flavor == AUTH_NULL) {
+    if (svcunix_authenticate(xprt, rqstp, msgp)) {
+        // A local client; the kernel has already told us who it is.
+    }
+    else if (msgp->rm_call.cb_cred.oa_flavor == AUTH_NULL) {
         rqstp->rq_xprt->xp_verf.oa_flavor = _null_auth.oa_flavor;
         rqstp->rq_xprt->xp_verf.oa_length = 0;
     }
@@ -2764,22 +3215,17 @@ get_single_request(req_t *reqp)
     mtxprt_t *mtxprt;
     int done = 0;
 
-#if 0
-    if (mtmode != 0) {
-        (void) xprt_gc_reap_all();
-    }
-#endif
-
     reqp->mtxprt = xprt_to_mtxprt(reqp->xprt);
     mtxprt = reqp->mtxprt;
     msgp = &mtxprt->mtxp_msg;
-#ifdef CHECK_CREDENTIALS
-    msgp->rm_call.cb_cred.oa_base = &(mtxprt->mtxp_cred[0]);
-    msgp->rm_call.cb_verf.oa_base = &(mtxprt->mtxp_cred[MAX_AUTH_BYTES]);
-#else
-    msgp->rm_call.cb_cred.oa_base = NULL;
-    msgp->rm_call.cb_verf.oa_base = NULL;
-#endif
+    if (mtxprt->mtxp_cred != NULL) {
+        msgp->rm_call.cb_cred.oa_base = &(mtxprt->mtxp_cred[0]);
+        msgp->rm_call.cb_verf.oa_base = &(mtxprt->mtxp_cred[MAX_AUTH_BYTES]);
+    }
+    else {
+        msgp->rm_call.cb_cred.oa_base = NULL;
+        msgp->rm_call.cb_verf.oa_base = NULL;
+    }
 
     // In case we fail before xprt is cloned.
     reqp->worker_xprt = reqp->xprt;
@@ -2834,17 +3280,29 @@ svc_getreq_common_rv(const int fd)
 {
     SVCXPRT *xprt;
 
+#ifdef CHECK_MTXPRT
     xports_global_lock();
     check_xports();
     xports_global_unlock();
+#endif
 
     tprintf(2, "Request # %zu\n", cnt_request_recv);
 
-    if (mtmode != 0) {
-        (void) xprt_gc_reap_all();
-    }
-
+    /*
+     * Look up @var{fd} under @var{xports_lock}, so that the reaper,
+     * which unregisters an @type{SVCXPRT} under that lock before it
+     * frees it, cannot free it out from under us.  A retired one is
+     * left alone; it is the reaper's, now.  Only the thread that
+     * services @var{fd} retires its @type{SVCXPRT}, so one that is
+     * not retired here stays alive until we are done with it.
+     */
+    xports_global_lock();
     xprt = sock_xports[fd];
+    if (xprt != NULL && xprt != BAD_SVCXPRT_PTR
+        && __sync_or_and_fetch(&(xprt_to_mtxprt(xprt)->mtxp_retired), 0) != 0) {
+        xprt = NULL;
+    }
+    xports_global_unlock();
 
     tprintf(2, "fd=%d, xprt=%s\n", fd, decode_addr(xprt));
 
@@ -2910,9 +3368,11 @@ svc_return(SVCXPRT *xprt)
 
     mtxprt_t *mtxprt;
     size_t id;
+    bool retire;
 
     mtxprt = xprt_to_mtxprt(xprt);
     id = mtxprt->mtxp_id;
+    retire = false;
 
     tprintf(2, "xprt=%s, id=%zu, fd=%d\n",
         decode_addr(xprt), id, xprt->xp_sock);
@@ -2929,7 +3389,8 @@ svc_return(SVCXPRT *xprt)
           svc_die();
           break;
       case 0:
-        worker_return = 1;
+        __sync_lock_test_and_set(&worker_return, 1);
+        futex_wake_all(&worker_return);
         break;
       case 1:
       case 2:
@@ -2940,11 +3401,25 @@ svc_return(SVCXPRT *xprt)
                     decode_addr(xprt), id);
                 svc_die();
             }
-            xprt_gc_mark(xprt);
+            retire = true;
         }
         break;
     }
     xprt_set_busy(xprt, 0);
+    if (xprt->xp_sock >= 0) {
+        embed_resume(xprt->xp_sock);
+    }
+    /*
+     * This is the last we touch @var{xprt}, unless it is a clone.
+     * Once the count of workers drops to zero, the reaper is free
+     * to destroy a retired SVCXPRT.  A clone is not on the retire stack,
+     * yet; it is retired only now, so that the reaper can destroy it
+     * the first time it looks.
+     */
+    __sync_fetch_and_sub(&(mtxprt->mtxp_workers), 1);
+    if (retire) {
+        xprt_gc_mark(xprt);
+    }
     dbuf_thread_reset();
     dbuf_thread_cleanup();
 }
@@ -2993,4 +3468,5 @@ ref_unused(void)
     UNUSED_FUNCTION(rpc_thread_svc_cleanup);
     UNUSED_FUNCTION(xprt_is_locked);
     UNUSED_FUNCTION(svc_backtrace);
+    UNUSED_FUNCTION(check_xports);
 }
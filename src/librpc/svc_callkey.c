@@ -0,0 +1,177 @@
+/*
+ * Filename: svc_callkey.c
+ * Project: rpc-mt
+ * Brief: Keys of whole RPC calls, and tables of marked procedures
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+    // Import memset()
+
+#include "svc_debug.h"
+#include "svc_callkey.h"
+
+/*
+ * FNV-1a, 64 bit, continued from @var{h}.
+ */
+static inline uint64_t
+callkey_hash_bytes(uint64_t h, const void *buf, size_t len)
+{
+    const unsigned char *p;
+    size_t i;
+
+    p = (const unsigned char *)buf;
+    for (i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (h);
+}
+
+/*
+ * Describe the key of the call @var{msg}, whose raw, still encoded,
+ * arguments are @var{args} and @var{argslen}, and hash it.
+ * Nothing is copied; the key is good for as long as they are.
+ */
+void
+callkey_init(struct callkey *ck, const struct rpc_msg *msg,
+    const void *args, size_t argslen)
+{
+    const struct opaque_auth *cred;
+    uint64_t h;
+
+    cred = &msg->rm_call.cb_cred;
+    memset(&ck->ck_hdr, 0, sizeof (ck->ck_hdr));
+    ck->ck_hdr.k_prog = (uint32_t)msg->rm_call.cb_prog;
+    ck->ck_hdr.k_vers = (uint32_t)msg->rm_call.cb_vers;
+    ck->ck_hdr.k_proc = (uint32_t)msg->rm_call.cb_proc;
+    ck->ck_hdr.k_flavor = (uint32_t)cred->oa_flavor;
+    ck->ck_hdr.k_credlen = cred->oa_length;
+    ck->ck_cred = cred->oa_base;
+    ck->ck_args = args;
+    ck->ck_argslen = argslen;
+
+    h = 0xcbf29ce484222325ULL;
+    h = callkey_hash_bytes(h, &ck->ck_hdr, sizeof (ck->ck_hdr));
+    h = callkey_hash_bytes(h, ck->ck_cred, ck->ck_hdr.k_credlen);
+    h = callkey_hash_bytes(h, args, argslen);
+    ck->ck_hash = h;
+}
+
+size_t
+callkey_len(const struct callkey *ck)
+{
+    return (sizeof (ck->ck_hdr) + ck->ck_hdr.k_credlen + ck->ck_argslen);
+}
+
+/*
+ * Copy the key to @var{k}, which has room for callkey_len() bytes.
+ */
+void
+callkey_store(const struct callkey *ck, unsigned char *k)
+{
+    memcpy(k, &ck->ck_hdr, sizeof (ck->ck_hdr));
+    k += sizeof (ck->ck_hdr);
+    memcpy(k, ck->ck_cred, ck->ck_hdr.k_credlen);
+    k += ck->ck_hdr.k_credlen;
+    memcpy(k, ck->ck_args, ck->ck_argslen);
+}
+
+/*
+ * Is @var{ck} the key that callkey_store() left at @var{k},
+ * @var{keylen} bytes?
+ */
+bool_t
+callkey_equal(const struct callkey *ck, const unsigned char *k, size_t keylen)
+{
+    if (keylen != callkey_len(ck)) {
+        return (FALSE);
+    }
+    if (memcmp(k, &ck->ck_hdr, sizeof (ck->ck_hdr)) != 0) {
+        return (FALSE);
+    }
+    k += sizeof (ck->ck_hdr);
+    if (memcmp(k, ck->ck_cred, ck->ck_hdr.k_credlen) != 0) {
+        return (FALSE);
+    }
+    k += ck->ck_hdr.k_credlen;
+    return (memcmp(k, ck->ck_args, ck->ck_argslen) == 0);
+}
+
+/*
+ * Return the index of a procedure in @var{pt}, or -1.
+ */
+int
+proctab_find(struct svc_proctab *pt,
+    rpcprog_t prog, rpcvers_t vers, rpcproc_t proc)
+{
+    struct svc_procid *pi;
+    size_t n;
+    size_t i;
+
+    n = pt->pt_count;
+    __sync_synchronize();
+    for (i = 0; i < n; ++i) {
+        pi = &pt->pt_ids[i];
+        if (pi->pi_proc == proc && pi->pi_prog == prog && pi->pi_vers == vers) {
+            return ((int)i);
+        }
+    }
+    return (-1);
+}
+
+/*
+ * Add a procedure to @var{pt}, unless it is already there.
+ * For a new one, @var{fill}, if not NULL, is called first, to set up
+ * the caller's own data for it.
+ * Return its index, or -1 if there is no room for another one.
+ */
+int
+proctab_add(struct svc_proctab *pt,
+    rpcprog_t prog, rpcvers_t vers, rpcproc_t proc,
+    proctab_fill_t fill, void *arg)
+{
+    size_t n;
+    int idx;
+
+    pthread_mutex_lock(&pt->pt_lock);
+    idx = proctab_find(pt, prog, vers, proc);
+    if (idx >= 0) {
+        pthread_mutex_unlock(&pt->pt_lock);
+        return (idx);
+    }
+    n = pt->pt_count;
+    if (n >= pt->pt_max) {
+        pthread_mutex_unlock(&pt->pt_lock);
+        eprintf("%s: too many procedures (max %zu)\n", pt->pt_name, pt->pt_max);
+        return (-1);
+    }
+    pt->pt_ids[n].pi_prog = prog;
+    pt->pt_ids[n].pi_vers = vers;
+    pt->pt_ids[n].pi_proc = proc;
+    if (fill != NULL) {
+        (*fill)(n, arg);
+    }
+    // Publish the entry only after it is filled in.
+    __sync_synchronize();
+    pt->pt_count = n + 1;
+    pthread_mutex_unlock(&pt->pt_lock);
+    return ((int)n);
+}
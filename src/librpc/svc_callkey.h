@@ -0,0 +1,117 @@
+/*
+ * Filename: svc_callkey.h
+ * Project: rpc-mt
+ * Brief: Keys of whole RPC calls, and tables of marked procedures
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_CALLKEY_H
+#define _SVC_CALLKEY_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>      // Import size_t
+#include <stdint.h>      // Import uint32_t, uint64_t
+#include <pthread.h>     // Import pthread_mutex_t
+#include <rpc/rpc.h>     // Import struct rpc_msg, rpcprog_t, rpcvers_t, rpcproc_t
+
+/*
+ * Call keys
+ * ---------
+ * Single-flight (svc_flight.c) and the memo cache (svc_memo.c) both
+ * need to tell whether two calls are the same call: same procedure,
+ * same credentials, and the same argument bytes.  The key of a call
+ * is the bytes
+ *
+ *     prog, vers, proc, credential flavor, credential length,
+ *     credential body, argument bytes
+ *
+ * callkey_init() describes the key of a call, without copying it,
+ * and hashes it.  callkey_store() copies it to where a table keeps it,
+ * callkey_len() bytes, and callkey_equal() compares a call with a key
+ * that was stored.  A key is found by its hash, then compared in full,
+ * so a hash collision can never hand one caller another caller's reply.
+ *
+ * Procedure tables
+ * ----------------
+ * A @type{struct svc_proctab} is a short list of the procedures that
+ * are marked for something, such as single-flight.  Procedures are
+ * only ever added, so proctab_find() takes no lock; it runs for every
+ * call.  A table can have a parallel array of its own data, per
+ * procedure, indexed the same way.
+ */
+
+struct callkey_hdr {
+    uint32_t k_prog;
+    uint32_t k_vers;
+    uint32_t k_proc;
+    uint32_t k_flavor;
+    uint32_t k_credlen;
+};
+
+struct callkey {
+    struct callkey_hdr  ck_hdr;
+    const void         *ck_cred;
+    const void         *ck_args;
+    size_t              ck_argslen;
+    uint64_t            ck_hash;
+};
+
+extern void   callkey_init(struct callkey *ck, const struct rpc_msg *msg,
+                  const void *args, size_t argslen);
+extern size_t callkey_len(const struct callkey *ck);
+extern void   callkey_store(const struct callkey *ck, unsigned char *k);
+extern bool_t callkey_equal(const struct callkey *ck,
+                  const unsigned char *k, size_t keylen);
+
+struct svc_procid {
+    rpcprog_t pi_prog;
+    rpcvers_t pi_vers;
+    rpcproc_t pi_proc;
+};
+
+struct svc_proctab {
+    pthread_mutex_t    pt_lock;
+    size_t             pt_count;
+    size_t             pt_max;
+    struct svc_procid *pt_ids;
+    const char        *pt_name;         /* for the message when it is full */
+};
+
+#define SVC_PROCTAB_INITIALIZER(ids, max, name) \
+    { PTHREAD_MUTEX_INITIALIZER, 0, (max), (ids), (name) }
+
+/*
+ * Called by proctab_add() for a new procedure, with the index it
+ * will have, before anybody else can find it.
+ */
+typedef void (*proctab_fill_t)(size_t idx, void *arg);
+
+extern int proctab_find(struct svc_proctab *pt,
+               rpcprog_t prog, rpcvers_t vers, rpcproc_t proc);
+extern int proctab_add(struct svc_proctab *pt,
+               rpcprog_t prog, rpcvers_t vers, rpcproc_t proc,
+               proctab_fill_t fill, void *arg);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_CALLKEY_H */
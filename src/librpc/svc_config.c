@@ -24,6 +24,9 @@
     // Import var EFAULT
     // Import var EINVAL
     // Import var ENOENT
+    // Import var ERANGE
+#include <limits.h>
+    // Import constant INT_MAX
 #include <stddef.h>
     // Import constant NULL
 #include <string.h>
@@ -34,7 +37,10 @@
     // Import type size_t
 
 #include "svc_config.h"
+#include "svc_debug.h"
+    // Import eprintf()
 #include "svc_tcp_impl.h"
+#include "svc_uring.h"
 
 extern void svc_trace(unsigned int lvl);
 
@@ -96,6 +102,23 @@ struct fd_region socket_fd_region = { 64, 1023, -1 };
  */
 int mtmode = 1;
 
+/*
+ * Number of event-loop threads (reactors) that svc_run() starts.
+ * The default is 1, that is, just the thread that calls svc_run().
+ * See svc_reactor.h.
+ *
+ * Must be set before any transports are created, so that
+ * svctcp_create() and svcudp_bufcreate() know to create sockets
+ * that can be shared with SO_REUSEPORT.
+ */
+int svc_reactors = 1;
+
+/*
+ * How svc_run() does socket I/O: IO_ENGINE_POLL, the traditional
+ * poll(2) and read(2)/write(2), or IO_ENGINE_URING.  See svc_uring.h.
+ */
+int svc_io_engine = IO_ENGINE_POLL;
+
 /*
  * A production system should simply return status,
  * whether or not there is an error; the caller can
@@ -118,14 +141,16 @@ unsigned int io_trace;
 unsigned int sys_break;
 
 /*
- * Some "reasonable values for jiffy
+ * Upper bound on the number of times to spin, re-examining
+ * the progress word, before going to sleep on a futex,
+ * when waiting for a worker thread to reach a milestone.
+ * The actual amount of spinning adapts, up to this bound.
  *
- *  const long jiffy = 1000000; // 1,000,000 nsec ==   1 msec
- *  const long jiffy =  100000; //   100,000 nsec == 100 usec
- *  const long jiffy =   10000; //    10,000 nsec ==  10 usec
+ * 0 means never spin.  A few thousand is reasonable,
+ * if there are spare CPUs and latency matters.
  */
 
-long jiffy = 1000000; // 1,000,000 nsec ==   1 msec
+int wait_spin = 0;
 
 static int
 bstr_equal(const char *bstr, size_t len, const char *zstr)
@@ -222,10 +247,14 @@ svc_config_set_mtmode(const char *arg)
 }
 
 static int
-svc_config_set_jiffy(const char *arg)
+svc_config_get_number(const char *arg, long *nump)
 {
     long n;
 
+    if (arg == NULL || *arg == '\0') {
+        return (EFAULT);
+    }
+
     n = 0;
     while (*arg) {
         if (*arg >= '0' && *arg <= '9') {
@@ -234,10 +263,104 @@ svc_config_set_jiffy(const char *arg)
         else {
             return (EINVAL);
         }
+        if (n > INT_MAX) {
+            return (ERANGE);
+        }
         ++arg;
     }
 
-    jiffy = n;
+    *nump = n;
+    return (0);
+}
+
+/*
+ * "jiffy" used to be the sleep interval when polling for
+ * a worker thread to reach a milestone.  Waiting is now
+ * event driven, so there is nothing left for it to set.
+ * Accept it, so that existing applications keep working,
+ * but say, once, that it is obsolete; "spin" is the knob
+ * that matters, now.
+ */
+static int
+svc_config_set_jiffy(const char *arg)
+{
+    static int warned;
+    long n;
+    int rv;
+
+    rv = svc_config_get_number(arg, &n);
+    if (rv != 0) {
+        return (rv);
+    }
+    if (__sync_lock_test_and_set(&warned, 1) == 0) {
+        eprintf("svc_config: jiffy is obsolete, and is ignored;"
+            " see spin.\n");
+    }
+    return (0);
+}
+
+static int
+svc_config_set_spin(const char *arg)
+{
+    long n;
+    int rv;
+
+    rv = svc_config_get_number(arg, &n);
+    if (rv == 0) {
+        wait_spin = (int) n;
+    }
+    return (rv);
+}
+
+static int
+svc_config_set_reactors(const char *arg)
+{
+    long n;
+    int rv;
+
+    rv = svc_config_get_number(arg, &n);
+    if (rv == 0) {
+        if (n < 1) {
+            return (EINVAL);
+        }
+        svc_reactors = (int) n;
+    }
+    return (rv);
+}
+
+static int
+svc_config_set_io_engine(const char *arg)
+{
+    if (arg == NULL) {
+        return (EFAULT);
+    }
+    if (strcmp(arg, "poll") == 0) {
+        svc_io_engine = IO_ENGINE_POLL;
+    }
+    else if (strcmp(arg, "uring") == 0) {
+        svc_io_engine = IO_ENGINE_URING;
+    }
+    else {
+        return (EINVAL);
+    }
+    return (0);
+}
+
+static int
+svc_config_set_wait_method(int *methodp, const char *arg)
+{
+    if (arg == NULL) {
+        return (EFAULT);
+    }
+    if (strcmp(arg, "mutex") == 0) {
+        *methodp = WAIT_MUTEX;
+    }
+    else if (strcmp(arg, "futex") == 0 || strcmp(arg, "usleep") == 0) {
+        *methodp = WAIT_FUTEX;
+    }
+    else {
+        return (EINVAL);
+    }
     return (0);
 }
 
@@ -273,9 +396,24 @@ svc_config_lookup(const char *cmd, size_t len, const char *arg)
         failfast = 0;
         return (0);
     }
+    else if (bstr_equal(cmd, len, "io")) {
+        return (svc_config_set_io_engine(arg));
+    }
     else if (bstr_equal(cmd, len, "jiffy")) {
         return (svc_config_set_jiffy(arg));
     }
+    else if (bstr_equal(cmd, len, "reactors")) {
+        return (svc_config_set_reactors(arg));
+    }
+    else if (bstr_equal(cmd, len, "spin")) {
+        return (svc_config_set_spin(arg));
+    }
+    else if (bstr_equal(cmd, len, "wait-tcp")) {
+        return (svc_config_set_wait_method(&wait_method_tcp, arg));
+    }
+    else if (bstr_equal(cmd, len, "wait-udp")) {
+        return (svc_config_set_wait_method(&wait_method_udp, arg));
+    }
     else if (bstr_equal(cmd, len, "trace")) {
         return (svc_config_set_trace(arg));
     }
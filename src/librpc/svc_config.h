@@ -30,6 +30,9 @@ extern "C" {
 /*
  * When mtmode == 1, the server dispatch thread waits for svc_getargs(),
  * before accepting more connections.
+ * When mtmode == 2, it waits only for a worker that has no stream
+ * of its own, that is, one that serves a TCP or shared memory
+ * connection; a UDP worker gets a clone, and is not waited for.
  * 
  * There are two methods for waiting:
  *
@@ -38,9 +41,18 @@ extern "C" {
  *      of the worker SVCXPRT.
  *      The worker thread must unlock it after svc_getargs() has completed.
  *
- *   2) WAIT_USLEEP
- *      sleeping in a loop, waiting for the worker thread to complete
- *      its call to svc_getargs() and set the milestone, XPRT_WAIT.
+ *   2) WAIT_FUTEX
+ *      wait on the progress word of the worker SVCXPRT, using futex(2),
+ *      until the worker thread completes its call to svc_getargs()
+ *      and sets the milestone, XPRT_GETARGS.
+ *      xprt_progress_setbits() wakes any waiter directly.
+ *      Optionally, spin for a short while before sleeping.
+ *      See |wait_spin|.
+ *
+ *      This used to be WAIT_USLEEP, sleeping in a loop, one "jiffy"
+ *      at a time.  The name WAIT_USLEEP is kept as an alias.
+ *      svc_config("jiffy=N") is still accepted, but it is ignored,
+ *      with a warning, the first time, that it is obsolete.
  *
  * Each transport type (TCP or UDP) is responsible for notifying
  * the main dispatch thread when svc_getargs() has completed,
@@ -57,7 +69,8 @@ extern "C" {
  */
 
 #define WAIT_MUTEX  1
-#define WAIT_USLEEP 2
+#define WAIT_FUTEX  2
+#define WAIT_USLEEP WAIT_FUTEX
 
 #ifdef  __cplusplus
 }
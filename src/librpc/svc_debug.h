@@ -37,6 +37,8 @@ extern "C" {
 
 #include <decode-impl.h>
 
+#include "svc_lockprof.h"
+
 extern pthread_mutex_t trace_lock;
 
 #define eprintf_with_lock(fmt, ...) \
@@ -50,9 +52,9 @@ extern pthread_mutex_t trace_lock;
 
 #define eprintf(fmt, ...) \
     ({ \
-        pthread_mutex_lock(&trace_lock); \
+        svc_mutex_lock(&trace_lock); \
         eprintf_with_lock(fmt, ## __VA_ARGS__); \
-        pthread_mutex_unlock(&trace_lock); \
+        svc_mutex_unlock(&trace_lock); \
     })
 
 #define trace_printf_with_lock(fmt, ...) \
@@ -68,9 +70,9 @@ extern pthread_mutex_t trace_lock;
 
 #define trace_printf(fmt, ...) \
     ({ \
-        pthread_mutex_lock(&trace_lock); \
+        svc_mutex_lock(&trace_lock); \
         trace_printf_with_lock(fmt, ## __VA_ARGS__); \
-        pthread_mutex_unlock(&trace_lock); \
+        svc_mutex_unlock(&trace_lock); \
     })
 
 #define teprintf_with_lock(fmt, ...) \
@@ -86,9 +88,9 @@ extern pthread_mutex_t trace_lock;
 
 #define teprintf(fmt, ...) \
     ({ \
-        pthread_mutex_lock(&trace_lock); \
+        svc_mutex_lock(&trace_lock); \
         teprintf_with_lock(fmt, ## __VA_ARGS__); \
-        pthread_mutex_unlock(&trace_lock); \
+        svc_mutex_unlock(&trace_lock); \
     })
 
 #define tprintf(lvl, fmt, ...) \
@@ -107,9 +109,24 @@ extern unsigned int opt_svc_trace;
 
 extern int ssize_to_int(ssize_t ssz);
 
+/*
+ * Allocator functions of librpc (svc_util.c), alongside guard_malloc(),
+ * guard_calloc() and guard_realloc(), which come from <decode-impl.h>.
+ */
+extern void *guard_memalign(size_t alignment, size_t size);
+
 extern ssize_t sys_read(int fd, void *buf, size_t count);
 extern ssize_t sys_write(int fd, const void *buf, size_t count);
 extern int sys_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+extern int sys_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
+               int flags);
+extern int sys_io_uring_setup(unsigned int entries, void *params);
+extern int sys_io_uring_enter(int fd, unsigned int to_submit,
+               unsigned int min_complete, unsigned int flags,
+               const void *arg, size_t argsz);
+extern int sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+               unsigned int nr_args);
+extern void sys_io_trace(const char *op, int fd, const void *buf, ssize_t rsize);
 
 extern void fhexdump(FILE *f, size_t align, size_t indent, const void *buf, size_t count);
 
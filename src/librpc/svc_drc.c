@@ -0,0 +1,562 @@
+/*
+ * Filename: svc_drc.c
+ * Project: rpc-mt
+ * Brief: Byte-bounded, sharded duplicate request cache (DRC)
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+    // Import free()
+    // Import malloc()
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+    // Import memset()
+#include <time.h>
+    // Import clock_gettime()
+#include <pthread.h>
+    // Import pthread_mutex_lock(), pthread_mutex_unlock()
+#include <netinet/in.h>
+    // Import type struct sockaddr_in, struct sockaddr_in6
+#include <cache-align.h>
+    // Import CACHE_ALIGNED, CACHE_LINE_SIZE
+
+#include "svc_debug.h"
+#include "svc_drc.h"
+
+/*
+ * See svc_drc.h for what the cache is for, and how it behaves.
+ *
+ * Memory
+ * ------
+ * Each entry is one chunk of memory: the @type{struct drc_entry}
+ * header, followed by the reply bytes.  Chunk sizes are powers of 2,
+ * from 2^DRC_MIN_SHIFT to 2^DRC_MAX_SHIFT bytes.  Each shard keeps
+ * a short free list of chunks for each size class, so that a busy
+ * cache, which evicts one entry for every one it inserts, seldom
+ * calls malloc() or free().  The budget is charged the full size
+ * of the chunk, not just the length of the reply.
+ */
+
+#define DRC_NSHARDS     16      /* power of 2 */
+#define DRC_MIN_SHIFT   7       /* 128 bytes */
+#define DRC_MAX_SHIFT   17      /* 128 KiB */
+#define DRC_NCLASSES    (DRC_MAX_SHIFT - DRC_MIN_SHIFT + 1)
+#define DRC_FREE_MAX    16      /* chunks kept per class, per shard */
+
+struct drc_entry {
+    struct drc_entry *de_hnext;         /* hash chain */
+    struct drc_entry *de_newer;         /* LRU list, toward most recent */
+    struct drc_entry *de_older;         /* LRU list, toward least recent */
+    struct drc_key    de_key;
+    uint64_t          de_hash;
+    time_t            de_expire;        /* 0, if it never expires */
+    size_t            de_len;           /* length of the reply */
+    unsigned int      de_class;         /* size class of this chunk */
+};
+
+#define DRC_ENTRY_DATA(de) ((char *)((de) + 1))
+
+struct drc_shard {
+    pthread_mutex_t    ds_lock;
+    struct drc_entry **ds_buckets;
+    size_t             ds_nbuckets;     /* power of 2 */
+    struct drc_entry  *ds_newest;
+    struct drc_entry  *ds_oldest;
+    size_t             ds_bytes;
+    size_t             ds_budget;
+    struct drc_entry  *ds_free[DRC_NCLASSES];
+    unsigned int       ds_nfree[DRC_NCLASSES];
+    struct drc_stats   ds_stats;        /* bytes is kept in ds_bytes */
+} CACHE_ALIGNED;
+
+struct drc {
+    size_t            d_budget;
+    size_t            d_maxlen;         /* longest reply that can be cached */
+    unsigned int      d_ttl;            /* seconds, 0 = forever */
+    struct drc_shard *d_shards;
+};
+
+static inline size_t
+class_size(unsigned int cls)
+{
+    return ((size_t)1 << (cls + DRC_MIN_SHIFT));
+}
+
+/*
+ * Smallest size class that holds an entry with a reply of @var{len} bytes.
+ */
+static inline int
+size_to_class(size_t len)
+{
+    size_t need;
+    unsigned int cls;
+
+    need = sizeof (struct drc_entry) + len;
+    for (cls = 0; cls < DRC_NCLASSES; ++cls) {
+        if (need <= class_size(cls)) {
+            return ((int)cls);
+        }
+    }
+    return (-1);
+}
+
+static inline time_t
+drc_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (ts.tv_sec);
+}
+
+/*
+ * Mix all the words of the key, xid, program, version, procedure
+ * and address, so that neither a run of xids from one client,
+ * nor the same xid from many clients, piles up in one bucket.
+ */
+static uint64_t
+drc_hash(const struct drc_key *key)
+{
+    const unsigned char *p;
+    uint64_t h;
+    uint32_t w;
+    size_t i;
+
+    h = 0x9e3779b97f4a7c15ULL;
+    p = (const unsigned char *)key;
+    for (i = 0; i + sizeof (w) <= sizeof (*key); i += sizeof (w)) {
+        memcpy(&w, p + i, sizeof (w));
+        h ^= w;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    h ^= h >> 29;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 32;
+    return (h);
+}
+
+static inline struct drc_shard *
+hash_to_shard(drc_t *drc, uint64_t h)
+{
+    return (&drc->d_shards[(h >> 56) & (DRC_NSHARDS - 1)]);
+}
+
+static inline struct drc_entry **
+hash_to_bucket(struct drc_shard *ds, uint64_t h)
+{
+    return (&ds->ds_buckets[h & (ds->ds_nbuckets - 1)]);
+}
+
+/*
+ * Build a key.  The address is reduced to just the family,
+ * the port and the IP address, so that padding and other noise
+ * in a @type{struct sockaddr} do not make two keys differ.
+ */
+void
+drc_key_init(struct drc_key *key, uint32_t xid,
+    uint32_t prog, uint32_t vers, uint32_t proc,
+    const struct sockaddr *addr, socklen_t addrlen)
+{
+    memset(key, 0, sizeof (*key));
+    key->dk_xid = xid;
+    key->dk_prog = prog;
+    key->dk_vers = vers;
+    key->dk_proc = proc;
+    if (addr == NULL || addrlen == 0) {
+        return;
+    }
+    if (addr->sa_family == AF_INET && addrlen >= sizeof (struct sockaddr_in)) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+        struct sockaddr_in *kin = (struct sockaddr_in *)key->dk_addr;
+
+        kin->sin_family = AF_INET;
+        kin->sin_port = sin->sin_port;
+        kin->sin_addr = sin->sin_addr;
+        key->dk_addrlen = sizeof (struct sockaddr_in);
+    }
+    else if (addr->sa_family == AF_INET6 && addrlen >= sizeof (struct sockaddr_in6)) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+        struct sockaddr_in6 *kin6 = (struct sockaddr_in6 *)key->dk_addr;
+
+        kin6->sin6_family = AF_INET6;
+        kin6->sin6_port = sin6->sin6_port;
+        kin6->sin6_addr = sin6->sin6_addr;
+        kin6->sin6_scope_id = sin6->sin6_scope_id;
+        key->dk_addrlen = sizeof (struct sockaddr_in6);
+    }
+    else {
+        if (addrlen > DRC_ADDR_MAX) {
+            addrlen = DRC_ADDR_MAX;
+        }
+        memcpy(key->dk_addr, addr, addrlen);
+        key->dk_addrlen = addrlen;
+    }
+}
+
+/*
+ * Checksum of the encoded arguments of a call, for @member{dk_sum}.
+ * Like nfsd, only look at the first DRC_SUM_BYTES, plus the length.
+ * That is enough to tell a new call from a retransmission,
+ * without reading all of a big write.
+ */
+#define DRC_SUM_BYTES 256
+
+uint32_t
+drc_args_sum(const void *args, size_t len)
+{
+    const unsigned char *p;
+    uint32_t h;
+    size_t n;
+    size_t i;
+
+    h = 2166136261U;
+    p = (const unsigned char *)args;
+    n = len < DRC_SUM_BYTES ? len : DRC_SUM_BYTES;
+    for (i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 16777619U;
+    }
+    h ^= (uint32_t)len;
+    h *= 16777619U;
+    return (h);
+}
+
+/*
+ * Create a cache that holds at most @var{budget} bytes of entries.
+ * Entries expire @var{ttl} seconds after they are inserted;
+ * a ttl of 0 means never.
+ */
+drc_t *
+drc_create(size_t budget, unsigned int ttl)
+{
+    drc_t *drc;
+    struct drc_shard *ds;
+    size_t shard_budget;
+    size_t nbuckets;
+    size_t i;
+
+    drc = (drc_t *)guard_calloc(1, sizeof (*drc));
+    drc->d_budget = budget;
+    drc->d_ttl = ttl;
+    shard_budget = budget / DRC_NSHARDS;
+
+    /*
+     * The longest reply we bother with is the one that fits
+     * in the largest size class, and in one shard's budget.
+     */
+    drc->d_maxlen = 0;
+    for (i = DRC_NCLASSES; i-- != 0; ) {
+        if (class_size(i) <= shard_budget) {
+            drc->d_maxlen = class_size(i) - sizeof (struct drc_entry);
+            break;
+        }
+    }
+
+    /*
+     * Size the hash table for a shard full of 512-byte entries,
+     * which is generous for typical replies.
+     */
+    nbuckets = 64;
+    while (nbuckets < shard_budget / 512) {
+        nbuckets *= 2;
+    }
+
+    drc->d_shards = (struct drc_shard *)
+        guard_memalign(CACHE_LINE_SIZE, DRC_NSHARDS * sizeof (struct drc_shard));
+    for (i = 0; i < DRC_NSHARDS; ++i) {
+        ds = &drc->d_shards[i];
+        memset(ds, 0, sizeof (*ds));
+        pthread_mutex_init(&ds->ds_lock, NULL);
+        ds->ds_nbuckets = nbuckets;
+        ds->ds_buckets = (struct drc_entry **)
+            guard_calloc(nbuckets, sizeof (struct drc_entry *));
+        ds->ds_budget = shard_budget;
+    }
+    tprintf(2, "budget=%zu, ttl=%u, maxlen=%zu, nbuckets=%zu\n",
+        budget, ttl, drc->d_maxlen, nbuckets);
+    return (drc);
+}
+
+void
+drc_destroy(drc_t *drc)
+{
+    struct drc_shard *ds;
+    struct drc_entry *de;
+    struct drc_entry *next;
+    size_t i;
+    unsigned int cls;
+
+    if (drc == NULL) {
+        return;
+    }
+    for (i = 0; i < DRC_NSHARDS; ++i) {
+        ds = &drc->d_shards[i];
+        for (de = ds->ds_newest; de != NULL; de = next) {
+            next = de->de_older;
+            free(de);
+        }
+        for (cls = 0; cls < DRC_NCLASSES; ++cls) {
+            for (de = ds->ds_free[cls]; de != NULL; de = next) {
+                next = de->de_hnext;
+                free(de);
+            }
+        }
+        free(ds->ds_buckets);
+        pthread_mutex_destroy(&ds->ds_lock);
+    }
+    free(drc->d_shards);
+    free(drc);
+}
+
+size_t
+drc_max_reply(drc_t *drc)
+{
+    return (drc->d_maxlen);
+}
+
+/*
+ * Chunk allocation, per size class.  Caller holds the shard lock.
+ */
+static struct drc_entry *
+chunk_alloc(struct drc_shard *ds, unsigned int cls)
+{
+    struct drc_entry *de;
+
+    de = ds->ds_free[cls];
+    if (de != NULL) {
+        ds->ds_free[cls] = de->de_hnext;
+        --ds->ds_nfree[cls];
+        return (de);
+    }
+    return ((struct drc_entry *)malloc(class_size(cls)));
+}
+
+static void
+chunk_free(struct drc_shard *ds, struct drc_entry *de)
+{
+    unsigned int cls;
+
+    cls = de->de_class;
+    if (ds->ds_nfree[cls] >= DRC_FREE_MAX) {
+        free(de);
+        return;
+    }
+    de->de_hnext = ds->ds_free[cls];
+    ds->ds_free[cls] = de;
+    ++ds->ds_nfree[cls];
+}
+
+static void
+lru_unlink(struct drc_shard *ds, struct drc_entry *de)
+{
+    if (de->de_newer != NULL) {
+        de->de_newer->de_older = de->de_older;
+    }
+    else {
+        ds->ds_newest = de->de_older;
+    }
+    if (de->de_older != NULL) {
+        de->de_older->de_newer = de->de_newer;
+    }
+    else {
+        ds->ds_oldest = de->de_newer;
+    }
+}
+
+static void
+lru_push(struct drc_shard *ds, struct drc_entry *de)
+{
+    de->de_newer = NULL;
+    de->de_older = ds->ds_newest;
+    if (ds->ds_newest != NULL) {
+        ds->ds_newest->de_newer = de;
+    }
+    else {
+        ds->ds_oldest = de;
+    }
+    ds->ds_newest = de;
+}
+
+/*
+ * Take an entry out of the cache, and release its chunk.
+ * Caller holds the shard lock.
+ */
+static void
+entry_remove(struct drc_shard *ds, struct drc_entry *de)
+{
+    struct drc_entry **dep;
+
+    for (dep = hash_to_bucket(ds, de->de_hash); *dep != NULL; dep = &(*dep)->de_hnext) {
+        if (*dep == de) {
+            *dep = de->de_hnext;
+            break;
+        }
+    }
+    lru_unlink(ds, de);
+    ds->ds_bytes -= class_size(de->de_class);
+    --ds->ds_stats.entries;
+    chunk_free(ds, de);
+}
+
+static inline bool_t
+entry_expired(drc_t *drc, struct drc_entry *de, time_t now)
+{
+    return (drc->d_ttl != 0 && now >= de->de_expire);
+}
+
+static struct drc_entry *
+entry_find(struct drc_shard *ds, const struct drc_key *key, uint64_t h)
+{
+    struct drc_entry *de;
+
+    for (de = *hash_to_bucket(ds, h); de != NULL; de = de->de_hnext) {
+        if (de->de_hash == h && memcmp(&de->de_key, key, sizeof (*key)) == 0) {
+            return (de);
+        }
+    }
+    return (NULL);
+}
+
+/*
+ * Look up the reply to a call.
+ * On a hit, copy the reply into @var{buf}, and return its length.
+ * On a miss, or if the reply does not fit in @var{size} bytes, return -1.
+ *
+ * The reply is copied while the shard is locked, because as soon
+ * as the lock is let go, the entry can be evicted and its chunk reused.
+ */
+ssize_t
+drc_lookup(drc_t *drc, const struct drc_key *key, void *buf, size_t size)
+{
+    struct drc_shard *ds;
+    struct drc_entry *de;
+    uint64_t h;
+    ssize_t len;
+
+    h = drc_hash(key);
+    ds = hash_to_shard(drc, h);
+    len = -1;
+    pthread_mutex_lock(&ds->ds_lock);
+    de = entry_find(ds, key, h);
+    if (de != NULL && entry_expired(drc, de, drc_now())) {
+        entry_remove(ds, de);
+        ++ds->ds_stats.expirations;
+        de = NULL;
+    }
+    if (de != NULL && de->de_len <= size) {
+        memcpy(buf, DRC_ENTRY_DATA(de), de->de_len);
+        len = (ssize_t)de->de_len;
+        lru_unlink(ds, de);
+        lru_push(ds, de);
+        ++ds->ds_stats.hits;
+    }
+    else {
+        ++ds->ds_stats.misses;
+    }
+    pthread_mutex_unlock(&ds->ds_lock);
+    return (len);
+}
+
+/*
+ * Remember the reply to a call.
+ * If there already is an entry for the same key, for example because
+ * two workers both missed on a retransmission, the newer one wins.
+ */
+void
+drc_insert(drc_t *drc, const struct drc_key *key, const void *reply, size_t len)
+{
+    struct drc_shard *ds;
+    struct drc_entry *de;
+    uint64_t h;
+    time_t now;
+    int cls;
+    size_t csize;
+
+    h = drc_hash(key);
+    ds = hash_to_shard(drc, h);
+    cls = size_to_class(len);
+    if (len > drc->d_maxlen || cls < 0) {
+        pthread_mutex_lock(&ds->ds_lock);
+        ++ds->ds_stats.toolarge;
+        pthread_mutex_unlock(&ds->ds_lock);
+        return;
+    }
+    csize = class_size((unsigned int)cls);
+
+    now = drc_now();
+    pthread_mutex_lock(&ds->ds_lock);
+
+    de = entry_find(ds, key, h);
+    if (de != NULL) {
+        entry_remove(ds, de);
+    }
+
+    // Expired entries go first, then least recently used.
+    while (ds->ds_oldest != NULL && entry_expired(drc, ds->ds_oldest, now)) {
+        entry_remove(ds, ds->ds_oldest);
+        ++ds->ds_stats.expirations;
+    }
+    while (ds->ds_oldest != NULL && ds->ds_bytes + csize > ds->ds_budget) {
+        entry_remove(ds, ds->ds_oldest);
+        ++ds->ds_stats.evictions;
+    }
+
+    de = chunk_alloc(ds, (unsigned int)cls);
+    if (de == NULL) {
+        ++ds->ds_stats.toolarge;
+        pthread_mutex_unlock(&ds->ds_lock);
+        return;
+    }
+    de->de_key = *key;
+    de->de_hash = h;
+    de->de_expire = drc->d_ttl != 0 ? now + drc->d_ttl : 0;
+    de->de_len = len;
+    de->de_class = (unsigned int)cls;
+    memcpy(DRC_ENTRY_DATA(de), reply, len);
+    de->de_hnext = *hash_to_bucket(ds, h);
+    *hash_to_bucket(ds, h) = de;
+    lru_push(ds, de);
+    ds->ds_bytes += csize;
+    ++ds->ds_stats.entries;
+    ++ds->ds_stats.inserts;
+    pthread_mutex_unlock(&ds->ds_lock);
+}
+
+void
+drc_get_stats(drc_t *drc, struct drc_stats *statsp)
+{
+    struct drc_shard *ds;
+    size_t i;
+
+    memset(statsp, 0, sizeof (*statsp));
+    for (i = 0; i < DRC_NSHARDS; ++i) {
+        ds = &drc->d_shards[i];
+        pthread_mutex_lock(&ds->ds_lock);
+        statsp->hits        += ds->ds_stats.hits;
+        statsp->misses      += ds->ds_stats.misses;
+        statsp->inserts     += ds->ds_stats.inserts;
+        statsp->evictions   += ds->ds_stats.evictions;
+        statsp->expirations += ds->ds_stats.expirations;
+        statsp->toolarge    += ds->ds_stats.toolarge;
+        statsp->bytes       += ds->ds_bytes;
+        statsp->entries     += ds->ds_stats.entries;
+        pthread_mutex_unlock(&ds->ds_lock);
+    }
+}
@@ -0,0 +1,134 @@
+/*
+ * Filename: svc_drc.h
+ * Project: rpc-mt
+ * Brief: Byte-bounded, sharded duplicate request cache (DRC)
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_DRC_H
+#define _SVC_DRC_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>      // Import size_t
+#include <stdint.h>      // Import uint32_t
+#include <sys/types.h>   // Import ssize_t
+#include <sys/socket.h>  // Import struct sockaddr, socklen_t
+#include <rpc/rpc.h>     // Import SVCXPRT
+
+/*
+ * A duplicate request cache remembers the encoded reply to
+ * recent calls, so that when a client retransmits a call,
+ * the reply can be sent again, without running the procedure again.
+ *
+ * This cache is bounded by the number of bytes of replies it holds,
+ * not by the number of entries.  Each reply is stored at its actual
+ * length, rounded up to a power-of-2 size class, so a cache full of
+ * small replies holds many more of them than a cache of big replies.
+ *
+ * Entries are evicted in least-recently-used order, when there is
+ * not enough room for a new reply, and an entry older than the
+ * time-to-live is never used, and is dropped when it is found.
+ *
+ * The cache is split into DRC_NSHARDS shards, each with its own lock
+ * and its own share of the budget.  The shard and the hash bucket are
+ * picked by a hash of the whole key: xid, client address, and
+ * program, version and procedure.  A transport can also put a checksum
+ * of the call arguments in @member{dk_sum}, made by drc_args_sum(),
+ * so that a new call that reuses an xid is not taken for a retransmission.
+ *
+ * One cache can be shared by any number of SVCXPRTs, of any kind,
+ * for example, all the TCP connections of a server.
+ *
+ * Counters
+ * --------
+ * Each shard keeps its own counters, under its own lock, so that
+ * counting does not make the shards share a cache line.
+ * drc_get_stats() adds them up, and reports:
+ *
+ *   hits:        lookups that found a reply
+ *   misses:      lookups that did not
+ *   inserts:     replies stored
+ *   evictions:   entries dropped to make room
+ *   expirations: entries dropped because they outlived the ttl
+ *   toolarge:    replies not stored, because they would not fit
+ *   bytes:       bytes of memory held by entries, now
+ *   entries:     number of entries, now
+ *
+ * The ratio of evictions to hits, and the age of the oldest entry,
+ * tell whether the budget covers the actual retransmit window.
+ */
+
+#define DRC_ADDR_MAX 28         /* sizeof (struct sockaddr_in6) */
+
+struct drc_key {
+    uint32_t      dk_xid;
+    uint32_t      dk_prog;
+    uint32_t      dk_vers;
+    uint32_t      dk_proc;
+    uint32_t      dk_addrlen;
+    uint32_t      dk_sum;       /* of the arguments; 0 if not used */
+    unsigned char dk_addr[DRC_ADDR_MAX];
+};
+
+struct drc_stats {
+    size_t hits;
+    size_t misses;
+    size_t inserts;
+    size_t evictions;
+    size_t expirations;
+    size_t toolarge;
+    size_t bytes;
+    size_t entries;
+};
+
+typedef struct drc drc_t;
+
+extern drc_t *drc_create(size_t budget, unsigned int ttl);
+extern void   drc_destroy(drc_t *drc);
+extern void   drc_key_init(struct drc_key *key, uint32_t xid,
+                  uint32_t prog, uint32_t vers, uint32_t proc,
+                  const struct sockaddr *addr, socklen_t addrlen);
+extern uint32_t drc_args_sum(const void *args, size_t len);
+extern ssize_t drc_lookup(drc_t *drc, const struct drc_key *key,
+                  void *buf, size_t size);
+extern void   drc_insert(drc_t *drc, const struct drc_key *key,
+                  const void *reply, size_t len);
+extern size_t drc_max_reply(drc_t *drc);
+extern void   drc_get_stats(drc_t *drc, struct drc_stats *statsp);
+
+/*
+ * UDP: a byte-bounded cache, instead of the classic svcudp_enablecache().
+ */
+extern int svcudp_enablecache_bytes(SVCXPRT *xprt, size_t budget,
+               unsigned int ttl);
+extern int svcudp_cache_stats(SVCXPRT *xprt, struct drc_stats *statsp);
+
+/*
+ * TCP: one cache, shared by all connections.
+ */
+extern int svctcp_enablecache(size_t budget, unsigned int ttl);
+extern int svctcp_cache_stats(struct drc_stats *statsp);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_DRC_H */
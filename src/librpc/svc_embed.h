@@ -0,0 +1,98 @@
+/*
+ * Filename: svc_embed.h
+ * Project: rpc-mt
+ * Brief: Serve RPC from an event loop that belongs to the application
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_EMBED_H
+#define _SVC_EMBED_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>        // Import struct pollfd, nfds_t
+
+/*
+ * svc_run() owns the thread that calls it, and polls with a timeout
+ * of 10 milliseconds, so that it notices when a busy connection
+ * becomes idle again.  An application that already has an event loop
+ * (libevent, epoll, poll) can, instead, have that loop watch the
+ * file descriptors of RPC service, and call into librpc only when
+ * one of them is ready.
+ *
+ * An event loop that keeps a set of fds to watch (epoll, libevent):
+ *
+ *     svc_embed_init(watch, arg);
+ *
+ *     watch(fd, events, arg) is called whenever librpc wants @var{fd}
+ *     watched for @var{events}, or, if @var{events} is 0, no longer
+ *     watched.  To begin with, it is called for every fd already
+ *     registered; after that, as transports come and go, and while
+ *     a connection is busy with a worker thread.  So, the application
+ *     never needs to ask what has changed, and is never woken up
+ *     for an fd that librpc cannot service, yet.
+ *
+ *     When an fd is ready, call svc_embed_ready(fd, revents).
+ *
+ * An event loop that builds a poll vector each time around:
+ *
+ *     n = svc_pollfds(fdv, size);
+ *
+ *     fills in @var{fdv} with the fds to watch, right now, and their
+ *     events, and returns how many there are.  If that is more than
+ *     @var{size}, only @var{size} were filled in; make room and ask
+ *     again.  After poll(), call svc_getreq_poll(fdv, poll_rv), or
+ *     svc_embed_ready() for each fd that is ready.
+ *     Such a loop can still give svc_embed_init() a watch function,
+ *     just to wake itself up, for example by writing to an eventfd
+ *     of its own, when it is time to build a new poll vector.
+ *
+ * The event loop must be level-triggered (poll, or epoll without
+ * EPOLLET).  svc_embed_ready() reads one request at a time, and
+ * can leave more data, or a connection whose worker is still busy,
+ * for later; that fd must be reported ready again, for as long as
+ * it stays ready, and when watching it starts again.
+ *
+ * The watch function can be called from any thread, including worker
+ * threads, and with internal locks held.  It must not call librpc;
+ * it should just update the event loop, and return.
+ *
+ * Embedding uses the poll engine and a single event loop; it ignores
+ * the io=uring and reactors=N configuration, which belong to svc_run().
+ */
+
+typedef void (*svc_watch_t)(int fd, short events, void *arg);
+
+extern void svc_embed_init(svc_watch_t watch, void *arg);
+extern void svc_embed_fini(void);
+extern nfds_t svc_pollfds(struct pollfd *fdv, nfds_t size);
+extern void svc_embed_ready(int fd, short revents);
+
+/*
+ * Hooks, for use inside librpc only.
+ */
+extern void embed_watch(int fd, short events);
+extern void embed_resume(int fd);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_EMBED_H */
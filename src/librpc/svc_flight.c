@@ -0,0 +1,258 @@
+/*
+ * Filename: svc_flight.c
+ * Project: rpc-mt
+ * Brief: Coalesce identical concurrent calls into one handler execution
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+    // Import free()
+    // Import malloc()
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+#include <pthread.h>
+    // Import pthread_mutex_lock(), pthread_mutex_unlock()
+#include <cache-align.h>
+    // Import CACHE_ALIGNED
+
+#include "svc_debug.h"
+#include "svc_callkey.h"
+#include "svc_flight.h"
+
+/*
+ * See svc_flight.h for what single-flight does.
+ *
+ * Flights in progress are kept in a hash table, split into shards,
+ * each with its own lock.  The key of a flight is the key of its call,
+ * as in svc_callkey.h, kept right after the @type{svc_flight}.
+ */
+
+#define SF_MAX_PROCS    64      /* procedures that can be marked */
+#define SF_NSHARDS      16      /* power of 2 */
+#define SF_NBUCKETS     64      /* per shard, power of 2 */
+#define SF_MAX_WAITERS  1024    /* followers per flight */
+
+static struct svc_procid sf_procids[SF_MAX_PROCS];
+static struct svc_proctab sf_procs =
+    SVC_PROCTAB_INITIALIZER(sf_procids, SF_MAX_PROCS, "svc_singleflight");
+
+struct sf_shard;
+
+struct svc_flight {
+    struct svc_flight *f_next;          /* hash chain */
+    struct sf_shard   *f_shard;
+    uint64_t           f_hash;
+    struct sf_waiter  *f_waiters;
+    size_t             f_nwaiters;
+    size_t             f_keylen;
+};
+
+#define SF_KEY(f) ((unsigned char *)((f) + 1))
+
+struct sf_shard {
+    pthread_mutex_t    s_lock;
+    struct svc_flight *s_buckets[SF_NBUCKETS];
+} CACHE_ALIGNED;
+
+static struct sf_shard sf_shards[SF_NSHARDS];
+static pthread_once_t sf_once = PTHREAD_ONCE_INIT;
+
+static size_t cnt_sf_leader;
+static size_t cnt_sf_follower;
+static size_t cnt_sf_fanout;
+static size_t cnt_sf_abandon;
+
+static void
+sf_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < SF_NSHARDS; ++i) {
+        pthread_mutex_init(&sf_shards[i].s_lock, NULL);
+    }
+}
+
+/*
+ * Mark a procedure for single-flight.
+ * Return 1 on success, 0 if there is no room for another one.
+ */
+int
+svc_singleflight(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc)
+{
+    pthread_once(&sf_once, sf_init);
+    return (proctab_add(&sf_procs, prog, vers, proc, NULL, NULL) >= 0);
+}
+
+bool_t
+sf_enabled(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc)
+{
+    return (proctab_find(&sf_procs, prog, vers, proc) >= 0);
+}
+
+/*
+ * Join the flight of an identical call, or start a new one.
+ *
+ * @var{args} and @var{argslen} are the raw, still encoded, argument
+ * bytes of the call.  @var{sock}, @var{addr} and @var{addrlen} say
+ * where a reply to this call would go.
+ *
+ * Return SF_LEADER, with *@var{flightp} set, if this call starts
+ * a new flight; SF_FOLLOWER if it has joined a flight in progress;
+ * or SF_NONE if it is not to be coalesced at all.
+ */
+int
+sf_join(const struct rpc_msg *msg, const void *args, size_t argslen,
+    int sock, const struct sockaddr *addr, socklen_t addrlen,
+    svc_flight_t **flightp)
+{
+    struct callkey ck;
+    struct sf_shard *shard;
+    svc_flight_t **bucket;
+    svc_flight_t *f;
+    struct sf_waiter *w;
+    uint64_t h;
+
+    *flightp = NULL;
+    if (addrlen > sizeof (w->sw_addr)) {
+        return (SF_NONE);
+    }
+    pthread_once(&sf_once, sf_init);
+
+    callkey_init(&ck, msg, args, argslen);
+    h = ck.ck_hash;
+    shard = &sf_shards[(h >> 32) & (SF_NSHARDS - 1)];
+    bucket = &shard->s_buckets[h & (SF_NBUCKETS - 1)];
+
+    pthread_mutex_lock(&shard->s_lock);
+    for (f = *bucket; f != NULL; f = f->f_next) {
+        if (f->f_hash == h && callkey_equal(&ck, SF_KEY(f), f->f_keylen)) {
+            break;
+        }
+    }
+
+    if (f != NULL) {
+        if (f->f_nwaiters >= SF_MAX_WAITERS) {
+            pthread_mutex_unlock(&shard->s_lock);
+            return (SF_NONE);
+        }
+        w = (struct sf_waiter *)malloc(sizeof (*w));
+        if (w == NULL) {
+            pthread_mutex_unlock(&shard->s_lock);
+            return (SF_NONE);
+        }
+        w->sw_sock = sock;
+        w->sw_xid = (uint32_t)msg->rm_xid;
+        w->sw_addrlen = addrlen;
+        memcpy(&w->sw_addr, addr, addrlen);
+        w->sw_next = f->f_waiters;
+        f->f_waiters = w;
+        ++f->f_nwaiters;
+        pthread_mutex_unlock(&shard->s_lock);
+        __sync_fetch_and_add(&cnt_sf_follower, 1);
+        tprintf(4, "xid=%lu: follower\n", (u_long)msg->rm_xid);
+        return (SF_FOLLOWER);
+    }
+
+    f = (svc_flight_t *)malloc(sizeof (*f) + callkey_len(&ck));
+    if (f == NULL) {
+        pthread_mutex_unlock(&shard->s_lock);
+        return (SF_NONE);
+    }
+    f->f_shard = shard;
+    f->f_hash = h;
+    f->f_waiters = NULL;
+    f->f_nwaiters = 0;
+    f->f_keylen = callkey_len(&ck);
+    callkey_store(&ck, SF_KEY(f));
+    f->f_next = *bucket;
+    *bucket = f;
+    pthread_mutex_unlock(&shard->s_lock);
+
+    __sync_fetch_and_add(&cnt_sf_leader, 1);
+    tprintf(4, "xid=%lu: leader\n", (u_long)msg->rm_xid);
+    *flightp = f;
+    return (SF_LEADER);
+}
+
+/*
+ * Take a flight out of the table, so that later calls start
+ * a new flight, free it, and hand back its followers.
+ */
+static struct sf_waiter *
+sf_detach(svc_flight_t *f, size_t *nwaitersp)
+{
+    struct sf_shard *shard;
+    svc_flight_t **fp;
+    struct sf_waiter *list;
+    size_t nwaiters;
+
+    shard = f->f_shard;
+    pthread_mutex_lock(&shard->s_lock);
+    for (fp = &shard->s_buckets[f->f_hash & (SF_NBUCKETS - 1)]; *fp != NULL; fp = &(*fp)->f_next) {
+        if (*fp == f) {
+            *fp = f->f_next;
+            break;
+        }
+    }
+    list = f->f_waiters;
+    nwaiters = f->f_nwaiters;
+    pthread_mutex_unlock(&shard->s_lock);
+    free(f);
+    *nwaitersp = nwaiters;
+    return (list);
+}
+
+/*
+ * The leader has its reply.  Hand back the followers.
+ * The caller sends each of them the reply, then sf_waiters_free().
+ */
+struct sf_waiter *
+sf_finish(svc_flight_t *f)
+{
+    struct sf_waiter *list;
+    size_t nwaiters;
+
+    list = sf_detach(f, &nwaiters);
+    __sync_fetch_and_add(&cnt_sf_fanout, nwaiters);
+    return (list);
+}
+
+/*
+ * The leader will never reply.  Drop the flight and its followers.
+ */
+void
+sf_abandon(svc_flight_t *f)
+{
+    size_t nwaiters;
+
+    __sync_fetch_and_add(&cnt_sf_abandon, 1);
+    sf_waiters_free(sf_detach(f, &nwaiters));
+    tprintf(2, "dropped %zu followers\n", nwaiters);
+}
+
+void
+sf_waiters_free(struct sf_waiter *list)
+{
+    struct sf_waiter *next;
+
+    for (; list != NULL; list = next) {
+        next = list->sw_next;
+        free(list);
+    }
+}
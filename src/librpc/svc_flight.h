@@ -0,0 +1,89 @@
+/*
+ * Filename: svc_flight.h
+ * Project: rpc-mt
+ * Brief: Coalesce identical concurrent calls into one handler execution
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_FLIGHT_H
+#define _SVC_FLIGHT_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>      // Import size_t
+#include <stdint.h>      // Import uint32_t
+#include <sys/socket.h>  // Import struct sockaddr, sockaddr_storage, socklen_t
+#include <rpc/rpc.h>     // Import struct rpc_msg, rpcprog_t, rpcvers_t, rpcproc_t
+
+/*
+ * Single-flight
+ * -------------
+ * svc_singleflight(prog, vers, proc) marks a procedure as one whose
+ * result depends only on its arguments and the caller's credentials,
+ * for example a read-only lookup.
+ *
+ * When a call to such a procedure arrives while an identical call
+ * (same prog, vers, proc, credentials, and argument bytes) is already
+ * being handled, the new call is not dispatched.  It is parked,
+ * as a "follower" of the call already in flight, the "leader".
+ * When the leader sends its reply, the same encoded reply is sent
+ * to every follower, with the follower's own xid spliced in.
+ *
+ * The argument bytes are compared raw, as they are in the receive
+ * buffer, right after xdr_callmsg(), so the arguments of a follower
+ * are never decoded at all.
+ *
+ * Only UDP calls are coalesced.  A follower is remembered by just
+ * its socket, address and xid, so nothing has to be kept alive
+ * for it, while it waits.
+ *
+ * If the leader never replies, its flight is abandoned when its
+ * SVCXPRT is finished with, and the followers are dropped; they
+ * retransmit, like they would for any lost datagram.
+ */
+
+#define SF_NONE     0   /* not coalesced; dispatch as usual */
+#define SF_LEADER   1   /* dispatch, and call sf_finish() with the reply */
+#define SF_FOLLOWER 2   /* parked; do not dispatch */
+
+struct sf_waiter {
+    struct sf_waiter        *sw_next;
+    int                      sw_sock;
+    uint32_t                 sw_xid;
+    socklen_t                sw_addrlen;
+    struct sockaddr_storage  sw_addr;
+};
+
+typedef struct svc_flight svc_flight_t;
+
+extern int  svc_singleflight(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc);
+extern bool_t sf_enabled(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc);
+extern int  sf_join(const struct rpc_msg *msg, const void *args, size_t argslen,
+                int sock, const struct sockaddr *addr, socklen_t addrlen,
+                svc_flight_t **flightp);
+extern struct sf_waiter *sf_finish(svc_flight_t *flight);
+extern void sf_abandon(svc_flight_t *flight);
+extern void sf_waiters_free(struct sf_waiter *list);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_FLIGHT_H */
@@ -0,0 +1,297 @@
+/*
+ * Filename: svc_lockprof.c
+ * Project: rpc-mt
+ * Brief: Optional contention profiling of the svc mutexes
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+    // Import fprintf()
+#include <string.h>
+    // Import memcpy(), memmove(), memset(), strcmp(), strrchr()
+#include <ctype.h>
+    // Import isalnum(), isalpha()
+#include <time.h>
+    // Import clock_gettime()
+#include <pthread.h>
+    // Import pthread_mutex_lock(), pthread_mutex_trylock()
+
+#include "svc_lockprof.h"
+
+/*
+ * Each call site registers itself, the first time it is used,
+ * by pushing itself on @var{lockprof_sites}.  Sites are never
+ * removed, so the list can be walked without a lock.
+ */
+static struct lockprof_site *lockprof_sites;
+
+/*
+ * The locks that this thread holds, and when it got them,
+ * so that svc_mutex_unlock() knows how long each was held,
+ * and which call site to charge it to.
+ */
+#define LOCKPROF_DEPTH 16
+
+struct lockprof_held {
+    pthread_mutex_t      *lh_lock;
+    struct lockprof_site *lh_site;
+    uint64_t              lh_since;
+};
+
+static __thread struct lockprof_held lockprof_held[LOCKPROF_DEPTH];
+static __thread int lockprof_depth;
+
+static inline uint64_t
+lockprof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static inline void
+lockprof_max(uint64_t *maxp, uint64_t v)
+{
+    uint64_t old;
+
+    old = __atomic_load_n(maxp, __ATOMIC_RELAXED);
+    while (v > old) {
+        if (__atomic_compare_exchange_n(maxp, &old, v, 1,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+}
+
+static void
+lockprof_register(struct lockprof_site *site)
+{
+    struct lockprof_site *head;
+
+    if (__atomic_exchange_n(&site->ls_registered, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    head = __atomic_load_n(&lockprof_sites, __ATOMIC_ACQUIRE);
+    do {
+        site->ls_next = head;
+    } while (!__atomic_compare_exchange_n(&lockprof_sites, &head, site, 1,
+                 __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+int
+lockprof_lock(pthread_mutex_t *lockp, struct lockprof_site *site)
+{
+    struct lockprof_held *h;
+    uint64_t t0;
+    uint64_t now;
+    uint64_t wait;
+    int ret;
+
+    if (!__atomic_load_n(&site->ls_registered, __ATOMIC_RELAXED)) {
+        lockprof_register(site);
+    }
+
+    ret = pthread_mutex_trylock(lockp);
+    if (ret == 0) {
+        now = lockprof_now();
+    }
+    else {
+        t0 = lockprof_now();
+        ret = pthread_mutex_lock(lockp);
+        if (ret != 0) {
+            return (ret);
+        }
+        now = lockprof_now();
+        wait = now - t0;
+        __atomic_fetch_add(&site->ls_contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&site->ls_wait_ns, wait, __ATOMIC_RELAXED);
+        lockprof_max(&site->ls_wait_max, wait);
+    }
+    __atomic_fetch_add(&site->ls_acquired, 1, __ATOMIC_RELAXED);
+
+    if (lockprof_depth < LOCKPROF_DEPTH) {
+        h = &lockprof_held[lockprof_depth++];
+        h->lh_lock = lockp;
+        h->lh_site = site;
+        h->lh_since = now;
+    }
+    return (0);
+}
+
+int
+lockprof_unlock(pthread_mutex_t *lockp)
+{
+    struct lockprof_site *site;
+    uint64_t hold;
+    int i;
+
+    // Usually, the most recently taken lock is the first one released.
+    for (i = lockprof_depth - 1; i >= 0; --i) {
+        if (lockprof_held[i].lh_lock == lockp) {
+            site = lockprof_held[i].lh_site;
+            hold = lockprof_now() - lockprof_held[i].lh_since;
+            __atomic_fetch_add(&site->ls_hold_ns, hold, __ATOMIC_RELAXED);
+            lockprof_max(&site->ls_hold_max, hold);
+            --lockprof_depth;
+            memmove(&lockprof_held[i], &lockprof_held[i + 1],
+                (size_t)(lockprof_depth - i) * sizeof (lockprof_held[0]));
+            break;
+        }
+    }
+    return (pthread_mutex_unlock(lockp));
+}
+
+/*
+ * The name of the mutex, from the text of the call: the last
+ * identifier in it.  "&(mtxprt->mtxp_lock)" is "mtxp_lock".
+ */
+static void
+lockprof_name(const char *expr, char *buf, size_t size)
+{
+    const char *start;
+    const char *end;
+    const char *p;
+    size_t len;
+
+    start = end = expr;
+    for (p = expr; *p != '\0'; ) {
+        if (isalpha((unsigned char)*p) || *p == '_') {
+            start = p;
+            while (isalnum((unsigned char)*p) || *p == '_') {
+                ++p;
+            }
+            end = p;
+        }
+        else {
+            ++p;
+        }
+    }
+    len = (size_t)(end - start);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+}
+
+static const char *
+lockprof_basename(const char *path)
+{
+    const char *slash;
+
+    slash = strrchr(path, '/');
+    return (slash != NULL ? slash + 1 : path);
+}
+
+#define LOCKPROF_MAXLOCKS 32
+
+struct lockprof_sum {
+    char     lk_name[48];
+    uint64_t lk_acquired;
+    uint64_t lk_contended;
+    uint64_t lk_wait_ns;
+    uint64_t lk_hold_ns;
+};
+
+void
+svc_lock_profile(FILE *f)
+{
+    struct lockprof_sum sums[LOCKPROF_MAXLOCKS];
+    struct lockprof_sum tmp;
+    struct lockprof_site *site;
+    char name[48];
+    uint64_t total_wait;
+    size_t nsums;
+    size_t i, j;
+
+#ifndef LOCK_PROFILE
+    fprintf(f, "lockprof enabled=0\n");
+#endif
+    nsums = 0;
+    total_wait = 0;
+    site = __atomic_load_n(&lockprof_sites, __ATOMIC_ACQUIRE);
+    for (; site != NULL; site = site->ls_next) {
+        lockprof_name(site->ls_name, name, sizeof (name));
+        fprintf(f, "site lock=%s at=%s:%u acquired=%llu contended=%llu"
+            " wait_ns=%llu wait_max_ns=%llu hold_ns=%llu hold_max_ns=%llu\n",
+            name, lockprof_basename(site->ls_file), site->ls_line,
+            (unsigned long long)site->ls_acquired,
+            (unsigned long long)site->ls_contended,
+            (unsigned long long)site->ls_wait_ns,
+            (unsigned long long)site->ls_wait_max,
+            (unsigned long long)site->ls_hold_ns,
+            (unsigned long long)site->ls_hold_max);
+
+        for (i = 0; i < nsums; ++i) {
+            if (strcmp(sums[i].lk_name, name) == 0) {
+                break;
+            }
+        }
+        if (i == nsums) {
+            if (nsums == LOCKPROF_MAXLOCKS) {
+                continue;
+            }
+            memset(&sums[i], 0, sizeof (sums[i]));
+            memcpy(sums[i].lk_name, name, sizeof (name));
+            ++nsums;
+        }
+        sums[i].lk_acquired += site->ls_acquired;
+        sums[i].lk_contended += site->ls_contended;
+        sums[i].lk_wait_ns += site->ls_wait_ns;
+        sums[i].lk_hold_ns += site->ls_hold_ns;
+        total_wait += site->ls_wait_ns;
+    }
+
+    // Busiest first; there are only a handful.
+    for (i = 1; i < nsums; ++i) {
+        tmp = sums[i];
+        for (j = i; j > 0 && sums[j - 1].lk_wait_ns < tmp.lk_wait_ns; --j) {
+            sums[j] = sums[j - 1];
+        }
+        sums[j] = tmp;
+    }
+    for (i = 0; i < nsums; ++i) {
+        fprintf(f, "lock lock=%s acquired=%llu contended=%llu"
+            " wait_ns=%llu hold_ns=%llu wait_share=%.1f\n",
+            sums[i].lk_name,
+            (unsigned long long)sums[i].lk_acquired,
+            (unsigned long long)sums[i].lk_contended,
+            (unsigned long long)sums[i].lk_wait_ns,
+            (unsigned long long)sums[i].lk_hold_ns,
+            total_wait ? 100.0 * (double)sums[i].lk_wait_ns / (double)total_wait : 0.0);
+    }
+    fprintf(f, "end\n");
+    fflush(f);
+}
+
+void
+svc_lock_profile_reset(void)
+{
+    struct lockprof_site *site;
+
+    site = __atomic_load_n(&lockprof_sites, __ATOMIC_ACQUIRE);
+    for (; site != NULL; site = site->ls_next) {
+        __atomic_store_n(&site->ls_acquired, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->ls_contended, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->ls_wait_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->ls_wait_max, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->ls_hold_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->ls_hold_max, 0, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Filename: svc_lockprof.h
+ * Project: rpc-mt
+ * Brief: Optional contention profiling of the svc mutexes
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_LOCKPROF_H
+#define _SVC_LOCKPROF_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>       // Import FILE
+#include <stdint.h>      // Import uint64_t
+#include <pthread.h>     // Import pthread_mutex_t
+
+/*
+ * Lock profiling
+ * --------------
+ * The global mutexes (poll_lock, io_lock, xports_lock, xprtgc_lock,
+ * xports_view_lock, trace_lock) and the per-xprt mtxp_lock are taken
+ * and released with svc_mutex_lock() and svc_mutex_unlock().
+ *
+ * Normally, those are just pthread_mutex_lock() and
+ * pthread_mutex_unlock().  When librpc is built with LOCK_PROFILE
+ * defined (make LOCK_PROFILE=1), each place that takes a lock
+ * counts how many times it got it, how many of those times it had
+ * to wait, how long it waited, and how long the lock was then held
+ * before it was released.  svc_lock_profile() reports the counts,
+ * by call site and by lock.
+ *
+ * Hold time is measured by the thread that took the lock.  If a
+ * lock is released by some other thread, the time it was held
+ * is not counted.
+ */
+
+struct lockprof_site {
+    const char           *ls_name;      /* the mutex, as written at the call */
+    const char           *ls_file;
+    unsigned int          ls_line;
+    int                   ls_registered;
+    struct lockprof_site *ls_next;
+    uint64_t              ls_acquired;
+    uint64_t              ls_contended;
+    uint64_t              ls_wait_ns;
+    uint64_t              ls_wait_max;
+    uint64_t              ls_hold_ns;
+    uint64_t              ls_hold_max;
+};
+
+extern int lockprof_lock(pthread_mutex_t *lockp, struct lockprof_site *site);
+extern int lockprof_unlock(pthread_mutex_t *lockp);
+
+#ifdef LOCK_PROFILE
+
+/*
+ * Two levels, so that a lock that is named by a macro, like tcp_lock,
+ * is reported by the name of the mutex it stands for.
+ */
+#define svc_mutex_lock(lockp) lockprof_lock_at(lockp)
+
+#define lockprof_lock_at(lockp) \
+    ({ \
+        static struct lockprof_site lockprof_site_ = { \
+            #lockp, __FILE__, __LINE__, 0, NULL, 0, 0, 0, 0, 0, 0 \
+        }; \
+        lockprof_lock((lockp), &lockprof_site_); \
+    })
+
+#define svc_mutex_unlock(lockp) lockprof_unlock(lockp)
+
+#else
+
+#define svc_mutex_lock(lockp)   pthread_mutex_lock(lockp)
+#define svc_mutex_unlock(lockp) pthread_mutex_unlock(lockp)
+
+#endif /* LOCK_PROFILE */
+
+/*
+ * svc_lock_profile(f) writes one line of key=value pairs per call
+ * site, then one line per lock, busiest first, with its share of
+ * all the time spent waiting for locks, then a line, "end".
+ * Without LOCK_PROFILE, it writes only "lockprof enabled=0", "end".
+ *
+ * svc_lock_profile_reset() sets all the counts back to zero.
+ */
+
+extern void svc_lock_profile(FILE *f);
+extern void svc_lock_profile_reset(void);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_LOCKPROF_H */
@@ -0,0 +1,487 @@
+/*
+ * Filename: svc_memo.c
+ * Project: rpc-mt
+ * Brief: Reply cache for idempotent procedures, with explicit invalidation
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+    // Import free()
+    // Import malloc()
+#include <string.h>
+    // Import memcmp()
+    // Import memcpy()
+    // Import memset()
+#include <time.h>
+    // Import clock_gettime()
+#include <pthread.h>
+    // Import pthread_mutex_lock(), pthread_mutex_unlock()
+#include <netinet/in.h>
+    // Import htonl()
+#include <cache-align.h>
+    // Import CACHE_ALIGNED
+
+#include "svc_debug.h"
+#include "svc_callkey.h"
+#include "svc_memo.h"
+
+/*
+ * See svc_memo.h for what the cache is for, and how it behaves.
+ *
+ * Each memoized procedure has a slot in @var{memo_procs}, and the same
+ * slot in @var{memo_procv}, with its ttl
+ * and a generation number, which svc_cache_invalidate() bumps.
+ * Every entry, and every ticket handed out on a miss, remembers the
+ * generation it was computed under.  An entry of an older generation
+ * is never used, and a ticket of an older generation is never turned
+ * into an entry.  That is what makes invalidation safe against calls
+ * that are being handled at the time; the sweep that svc_cache_invalidate()
+ * does afterward only gives back the memory sooner.
+ *
+ * The key of an entry is the key of its call, as in svc_callkey.h,
+ * kept right after the @type{struct memo_entry}, followed by the
+ * encoded reply.
+ *
+ * The table is split into shards, each with its own lock, LRU list,
+ * and an equal share of the byte budget.
+ */
+
+#define MEMO_MAX_PROCS  64      /* procedures that can be memoized */
+#define MEMO_NSHARDS    16      /* power of 2 */
+#define MEMO_NBUCKETS   256     /* per shard, power of 2 */
+#define MEMO_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+struct memo_proc {
+    unsigned int  mp_ttl;
+    unsigned long mp_gen;
+};
+
+static struct svc_procid memo_procids[MEMO_MAX_PROCS];
+static struct svc_proctab memo_procs =
+    SVC_PROCTAB_INITIALIZER(memo_procids, MEMO_MAX_PROCS, "svc_memoize");
+static struct memo_proc memo_procv[MEMO_MAX_PROCS];
+
+static size_t memo_budget_total = MEMO_DEFAULT_BUDGET;
+
+struct memo_entry {
+    struct memo_entry *me_hnext;        /* hash chain */
+    struct memo_entry *me_newer;        /* LRU list, toward most recent */
+    struct memo_entry *me_older;        /* LRU list, toward least recent */
+    uint64_t           me_hash;
+    time_t             me_expire;       /* 0, if it never expires */
+    unsigned long      me_gen;
+    size_t             me_pidx;         /* index into memo_procv[] */
+    size_t             me_keylen;
+    size_t             me_len;          /* length of the reply */
+    size_t             me_size;         /* bytes charged to the budget */
+};
+
+#define ME_KEY(e)   ((unsigned char *)((e) + 1))
+#define ME_REPLY(e) ((char *)ME_KEY(e) + (e)->me_keylen)
+
+struct memo_ticket {
+    uint64_t      mt_hash;
+    unsigned long mt_gen;
+    size_t        mt_pidx;
+    size_t        mt_keylen;
+};
+
+#define MT_KEY(t) ((unsigned char *)((t) + 1))
+
+struct memo_shard {
+    pthread_mutex_t    ms_lock;
+    struct memo_entry *ms_buckets[MEMO_NBUCKETS];
+    struct memo_entry *ms_newest;
+    struct memo_entry *ms_oldest;
+    size_t             ms_bytes;
+    size_t             ms_entries;
+} CACHE_ALIGNED;
+
+static struct memo_shard memo_shards[MEMO_NSHARDS];
+static pthread_once_t memo_once = PTHREAD_ONCE_INIT;
+
+static size_t cnt_memo_hits;
+static size_t cnt_memo_misses;
+static size_t cnt_memo_inserts;
+static size_t cnt_memo_stale;
+static size_t cnt_memo_evictions;
+static size_t cnt_memo_expirations;
+static size_t cnt_memo_invalidations;
+
+static void
+memo_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < MEMO_NSHARDS; ++i) {
+        pthread_mutex_init(&memo_shards[i].ms_lock, NULL);
+    }
+}
+
+static inline time_t
+memo_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (ts.tv_sec);
+}
+
+/*
+ * Return the index of the memo_procv[] slot of a procedure, or -1.
+ */
+static inline int
+memo_find(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc)
+{
+    return (proctab_find(&memo_procs, prog, vers, proc));
+}
+
+static void
+memo_proc_fill(size_t idx, void *arg)
+{
+    memo_procv[idx].mp_ttl = *(unsigned int *)arg;
+    memo_procv[idx].mp_gen = 0;
+}
+
+/*
+ * Memoize a procedure, or change its ttl.
+ * Return 1 on success, 0 if there is no room for another one.
+ */
+int
+svc_memoize(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc, unsigned int ttl)
+{
+    int pidx;
+
+    pthread_once(&memo_once, memo_init);
+    pidx = proctab_add(&memo_procs, prog, vers, proc, memo_proc_fill, &ttl);
+    if (pidx < 0) {
+        return (0);
+    }
+    memo_procv[pidx].mp_ttl = ttl;
+    return (1);
+}
+
+/*
+ * Set the total number of bytes the cache may hold.
+ * It applies to entries inserted from now on.
+ */
+void
+svc_memo_budget(size_t budget)
+{
+    memo_budget_total = budget;
+    __sync_synchronize();
+}
+
+static inline struct memo_shard *
+memo_shard(uint64_t h)
+{
+    return (&memo_shards[(h >> 32) & (MEMO_NSHARDS - 1)]);
+}
+
+static inline struct memo_entry **
+memo_bucket(struct memo_shard *shard, uint64_t h)
+{
+    return (&shard->ms_buckets[h & (MEMO_NBUCKETS - 1)]);
+}
+
+/*
+ * LRU list operations.  The shard lock is held.
+ */
+static void
+lru_unlink(struct memo_shard *shard, struct memo_entry *e)
+{
+    if (e->me_newer != NULL) {
+        e->me_newer->me_older = e->me_older;
+    }
+    else {
+        shard->ms_newest = e->me_older;
+    }
+    if (e->me_older != NULL) {
+        e->me_older->me_newer = e->me_newer;
+    }
+    else {
+        shard->ms_oldest = e->me_newer;
+    }
+}
+
+static void
+lru_push(struct memo_shard *shard, struct memo_entry *e)
+{
+    e->me_newer = NULL;
+    e->me_older = shard->ms_newest;
+    if (shard->ms_newest != NULL) {
+        shard->ms_newest->me_newer = e;
+    }
+    else {
+        shard->ms_oldest = e;
+    }
+    shard->ms_newest = e;
+}
+
+/*
+ * Take an entry out of its shard, and free it.
+ * The shard lock is held.
+ */
+static void
+memo_remove(struct memo_shard *shard, struct memo_entry *e)
+{
+    struct memo_entry **ep;
+
+    for (ep = memo_bucket(shard, e->me_hash); *ep != NULL; ep = &(*ep)->me_hnext) {
+        if (*ep == e) {
+            *ep = e->me_hnext;
+            break;
+        }
+    }
+    lru_unlink(shard, e);
+    shard->ms_bytes -= e->me_size;
+    --shard->ms_entries;
+    free(e);
+}
+
+/*
+ * Look for the memoized reply to a call.
+ *
+ * @var{args} and @var{argslen} are the raw, still encoded, argument
+ * bytes of the call.  On a hit, the reply is copied to @var{buf},
+ * with the xid of @var{msg}, and its length is returned.
+ *
+ * On a miss, -1 is returned.  If the procedure is memoized,
+ * *@var{ticketp} is set to a ticket, to be handed to memo_insert()
+ * along with the reply, or to memo_ticket_free().
+ */
+ssize_t
+memo_lookup(const struct rpc_msg *msg, const void *args, size_t argslen,
+    void *buf, size_t size, memo_ticket_t **ticketp)
+{
+    struct callkey ck;
+    const struct opaque_auth *cred;
+    struct memo_shard *shard;
+    struct memo_entry *e;
+    memo_ticket_t *t;
+    unsigned long gen;
+    uint64_t h;
+    uint32_t xid;
+    ssize_t len;
+    int pidx;
+
+    *ticketp = NULL;
+    pidx = memo_find(msg->rm_call.cb_prog, msg->rm_call.cb_vers, msg->rm_call.cb_proc);
+    if (pidx < 0) {
+        return (-1);
+    }
+    cred = &msg->rm_call.cb_cred;
+    if (cred->oa_flavor != AUTH_NONE && cred->oa_flavor != AUTH_UNIX) {
+        return (-1);
+    }
+
+    callkey_init(&ck, msg, args, argslen);
+    h = ck.ck_hash;
+
+    gen = __sync_fetch_and_add(&memo_procv[pidx].mp_gen, 0);
+    shard = memo_shard(h);
+    len = -1;
+
+    pthread_mutex_lock(&shard->ms_lock);
+    for (e = *memo_bucket(shard, h); e != NULL; e = e->me_hnext) {
+        if (e->me_hash == h && callkey_equal(&ck, ME_KEY(e), e->me_keylen)) {
+            break;
+        }
+    }
+    if (e != NULL) {
+        if (e->me_gen != gen) {
+            memo_remove(shard, e);
+            __sync_fetch_and_add(&cnt_memo_stale, 1);
+        }
+        else if (e->me_expire != 0 && e->me_expire <= memo_now()) {
+            memo_remove(shard, e);
+            __sync_fetch_and_add(&cnt_memo_expirations, 1);
+        }
+        else if (e->me_len <= size) {
+            // The args are no longer needed, even if they share @var{buf}.
+            memcpy(buf, ME_REPLY(e), e->me_len);
+            len = (ssize_t)e->me_len;
+            lru_unlink(shard, e);
+            lru_push(shard, e);
+        }
+    }
+    pthread_mutex_unlock(&shard->ms_lock);
+
+    if (len >= 0) {
+        xid = htonl((uint32_t)msg->rm_xid);
+        memcpy(buf, &xid, sizeof (xid));
+        __sync_fetch_and_add(&cnt_memo_hits, 1);
+        tprintf(4, "xid=%lu: memo hit\n", (u_long)msg->rm_xid);
+        return (len);
+    }
+
+    __sync_fetch_and_add(&cnt_memo_misses, 1);
+    t = (memo_ticket_t *)malloc(sizeof (*t) + callkey_len(&ck));
+    if (t == NULL) {
+        return (-1);
+    }
+    t->mt_hash = h;
+    t->mt_gen = gen;
+    t->mt_pidx = (size_t)pidx;
+    t->mt_keylen = callkey_len(&ck);
+    callkey_store(&ck, MT_KEY(t));
+    *ticketp = t;
+    return (-1);
+}
+
+/*
+ * Keep the reply to the call a ticket was handed out for,
+ * unless the procedure has been invalidated since.
+ * The ticket is freed, either way.
+ */
+void
+memo_insert(memo_ticket_t *t, const void *reply, size_t len)
+{
+    struct memo_proc *mp;
+    struct memo_shard *shard;
+    struct memo_entry **bucket;
+    struct memo_entry *e;
+    struct memo_entry *old;
+    size_t budget;
+    size_t size;
+    unsigned int ttl;
+
+    mp = &memo_procv[t->mt_pidx];
+    size = sizeof (*e) + t->mt_keylen + len;
+    budget = memo_budget_total / MEMO_NSHARDS;
+    if (size > budget) {
+        free(t);
+        return;
+    }
+    e = (struct memo_entry *)malloc(size);
+    if (e == NULL) {
+        free(t);
+        return;
+    }
+    ttl = mp->mp_ttl;
+    e->me_hash = t->mt_hash;
+    e->me_expire = (ttl != 0) ? memo_now() + (time_t)ttl : 0;
+    e->me_gen = t->mt_gen;
+    e->me_pidx = t->mt_pidx;
+    e->me_keylen = t->mt_keylen;
+    e->me_len = len;
+    e->me_size = size;
+    memcpy(ME_KEY(e), MT_KEY(t), t->mt_keylen);
+    memcpy(ME_REPLY(e), reply, len);
+    free(t);
+
+    shard = memo_shard(e->me_hash);
+    bucket = memo_bucket(shard, e->me_hash);
+    pthread_mutex_lock(&shard->ms_lock);
+    /*
+     * Checked under the shard lock, so that either this entry is
+     * refused, or it is in place before svc_cache_invalidate()
+     * sweeps this shard.
+     */
+    if (__sync_fetch_and_add(&mp->mp_gen, 0) != e->me_gen) {
+        pthread_mutex_unlock(&shard->ms_lock);
+        free(e);
+        __sync_fetch_and_add(&cnt_memo_stale, 1);
+        return;
+    }
+    // Two misses on the same key; the later reply wins.
+    for (old = *bucket; old != NULL; old = old->me_hnext) {
+        if (old->me_hash == e->me_hash && old->me_keylen == e->me_keylen
+            && memcmp(ME_KEY(old), ME_KEY(e), e->me_keylen) == 0) {
+            memo_remove(shard, old);
+            break;
+        }
+    }
+    while (shard->ms_oldest != NULL && shard->ms_bytes + size > budget) {
+        memo_remove(shard, shard->ms_oldest);
+        __sync_fetch_and_add(&cnt_memo_evictions, 1);
+    }
+    e->me_hnext = *bucket;
+    *bucket = e;
+    lru_push(shard, e);
+    shard->ms_bytes += size;
+    ++shard->ms_entries;
+    pthread_mutex_unlock(&shard->ms_lock);
+    __sync_fetch_and_add(&cnt_memo_inserts, 1);
+}
+
+void
+memo_ticket_free(memo_ticket_t *t)
+{
+    free(t);
+}
+
+/*
+ * Drop every result kept for a procedure, and every result
+ * of a call of it that is being handled right now.
+ */
+void
+svc_cache_invalidate(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc)
+{
+    struct memo_shard *shard;
+    struct memo_entry *e;
+    struct memo_entry *newer;
+    size_t i;
+    int pidx;
+
+    pidx = memo_find(prog, vers, proc);
+    if (pidx < 0) {
+        return;
+    }
+    __sync_fetch_and_add(&memo_procv[pidx].mp_gen, 1);
+    __sync_fetch_and_add(&cnt_memo_invalidations, 1);
+    tprintf(2, "prog=%lu, vers=%lu, proc=%lu\n",
+        (u_long)prog, (u_long)vers, (u_long)proc);
+
+    pthread_once(&memo_once, memo_init);
+    for (i = 0; i < MEMO_NSHARDS; ++i) {
+        shard = &memo_shards[i];
+        pthread_mutex_lock(&shard->ms_lock);
+        for (e = shard->ms_oldest; e != NULL; e = newer) {
+            newer = e->me_newer;
+            if (e->me_pidx == (size_t)pidx) {
+                memo_remove(shard, e);
+            }
+        }
+        pthread_mutex_unlock(&shard->ms_lock);
+    }
+}
+
+void
+svc_memo_stats(struct memo_stats *statsp)
+{
+    struct memo_shard *shard;
+    size_t i;
+
+    memset(statsp, 0, sizeof (*statsp));
+    statsp->hits = cnt_memo_hits;
+    statsp->misses = cnt_memo_misses;
+    statsp->inserts = cnt_memo_inserts;
+    statsp->stale = cnt_memo_stale;
+    statsp->evictions = cnt_memo_evictions;
+    statsp->expirations = cnt_memo_expirations;
+    statsp->invalidations = cnt_memo_invalidations;
+    pthread_once(&memo_once, memo_init);
+    for (i = 0; i < MEMO_NSHARDS; ++i) {
+        shard = &memo_shards[i];
+        pthread_mutex_lock(&shard->ms_lock);
+        statsp->bytes += shard->ms_bytes;
+        statsp->entries += shard->ms_entries;
+        pthread_mutex_unlock(&shard->ms_lock);
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Filename: svc_memo.h
+ * Project: rpc-mt
+ * Brief: Reply cache for idempotent procedures, with explicit invalidation
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_MEMO_H
+#define _SVC_MEMO_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>      // Import size_t
+#include <sys/types.h>   // Import ssize_t
+#include <rpc/rpc.h>     // Import struct rpc_msg, rpcprog_t, rpcvers_t, rpcproc_t
+
+/*
+ * Memoization
+ * -----------
+ * svc_memoize(prog, vers, proc, ttl) marks a procedure as a pure
+ * function of its arguments and the caller's credentials, whose
+ * results may be reused for up to @var{ttl} seconds (0: until
+ * invalidated).
+ *
+ * The encoded reply to a successful call of such a procedure is kept,
+ * keyed by prog, vers, proc, credentials and the raw argument bytes.
+ * A later call with the same key is answered from the cache, with
+ * its own xid spliced in.  Its arguments are never decoded, and
+ * it is never dispatched.
+ *
+ * Unlike the duplicate request cache, which is keyed by xid and
+ * client, and only ever answers retransmissions, this cache answers
+ * any client that asks the same question.
+ *
+ * Code that changes the data behind a memoized procedure calls
+ * svc_cache_invalidate(prog, vers, proc).  Every result kept for that
+ * procedure is dropped, and a result that was being computed while
+ * svc_cache_invalidate() was called is not kept, when it arrives.
+ *
+ * Only calls with AUTH_NONE or AUTH_UNIX credentials are memoized,
+ * because only their reply verifier does not depend on the call.
+ * Only UDP calls are memoized.
+ */
+
+struct memo_stats {
+    size_t hits;
+    size_t misses;
+    size_t inserts;
+    size_t stale;           /* results dropped, because of invalidation */
+    size_t evictions;
+    size_t expirations;
+    size_t invalidations;
+    size_t bytes;
+    size_t entries;
+};
+
+typedef struct memo_ticket memo_ticket_t;
+
+extern int    svc_memoize(rpcprog_t prog, rpcvers_t vers, rpcproc_t proc,
+                  unsigned int ttl);
+extern void   svc_cache_invalidate(rpcprog_t prog, rpcvers_t vers,
+                  rpcproc_t proc);
+extern void   svc_memo_budget(size_t budget);
+extern void   svc_memo_stats(struct memo_stats *statsp);
+
+extern ssize_t memo_lookup(const struct rpc_msg *msg,
+                  const void *args, size_t argslen,
+                  void *buf, size_t size, memo_ticket_t **ticketp);
+extern void   memo_insert(memo_ticket_t *ticket, const void *reply,
+                  size_t len);
+extern void   memo_ticket_free(memo_ticket_t *ticket);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_MEMO_H */
@@ -30,13 +30,28 @@ extern "C" {
 #include <sys/types.h>   // Import caddr_t
 #include <pthread.h>     // Import pthread_t, pthread_mutex_t
 #include <rpc/xdr.h>     // Import XDR
+#include <cache-align.h> // Import CACHE_LINE_SIZE, CACHE_ALIGNED
 
 #define XPRT_ID_INVALID ((size_t)(-1))
 #define NO_PARENT ((size_t)(-1))
 
 #define RQCRED_SIZE 400 /* This size is excessive */
 
-// XXX #define XPRT_BUSY       0x01
+/*
+ * Size of the full credentials area of an original SVCXPRT.
+ * Room for raw credentials, raw verifier, and "cooked" credentials.
+ */
+#define RQCRED_AREA_SIZE (2 * MAX_AUTH_BYTES + RQCRED_SIZE)
+
+/*
+ * Bits of the state word, @member{mtxp_progress}.
+ *
+ * XPRT_BUSY used to be a separate field, mtxp_busy, protected,
+ * along with mtxp_progress, by its own mutex.  Now, busy is just
+ * one more bit in the state word, so that both can be read or
+ * updated together, with a single atomic operation, and no lock.
+ */
+#define XPRT_BUSY       0x01
 #define XPRT_DONE_RECV  0x02
 #define XPRT_DONE_READ  0x04
 
@@ -72,6 +87,23 @@ extern "C" {
  * mtxp_lock:
  *     pthread_mutex per SVCXPRT.
  *
+ * mtxp_progress:
+ *     The state word.  Milestones (XPRT_GETARGS, XPRT_RETURN, etc.)
+ *     and the busy flag, XPRT_BUSY, are all bits in this one word.
+ *     It is only ever read or modified using atomic operations,
+ *     by way of xprt_get_progress(), xprt_progress_setbits(), etc.
+ *     It is written by both the dispatcher and the worker thread,
+ *     so it has a cache line all to itself.  That way, updates to
+ *     the state word do not keep stealing the cache line that holds
+ *     the fields that both threads only read, like mtxp_id and
+ *     mtxp_parent.
+ *
+ * mtxp_workers:
+ *     Number of dispatched requests that have not yet come back
+ *     by way of svc_return().  The reaper does not destroy a retired
+ *     SVCXPRT while a worker may still use it.  It shares the cache line
+ *     of the state word, because both threads write it, too.
+ *
  * mtxp_bufsz:
  *     Used to remember the bufsize of an "original" parent SVCXPRT,
  *     so that a clone can allocate a buffer of the same size.
@@ -112,6 +144,56 @@ extern "C" {
  *     Both @member{mtxp_rqst} and @member{mtxp_msg} point into the
  *     credentials area, so it needs to be private, per worker thread,
  *     as well.
+ *     The credentials area is not part of @type{struct mtxprt}.
+ *     It is allocated along with the @type{SVCXPRT}, right after
+ *     the @type{mtxprt}, and its size depends on what it is used for.
+ *     An original SVCXPRT, which receives requests, gets a full-size
+ *     area of RQCRED_AREA_SIZE bytes, laid out the same as in glibc:
+ *     raw credentials, raw verifier, then the "cooked" credentials.
+ *     A clone gets only as much as it needs to hold a private copy
+ *     of the credentials of the one request it serves.
+ *     That is nothing at all, for AUTH_NULL.
+ *     See xprt_cred_clone().
+ *
+ * mtxp_credsz:
+ *     Size, in bytes, of the credentials area.
+ *
+ * mtxp_reactor:
+ *     Index of the reactor whose poll set holds the socket of this SVCXPRT,
+ *     or NO_REACTOR, if it is in the shared @var{xports_pollfd}.
+ *     See svc_reactor.h.
+ *
+ * mtxp_paused:
+ *     Set while the application's event loop has been told to stop
+ *     watching the socket of this SVCXPRT, because it was busy.
+ *     See svc_embed.h.
+ *
+ * mtxp_footprint:
+ *     Total number of bytes of memory owned by this SVCXPRT,
+ *     including the @type{SVCXPRT} itself, the @type{mtxprt},
+ *     the credentials area, and transport-specific data and buffers.
+ *     See xprt_footprint_add().
+ *
+ * mtxp_retired:
+ *     Set, once, when this SVCXPRT is handed over to be destroyed,
+ *     by xprt_gc_mark().  Guards against retiring it twice.
+ *
+ * mtxp_retire_next:
+ *     Link in the stack of retired SVCXPRTs, waiting for the reaper.
+ *     See xprt_retire_push().
+ *
+ * Layout
+ * ------
+ * The fields are arranged in order of how hot they are.
+ *   1) Identity and read-mostly fields, which are read by both
+ *      the dispatcher and the worker thread, all through the life
+ *      of a request, are packed into the first cache line.
+ *   2) The state word, which is written by both threads,
+ *      has the next cache line to itself.
+ *   3) The per-xprt locks, which are taken by the worker thread.
+ *   4) Cold fields: the per-request context, which is written once,
+ *      when a request is received or cloned, and things that are
+ *      only of interest for debugging.
  *
  */
 
@@ -123,29 +205,57 @@ typedef SVCXPRT *(*clone_func_t)(SVCXPRT *);
 typedef void (*update_func_t)(SVCXPRT *, SVCXPRT *);
 
 struct mtxprt {
+    // Hot, read-mostly
     int              mtxp_magic;
+    int              mtxp_stat;
     size_t           mtxp_id;
-    pthread_t        mtxp_creator;
-    pthread_mutex_t  mtxp_lock;
-    pthread_mutex_t  mtxp_mtready;
-    pthread_mutex_t  mtxp_progress_lock;
-    size_t           mtxp_bufsz;
     size_t           mtxp_parent;
+    size_t           mtxp_bufsz;
+    clone_func_t     mtxp_clone;
     int              mtxp_refcnt;
     int              mtxp_fsck_refcnt;
-    int              mtxp_busy;
-    int              mtxp_pad;
-    int              mtxp_progress;
-    clone_func_t     mtxp_clone;
-    int              mtxp_stat;
+    char *           mtxp_cred;
+    size_t           mtxp_credsz;
+
+    // Hot, written by both dispatcher and worker
+    int              mtxp_progress CACHE_ALIGNED;
+    int              mtxp_workers;
+
+    // Warm, taken by the worker
+    pthread_mutex_t  mtxp_lock CACHE_ALIGNED;
+    pthread_mutex_t  mtxp_mtready;
+
+    // Cold
     struct svc_req   mtxp_rqst;
     struct rpc_msg   mtxp_msg;
-    char *           mtxp_cred;
+    pthread_t        mtxp_creator;
+    int              mtxp_reactor;
+    int              mtxp_paused;
+    size_t           mtxp_footprint;
+    int              mtxp_retired;
+    SVCXPRT *        mtxp_retire_next;
     char             mtxp_guard[8];
 };
  
 typedef struct mtxprt mtxprt_t;
 
+/*
+ * The @type{mtxprt} extension starts at the first cache line boundary
+ * following the "public" @type{SVCXPRT}, and the whole allocation
+ * is aligned on a cache line boundary.  See alloc_xprt().
+ */
+#define MTXPRT_OFFSET \
+    ((sizeof (SVCXPRT) + CACHE_LINE_SIZE - 1) & ~((size_t)CACHE_LINE_SIZE - 1))
+
+#define XPRT_ALLOC_SIZE (MTXPRT_OFFSET + sizeof (mtxprt_t))
+
+extern SVCXPRT *alloc_xprt(size_t credsz);
+extern void xprt_ext_attach(SVCXPRT *xprt, size_t credsz);
+extern size_t xprt_cred_clone_size(SVCXPRT *xprt);
+extern void xprt_cred_clone(SVCXPRT *xprt2, SVCXPRT *xprt1);
+extern void xprt_footprint_add(SVCXPRT *xprt, size_t nbytes);
+extern void xprt_footprint_release(SVCXPRT *xprt);
+
 
 /*
  * Simple functions to navigate from a pointer to @type{SVCXPRT}
@@ -161,9 +271,34 @@ typedef struct mtxprt mtxprt_t;
  * and can tolerate walking over a @type{SVCXPRT} that is under
  * construction or is being destroyed.
  *
+ * Checking the magic number and guard costs a call and a couple
+ * of compares on every access, and these functions are called
+ * many times per request.  So, @function{xprt_to_mtxprt} does
+ * the extra checking only in debug builds, that is, when
+ * CHECK_MTXPRT is defined.  Otherwise, it is the same as
+ * @function{xprt_to_mtxprt_nocheck}, and both are inline.
+ *
  */
+
+static inline mtxprt_t *
+xprt_to_mtxprt_nocheck(SVCXPRT *xprt)
+{
+    return ((mtxprt_t *)((char *)xprt + MTXPRT_OFFSET));
+}
+
+#ifdef CHECK_MTXPRT
+
 extern mtxprt_t *xprt_to_mtxprt(SVCXPRT *xprt);
-extern mtxprt_t *xprt_to_mtxprt_nocheck(SVCXPRT *xprt);
+
+#else
+
+static inline mtxprt_t *
+xprt_to_mtxprt(SVCXPRT *xprt)
+{
+    return (xprt_to_mtxprt_nocheck(xprt));
+}
+
+#endif /* CHECK_MTXPRT */
 
 
 #ifdef  __cplusplus
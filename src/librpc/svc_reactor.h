@@ -0,0 +1,113 @@
+/*
+ * Filename: svc_reactor.h
+ * Project: rpc-mt
+ * Brief: Definitions for running svc_run() as multiple event-loop threads
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_REACTOR_H
+#define _SVC_REACTOR_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>        // Import struct pollfd, nfds_t
+#include <pthread.h>     // Import pthread_t, pthread_mutex_t
+#include <cache-align.h> // Import CACHE_ALIGNED
+
+/*
+ * A reactor is one event-loop thread, running its own copy of
+ * the main loop of svc_run(), over its own set of file descriptors.
+ *
+ * By default, there is just one reactor, the thread that calls svc_run(),
+ * and it polls all registered sockets, using the shared @var{xports_pollfd}.
+ * That is the way it has always been.
+ *
+ * With svc_config("reactors=N"), N > 1, svc_run() starts N reactors.
+ * Each reactor has its own SO_REUSEPORT replica of every TCP rendezvous
+ * and UDP socket that was created before svc_run() was called,
+ * so the kernel spreads new connections and datagrams across reactors.
+ * Every SVCXPRT registered by a reactor thread belongs to that reactor,
+ * and its socket is polled only by that reactor.  So, TCP connections
+ * stay with the reactor that accepted them.
+ *
+ * The shared tables, @var{xports} and @var{sock_xports}, are still
+ * used, but only to register and unregister SVCXPRTs.
+ * Polling uses only the per-reactor set, under the per-reactor lock.
+ *
+ * Fields of @type{struct reactor}
+ * -------------------------------
+ *
+ * r_id:
+ *     Index of this reactor in @var{reactorv}.
+ *
+ * r_thread:
+ *     The thread running this reactor.
+ *
+ * r_lock:
+ *     Protects r_fds and r_nfds.
+ *     Taken by the reactor itself, when it builds its poll vector,
+ *     and by any thread that registers or unregisters an SVCXPRT
+ *     that belongs to this reactor.
+ *
+ * r_fds:
+ *     Set of file descriptors that belong to this reactor,
+ *     and the events of interest.  A vacant slot has fd == -1.
+ *
+ * r_nfds:
+ *     Number of slots of r_fds in use, including vacant slots.
+ *
+ * r_fds_size:
+ *     Number of slots allocated.
+ *
+ * r_pollfdv:
+ *     Private scratch vector, which is handed to poll().
+ *     Only the reactor thread touches it.
+ *
+ */
+
+#define NO_REACTOR (-1)
+
+struct reactor {
+    size_t           r_id;
+    pthread_t        r_thread;
+    pthread_mutex_t  r_lock;
+    struct pollfd   *r_fds;
+    nfds_t           r_nfds;
+    nfds_t           r_fds_size;
+    struct pollfd   *r_pollfdv;
+    nfds_t           r_pollfdv_size;
+} CACHE_ALIGNED;
+
+typedef struct reactor reactor_t;
+
+extern int svc_reactors;
+
+extern reactor_t *reactor_for_register(void);
+extern void reactor_add_fd(reactor_t *rp, int fd);
+extern void reactor_remove_fd(reactor_t *rp, int fd);
+extern reactor_t *reactor_by_id(int id);
+extern int svc_reuseport_socket(int fd, int type, int protocol);
+extern void svc_set_reuseport(int sock);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_REACTOR_H */
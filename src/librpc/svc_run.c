@@ -42,11 +42,16 @@
 #include <errno.h>
 #include <unistd.h>
 #include <libintl.h>
+#include <string.h>
 #include <sys/poll.h>
+#include <sys/socket.h>
 #include <rpc/rpc.h>
 
 #include "svc_mtxprt.h"
 #include "svc_debug.h"
+#include "svc_reactor.h"
+#include "svc_uring.h"
+#include "svc_embed.h"
 
 extern void xports_init(void);
 extern void xports_free(void);
@@ -57,12 +62,16 @@ extern void show_pollfd(struct pollfd *, nfds_t);
 extern void svc_getreq_poll_mt(struct pollfd *, nfds_t, int);
 extern int  fd_is_busy(int fd);
 extern size_t count_busy(void);
+extern void xprt_idle_tick(void);
 extern void xprt_lock(SVCXPRT *xprt);
 extern void xprt_unlock(SVCXPRT *xprt);
 extern SVCXPRT *socket_to_xprt(int fd);
+extern SVCXPRT *svctcp_reuseport_clone(SVCXPRT *xprt);
+extern SVCXPRT *svcudp_reuseport_clone(SVCXPRT *xprt);
 
+extern pthread_mutex_t io_lock;
 extern struct pollfd *xports_pollfd;
-extern int xports_max_pollfd;
+extern nfds_t xports_max_pollfd;
 extern int mtmode;
 extern int svc_quit;
 
@@ -192,7 +201,7 @@ show_pollfds(struct pollfd *pollfd, nfds_t npoll)
     nfds_t i;
 
     show_xports();
-    pthread_mutex_lock(&trace_lock);
+    svc_mutex_lock(&trace_lock);
     trace_printf_with_lock("poll\n");
     eprintf_with_lock("  [\n");
     for (i = 0; i < npoll; ++i) {
@@ -201,77 +210,112 @@ show_pollfds(struct pollfd *pollfd, nfds_t npoll)
             pollfd[i].fd, decode_poll_events(pe));
     }
     eprintf_with_lock("  ]\n");
-    pthread_mutex_unlock(&trace_lock);
+    svc_mutex_unlock(&trace_lock);
 }
 
-// Poll all "active" connections - just one time around
+/*
+ * Should the socket, @var{fd}, be polled, right now?
+ * Called with @var{xports_lock} held.
+ */
+static int
+poll_wanted(int fd)
+{
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
 
-void
-svc_poll(nfds_t max_pollfd)
+    xprt = socket_to_xprt(fd);
+    if (xprt == NULL || xprt == BAD_SVCXPRT_PTR) {
+        return (0);
+    }
+
+    mtxprt = xprt_to_mtxprt(xprt);
+
+    /*
+     * A retired SVCXPORT is waiting for the reaper,
+     * which will unregister it; there is nothing more to read.
+     */
+    if (__sync_or_and_fetch(&(mtxprt->mtxp_retired), 0) != 0) {
+        return (0);
+    }
+
+    /*
+     * What do we do if this SVCXPORT has returned?
+     */
+
+    if (mtmode == 0 && (mtxprt->mtxp_progress & XPRT_RETURN) != 0) {
+        /*
+         * In single-threaded mode, we do not create clones
+         * of SVCXPORT data structures, because we do not need
+         * to keep transport data for multiple threads.
+         * So, if we see that the SVCXPORT has returned,
+         * we just reuse it.
+         */
+        __sync_lock_test_and_set(&(mtxprt->mtxp_progress), 0);
+    }
+
+#if 0
+    if (mtmode != 0) {
+        if ((mtxprt->mtxp_progress & XPRT_RETURN) != 0) {
+            return (0);
+        }
+    }
+#endif
+
+    /*
+     * We do not poll all fds associated with all xprt structures,
+     * because some xprts and their associated fds are busy,
+     * for example, with some ongoing data transport over TCP.
+     * For UDP, not so much.
+     */
+    return (mtmode == 0 || (mtxprt->mtxp_progress & XPRT_BUSY) == 0);
+}
+
+/*
+ * Fill in @var{fdv}, which has room for @var{size} entries,
+ * with the sockets to be polled, right now.
+ * Return how many there are, which can be more than @var{size}.
+ */
+static nfds_t
+poll_collect(struct pollfd *fdv, nfds_t size)
 {
     nfds_t npoll;
     nfds_t i;
-    int poll_rv;
-    int err;
 
     xports_global_lock();
-    pollfdv = pollfd_realloc(max_pollfd);
     npoll = 0;
-    for (i = 0; i < max_pollfd; ++i) {
-        SVCXPRT *xprt;
-        mtxprt_t *mtxprt;
+    for (i = 0; i < xports_max_pollfd; ++i) {
         int fd;
 
         fd = xports_pollfd[i].fd;
-        if (fd == -1) {
+        if (fd == -1 || !poll_wanted(fd)) {
             continue;
         }
-
-        xprt = socket_to_xprt(fd);
-        if (xprt == BAD_SVCXPRT_PTR) {
-            continue;
+        if (npoll < size) {
+            fdv[npoll].fd = fd;
+            fdv[npoll].events = xports_pollfd[i].events;
+            fdv[npoll].revents = 0;
         }
+        ++npoll;
+    }
+    xports_global_unlock();
+    return (npoll);
+}
 
-        mtxprt = xprt_to_mtxprt(xprt);
-
-        /*
-         * What do we do if this SVCXPORT has returned?
-         */
-
-        if (mtmode == 0 && (mtxprt->mtxp_progress & XPRT_RETURN) != 0) {
-            /*
-             * In single-threaded mode, we do not create clones
-             * of SVCXPORT data structures, because we do not need
-             * to keep transport data for multiple threads.
-             * So, if we see that the SVCXPORT has returned,
-             * we just reuse it.
-             */
-            mtxprt->mtxp_progress = 0;
-            mtxprt->mtxp_busy = 0;
-        }
+// Poll all "active" connections - just one time around
 
-#if 0
-        if (mtmode != 0) {
-            if ((mtxprt->mtxp_progress & XPRT_RETURN) != 0) {
-                continue;
-            }
-        }
-#endif
+void
+svc_poll(nfds_t max_pollfd)
+{
+    nfds_t npoll;
+    int poll_rv;
+    int err;
 
-        /*
-         * We do not poll all fds associated with all xprt structures,
-         * because some xprts and their associated fds are busy,
-         * for example, with some ongoing data transport over TCP.
-         * For UDP, not so much.
-         */
-        if (mtmode == 0 || mtxprt->mtxp_busy == 0) {
-            pollfdv[npoll].fd = fd;
-            pollfdv[npoll].events = xports_pollfd[i].events;
-            pollfdv[npoll].revents = 0;
-            ++npoll;
-        }
+    pollfdv = pollfd_realloc(max_pollfd);
+    npoll = poll_collect(pollfdv, max_pollfd);
+    if (npoll > max_pollfd) {
+        // More were registered since the caller looked.
+        npoll = max_pollfd;
     }
-    xports_global_unlock();
 
     if (npoll == 0) {
         teprintf("npoll == 0\n");
@@ -298,7 +342,7 @@ svc_poll(nfds_t max_pollfd)
     case 0:
         break;
     default:
-        pthread_mutex_unlock(&poll_lock);
+        svc_mutex_unlock(&poll_lock);
         svc_getreq_poll_mt(pollfdv, npoll, poll_rv);
         poll_trace_count = 0;
         poll_countdown = poll_trace_interval;
@@ -314,6 +358,422 @@ svc_run_cleanup(void)
     }
 }
 
+/*
+ * Multi-reactor mode.  See svc_reactor.h.
+ */
+
+static reactor_t *reactorv;
+static size_t nreactors;
+static __thread reactor_t *this_reactor;
+
+/*
+ * Sockets that existed before svc_run() started the reactors,
+ * and that get an SO_REUSEPORT replica in every other reactor.
+ *
+ * Reactor 0 owns them, and may destroy them once it runs.
+ * So, it waits at @var{reactors_ready} until every other reactor
+ * has made its replicas; after that, nobody looks at this vector.
+ */
+static SVCXPRT **reuse_xprtv;
+static size_t reuse_count;
+static pthread_barrier_t reactors_ready;
+
+reactor_t *
+reactor_by_id(int id)
+{
+    if (reactorv == NULL || id < 0 || (size_t)id >= nreactors) {
+        return (NULL);
+    }
+    return (&reactorv[id]);
+}
+
+/*
+ * Which reactor gets a newly registered SVCXPRT?
+ * If we are not running reactors, then none; use @var{xports_pollfd}.
+ * A reactor thread gets whatever it registers.
+ * Any other thread registers on behalf of reactor 0.
+ *
+ * Called with @var{xports_lock} held.
+ */
+reactor_t *
+reactor_for_register(void)
+{
+    if (reactorv == NULL) {
+        return (NULL);
+    }
+    if (this_reactor != NULL) {
+        return (this_reactor);
+    }
+    return (&reactorv[0]);
+}
+
+void
+reactor_add_fd(reactor_t *rp, int fd)
+{
+    nfds_t slot;
+
+    pthread_mutex_lock(&rp->r_lock);
+    for (slot = 0; slot < rp->r_nfds; ++slot) {
+        if (rp->r_fds[slot].fd == -1) {
+            break;
+        }
+    }
+    if (slot == rp->r_nfds) {
+        if (rp->r_nfds == rp->r_fds_size) {
+            rp->r_fds_size = fd_alloc_roundup(rp->r_fds_size + 1);
+            rp->r_fds = (struct pollfd *)guard_realloc(rp->r_fds,
+                rp->r_fds_size * sizeof (struct pollfd));
+        }
+        ++rp->r_nfds;
+    }
+    rp->r_fds[slot].fd = fd;
+    rp->r_fds[slot].events = (POLLIN | POLLPRI);
+    rp->r_fds[slot].revents = 0;
+    pthread_mutex_unlock(&rp->r_lock);
+    tprintf(2, "reactor=%zu, fd=%d, slot=%lu\n", rp->r_id, fd, slot);
+}
+
+void
+reactor_remove_fd(reactor_t *rp, int fd)
+{
+    nfds_t slot;
+
+    pthread_mutex_lock(&rp->r_lock);
+    for (slot = 0; slot < rp->r_nfds; ++slot) {
+        if (rp->r_fds[slot].fd == fd) {
+            rp->r_fds[slot].fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&rp->r_lock);
+    tprintf(2, "reactor=%zu, fd=%d\n", rp->r_id, fd);
+}
+
+/*
+ * Set SO_REUSEPORT on a socket that is about to be bound,
+ * so that other reactors can bind replicas to the same address.
+ * Failure is not fatal; it just means no replicas.
+ */
+void
+svc_set_reuseport(int sock)
+{
+    int on;
+
+    on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) != 0) {
+        svc_perror(errno, "svc_set_reuseport - setsockopt() failed");
+    }
+}
+
+/*
+ * Create a new socket of the given @var{type} and @var{protocol},
+ * with SO_REUSEPORT set, and bind it to the same address as the
+ * socket @var{fd}.  Return the new socket, or -1 on failure.
+ *
+ * This works only if @var{fd} also had SO_REUSEPORT set,
+ * before it was bound.  svctcp_create() and svcudp_bufcreate()
+ * take care of that, if they create the socket, themselves.
+ */
+int
+svc_reuseport_socket(int fd, int type, int protocol)
+{
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int sock;
+    int on;
+
+    len = sizeof (addr);
+    if (getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        svc_perror(errno, "svc_reuseport_socket - getsockname() failed");
+        return (-1);
+    }
+
+    sock = socket(addr.ss_family, type, protocol);
+    if (sock < 0) {
+        svc_perror(errno, "svc_reuseport_socket - socket() failed");
+        return (-1);
+    }
+
+    on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) != 0
+        || bind(sock, (struct sockaddr *)&addr, len) != 0) {
+        svc_perror(errno, "svc_reuseport_socket - cannot share address");
+        (void) close(sock);
+        return (-1);
+    }
+
+    return (sock);
+}
+
+/*
+ * Make this reactor's replica of a rendezvous or UDP socket.
+ */
+static void
+reactor_replicate(reactor_t *rp, SVCXPRT *xprt)
+{
+    SVCXPRT *rxprt;
+    int type;
+    socklen_t len;
+
+    len = sizeof (type);
+    if (getsockopt(xprt->xp_sock, SOL_SOCKET, SO_TYPE, &type, &len) != 0) {
+        svc_perror(errno, "reactor_replicate - getsockopt(SO_TYPE) failed");
+        return;
+    }
+
+    if (type == SOCK_STREAM) {
+        rxprt = svctcp_reuseport_clone(xprt);
+    }
+    else {
+        rxprt = svcudp_reuseport_clone(xprt);
+    }
+
+    if (rxprt == NULL) {
+        eprintf("reactor %zu: cannot replicate fd=%d, port=%d.\n"
+            "  It will be served by reactor 0, only.\n",
+            rp->r_id, xprt->xp_sock, xprt->xp_port);
+        return;
+    }
+    tprintf(2, "reactor=%zu, fd=%d => fd=%d\n",
+        rp->r_id, xprt->xp_sock, rxprt->xp_sock);
+}
+
+/*
+ * Poll all the sockets that belong to one reactor - just one time around.
+ *
+ * Unlike svc_poll(), this does not take @var{poll_lock} or
+ * @var{xports_lock}, so that reactors do not serialize each other.
+ */
+static void
+reactor_poll(reactor_t *rp)
+{
+    nfds_t npoll;
+    nfds_t i;
+    int poll_rv;
+    int err;
+
+    pthread_mutex_lock(&rp->r_lock);
+    if (rp->r_pollfdv_size < rp->r_nfds) {
+        rp->r_pollfdv_size = fd_alloc_roundup(rp->r_nfds);
+        rp->r_pollfdv = (struct pollfd *)guard_realloc(rp->r_pollfdv,
+            rp->r_pollfdv_size * sizeof (struct pollfd));
+    }
+    npoll = 0;
+    for (i = 0; i < rp->r_nfds; ++i) {
+        SVCXPRT *xprt;
+        mtxprt_t *mtxprt;
+        int fd;
+
+        fd = rp->r_fds[i].fd;
+        if (fd == -1) {
+            continue;
+        }
+
+        xprt = socket_to_xprt(fd);
+        if (xprt == NULL || xprt == BAD_SVCXPRT_PTR) {
+            continue;
+        }
+
+        mtxprt = xprt_to_mtxprt(xprt);
+        if ((mtxprt->mtxp_progress & XPRT_BUSY) == 0) {
+            rp->r_pollfdv[npoll].fd = fd;
+            rp->r_pollfdv[npoll].events = rp->r_fds[i].events;
+            rp->r_pollfdv[npoll].revents = 0;
+            ++npoll;
+        }
+    }
+    pthread_mutex_unlock(&rp->r_lock);
+
+    poll_rv = poll(rp->r_pollfdv, npoll, poll_timeout);
+    err = errno;
+    switch (poll_rv) {
+    case -1:
+        if (err != EINTR) {
+            svc_perror(err, "svc_run: reactor - poll() failed");
+        }
+        break;
+    case 0:
+        break;
+    default:
+        svc_getreq_poll_mt(rp->r_pollfdv, npoll, poll_rv);
+        break;
+    }
+}
+
+static void
+reactor_loop(reactor_t *rp)
+{
+    this_reactor = rp;
+    tprintf(2, "reactor=%zu: start\n", rp->r_id);
+    while (svc_quit == 0) {
+        rate_limit();
+        xprt_idle_tick();
+        reactor_poll(rp);
+    }
+    tprintf(2, "reactor=%zu: quit\n", rp->r_id);
+}
+
+static void *
+reactor_thread(void *arg)
+{
+    reactor_t *rp;
+    size_t i;
+
+    rp = (reactor_t *)arg;
+    this_reactor = rp;
+    for (i = 0; i < reuse_count; ++i) {
+        reactor_replicate(rp, reuse_xprtv[i]);
+    }
+    (void) pthread_barrier_wait(&reactors_ready);
+    reactor_loop(rp);
+    return (NULL);
+}
+
+/*
+ * Hand over all sockets registered so far, in @var{xports_pollfd},
+ * to reactor 0, and remember which of them are rendezvous or UDP
+ * sockets, to be replicated by the other reactors.
+ */
+static void
+reactors_adopt(reactor_t *rv)
+{
+    reactor_t *rp;
+    nfds_t slot;
+
+    rp = &rv[0];
+    svc_mutex_lock(&io_lock);
+    xports_global_lock();
+    reuse_xprtv = (SVCXPRT **)guard_calloc(xports_max_pollfd + 1,
+        sizeof (SVCXPRT *));
+    reuse_count = 0;
+    for (slot = 0; slot < xports_max_pollfd; ++slot) {
+        SVCXPRT *xprt;
+        mtxprt_t *mtxprt;
+        int fd;
+
+        fd = xports_pollfd[slot].fd;
+        if (fd == -1) {
+            continue;
+        }
+        xprt = socket_to_xprt(fd);
+        if (xprt == NULL || xprt == BAD_SVCXPRT_PTR) {
+            continue;
+        }
+        mtxprt = xprt_to_mtxprt(xprt);
+        mtxprt->mtxp_reactor = (int)rp->r_id;
+        reactor_add_fd(rp, fd);
+        xports_pollfd[slot].fd = -1;
+        if (xprt->xp_port != 0) {
+            reuse_xprtv[reuse_count] = xprt;
+            ++reuse_count;
+        }
+    }
+    reactorv = rv;
+    xports_global_unlock();
+    svc_mutex_unlock(&io_lock);
+}
+
+/*
+ * Main loop, multi-reactor version.
+ * The calling thread becomes reactor 0.
+ */
+static void
+svc_run_reactors(size_t n)
+{
+    reactor_t *rv;
+    size_t i;
+    int rc;
+
+    rv = (reactor_t *)guard_memalign(CACHE_LINE_SIZE, n * sizeof (reactor_t));
+    memset(rv, 0, n * sizeof (reactor_t));
+    for (i = 0; i < n; ++i) {
+        rv[i].r_id = i;
+        pthread_mutex_init(&rv[i].r_lock, NULL);
+    }
+    nreactors = n;
+    reactors_adopt(rv);
+
+    pthread_barrier_init(&reactors_ready, NULL, (unsigned int)n);
+    rv[0].r_thread = pthread_self();
+    for (i = 1; i < n; ++i) {
+        rc = pthread_create(&rv[i].r_thread, NULL, reactor_thread, &rv[i]);
+        if (rc != 0) {
+            svc_perror(rc, "svc_run: cannot create reactor thread");
+            svc_die();
+        }
+    }
+
+    // Do not serve, or destroy, the originals until all replicas exist.
+    (void) pthread_barrier_wait(&reactors_ready);
+    free(reuse_xprtv);
+    reuse_xprtv = NULL;
+    reuse_count = 0;
+
+    reactor_loop(&rv[0]);
+
+    for (i = 1; i < n; ++i) {
+        pthread_join(rv[i].r_thread, NULL);
+    }
+}
+
+/*
+ * Decide whether a socket that the io_uring engine says is ready
+ * should be serviced now.  Same rules as for svc_poll().
+ */
+static int
+uring_filter(int fd)
+{
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
+
+    xprt = socket_to_xprt(fd);
+    if (xprt == NULL || xprt == BAD_SVCXPRT_PTR) {
+        return (0);
+    }
+
+    mtxprt = xprt_to_mtxprt(xprt);
+    if (mtmode == 0 && (mtxprt->mtxp_progress & XPRT_RETURN) != 0) {
+        __sync_lock_test_and_set(&(mtxprt->mtxp_progress), 0);
+    }
+    return (mtmode == 0 || (mtxprt->mtxp_progress & XPRT_BUSY) == 0);
+}
+
+/*
+ * Main loop, io_uring version.
+ * Sockets registered before svc_run() was called get watched, now;
+ * xprt_register() takes care of the rest.
+ */
+static void
+svc_run_uring(void)
+{
+    struct pollfd *readyv;
+    nfds_t readyv_size;
+    nfds_t nready;
+    nfds_t slot;
+
+    svc_mutex_lock(&io_lock);
+    xports_global_lock();
+    for (slot = 0; slot < xports_max_pollfd; ++slot) {
+        if (xports_pollfd[slot].fd != -1) {
+            uring_watch(xports_pollfd[slot].fd);
+        }
+    }
+    xports_global_unlock();
+    svc_mutex_unlock(&io_lock);
+
+    readyv = NULL;
+    readyv_size = 0;
+    while (svc_quit == 0) {
+        rate_limit();
+        xprt_idle_tick();
+        nready = uring_poll(&readyv, &readyv_size, poll_timeout, uring_filter);
+        if (nready != 0) {
+            svc_getreq_poll_mt(readyv, nready, (int)nready);
+        }
+    }
+    free(readyv);
+    uring_fini();
+}
+
 /*
  * Main loop.  Keep polling "active" connections
  */
@@ -321,25 +781,206 @@ svc_run_cleanup(void)
 void
 svc_run(void)
 {
-    extern int xprt_gc_reap_all(void);
-
     nfds_t max_pollfd;
 
     poll_init();
     xports_init();
+
+    if (svc_io_engine == IO_ENGINE_URING) {
+        int err;
+
+        err = uring_init();
+        if (err == 0) {
+            if (svc_reactors > 1) {
+                eprintf("svc_run: io=uring runs a single event loop.\n"
+                    "  Ignoring reactors=%d.\n", svc_reactors);
+            }
+            svc_run_uring();
+            svc_run_cleanup();
+            return;
+        }
+        svc_perror(err, "svc_run: io=uring is not available; using poll()");
+    }
+
+    if (svc_reactors > 1) {
+        if (mtmode == 0) {
+            eprintf("svc_run: reactors=%d requires mtmode 1 or 2.\n"
+                "  Running a single reactor.\n", svc_reactors);
+        }
+        else {
+            svc_run_reactors((size_t)svc_reactors);
+            svc_run_cleanup();
+            return;
+        }
+    }
+
     while (svc_quit == 0) {
         max_pollfd = xports_max_pollfd;
         if (max_pollfd == 0 && xports_pollfd == NULL) {
             break;
         }
 
-        (void) xprt_gc_reap_all();
         rate_limit();
+        xprt_idle_tick();
 
-        pthread_mutex_lock(&poll_lock);
+        svc_mutex_lock(&poll_lock);
         svc_poll(max_pollfd);
-        pthread_mutex_unlock(&poll_lock);
+        svc_mutex_unlock(&poll_lock);
     }
 
     svc_run_cleanup();
 }
+
+/*
+ * Embedded mode.  See svc_embed.h.
+ */
+
+static svc_watch_t embed_watch_fn;
+static void *embed_watch_arg;
+
+#define EMBED_EVENTS (POLLIN | POLLPRI)
+
+/*
+ * Tell the application's event loop to watch @var{fd} for @var{events},
+ * or, if @var{events} is 0, to stop watching it.
+ * Called by xprt_register() and xprt_unregister().
+ */
+void
+embed_watch(int fd, short events)
+{
+    svc_watch_t watch;
+
+    watch = __atomic_load_n(&embed_watch_fn, __ATOMIC_ACQUIRE);
+    if (watch != NULL) {
+        (*watch)(fd, events, embed_watch_arg);
+    }
+}
+
+/*
+ * The SVCXPRT of @var{fd} is no longer busy.
+ * If svc_embed_ready() had to stop watching @var{fd}, because it was busy,
+ * start watching it again.  Called by svc_return().
+ *
+ * Only one of svc_embed_ready() and embed_resume() wins the exchange
+ * of @member{mtxp_paused}, so the watch is resumed exactly once,
+ * and never before it was paused.
+ */
+void
+embed_resume(int fd)
+{
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
+
+    if (__atomic_load_n(&embed_watch_fn, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+    xprt = socket_to_xprt(fd);
+    if (xprt == NULL || xprt == BAD_SVCXPRT_PTR) {
+        return;
+    }
+    mtxprt = xprt_to_mtxprt(xprt);
+    if (__atomic_exchange_n(&mtxprt->mtxp_paused, 0, __ATOMIC_SEQ_CST) != 0) {
+        embed_watch(fd, EMBED_EVENTS);
+    }
+}
+
+/*
+ * Usage:
+ *      svc_embed_init(watch, arg);
+ *
+ * Hand over RPC service to the caller's event loop.
+ * @var{watch} is called, now, for every fd already registered,
+ * and, from then on, whenever the set of fds to watch changes.
+ * @var{watch} can be NULL, for an event loop that uses svc_pollfds(),
+ * and does not need to be told.
+ */
+void
+svc_embed_init(svc_watch_t watch, void *arg)
+{
+    nfds_t slot;
+
+    xports_init();
+    xports_global_lock();
+    embed_watch_arg = arg;
+    __atomic_store_n(&embed_watch_fn, watch, __ATOMIC_RELEASE);
+    for (slot = 0; slot < xports_max_pollfd; ++slot) {
+        if (xports_pollfd[slot].fd != -1) {
+            embed_watch(xports_pollfd[slot].fd, xports_pollfd[slot].events);
+        }
+    }
+    xports_global_unlock();
+}
+
+/*
+ * Stop calling the watch function.  The application's event loop
+ * should stop watching RPC fds, and call svc_embed_ready(), no more.
+ */
+void
+svc_embed_fini(void)
+{
+    xports_global_lock();
+    __atomic_store_n(&embed_watch_fn, (svc_watch_t)NULL, __ATOMIC_RELEASE);
+    embed_watch_arg = NULL;
+    xports_global_unlock();
+}
+
+/*
+ * Fill in @var{fdv} with the fds to poll, right now.
+ * See svc_embed.h.
+ */
+nfds_t
+svc_pollfds(struct pollfd *fdv, nfds_t size)
+{
+    xports_init();
+    return (poll_collect(fdv, size));
+}
+
+/*
+ * The application's event loop says that @var{fd} is ready.
+ * Service it, unless its SVCXPRT is busy with a worker thread.
+ * If it is busy, stop watching it, until svc_return() says it
+ * is done; see embed_resume().
+ */
+void
+svc_embed_ready(int fd, short revents)
+{
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
+    int wanted;
+
+    tprintf(2, "fd=%d, revents=%s\n", fd, decode_poll_events(revents));
+    if (revents & POLLNVAL) {
+        return;
+    }
+
+    xprt_idle_tick();
+    xports_global_lock();
+    wanted = poll_wanted(fd);
+    xports_global_unlock();
+    if (wanted) {
+        svc_getreq_common(fd);
+        return;
+    }
+
+    if (__atomic_load_n(&embed_watch_fn, __ATOMIC_ACQUIRE) == NULL) {
+        // A poll loop will leave it out of the next svc_pollfds().
+        return;
+    }
+    xprt = socket_to_xprt(fd);
+    if (xprt == NULL || xprt == BAD_SVCXPRT_PTR) {
+        return;
+    }
+    mtxprt = xprt_to_mtxprt(xprt);
+
+    /*
+     * Stop watching first, then say so, then look again.
+     * If it went idle in the meantime, whichever of us, or
+     * embed_resume(), clears @member{mtxp_paused} starts watching again.
+     */
+    embed_watch(fd, 0);
+    __atomic_store_n(&mtxprt->mtxp_paused, 1, __ATOMIC_SEQ_CST);
+    if ((__atomic_load_n(&mtxprt->mtxp_progress, __ATOMIC_SEQ_CST) & XPRT_BUSY) == 0
+        && __atomic_exchange_n(&mtxprt->mtxp_paused, 0, __ATOMIC_SEQ_CST) != 0) {
+        embed_watch(fd, EMBED_EVENTS);
+    }
+}
@@ -0,0 +1,739 @@
+/*
+ * Filename: svc_shm.c
+ * Project: rpc-mt
+ * Brief: Server side of the shared-memory ring transport
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * See svc_shm.h for the layout of the shared region and the doorbells.
+ *
+ * A connection is handled like a TCP connection: one call at a time
+ * is decoded, by the dispatcher, and the dispatcher waits until the
+ * worker has got the arguments (svc_getargs()) before it decodes
+ * the next call.  So, the consumer side of the call ring belongs
+ * to one thread at a time.  Replies, from however many workers,
+ * go into the reply ring under xprt_lock().
+ *
+ * A call slot is given back to the client once the arguments have
+ * been decoded, or once the call has been replied to, whichever
+ * comes first.
+ */
+
+#include <stdlib.h>
+    // Import abort(), free()
+#include <string.h>
+    // Import memcpy(), memset(), strlen()
+#include <stddef.h>
+    // Import offsetof()
+#include <unistd.h>
+    // Import close(), read(), ftruncate()
+#include <errno.h>
+    // Import errno
+#include <fcntl.h>
+    // Import fcntl(), O_NONBLOCK
+#include <sys/mman.h>
+    // Import mmap(), munmap(), memfd_create()
+#include <sys/socket.h>
+    // Import socket(), bind(), listen(), accept4(), sendmsg(), recv()
+#include <sys/un.h>
+    // Import struct sockaddr_un
+#include <sys/eventfd.h>
+    // Import eventfd()
+#include <sys/epoll.h>
+    // Import epoll_create1(), epoll_ctl()
+#include <rpc/rpc.h>
+    // Import SVCXPRT, xdr_callmsg(), xdr_replymsg()
+
+#include "svc_mtxprt.h"
+#include "svc_debug.h"
+#include "svc_config.h"
+#include "svc_shm.h"
+
+extern void xports_global_lock(void);
+extern void xports_global_unlock(void);
+extern void xprt_lock(SVCXPRT *);
+extern void xprt_unlock(SVCXPRT *);
+extern int  xprt_progress_setbits(SVCXPRT *, int);
+extern int  xprt_progress_clrbits(SVCXPRT *, int);
+extern void xprt_set_busy(SVCXPRT *, int);
+
+extern void svc_perror(int, const char *);
+extern void svc_accept_failed(void);
+
+extern int wait_method_tcp;
+
+/*
+ * Ops vector for shared-memory connections
+ */
+static bool_t svcshm_recv(SVCXPRT *, struct rpc_msg *);
+static enum xprt_stat svcshm_stat(SVCXPRT *);
+static bool_t svcshm_getargs(SVCXPRT *, xdrproc_t, caddr_t);
+static bool_t svcshm_reply(SVCXPRT *, struct rpc_msg *);
+static bool_t svcshm_freeargs(SVCXPRT *, xdrproc_t, caddr_t);
+static void svcshm_destroy(SVCXPRT *);
+
+static const xp_ops_t svcshm_op = {
+    svcshm_recv,
+    svcshm_stat,
+    svcshm_getargs,
+    svcshm_reply,
+    svcshm_freeargs,
+    svcshm_destroy
+};
+
+/*
+ * Ops vector for the rendezvouser, which hands out regions
+ */
+static bool_t shm_rendezvous_request(SVCXPRT *, struct rpc_msg *);
+static enum xprt_stat shm_rendezvous_stat(SVCXPRT *);
+static void shm_rendezvous_destroy(SVCXPRT *);
+static void svcshm_rendezvous_abort(void) __attribute__ ((__noreturn__));
+
+static void
+svcshm_rendezvous_abort(void)
+{
+    abort();
+}
+
+static const xp_ops_t svcshm_rendezvous_op = {
+    shm_rendezvous_request,
+    shm_rendezvous_stat,
+    (bool_t (*) (SVCXPRT *, xdrproc_t, caddr_t)) svcshm_rendezvous_abort,
+    (bool_t (*) (SVCXPRT *, struct rpc_msg *)) svcshm_rendezvous_abort,
+    (bool_t (*) (SVCXPRT *, xdrproc_t, caddr_t)) svcshm_rendezvous_abort,
+    shm_rendezvous_destroy
+};
+
+/*
+ * Maximum number of clients to accept for one readiness event.
+ */
+#define SHM_ACCEPT_BATCH 16
+
+/* kept in xprt->xp_p1 */
+struct shm_rendezvous {
+    uint32_t nslots;
+    uint32_t slotsize;
+};
+
+/* kept in xprt->xp_p1 */
+struct shm_conn {
+    struct shm_region *region;
+    size_t   maplen;
+    uint32_t nslots;                    /* our own copies; see svc_shm.h */
+    uint32_t slotsize;
+    int      conn_sock;                 /* to find out when the client hangs up */
+    int      call_efd;                  /* doorbell of the call ring */
+    int      reply_efd;                 /* doorbell of the reply ring */
+    enum xprt_stat stat;
+    u_long   x_id;
+    bool     call_held;                 /* call slot at sr_head is in use */
+    bool     armed;                     /* we asked for the call doorbell */
+    XDR      xdrs;                      /* decodes the call, in its slot */
+    char     verf_body[MAX_AUTH_BYTES];
+};
+
+/*
+ * Construct an SVCXPRT for the shared memory transport, and register it.
+ * See makefd_xprt_construct() in svc_tcp.c.
+ */
+static SVCXPRT *
+shm_xprt_construct(int sock, const xp_ops_t *ops, void *p1, size_t p1size,
+    size_t credsz, u_short port)
+{
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
+
+    xprt = alloc_xprt(credsz);
+
+    /*
+     * Constructor for @type{SVCXPRT}, including the additional @type{mtxprt_t}
+     * Order of construction is important.  See svc_tcp.c.
+     */
+    mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    xprt_ext_attach(xprt, credsz);
+    xprt_footprint_add(xprt, p1size);
+
+    if (pthread_mutex_init(&(mtxprt->mtxp_lock), NULL) != 0) {
+        abort();
+    }
+
+    if (pthread_mutex_init(&(mtxprt->mtxp_mtready), NULL) != 0) {
+        abort();
+    }
+
+    // Start off locked.  svcshm_getargs() will unlock it.
+    if (pthread_mutex_lock(&(mtxprt->mtxp_mtready)) != 0) {
+        abort();
+    }
+
+    /*
+     * Do not use xprt_lock(xprt) here.
+     * The constructor has not progressed far enough, yet.
+     */
+    if (svc_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
+        abort();
+    }
+
+    mtxprt->mtxp_magic = MTXPRT_MAGIC;
+    mtxprt->mtxp_progress = 0;
+    xprt->xp_p2 = NULL;
+    xprt->xp_p1 = (caddr_t)p1;
+    xprt->xp_verf = _null_auth;
+    xprt->xp_addrlen = 0;
+    xprt->xp_ops = ops;
+    xprt->xp_port = port;
+    xprt->xp_sock = sock;
+
+    mtxprt->mtxp_creator = pthread_self();
+    mtxprt->mtxp_id = XPRT_ID_INVALID;
+    mtxprt->mtxp_clone  = NULL;
+    mtxprt->mtxp_parent = NO_PARENT;
+    mtxprt->mtxp_refcnt = 0;
+    memcpy(mtxprt->mtxp_guard, MTXPRT_GUARD, sizeof (mtxprt->mtxp_guard));
+    xprt_unlock(xprt);
+    xprt_register(xprt);
+    return (xprt);
+}
+
+/*
+ * Usage:
+ *      xprt = svcshm_create(path, nslots, slotsize);
+ *
+ * Listen for shared-memory clients on the AF_UNIX socket, @var{path},
+ * which must not already exist.  Each client gets rings of @var{nslots}
+ * slots of @var{slotsize} bytes, each way; 0 means use the default.
+ * A message, call or reply, must fit in one slot, less SHM_SLOT_HDR.
+ *
+ * Returns the rendezvouser, or NULL if there was a problem.
+ * Like a TCP rendezvouser, it is registered in @var{xports}, and
+ * its @member{xp_port} is not 0; it is -1, as for AF_UNIX.
+ */
+SVCXPRT *
+svcshm_create(const char *path, u_int nslots, u_int slotsize)
+{
+    struct shm_rendezvous *r;
+    struct sockaddr_un addr;
+    socklen_t len;
+    size_t pathlen;
+    int sock;
+
+    tprintf(2, "path='%s', nslots=%u, slotsize=%u\n", path, nslots, slotsize);
+    if (nslots == 0) {
+        nslots = SHM_NSLOTS;
+    }
+    if (slotsize == 0) {
+        slotsize = SHM_SLOTSIZE;
+    }
+    slotsize = (slotsize + 7) & ~7U;
+    if ((nslots & (nslots - 1)) != 0 || nslots < 2 || nslots > SHM_NSLOTS_MAX
+        || slotsize < SHM_SLOTSIZE_MIN || slotsize > SHM_SLOTSIZE_MAX) {
+        svc_perror(EINVAL, "svc_shm.c - svcshm_create: bad ring geometry");
+        return ((SVCXPRT *)NULL);
+    }
+
+    pathlen = strlen(path);
+    if (pathlen >= sizeof (addr.sun_path)) {
+        svc_perror(ENAMETOOLONG, "svc_shm.c - svcshm_create: path is too long");
+        return ((SVCXPRT *)NULL);
+    }
+
+    sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        svc_perror(errno, "svc_shm.c - socket creation problem");
+        return ((SVCXPRT *)NULL);
+    }
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, pathlen + 1);
+    len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + pathlen + 1);
+    if (bind(sock, (struct sockaddr *)&addr, len) != 0
+        || listen(sock, SOMAXCONN) != 0) {
+        svc_perror(errno, "svc_shm.c - svcshm_create: cannot listen");
+        (void) close(sock);
+        return ((SVCXPRT *)NULL);
+    }
+
+    r = (struct shm_rendezvous *)guard_malloc(sizeof (*r));
+    r->nslots = nslots;
+    r->slotsize = slotsize;
+    // A rendezvouser never receives a request, so it needs no credentials.
+    return (shm_xprt_construct(sock, &svcshm_rendezvous_op, r, sizeof (*r),
+        0, (u_short)-1));
+}
+
+/*
+ * Make the region and the doorbells for a new client on @var{conn_sock},
+ * hand them over, and make the connection SVCXPRT.
+ * On failure, close everything and return NULL.
+ */
+static SVCXPRT *
+shm_conn_create(struct shm_rendezvous *r, int conn_sock)
+{
+    struct shm_conn *cd;
+    struct shm_region *sh;
+    struct shm_hello hello;
+    struct epoll_event ev;
+    struct msghdr mh;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof (int))];
+    } cmsg;
+    struct cmsghdr *cm;
+    int fds[3];
+    size_t maplen;
+    int memfd;
+    int call_efd;
+    int reply_efd;
+    int epfd;
+    int err;
+
+    memfd = call_efd = reply_efd = epfd = -1;
+    sh = (struct shm_region *)MAP_FAILED;
+    maplen = shm_region_size(r->nslots, r->slotsize);
+
+    memfd = memfd_create("rpc-shm", MFD_CLOEXEC);
+    if (memfd < 0 || ftruncate(memfd, (off_t)maplen) != 0) {
+        goto fail;
+    }
+    sh = (struct shm_region *)mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+        MAP_SHARED, memfd, 0);
+    if (sh == (struct shm_region *)MAP_FAILED) {
+        goto fail;
+    }
+    sh->sh_magic = SHM_MAGIC;
+    sh->sh_version = SHM_VERSION;
+    sh->sh_nslots = r->nslots;
+    sh->sh_slotsize = r->slotsize;
+    // Nothing to do until the first call; ask for the doorbell.
+    sh->sh_ring[SHM_CALL].sr_armed = 1;
+
+    // The client writes call_efd, blocks on reply_efd; we never block.
+    call_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    reply_efd = eventfd(0, EFD_CLOEXEC);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (call_efd < 0 || reply_efd < 0 || epfd < 0) {
+        goto fail;
+    }
+    memset(&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = call_efd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, call_efd, &ev) != 0) {
+        goto fail;
+    }
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = conn_sock;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn_sock, &ev) != 0) {
+        goto fail;
+    }
+
+    hello.sh_magic = SHM_MAGIC;
+    hello.sh_version = SHM_VERSION;
+    hello.sh_nslots = r->nslots;
+    hello.sh_slotsize = r->slotsize;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof (hello);
+    memset(&mh, 0, sizeof (mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = cmsg.buf;
+    mh.msg_controllen = sizeof (cmsg.buf);
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof (fds));
+    fds[0] = memfd;
+    fds[1] = call_efd;
+    fds[2] = reply_efd;
+    memcpy(CMSG_DATA(cm), fds, sizeof (fds));
+    if (sendmsg(conn_sock, &mh, MSG_NOSIGNAL) != (ssize_t)sizeof (hello)) {
+        goto fail;
+    }
+    // The mapping keeps the region; the client has its own fd.
+    (void) close(memfd);
+
+    cd = (struct shm_conn *)guard_malloc(sizeof (*cd));
+    memset(cd, 0, sizeof (*cd));
+    cd->region = sh;
+    cd->maplen = maplen;
+    cd->nslots = r->nslots;
+    cd->slotsize = r->slotsize;
+    cd->conn_sock = conn_sock;
+    cd->call_efd = call_efd;
+    cd->reply_efd = reply_efd;
+    cd->stat = XPRT_IDLE;
+    cd->call_held = false;
+    cd->armed = true;
+    tprintf(2, "conn_sock=%d, epfd=%d, region=%s, %zu bytes\n",
+        conn_sock, epfd, decode_addr(sh), maplen);
+    return (shm_xprt_construct(epfd, &svcshm_op, cd,
+        sizeof (*cd) + maplen, RQCRED_AREA_SIZE, 0));
+
+fail:
+    err = errno;
+    svc_perror(err, "svc_shm.c - cannot set up a client");
+    if (sh != (struct shm_region *)MAP_FAILED) {
+        (void) munmap(sh, maplen);
+    }
+    if (memfd >= 0) {
+        (void) close(memfd);
+    }
+    if (call_efd >= 0) {
+        (void) close(call_efd);
+    }
+    if (reply_efd >= 0) {
+        (void) close(reply_efd);
+    }
+    if (epfd >= 0) {
+        (void) close(epfd);
+    }
+    (void) close(conn_sock);
+    return ((SVCXPRT *)NULL);
+}
+
+static bool_t
+shm_rendezvous_request(SVCXPRT *xprt, struct rpc_msg *errmsg)
+{
+    struct shm_rendezvous *r;
+    int conn_sock;
+    int n;
+
+    (void) errmsg;
+    r = (struct shm_rendezvous *)xprt->xp_p1;
+    for (n = 0; n < SHM_ACCEPT_BATCH; ++n) {
+        conn_sock = accept4(xprt->xp_sock, NULL, NULL,
+            SOCK_CLOEXEC | SOCK_NONBLOCK);
+        tprintf(2, "accept(%d) => %d\n", xprt->xp_sock, conn_sock);
+        if (conn_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && n == 0) {
+                svc_accept_failed();
+            }
+            break;
+        }
+        (void) shm_conn_create(r, conn_sock);
+    }
+    return (FALSE);             /* There is never an rpc msg to be processed */
+}
+
+static enum xprt_stat
+shm_rendezvous_stat(SVCXPRT *xprt  __attribute__((unused)))
+{
+    return (XPRT_IDLE);
+}
+
+/*
+ * Unregister before closing anything, so that a new socket that
+ * gets the same fd number does not lose its slot, or its poll entry.
+ */
+static void
+shm_unregister(SVCXPRT *xprt)
+{
+    xprt_set_busy(xprt, 1);
+    xports_global_lock();
+    xprt_unregister(xprt);
+    xports_global_unlock();
+}
+
+static void
+shm_free(SVCXPRT *xprt)
+{
+    xprt_unlock(xprt);
+    xports_global_lock();
+    xprt_footprint_release(xprt);
+    free(xprt);
+    xports_global_unlock();
+}
+
+static void
+shm_rendezvous_destroy(SVCXPRT *xprt)
+{
+    shm_unregister(xprt);
+    xprt_lock(xprt);
+    tprintf(2, "xprt=%s, fd=%d\n", decode_addr(xprt), xprt->xp_sock);
+    (void) close(xprt->xp_sock);
+    free(xprt->xp_p1);
+    shm_free(xprt);
+}
+
+/*
+ * The call at the head of the call ring is finished with.
+ * Give its slot back to the client.
+ */
+static void
+shm_call_release(struct shm_conn *cd)
+{
+    struct shm_ring *r;
+
+    if (cd->call_held) {
+        r = &(cd->region->sh_ring[SHM_CALL]);
+        XDR_DESTROY(&(cd->xdrs));
+        __atomic_store_n(&r->sr_head, r->sr_head + 1, __ATOMIC_RELEASE);
+        cd->call_held = false;
+    }
+}
+
+/*
+ * Has the client hung up?  Ask only when there is nothing in the ring.
+ */
+static bool
+shm_peer_gone(struct shm_conn *cd)
+{
+    char c;
+    ssize_t n;
+
+    if (__atomic_load_n(&(cd->region->sh_closed), __ATOMIC_ACQUIRE)) {
+        return (true);
+    }
+    n = recv(cd->conn_sock, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+    return (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+        && errno != EINTR));
+}
+
+static bool_t
+svcshm_recv(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+    struct shm_conn *cd;
+    struct shm_ring *r;
+    char *slot;
+    uint32_t head;
+    uint32_t len;
+    uint64_t count;
+    bool_t rv;
+
+    tprintf(2, "xprt=%s, msg=%s, fd=%d\n",
+        decode_addr(xprt), decode_addr(msg), xprt->xp_sock);
+    xprt_lock(xprt);
+    xprt_progress_clrbits(xprt, XPRT_DONE_RECV);
+    cd = (struct shm_conn *)(xprt->xp_p1);
+    r = &(cd->region->sh_ring[SHM_CALL]);
+
+    // The last call may not have called svc_getargs().
+    shm_call_release(cd);
+
+    head = r->sr_head;
+    rv = FALSE;
+    if (__atomic_load_n(&r->sr_tail, __ATOMIC_ACQUIRE) == head) {
+        // Woken by the doorbell, or by a hang-up.
+        (void) read(cd->call_efd, &count, sizeof (count));
+        cd->armed = false;
+        if (shm_peer_gone(cd)) {
+            cd->stat = XPRT_DIED;
+        }
+    }
+    else {
+        slot = shm_slot(cd->region, cd->nslots, cd->slotsize, SHM_CALL, head);
+        memcpy(&len, slot, sizeof (len));
+        if (len > cd->slotsize - SHM_SLOT_HDR) {
+            cd->stat = XPRT_DIED;
+        }
+        else {
+            xdrmem_create(&(cd->xdrs), slot + SHM_SLOT_HDR, len, XDR_DECODE);
+            cd->call_held = true;
+            if (xdr_callmsg(&(cd->xdrs), msg)) {
+                cd->x_id = msg->rm_xid;
+                rv = TRUE;
+            }
+            else {
+                shm_call_release(cd);
+            }
+        }
+    }
+    xprt_progress_setbits(xprt, XPRT_DONE_RECV);
+    xprt_unlock(xprt);
+    return (rv);
+}
+
+static enum xprt_stat
+svcshm_stat(SVCXPRT *xprt)
+{
+    struct shm_conn *cd;
+    struct shm_ring *r;
+    uint32_t head;
+    uint64_t count;
+
+    cd = (struct shm_conn *)(xprt->xp_p1);
+    if (cd->stat == XPRT_DIED) {
+        return (XPRT_DIED);
+    }
+    r = &(cd->region->sh_ring[SHM_CALL]);
+
+    /*
+     * While a call is held, sr_head still points at it,
+     * so look past it.
+     */
+    head = r->sr_head + (cd->call_held ? 1 : 0);
+    if (__atomic_load_n(&r->sr_tail, __ATOMIC_ACQUIRE) != head) {
+        return (XPRT_MOREREQS);
+    }
+
+    /*
+     * Going idle.  If the client took our last request for
+     * the doorbell, and rang it, clear it now, rather than be
+     * woken up for nothing.
+     */
+    if (cd->armed && __atomic_load_n(&r->sr_armed, __ATOMIC_ACQUIRE) == 0) {
+        (void) read(cd->call_efd, &count, sizeof (count));
+    }
+    cd->armed = true;
+    if (!shm_ring_arm(r, head)) {
+        return (XPRT_MOREREQS);
+    }
+    return (XPRT_IDLE);
+}
+
+static bool_t
+svcshm_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, caddr_t args_ptr)
+{
+    extern size_t cnt_getargs;
+    struct shm_conn *cd;
+    mtxprt_t *mtxprt;
+    bool_t rv;
+
+    __sync_fetch_and_add(&cnt_getargs, 1);
+    tprintf(2, "xprt=%s, args_ptr=%s, fd=%d\n",
+        decode_addr(xprt), decode_addr(args_ptr), xprt->xp_sock);
+
+    shm_unregister(xprt);
+    xprt_lock(xprt);
+    cd = (struct shm_conn *)(xprt->xp_p1);
+    if (cd->call_held) {
+        rv = (*xdr_args) (&(cd->xdrs), args_ptr);
+        shm_call_release(cd);
+    }
+    else {
+        rv = FALSE;
+    }
+    xprt_set_busy(xprt, 0);
+
+    xprt_progress_setbits(xprt, XPRT_GETARGS);
+    mtxprt = xprt_to_mtxprt(xprt);
+    if (wait_method_tcp == WAIT_MUTEX) {
+        pthread_mutex_unlock(&mtxprt->mtxp_mtready);
+    }
+    else {
+        xprt_set_busy(xprt, 1);
+    }
+    xprt_unlock(xprt);
+    return (rv);
+}
+
+static bool_t
+svcshm_freeargs(SVCXPRT *xprt, xdrproc_t xdr_args, caddr_t args_ptr)
+{
+    extern size_t cnt_freeargs;
+    XDR xdrs;
+    bool_t rv;
+
+    __sync_fetch_and_add(&cnt_freeargs, 1);
+    memset(&xdrs, 0, sizeof (xdrs));
+    xdrs.x_op = XDR_FREE;
+    rv = (*xdr_args) (&xdrs, args_ptr);
+    xprt_progress_setbits(xprt, XPRT_FREEARGS);
+    return (rv);
+}
+
+/*
+ * Encode the reply straight into the next slot of the reply ring.
+ * If it does not fit, the client gets SYSTEM_ERR instead, rather
+ * than wait for a reply that will never come.
+ */
+static bool_t
+svcshm_reply(SVCXPRT *xprt, struct rpc_msg *msg)
+{
+    extern size_t cnt_reply;
+    struct shm_conn *cd;
+    struct shm_ring *r;
+    struct rpc_msg errmsg;
+    XDR xdrs;
+    char *slot;
+    uint32_t tail;
+    uint32_t len;
+    bool_t stat;
+
+    tprintf(2, "xprt=%s, msg=%s, fd=%d\n",
+        decode_addr(xprt), decode_addr(msg), xprt->xp_sock);
+    __sync_fetch_and_add(&cnt_reply, 1);
+    xprt_lock(xprt);
+    cd = (struct shm_conn *)(xprt->xp_p1);
+    shm_call_release(cd);
+    r = &(cd->region->sh_ring[SHM_REPLY]);
+    tail = r->sr_tail;
+
+    // The client is not taking its replies.  Do not wait for it.
+    if (tail - __atomic_load_n(&r->sr_head, __ATOMIC_ACQUIRE) >= cd->nslots) {
+        stat = FALSE;
+    }
+    else {
+        slot = shm_slot(cd->region, cd->nslots, cd->slotsize, SHM_REPLY, tail);
+        msg->rm_xid = cd->x_id;
+        xdrmem_create(&xdrs, slot + SHM_SLOT_HDR,
+            cd->slotsize - SHM_SLOT_HDR, XDR_ENCODE);
+        stat = xdr_replymsg(&xdrs, msg);
+        if (!stat) {
+            XDR_DESTROY(&xdrs);
+            memset(&errmsg, 0, sizeof (errmsg));
+            errmsg.rm_xid = cd->x_id;
+            errmsg.rm_direction = REPLY;
+            errmsg.rm_reply.rp_stat = MSG_ACCEPTED;
+            errmsg.acpted_rply.ar_verf = xprt->xp_verf;
+            errmsg.acpted_rply.ar_stat = SYSTEM_ERR;
+            xdrmem_create(&xdrs, slot + SHM_SLOT_HDR,
+                cd->slotsize - SHM_SLOT_HDR, XDR_ENCODE);
+            (void) xdr_replymsg(&xdrs, &errmsg);
+        }
+        len = XDR_GETPOS(&xdrs);
+        XDR_DESTROY(&xdrs);
+        memcpy(slot, &len, sizeof (len));
+        shm_ring_publish(r, tail + 1, cd->reply_efd);
+    }
+    xprt_progress_setbits(xprt, XPRT_REPLY);
+    xprt_unlock(xprt);
+    return (stat);
+}
+
+static void
+svcshm_destroy(SVCXPRT *xprt)
+{
+    struct shm_conn *cd;
+    uint64_t one = 1;
+
+    shm_unregister(xprt);
+    xprt_lock(xprt);
+    cd = (struct shm_conn *)(xprt->xp_p1);
+    tprintf(2, "xprt=%s, fd=%d, conn_sock=%d\n",
+        decode_addr(xprt), xprt->xp_sock, cd->conn_sock);
+
+    // Wake up a client that is waiting for a reply.
+    __atomic_store_n(&(cd->region->sh_closed), 1, __ATOMIC_RELEASE);
+    (void) write(cd->reply_efd, &one, sizeof (one));
+
+    if (cd->call_held) {
+        XDR_DESTROY(&(cd->xdrs));
+    }
+    (void) munmap(cd->region, cd->maplen);
+    (void) close(cd->call_efd);
+    (void) close(cd->reply_efd);
+    (void) close(cd->conn_sock);
+    (void) close(xprt->xp_sock);
+    free(cd);
+    shm_free(xprt);
+}
@@ -0,0 +1,179 @@
+/*
+ * Filename: svc_shm.h
+ * Project: rpc-mt
+ * Brief: Shared-memory ring transport for clients on the same host
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_SHM_H
+#define _SVC_SHM_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>      // Import uint32_t, uint64_t
+#include <stdbool.h>     // Import bool
+#include <unistd.h>      // Import write()
+#include <rpc/rpc.h>     // Import SVCXPRT, CLIENT
+
+/*
+ * Shared-memory transport
+ * -----------------------
+ * svcshm_create(path, nslots, slotsize) listens on the AF_UNIX
+ * (SOCK_SEQPACKET) socket, @var{path}.  For each client that connects,
+ * the server makes a shared memory region (memfd) holding two rings:
+ * one for calls, from client to server, and one for replies,
+ * from server to client.  Each ring has one producer and one consumer.
+ * The memfd and two eventfds, one doorbell for each ring, are handed
+ * to the client over the socket (SCM_RIGHTS).  After that, the socket
+ * is used only to find out when the client goes away.
+ *
+ * Each message takes one slot: a length word, then the XDR bytes
+ * of the RPC message, with no record marks.  The server decodes a call
+ * right where it lies in its slot, with xdrmem, and encodes the reply
+ * straight into the next slot of the reply ring.  So, a call and its
+ * reply are each written once and read once, and no system call is
+ * needed to move them.
+ *
+ * Doorbells
+ * ---------
+ * A consumer that finds its ring empty sets @member{sr_armed}, checks
+ * the ring once more, then sleeps on the eventfd.  A producer rings
+ * the doorbell only if it finds @member{sr_armed} set, and clears it.
+ * So, while both sides are busy, there are no system calls at all.
+ *
+ * On the server side, each connection is an ordinary SVCXPRT,
+ * registered in @var{xports}.  Its @member{xp_sock} is an epoll fd,
+ * which is readable when the doorbell has been rung, or when
+ * the client has hung up.
+ *
+ * The server trusts nothing in the region but the bytes of messages.
+ * Sizes come from its own copies; lengths are checked.
+ *
+ * The epoll fds are not sockets, so the io_uring engine does not
+ * watch them (see svc_uring.h).  Use the poll engine, the default,
+ * with shared-memory clients.
+ *
+ * clntshm_create(path, prog, vers) connects to such a server, and
+ * returns an ordinary CLIENT handle.  A handle carries one call at
+ * a time; a thread that calls while another call is in progress waits
+ * its turn.
+ */
+
+#define SHM_MAGIC        0x52504353     /* "RPCS" */
+#define SHM_VERSION      1
+
+#define SHM_NSLOTS       64             /* default; a power of 2 */
+#define SHM_NSLOTS_MAX   4096
+#define SHM_SLOTSIZE     (16 * 1024)    /* default */
+#define SHM_SLOTSIZE_MIN 1024
+#define SHM_SLOTSIZE_MAX (1024 * 1024)
+
+#define SHM_CALL  0
+#define SHM_REPLY 1
+
+#define SHM_ALIGNED __attribute__((aligned(64)))
+
+struct shm_ring {
+    uint32_t sr_head SHM_ALIGNED;       /* next slot to take; consumer writes */
+    uint32_t sr_armed;                  /* consumer sleeps; ring the doorbell */
+    uint32_t sr_tail SHM_ALIGNED;       /* next slot to fill; producer writes */
+};
+
+struct shm_region {
+    uint32_t        sh_magic;
+    uint32_t        sh_version;
+    uint32_t        sh_nslots;
+    uint32_t        sh_slotsize;
+    uint32_t        sh_closed;          /* either side has gone away */
+    struct shm_ring sh_ring[2] SHM_ALIGNED;
+};
+
+/*
+ * Slots start on a page boundary, after the header.
+ * Each slot is a length word, padding, then the message.
+ */
+#define SHM_SLOTS_OFFSET 4096
+#define SHM_SLOT_HDR     8
+
+/*
+ * What the server sends, along with the three fds.
+ */
+struct shm_hello {
+    uint32_t sh_magic;
+    uint32_t sh_version;
+    uint32_t sh_nslots;
+    uint32_t sh_slotsize;
+};
+
+static inline size_t
+shm_region_size(uint32_t nslots, uint32_t slotsize)
+{
+    return (SHM_SLOTS_OFFSET + 2 * (size_t)nslots * slotsize);
+}
+
+/*
+ * Address of slot @var{idx} of ring @var{ring}.  @var{nslots} and
+ * @var{slotsize} must be the caller's own copies, not those in the region.
+ */
+static inline char *
+shm_slot(struct shm_region *sh, uint32_t nslots, uint32_t slotsize,
+    int ring, uint32_t idx)
+{
+    size_t n;
+
+    n = (size_t)ring * nslots + (idx & (nslots - 1));
+    return ((char *)sh + SHM_SLOTS_OFFSET + n * slotsize);
+}
+
+/*
+ * Producer: make the slot at @var{tail} visible, and ring the doorbell,
+ * @var{efd}, if the consumer is asleep.
+ */
+static inline void
+shm_ring_publish(struct shm_ring *r, uint32_t tail, int efd)
+{
+    uint64_t one = 1;
+
+    __atomic_store_n(&r->sr_tail, tail, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->sr_armed, __ATOMIC_SEQ_CST) != 0
+        && __atomic_exchange_n(&r->sr_armed, 0, __ATOMIC_SEQ_CST) != 0) {
+        (void) write(efd, &one, sizeof (one));
+    }
+}
+
+/*
+ * Consumer: about to sleep.  Ask for the doorbell, then look again.
+ * Return true if the ring is still empty, and it is safe to sleep.
+ */
+static inline bool
+shm_ring_arm(struct shm_ring *r, uint32_t head)
+{
+    __atomic_store_n(&r->sr_armed, 1, __ATOMIC_SEQ_CST);
+    return (__atomic_load_n(&r->sr_tail, __ATOMIC_SEQ_CST) == head);
+}
+
+extern SVCXPRT *svcshm_create(const char *path, u_int nslots, u_int slotsize);
+extern CLIENT *clntshm_create(const char *path, u_long prog, u_long vers);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_SHM_H */
@@ -32,7 +32,8 @@
  *
  * Actually implements two flavors of transporter -
  * a tcp rendezvouser (a listener and connection establisher)
- * and a record/tcp stream.
+ * and a record/tcp stream.  Both also come in an AF_UNIX flavor;
+ * see svcunix_create().
  */
 
 /*
@@ -44,6 +45,7 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -51,25 +53,35 @@
 #include <libintl.h>
 #include <rpc/rpc.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/poll.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <time.h>
 #include <sys/stat.h>
 
 #include "svc_mtxprt.h"
 #include "svc_debug.h"
+#include "svc_config.h"
+#include "svc_reactor.h"
 #include "svc_tcp_impl.h"
+#include "svc_uring.h"
+#include "svc_drc.h"
+#include "bitvec.h"
+#include "xdr_rec.h"
 
 #define UNUSED(x) (void)(x)
 
 extern void xports_global_lock(void);
 extern void xports_global_unlock(void);
-extern SVCXPRT *alloc_xprt(void);
 extern void xprt_lock(SVCXPRT *);
+extern int  xprt_trylock(SVCXPRT *);
 extern void xprt_unlock(SVCXPRT *);
 extern int  xprt_progress_setbits(SVCXPRT *, int);
 extern int  xprt_progress_clrbits(SVCXPRT *, int);
 extern void xprt_set_busy(SVCXPRT *, int);
+extern void xprt_register_batch(SVCXPRT **, size_t);
 
 extern void svc_perror(int, const char *);
 extern void svc_accept_failed(void);
@@ -113,6 +125,20 @@ static const xp_ops_t svctcp_op = {
     svctcp_destroy
 };
 
+/*
+ * Ops vector for AF_UNIX connections.  The same functions as svctcp_op;
+ * it is a separate vector only so that svcunix_authenticate() can tell
+ * a local connection from a TCP connection.
+ */
+static const xp_ops_t svcunix_op = {
+    svctcp_recv,
+    svctcp_stat,
+    svctcp_getargs,
+    svctcp_reply,
+    svctcp_freeargs,
+    svctcp_destroy
+};
+
 /*
  * Ops vector for TCP/IP rendezvous handler
  */
@@ -147,12 +173,48 @@ static const xp_ops_t svctcp_rendezvous_op = {
  */
 static int readtcp(char *, char *, int);
 static int writetcp(char *, char *, int);
+
+/*
+ * Calls of up to this many bytes are loaded whole, before they are
+ * decoded; see xdrrec_recordmode().  Bigger ones are loaded up to
+ * this size, and the rest is streamed.
+ */
+#define TCP_MAX_RECORD (256 * 1024)
+
+/*
+ * A connection with no calls for this many seconds gives its stream
+ * buffers back to the pool; see svctcp_release_idle().
+ */
+#define TCP_IDLE_RELEASE 1
 static SVCXPRT *makefd_xprt(int, u_int, u_int);
+static SVCXPRT *makefd_xprt_construct(int, u_int, u_int);
+
+/*
+ * Maximum number of connections to accept for one readiness event
+ * on a rendezvous socket.  Whatever is left in the accept queue
+ * gets picked up the next time around the main loop.
+ */
+#define ACCEPT_BATCH 64
 
 /* kept in xprt->xp_p1 */
 struct tcp_rendezvous {
     u_int sendsize;
     u_int recvsize;
+    int family;                         /* AF_INET, or AF_UNIX */
+    int sockflags;                      /* F_GETFL of the socket we were given */
+};
+
+/*
+ * Identity of the process at the other end of an AF_UNIX connection,
+ * as the kernel tells it (SO_PEERCRED), when the connection is accepted.
+ * See svcunix_authenticate().
+ */
+struct unix_peer {
+    pid_t up_pid;
+    uid_t up_uid;
+    gid_t up_gid;
+    u_int up_ngroups;
+    gid_t up_groups[NGRPS];
 };
 
 /* kept in xprt->xp_p1 */
@@ -161,8 +223,180 @@ struct tcp_conn {
     u_long x_id;
     XDR xdrs;
     char verf_body[MAX_AUTH_BYTES];
+    struct drc_key drc_key;             /* key of the last call received */
+    bool drc_keyed;                     /* drc_key is good */
+    struct unix_peer *peer;             /* AF_UNIX only; else NULL */
+    time_t last_active;                 /* last call or reply */
+    char *replay;                       /* cached replies not yet written */
+    size_t replay_len;
+    size_t replay_off;
 };
 
+/*
+ * Duplicate request cache for TCP
+ * -------------------------------
+ * A client that reconnects after a network blip retransmits calls
+ * that it never got a reply to, on the new connection.
+ * svctcp_enablecache() turns on one cache, shared by all TCP
+ * connections, with one memory budget.  See svc_drc.h.
+ *
+ * The key is (peer IP address, prog, vers, proc, xid), plus a checksum
+ * of the arguments.  The peer port is left out, because a client that
+ * reconnects does so from a new ephemeral port.  Many clients behind
+ * one NAT address, or on one host, can use the same xids; the checksum
+ * keeps a call from one of them, or a new call that happens to reuse
+ * an xid, from getting the reply to another.
+ *
+ * What is cached is the exact bytes that writetcp() wrote for the
+ * reply, record marks and all.  While svctcp_reply() encodes a reply,
+ * writetcp() copies whatever it writes into a per-thread capture buffer.
+ *
+ * When svctcp_recv() finds a retransmission, it does not dispatch
+ * the call; it queues the cached bytes on the connection, the way
+ * a reply is queued, and never waits for the client to read them.
+ * See tcp_drc_replay().
+ */
+static drc_t *tcp_drc;
+
+struct tcp_drc_buf {
+    SVCXPRT *xprt;          /* connection being captured, or NULL */
+    char    *buf;
+    size_t   size;
+    size_t   len;
+    bool     overflow;
+};
+
+static __thread struct tcp_drc_buf tcp_drc_tls;
+
+/*
+ * The call that this thread is serving.
+ *
+ * Calls pipelined on one connection are received one after another,
+ * while earlier ones may still be running; so, @member{x_id} and
+ * @member{drc_key} in @type{struct tcp_conn} belong to the last call
+ * received, not to the one being replied to.  svctcp_getargs() moves
+ * them here, on the thread that serves the call, and svctcp_reply()
+ * takes them from here.  A reply with no getargs() before it,
+ * such as svcerr_noproc(), uses the ones in @type{struct tcp_conn}.
+ */
+struct tcp_call {
+    SVCXPRT *xprt;              /* connection, or NULL if none */
+    u_long x_id;
+    struct drc_key drc_key;
+    bool drc_keyed;
+};
+
+static __thread struct tcp_call tcp_call_tls;
+
+/*
+ * Construct and register a rendezvouser on the listening socket, @var{sock}.
+ * Connections accepted on it get buffers of @var{sendsize} and
+ * @var{recvsize}.  @var{family} is the address family of the socket.
+ * @var{port} is the port it listens on, or -1 for AF_UNIX;
+ * either way, it is not 0, because that means a connection.
+ * @var{sockflags} are the file status flags the socket had before
+ * rendezvous_nonblock(), or -1 if there are none to put back.
+ */
+static SVCXPRT *
+rendezvous_construct(int sock, u_int sendsize, u_int recvsize,
+    int family, u_short port, int sockflags)
+{
+    SVCXPRT *xprt;
+    mtxprt_t *mtxprt;
+    struct tcp_rendezvous *r;
+
+    r = (struct tcp_rendezvous *)guard_malloc(sizeof (*r));
+    // A rendezvouser never receives a request, so it needs no credentials.
+    xprt = alloc_xprt(0);
+
+    /*
+     * Constructor for @type{SVCXPRT}, including the additional @type{mtxprt_t}
+     * Order of construction is important.
+     * We want to create a lock for each @type{SVCXPRT}.
+     * The rest of the contructor should all be done while the lock is held.
+     * Even if it is not _really_ necessary, it will keep Valgrind/Helgrind
+     * happy.  And they are our friends.
+     * Second step is to initialize the "magic" value, so that other
+     * helper functions that validate it will be happy.
+     */
+
+    mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    xprt_ext_attach(xprt, 0);
+    xprt_footprint_add(xprt, sizeof (*r));
+
+    if (pthread_mutex_init(&(mtxprt->mtxp_lock), NULL) != 0) {
+        abort();
+    }
+
+    if (pthread_mutex_init(&(mtxprt->mtxp_mtready), NULL) != 0) {
+        abort();
+    }
+
+    // Start off locked.  svctcp_getargs() will unlock it.
+    if (pthread_mutex_lock(&(mtxprt->mtxp_mtready)) != 0) {
+        abort();
+    }
+
+    /*
+     * Do not use xprt_lock(xprt) here.
+     * The constructor has not progressed far enough, yet.
+     */
+    if (svc_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
+        abort();
+    }
+
+    /*
+     * Set "magic", right away.
+     * Other functions validate it.  Keep them happy.
+     */
+    mtxprt->mtxp_magic = MTXPRT_MAGIC;
+
+    r->sendsize = sendsize;
+    r->recvsize = recvsize;
+    r->family = family;
+    r->sockflags = sockflags;
+    mtxprt->mtxp_progress = 0;
+    xprt->xp_p2 = NULL;
+    xprt->xp_p1 = (caddr_t)r;
+    xprt->xp_verf = _null_auth;
+    xprt->xp_ops = &svctcp_rendezvous_op;
+    xprt->xp_port = port;
+    xprt->xp_sock = sock;
+
+    mtxprt->mtxp_creator = pthread_self();
+    mtxprt->mtxp_id = XPRT_ID_INVALID;
+    mtxprt->mtxp_clone  = NULL;
+    mtxprt->mtxp_parent = NO_PARENT;
+    mtxprt->mtxp_refcnt = 0;
+    memcpy(mtxprt->mtxp_guard, MTXPRT_GUARD, sizeof (mtxprt->mtxp_guard));
+    xprt_unlock(xprt);
+    xprt_register(xprt);
+    return (xprt);
+}
+
+/*
+ * rendezvous_request() drains the accept queue,
+ * so accept() must not block when the queue is empty.
+ * Make the listening socket non-blocking.
+ *
+ * O_NONBLOCK belongs to the open file, so it is seen through every
+ * descriptor for it, not just ours.  For a socket that the caller gave
+ * us, return the flags it had, so that svctcp_destroy() can put them
+ * back; for a socket we made, return -1.
+ */
+static int
+rendezvous_nonblock(int sock, bool_t madesock)
+{
+    int flags;
+
+    flags = fcntl(sock, F_GETFL);
+    if (flags == -1 || (flags & O_NONBLOCK) != 0) {
+        return (-1);
+    }
+    (void) fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    return (madesock ? -1 : flags);
+}
+
 /*
  * Usage:
  *      xprt = svctcp_create(sock, send_buf_size, recv_buf_size);
@@ -182,17 +416,20 @@ struct tcp_conn {
  * Since tcp streams do buffered io similar to stdio, the caller can specify
  * how big the send and receive buffers are via the second and third parms;
  * 0 => use the system default.
+ *
+ * The listening socket is made non-blocking.  If the caller gave us
+ * @var{sock}, its old file status flags are put back when the
+ * transporter is destroyed, just before the socket is closed.
+ * Until then, other descriptors for the same socket see O_NONBLOCK.
  */
 SVCXPRT *
 svctcp_create_with_lock(int sock, u_int sendsize, u_int recvsize)
 {
     bool_t madesock;
-    SVCXPRT *xprt;
-    mtxprt_t *mtxprt;
-    struct tcp_rendezvous *r;
     struct sockaddr_in addr;
     socklen_t len;
     int ret;
+    int sockflags;
     int err;
 
 #ifdef DEBUG_BUFSIZE_8K
@@ -217,6 +454,9 @@ svctcp_create_with_lock(int sock, u_int sendsize, u_int recvsize)
             return ((SVCXPRT *)NULL);
         }
         madesock = TRUE;
+        if (svc_reactors > 1) {
+            svc_set_reuseport(sock);
+        }
     }
     bzero((char *)&addr, sizeof (addr));
     addr.sin_family = AF_INET;
@@ -245,110 +485,316 @@ svctcp_create_with_lock(int sock, u_int sendsize, u_int recvsize)
         return ((SVCXPRT *)NULL);
     }
 
-    r = (struct tcp_rendezvous *)guard_malloc(sizeof (*r));
-    xprt = alloc_xprt();
+    sockflags = rendezvous_nonblock(sock, madesock);
+    return (rendezvous_construct(sock, sendsize, recvsize, AF_INET,
+        ntohs(addr.sin_port), sockflags));
+}
 
-    /*
-     * Constructor for @type{SVCXPRT}, including the additional @type{mtxprt_t}
-     * Order of construction is important.
-     * We want to create a lock for each @type{SVCXPRT}.
-     * The rest of the contructor should all be done while the lock is held.
-     * Even if it is not _really_ necessary, it will keep Valgrind/Helgrind
-     * happy.  And they are our friends.
-     * Second step is to initialize the "magic" value, so that other
-     * helper functions that validate it will be happy.
-     */
+SVCXPRT *
+svctcp_create(int sock, u_int sendsize, u_int recvsize)
+{
+    SVCXPRT *xprt;
 
-    mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    xprt = svctcp_create_with_lock(sock, sendsize, recvsize);
+    return (xprt);
+}
 
-    if (pthread_mutex_init(&(mtxprt->mtxp_lock), NULL) != 0) {
-        abort();
+/*
+ * Make another rendezvouser, listening on the same address and port
+ * as @var{xprt}, with the same buffer sizes, for use by another reactor.
+ * The kernel spreads incoming connections across all of them.
+ * See svc_reactor.h.
+ */
+SVCXPRT *
+svctcp_reuseport_clone(SVCXPRT *xprt)
+{
+    SVCXPRT *rxprt;
+    struct tcp_rendezvous *r;
+    int sock;
+
+    r = (struct tcp_rendezvous *)xprt->xp_p1;
+    if (r->family == AF_UNIX) {
+        // An AF_UNIX path cannot be shared.  Reactor 0 serves it, alone.
+        return ((SVCXPRT *)NULL);
+    }
+    sock = svc_reuseport_socket(xprt->xp_sock, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return ((SVCXPRT *)NULL);
+    }
+    rxprt = svctcp_create(sock, r->sendsize, r->recvsize);
+    if (rxprt == NULL) {
+        (void) close(sock);
     }
+    return (rxprt);
+}
 
-    if (pthread_mutex_init(&(mtxprt->mtxp_progress_lock), NULL) != 0) {
-        abort();
+/*
+ * Like svctcp_create(), except the routine takes any *open* UNIX file
+ * descriptor as its first input.
+ */
+SVCXPRT *
+svcfd_create(int fd, u_int sendsize, u_int recvsize)
+{
+    tprintf(2, "fd=%d, sendsize=%u, recvsize=%u\n", fd, sendsize, recvsize);
+    return (makefd_xprt(fd, sendsize, recvsize));
+}
+
+static char unix_machname[MAX_MACHINE_NAME + 1];
+static pthread_once_t unix_machname_once = PTHREAD_ONCE_INIT;
+
+static void
+unix_machname_init(void)
+{
+    if (gethostname(unix_machname, sizeof (unix_machname) - 1) != 0) {
+        strcpy(unix_machname, "localhost");
     }
+}
 
-    if (pthread_mutex_init(&(mtxprt->mtxp_mtready), NULL) != 0) {
-        abort();
+/*
+ * Usage:
+ *      xprt = svcunix_create(sock, send_buf_size, recv_buf_size, path);
+ *
+ * Like svctcp_create(), but for AF_UNIX stream sockets.
+ * If sock<0 then a socket is created, else sock is used.
+ * The socket is bound to the filesystem name, @var{path},
+ * which must not already exist.
+ *
+ * Connections accepted on it are handled by the same code as TCP
+ * connections, and live in the same @var{xports}, fd region, and
+ * clone lifecycle.  The difference is that the identity of the
+ * client process is got from the kernel, once per connection;
+ * see svcunix_authenticate().
+ */
+SVCXPRT *
+svcunix_create(int sock, u_int sendsize, u_int recvsize, char *path)
+{
+    bool_t madesock;
+    struct sockaddr_un addr;
+    socklen_t len;
+    size_t pathlen;
+    int flags;
+    int err;
+
+    tprintf(2, "sock=%d, sendsize=%u, recvsize=%u, path='%s'\n",
+        sock, sendsize, recvsize, path);
+    pthread_once(&unix_machname_once, unix_machname_init);
+
+    pathlen = strlen(path);
+    if (pathlen >= sizeof (addr.sun_path)) {
+        svc_perror(ENAMETOOLONG, "svc_tcp.c - svcunix_create: path is too long");
+        return ((SVCXPRT *)NULL);
     }
 
-    // Start off locked.  svctcp_getargs() will unlock it.
-    if (pthread_mutex_lock(&(mtxprt->mtxp_mtready)) != 0) {
-        abort();
+    madesock = FALSE;
+    if (sock == RPC_ANYSOCK) {
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        tprintf(2, "socket() => %d\n", sock);
+        if (sock < 0) {
+            svc_perror(errno, "svc_tcp.c - AF_UNIX socket creation problem");
+            return ((SVCXPRT *)NULL);
+        }
+        madesock = TRUE;
     }
 
-    /*
-     * Do not use xprt_lock(xprt) here.
-     * The constructor has not progressed far enough, yet.
-     */
-    if (pthread_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
-        abort();
+    memset(&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, pathlen + 1);
+    len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + pathlen + 1);
+
+    // A socket we were given may already be bound.  That is fine.
+    if (bind(sock, (struct sockaddr *)&addr, len) != 0
+        && (madesock || errno != EINVAL)) {
+        err = errno;
+        svc_perror(err, "svc_tcp.c - svcunix_create: bind() failed");
+    }
+    else if (listen(sock, SOMAXCONN) != 0) {
+        err = errno;
+        svc_perror(err, "svc_tcp.c - svcunix_create: listen() failed");
+    }
+    else {
+        err = 0;
     }
 
-    /*
-     * Set "magic", right away.
-     * Other functions validate it.  Keep them happy.
-     */
-    mtxprt->mtxp_magic = MTXPRT_MAGIC;
+    if (err != 0) {
+        if (madesock) {
+            (void) close(sock);
+        }
+        return ((SVCXPRT *)NULL);
+    }
 
-    r->sendsize = sendsize;
-    r->recvsize = recvsize;
-    mtxprt->mtxp_progress = 0;
-    mtxprt->mtxp_busy = 0;
-    xprt->xp_p2 = NULL;
-    xprt->xp_p1 = (caddr_t)r;
-    xprt->xp_verf = _null_auth;
-    xprt->xp_ops = &svctcp_rendezvous_op;
-    xprt->xp_port = ntohs(addr.sin_port);
-    xprt->xp_sock = sock;
+    // See svctcp_create_with_lock().
+    flags = rendezvous_nonblock(sock, madesock);
+    return (rendezvous_construct(sock, sendsize, recvsize, AF_UNIX,
+        (u_short)-1, flags));
+}
 
-    mtxprt->mtxp_creator = pthread_self();
-    mtxprt->mtxp_id = XPRT_ID_INVALID;
-    mtxprt->mtxp_clone  = NULL;
-    mtxprt->mtxp_parent = NO_PARENT;
-    mtxprt->mtxp_refcnt = 0;
-#ifdef CHECK_CREDENTIALS
-    memset(mtxprt->mtxp_cred, 0, sizeof (mtxprt->mtxp_cred));
+/*
+ * Ask the kernel who is at the other end of the AF_UNIX connection,
+ * @var{xprt}.  The answer stays good for the life of the connection.
+ * Return NULL if it cannot tell us; calls on the connection are then
+ * authenticated the ordinary way, from the credentials they carry.
+ */
+static struct unix_peer *
+unix_peer_get(SVCXPRT *xprt)
+{
+    struct unix_peer *up;
+    struct ucred uc;
+    socklen_t len;
+
+    len = sizeof (uc);
+    if (getsockopt(xprt->xp_sock, SOL_SOCKET, SO_PEERCRED, &uc, &len) != 0) {
+        svc_perror(errno, "svc_tcp.c - getsockopt(SO_PEERCRED) failed");
+        return (NULL);
+    }
+
+    up = (struct unix_peer *)guard_malloc(sizeof (*up));
+    up->up_pid = uc.pid;
+    up->up_uid = uc.uid;
+    up->up_gid = uc.gid;
+    up->up_ngroups = 0;
+
+#ifdef SO_PEERGROUPS
+    {
+        gid_t groups[NGROUPS_MAX > 1024 ? 1024 : NGROUPS_MAX];
+        u_int n;
+
+        /*
+         * Supplementary groups, since Linux 4.13.  Like AUTH_UNIX,
+         * we keep at most NGRPS of them.  If there are too many to
+         * fit even in @var{groups}, we keep none.
+         */
+        len = sizeof (groups);
+        if (getsockopt(xprt->xp_sock, SOL_SOCKET, SO_PEERGROUPS,
+                groups, &len) == 0) {
+            n = (u_int)(len / sizeof (gid_t));
+            if (n > NGRPS) {
+                n = NGRPS;
+            }
+            memcpy(up->up_groups, groups, n * sizeof (gid_t));
+            up->up_ngroups = n;
+        }
+    }
 #endif
-    memcpy(mtxprt->mtxp_guard, MTXPRT_GUARD, sizeof (mtxprt->mtxp_guard));
-    xprt_unlock(xprt);
-    xprt_register(xprt);
-    return (xprt);
+
+    xprt_footprint_add(xprt, sizeof (*up));
+    tprintf(2, "xprt=%s, fd=%d: pid=%d, uid=%u, gid=%u, groups=%u\n",
+        decode_addr(xprt), xprt->xp_sock,
+        (int)up->up_pid, (u_int)up->up_uid, (u_int)up->up_gid,
+        up->up_ngroups);
+    return (up);
 }
 
-SVCXPRT *
-svctcp_create(int sock, u_int sendsize, u_int recvsize)
+/*
+ * Finish making a newly accepted AF_UNIX connection.
+ * There is no address to speak of; like glibc, we leave just
+ * the address family in @member{xp_raddr}.
+ */
+static void
+unix_conn_init(SVCXPRT *xprt)
 {
-    SVCXPRT *xprt;
+    struct tcp_conn *cd;
 
-    xprt = svctcp_create_with_lock(sock, sendsize, recvsize);
-    return (xprt);
+    cd = (struct tcp_conn *)xprt->xp_p1;
+    xprt->xp_ops = &svcunix_op;
+    memset(&xprt->xp_raddr, 0, sizeof (xprt->xp_raddr));
+    xprt->xp_raddr.sin_family = AF_UNIX;
+    cd->peer = unix_peer_get(xprt);
 }
 
 /*
- * Like svctcp_create(), except the routine takes any *open* UNIX file
- * descriptor as its first input.
+ * Laid out like the "cooked" AUTH_UNIX credentials made by
+ * _svcauth_unix(), in the RQCRED_SIZE bytes at @member{rq_clntcred}.
  */
-SVCXPRT *
-svcfd_create(int fd, u_int sendsize, u_int recvsize)
+struct unix_cred_area {
+    struct authunix_parms uca_parms;
+    char                  uca_machname[MAX_MACHINE_NAME + 1];
+    gid_t                 uca_gids[NGRPS];
+};
+
+/*
+ * Fast authentication for local connections
+ * -----------------------------------------
+ * If @var{xprt} is an AF_UNIX connection, and the kernel told us
+ * who the client is, then a call that comes with AUTH_NULL or AUTH_UNIX
+ * credentials is given the AUTH_UNIX identity of the client process,
+ * straight from what we got when the connection was accepted.
+ * Whatever credentials the call carried are not decoded, and not
+ * believed.  Return true, if so; the caller need not authenticate
+ * the call, any further.
+ *
+ * Other flavors of credentials, and all TCP connections, are left
+ * to the usual _authenticate().
+ *
+ * Called by request_lookup(), in svc.c, for every call.
+ */
+bool
+svcunix_authenticate(SVCXPRT *xprt, struct svc_req *rqstp,
+    struct rpc_msg *msgp)
 {
-    tprintf(2, "fd=%d, sendsize=%u, recvsize=%u\n", fd, sendsize, recvsize);
-    return (makefd_xprt(fd, sendsize, recvsize));
+    struct tcp_conn *cd;
+    struct unix_peer *up;
+    struct unix_cred_area *area;
+    struct authunix_parms *aup;
+    enum_t flavor;
+
+    if (xprt->xp_ops != &svcunix_op || rqstp->rq_clntcred == NULL) {
+        return (false);
+    }
+    cd = (struct tcp_conn *)xprt->xp_p1;
+    up = cd->peer;
+    flavor = msgp->rm_call.cb_cred.oa_flavor;
+    if (up == NULL || (flavor != AUTH_NULL && flavor != AUTH_UNIX)) {
+        return (false);
+    }
+
+    area = (struct unix_cred_area *)rqstp->rq_clntcred;
+    aup = &(area->uca_parms);
+    aup->aup_time = 0;
+    aup->aup_machname = area->uca_machname;
+    strcpy(area->uca_machname, unix_machname);
+    aup->aup_uid = up->up_uid;
+    aup->aup_gid = up->up_gid;
+    aup->aup_len = up->up_ngroups;
+    aup->aup_gids = area->uca_gids;
+    memcpy(area->uca_gids, up->up_groups, up->up_ngroups * sizeof (gid_t));
+
+    // Clones copy credentials by the flavor in the message.
+    msgp->rm_call.cb_cred.oa_flavor = AUTH_UNIX;
+    rqstp->rq_cred = msgp->rm_call.cb_cred;
+    xprt->xp_verf.oa_flavor = AUTH_NULL;
+    xprt->xp_verf.oa_length = 0;
+    return (true);
 }
 
+/*
+ * Construct a connection SVCXPRT, but do not register it.
+ */
 static SVCXPRT *
-makefd_xprt_with_lock(int fd, u_int sendsize, u_int recvsize)
+makefd_xprt_construct(int fd, u_int sendsize, u_int recvsize)
 {
     SVCXPRT *xprt;
     mtxprt_t *mtxprt;
     struct tcp_conn *cd;
 
     tprintf(2, "fd=%d, sendsize=%u, recvsize=%u\n", fd, sendsize, recvsize);
-    xprt = alloc_xprt();
+    xprt = alloc_xprt(RQCRED_AREA_SIZE);
     cd = (struct tcp_conn *)guard_malloc(sizeof (struct tcp_conn));
     cd->strm_stat = XPRT_IDLE;
+    cd->drc_keyed = false;
+    cd->peer = NULL;
+    cd->last_active = time(NULL);
+    cd->replay = NULL;
+    cd->replay_len = 0;
+    cd->replay_off = 0;
     xdrrec_create(&(cd->xdrs), sendsize, recvsize, (caddr_t)xprt, readtcp, writetcp);
+    xdrrec_recordmode(&(cd->xdrs), TCP_MAX_RECORD);
+    /*
+     * Buffers come from the shared pool, sized from the traffic
+     * on this connection, not from @var{sendsize} and @var{recvsize},
+     * and go back to the pool once the connection has been idle
+     * for a while.  See svctcp_release_idle().
+     */
+    xdrrec_adaptive(&(cd->xdrs));
 
     /*
      * Constructor for @type{SVCXPRT}, including the additional @type{mtxprt_t}
@@ -362,15 +808,13 @@ makefd_xprt_with_lock(int fd, u_int sendsize, u_int recvsize)
      */
 
     mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    xprt_ext_attach(xprt, RQCRED_AREA_SIZE);
+    xprt_footprint_add(xprt, sizeof (struct tcp_conn));
 
     if (pthread_mutex_init(&(mtxprt->mtxp_lock), NULL) != 0) {
         abort();
     }
 
-    if (pthread_mutex_init(&(mtxprt->mtxp_progress_lock), NULL) != 0) {
-        abort();
-    }
-
     if (pthread_mutex_init(&(mtxprt->mtxp_mtready), NULL) != 0) {
         abort();
     }
@@ -384,11 +828,10 @@ makefd_xprt_with_lock(int fd, u_int sendsize, u_int recvsize)
      * Do not use xprt_lock(xprt) here.
      * The constructor has not progressed far enough, yet.
      */
-    if (pthread_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
+    if (svc_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
         abort();
     }
     mtxprt->mtxp_progress = 0;
-    mtxprt->mtxp_busy = 0;
     xprt->xp_p2 = NULL;
     xprt->xp_p1 = (caddr_t)cd;
     xprt->xp_verf.oa_base = cd->verf_body;
@@ -413,12 +856,8 @@ makefd_xprt_with_lock(int fd, u_int sendsize, u_int recvsize)
     mtxprt->mtxp_clone  = NULL;
     mtxprt->mtxp_parent = NO_PARENT;
     mtxprt->mtxp_refcnt = 0;
-#ifdef CHECK_CREDENTIALS
-    memset(mtxprt->mtxp_cred, 0, sizeof (mtxprt->mtxp_cred));
-#endif
     memcpy(mtxprt->mtxp_guard, MTXPRT_GUARD, sizeof (mtxprt->mtxp_guard));
     xprt_unlock(xprt);
-    xprt_register(xprt);
     return (xprt);
 }
 
@@ -427,7 +866,8 @@ makefd_xprt(int fd, u_int sendsize, u_int recvsize)
 {
     SVCXPRT *xprt;
 
-    xprt = makefd_xprt_with_lock(fd, sendsize, recvsize);
+    xprt = makefd_xprt_construct(fd, sendsize, recvsize);
+    xprt_register(xprt);
     return (xprt);
 }
 
@@ -438,90 +878,288 @@ fd_is_open(int fd)
     return (fcntl(fd, F_GETFD) != -1 || errno != EBADF);
 }
 
+/*
+ * Occupancy of the managed fd region, @var{socket_fd_region}.
+ * Bit i stands for fd (lo + i).
+ *
+ * fd_region_owned:
+ *     fds that move_fd() put there, and that have not yet been
+ *     released by svctcp_destroy().
+ *
+ * fd_region_used:
+ *     fd_region_owned, plus fds that we found to be in use by
+ *     someone else, when F_DUPFD did not land where we asked.
+ *     Those are only a guess; they get re-verified, the slow way,
+ *     when there is no clear bit left.
+ *
+ * So, relocating an fd normally costs one fcntl(F_DUPFD) and one close().
+ */
+static pthread_mutex_t fd_region_lock = PTHREAD_MUTEX_INITIALIZER;
+static bitvec_t fd_region_owned;
+static bitvec_t fd_region_used;
+static struct fd_region fd_region_map = { 0, -1, 0 };
+
+static void
+fd_region_map_init(void)
+{
+    size_t nbits;
+
+    if (fd_region_map.lo == socket_fd_region.lo &&
+        fd_region_map.hi == socket_fd_region.hi) {
+        return;
+    }
+    if (fd_region_map.hi >= fd_region_map.lo) {
+        bitvec_free(&fd_region_owned);
+        bitvec_free(&fd_region_used);
+    }
+    fd_region_map = socket_fd_region;
+    nbits = (size_t)(fd_region_map.hi - fd_region_map.lo + 1);
+    bitvec_init(&fd_region_owned, nbits);
+    bitvec_init(&fd_region_used, nbits);
+}
+
+static inline bool
+fd_in_region_map(int fd)
+{
+    return (fd >= fd_region_map.lo && fd <= fd_region_map.hi);
+}
+
+/*
+ * All slots look used.  Forget what we guessed about fds
+ * that are not ours, and check them again, one by one.
+ * Return the number of slots that turned out to be free.
+ */
+static size_t
+fd_region_reverify(void)
+{
+    size_t nfree;
+    size_t i;
+
+    nfree = 0;
+    for (i = 0; i < fd_region_used.sz; ++i) {
+        if (bitvec_get_bit(&fd_region_owned, i)) {
+            continue;
+        }
+        if (fd_is_open(fd_region_map.lo + (int)i)) {
+            bitvec_set_bit(&fd_region_used, i);
+        }
+        else {
+            bitvec_clr_bit(&fd_region_used, i);
+            ++nfree;
+        }
+    }
+    return (nfree);
+}
+
+static size_t
+fd_region_pick(void)
+{
+    if (socket_fd_region.order > 0) {
+        return (bitvec_find_first_clear(&fd_region_used, 0));
+    }
+    return (bitvec_find_last_clear(&fd_region_used, fd_region_used.sz - 1));
+}
+
+/*
+ * Move a newly accepted socket, @var{fd}, into the managed fd region.
+ * Caller holds @var{poll_lock}.
+ */
+static int
+move_fd(int fd)
+{
+    size_t idx;
+    int new_fd;
+    int dup_fd;
+
+    if (socket_fd_region.order == 0 ||
+        socket_fd_region.hi < socket_fd_region.lo) {
+        return (fd);
+    }
+
+    pthread_mutex_lock(&fd_region_lock);
+    fd_region_map_init();
+    for (;;) {
+        idx = fd_region_pick();
+        if (idx >= fd_region_used.sz && fd_region_reverify() != 0) {
+            idx = fd_region_pick();
+        }
+        if (idx >= fd_region_used.sz) {
+            pthread_mutex_unlock(&fd_region_lock);
+            teprintf("Ran out of file descriptors in range %d..%d\n",
+                    socket_fd_region.lo, socket_fd_region.hi);
+            if (opt_svc_trace) {
+                show_xports();
+            }
+            svc_die();
+            return (-1);
+        }
+
+        new_fd = fd_region_map.lo + (int)idx;
+        dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, new_fd);
+        if (dup_fd < 0) {
+            pthread_mutex_unlock(&fd_region_lock);
+            svc_perror(errno, "svc_tcp.c - move_fd: fcntl(F_DUPFD) failed");
+            return (fd);
+        }
+
+        /*
+         * Collision.  F_DUPFD gives us the lowest free fd >= new_fd,
+         * so everything from new_fd up to dup_fd is in use by someone.
+         */
+        if (dup_fd != new_fd) {
+            int busy_fd;
+
+            for (busy_fd = new_fd; busy_fd < dup_fd && fd_in_region_map(busy_fd);
+                    ++busy_fd) {
+                bitvec_set_bit(&fd_region_used,
+                    (size_t)(busy_fd - fd_region_map.lo));
+            }
+            if (!fd_in_region_map(dup_fd) ||
+                bitvec_get_bit(&fd_region_used,
+                    (size_t)(dup_fd - fd_region_map.lo))) {
+                (void) close(dup_fd);
+                continue;
+            }
+            new_fd = dup_fd;
+            idx = (size_t)(new_fd - fd_region_map.lo);
+        }
+
+        bitvec_set_bit(&fd_region_owned, idx);
+        bitvec_set_bit(&fd_region_used, idx);
+        pthread_mutex_unlock(&fd_region_lock);
+        (void) close(fd);
+        return (new_fd);
+    }
+}
+
+/*
+ * The socket, @var{fd}, has been closed.
+ * If move_fd() put it in the managed region, that slot is free again.
+ */
+static void
+fd_region_release(int fd)
+{
+    size_t idx;
+
+    pthread_mutex_lock(&fd_region_lock);
+    if (fd_in_region_map(fd)) {
+        idx = (size_t)(fd - fd_region_map.lo);
+        if (bitvec_get_bit(&fd_region_owned, idx)) {
+            bitvec_clr_bit(&fd_region_owned, idx);
+            bitvec_clr_bit(&fd_region_used, idx);
+        }
+    }
+    pthread_mutex_unlock(&fd_region_lock);
+}
+
+/*
+ * A batch of connections, accepted on one rendezvous socket,
+ * waiting to be made into transports.
+ */
+struct accept_batch {
+    size_t             ab_count;
+    int                ab_sock[ACCEPT_BATCH];
+    struct sockaddr_in ab_addr[ACCEPT_BATCH];
+    socklen_t          ab_addrlen[ACCEPT_BATCH];
+};
+
+/*
+ * Accept one connection, without blocking.
+ * Return the new socket, or -1 with errno set.
+ */
 static int
-move_fd(int fd)
+accept_one(SVCXPRT *xprt, struct sockaddr_in *addrp, socklen_t *lenp)
 {
-    int new_fd;
-    int end_fd;
-
-    if (socket_fd_region.order == 0) {
-        return (fd);
-    }
+    int accept_sock;
 
-    // Start with lowest or highest number in range
-    if (socket_fd_region.order == 1) {
-        new_fd = socket_fd_region.lo;
-        end_fd = socket_fd_region.hi;
+    *lenp = sizeof (struct sockaddr_in);
+    if (uring_watching(xprt->xp_sock)) {
+        accept_sock = uring_accept(xprt->xp_sock,
+            (struct sockaddr *)addrp, lenp);
     }
     else {
-        new_fd = socket_fd_region.hi;
-        end_fd = socket_fd_region.lo;
+        accept_sock = sys_accept4(xprt->xp_sock, (struct sockaddr *)addrp,
+            lenp, SOCK_CLOEXEC | SOCK_NONBLOCK);
     }
+    tprintf(2, "accept(%d) => %d\n", xprt->xp_sock, accept_sock);
+    return (accept_sock);
+}
 
-    while (true) {
-        if (!fd_is_open(new_fd)) {
-            int dup_fd;
-            dup_fd = fcntl(fd, F_DUPFD, new_fd);
-            if (dup_fd == new_fd) {
-                close(fd);
-                return (dup_fd);
-            }
-        }
-        new_fd += socket_fd_region.order;
-        if (new_fd * socket_fd_region.order > end_fd * socket_fd_region.order) {
-            teprintf("Ran out of file descriptors in range %d..%d\n",
-                    socket_fd_region.lo, socket_fd_region.hi);
-            if (opt_svc_trace) {
-                show_xports();
-            }
-            svc_die();
+/*
+ * Make transports for a batch of accepted connections,
+ * and register them all at once.
+ */
+static void
+accept_batch_register(struct accept_batch *ab, struct tcp_rendezvous *r)
+{
+    SVCXPRT *xprtv[ACCEPT_BATCH];
+    size_t i;
+
+    for (i = 0; i < ab->ab_count; ++i) {
+        SVCXPRT *xprt;
+
+        xprt = makefd_xprt_construct(ab->ab_sock[i], r->sendsize, r->recvsize);
+        memcpy(&xprt->xp_raddr, &ab->ab_addr[i], sizeof (ab->ab_addr[i]));
+        xprt->xp_addrlen = ab->ab_addrlen[i];
+        if (r->family == AF_UNIX) {
+            unix_conn_init(xprt);
         }
+        xprtv[i] = xprt;
     }
-
-    return (-1);
+    xprt_register_batch(xprtv, ab->ab_count);
 }
 
+/*
+ * Accept as many connections as are waiting, up to ACCEPT_BATCH.
+ * The rendezvous socket is non-blocking, so we stop when the
+ * accept queue is empty.  With the io_uring engine, connections
+ * have already been accepted, by a multishot accept, and are just
+ * taken off the queue of the watch.
+ *
+ * Accepted sockets are non-blocking; readtcp() and writetcp()
+ * poll for readiness, as needed.
+ */
 static bool_t
 rendezvous_request(SVCXPRT *xprt, struct rpc_msg *errmsg)
 {
+    struct accept_batch ab;
+    struct tcp_rendezvous *r;
     int accept_sock;
     int sock;
-    struct tcp_rendezvous *r;
-    struct sockaddr_in addr;
-    socklen_t len;
     int err;
 
     UNUSED(errmsg);
     r = (struct tcp_rendezvous *)xprt->xp_p1;
 
-    pthread_mutex_lock(&poll_lock);
-  again:
-    len = sizeof (struct sockaddr_in);
-    accept_sock = sys_accept(xprt->xp_sock, (struct sockaddr *)&addr, &len);
-    err = errno;
-    tprintf(2, "accept(%d) => %d\n", xprt->xp_sock, accept_sock);
-    if (accept_sock < 0) {
-        if (err == EINTR) {
-            goto again;
+    ab.ab_count = 0;
+    svc_mutex_lock(&poll_lock);
+    while (ab.ab_count < ACCEPT_BATCH) {
+        accept_sock = accept_one(xprt, &ab.ab_addr[ab.ab_count],
+            &ab.ab_addrlen[ab.ab_count]);
+        err = errno;
+        if (accept_sock < 0) {
+            if (err == EINTR || err == ECONNABORTED) {
+                continue;
+            }
+            if (err != EAGAIN && err != EWOULDBLOCK && ab.ab_count == 0) {
+                svc_mutex_unlock(&poll_lock);
+                svc_accept_failed();
+                return (FALSE);
+            }
+            break;
         }
-        pthread_mutex_unlock(&poll_lock);
-        svc_accept_failed();
-        return (FALSE);
-    }
-
-    sock = move_fd(accept_sock);
-    pthread_mutex_unlock(&poll_lock);
 
-    if (sock != accept_sock) {
-        tprintf(2, "move_fd(%d) => %d\n", accept_sock, sock);
+        sock = move_fd(accept_sock);
+        if (sock != accept_sock) {
+            tprintf(2, "move_fd(%d) => %d\n", accept_sock, sock);
+        }
+        ab.ab_sock[ab.ab_count] = sock;
+        ++ab.ab_count;
     }
+    svc_mutex_unlock(&poll_lock);
 
-    /*
-     * Make a new transporter (re-uses xprt)
-     */
-    xprt = makefd_xprt(sock, r->sendsize, r->recvsize);
-    memcpy(&xprt->xp_raddr, &addr, sizeof (addr));
-    xprt->xp_addrlen = len;
+    tprintf(2, "accepted %zu\n", ab.ab_count);
+    accept_batch_register(&ab, r);
     return (FALSE);             /* There is never an rpc msg to be processed */
 }
 
@@ -538,6 +1176,15 @@ svctcp_destroy(SVCXPRT *xprt)
     int sock;
 
     xprt_set_busy(xprt, 1);
+    /*
+     * Unregister first, then close.  As soon as the fd is closed,
+     * accept() can hand out the same number again; the new connection
+     * must not lose its slot, or its poll entry, to us.
+     */
+    xports_global_lock();
+    xprt_unregister(xprt);
+    xports_global_unlock();
+
     xprt_lock(xprt);
     mtxprt = xprt_to_mtxprt(xprt);
     sock = xprt->xp_sock;
@@ -559,6 +1206,15 @@ svctcp_destroy(SVCXPRT *xprt)
         rv = fstat(sock, &statb);
         err = errno;
         if (rv == 0) {
+            if (xprt->xp_port != 0) {
+                struct tcp_rendezvous *r;
+
+                // Put back what rendezvous_nonblock() changed.
+                r = (struct tcp_rendezvous *)xprt->xp_p1;
+                if (r != NULL && r->sockflags != -1) {
+                    (void) fcntl(sock, F_SETFL, r->sockflags);
+                }
+            }
             tprintf(2, "close(sock.fd=%d)\n", sock);
             (void) close(sock);
         }
@@ -575,6 +1231,7 @@ svctcp_destroy(SVCXPRT *xprt)
             tprintf(2, "sock=%d -- errno=%d=%s='%s'\n",
                 sock, err, esymbuf, ep);
         }
+        fd_region_release(sock);
     }
 
     if (xprt->xp_port != 0) {
@@ -590,6 +1247,8 @@ svctcp_destroy(SVCXPRT *xprt)
             cd = (struct tcp_conn *)xprt->xp_p1;
             if (cd != NULL) {
                 XDR_DESTROY(&(cd->xdrs));
+                free(cd->peer);
+                free(cd->replay);
             }
         }
     }
@@ -600,36 +1259,23 @@ svctcp_destroy(SVCXPRT *xprt)
     xprt_unlock(xprt);
 
     xports_global_lock();
-    xprt_unregister(xprt);
+    xprt_footprint_release(xprt);
     free(xprt);
     xports_global_unlock();
 }
 
 /*
- * Reads data from the tcp connection.
- * Any error is fatal and the connection is closed.
- * (And a read of zero bytes is a half closed stream => error.)
+ * Wait for the tcp connection to become readable.
+ * Return 1 if it is, or 0 on timeout or error.
  */
 static int
-readtcp_with_lock(char *xprtptr, char *buf, int ilen)
+poll_readable(SVCXPRT *xprt, int sock, int milliseconds)
 {
-    SVCXPRT *xprt;
-    int sock;
-    int milliseconds;
     struct pollfd pollfd;
-    size_t len;
-    ssize_t rdlen;
     int rv;
     int err;
     int pe;
 
-    tprintf(2, "ilen=%d\n", ilen);
-    xprt = (SVCXPRT *)xprtptr;
-    sock = xprt->xp_sock;
-    milliseconds = 35 * 1000;
-    tprintf(2, "xprt=%s, sock.fd=%d, ilen=%d\n        peer=%s\n",
-        decode_addr(xprt), sock, ilen, decode_inet_peer(sock));
-
     do {
         pollfd.fd = sock;
         pollfd.events = POLLIN;
@@ -642,23 +1288,64 @@ readtcp_with_lock(char *xprtptr, char *buf, int ilen)
                 continue;
             err = errno;
             teprintf("errno = %d\n", err);
-            goto fatal_err;
+            return (0);
         case 0:
             teprintf("poll() => 0\n");
-            goto fatal_err;
+            return (0);
         default:
             pe = pollfd.revents;
             if ((pe & POLLNVAL) != 0) {
                 teprintf("pollfd.fd=%d, pollfd.revents=x%x={%s}\n",
                     pollfd.fd, pe, decode_poll_events(pe));
-                goto fatal_err;
+                return (0);
             }
             break;
         }
     } while ((pollfd.revents & POLLIN) == 0);
 
+    return (1);
+}
+
+/*
+ * Reads data from the tcp connection.
+ * Any error is fatal and the connection is closed.
+ * (And a read of zero bytes is a half closed stream => error.)
+ *
+ * If the connection is watched by the io_uring engine, then the data
+ * has already been received, or will be, by a multishot recv;
+ * uring_read() just waits for it and copies it out.
+ */
+static int
+readtcp_with_lock(char *xprtptr, char *buf, int ilen)
+{
+    SVCXPRT *xprt;
+    int sock;
+    int milliseconds;
+    size_t len;
+    ssize_t rdlen;
+    int err;
+
+    tprintf(2, "ilen=%d\n", ilen);
+    xprt = (SVCXPRT *)xprtptr;
+    sock = xprt->xp_sock;
+    milliseconds = 35 * 1000;
+    tprintf(2, "xprt=%s, sock.fd=%d, ilen=%d\n        peer=%s\n",
+        decode_addr(xprt), sock, ilen, decode_inet_peer(sock));
+
     len = (size_t)ilen;
-    rdlen = sys_read(sock, buf, len);
+    if (uring_watching(sock)) {
+        xprt_set_busy(xprt, 1);
+        rdlen = uring_read(sock, buf, len, milliseconds);
+    }
+    else {
+        do {
+            if (!poll_readable(xprt, sock, milliseconds)) {
+                goto fatal_err;
+            }
+            rdlen = sys_read(sock, buf, len);
+        } while (rdlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                 errno == EINTR));
+    }
     err = errno;
     tprintf(2, "read(sock.fd=%d, %s, %zu) => %zd\n",
         sock, decode_addr(buf), len, rdlen);
@@ -690,42 +1377,317 @@ readtcp(char *xprtptr, char *buf, int len)
 {
     int rv;
 
-    pthread_mutex_lock(&tcp_lock);
+    svc_mutex_lock(&tcp_lock);
     rv = readtcp_with_lock(xprtptr, buf, len);
-    pthread_mutex_unlock(&tcp_lock);
+    svc_mutex_unlock(&tcp_lock);
     return (rv);
 }
 
 /*
- * Writes data to the tcp connection.
- * Any error is fatal and the connection is closed.
+ * Wait for room to write on the tcp connection.
+ * Return 1 if there is, or 0 on timeout or error.
  */
 static int
-writetcp(char *xprtptr, char *buf, int len)
+poll_writable(int sock, int milliseconds)
+{
+    struct pollfd pollfd;
+    int rv;
+
+    for (;;) {
+        pollfd.fd = sock;
+        pollfd.events = POLLOUT;
+        pollfd.revents = 0;
+        rv = poll(&pollfd, 1, milliseconds);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            teprintf("poll(fd=%d, POLLOUT) => %d\n", sock, rv);
+            return (0);
+        }
+        return ((pollfd.revents & POLLOUT) != 0);
+    }
+}
+
+/*
+ * Make sure the per-thread buffer can hold the longest cacheable reply.
+ */
+static void
+tcp_drc_buf_init(void)
+{
+    size_t size;
+
+    size = drc_max_reply(tcp_drc);
+    if (tcp_drc_tls.size < size) {
+        tcp_drc_tls.buf = (char *)guard_realloc(tcp_drc_tls.buf, size);
+        tcp_drc_tls.size = size;
+    }
+}
+
+static void
+tcp_drc_capture(const char *buf, size_t len)
+{
+    if (tcp_drc_tls.overflow) {
+        return;
+    }
+    if (len > tcp_drc_tls.size - tcp_drc_tls.len) {
+        tcp_drc_tls.overflow = true;
+        return;
+    }
+    memcpy(tcp_drc_tls.buf + tcp_drc_tls.len, buf, len);
+    tcp_drc_tls.len += len;
+}
+
+/*
+ * Build the cache key for the call header that was just decoded.
+ * The peer address comes from accept(); for a connection made
+ * by svcfd_create(), we have to ask for it.  The arguments are
+ * still in the record, not decoded, so we can sum them in place.
+ * Return false, if the record is not loaded; then, the call
+ * is not cached.
+ */
+static bool
+tcp_drc_key(SVCXPRT *xprt, struct tcp_conn *cd, struct rpc_msg *msg)
+{
+    struct sockaddr_storage peer;
+    socklen_t peerlen;
+    caddr_t args;
+    u_int argslen;
+
+    if (!xdrrec_peekrecord(&(cd->xdrs), &args, &argslen)) {
+        return (false);
+    }
+
+    memset(&peer, 0, sizeof (peer));
+    if (xprt->xp_addrlen != 0) {
+        peerlen = (socklen_t)xprt->xp_addrlen;
+        if (peerlen > sizeof (xprt->xp_raddr)) {
+            peerlen = sizeof (xprt->xp_raddr);
+        }
+        memcpy(&peer, &xprt->xp_raddr, peerlen);
+    }
+    else {
+        peerlen = sizeof (peer);
+        if (getpeername(xprt->xp_sock, (struct sockaddr *)&peer, &peerlen) != 0) {
+            peerlen = 0;
+        }
+    }
+
+    if (peer.ss_family == AF_INET) {
+        ((struct sockaddr_in *)&peer)->sin_port = 0;
+    }
+    else if (peer.ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *)&peer)->sin6_port = 0;
+    }
+    drc_key_init(&cd->drc_key, (uint32_t)msg->rm_xid,
+        (uint32_t)msg->rm_call.cb_prog, (uint32_t)msg->rm_call.cb_vers,
+        (uint32_t)msg->rm_call.cb_proc,
+        (struct sockaddr *)&peer, peerlen);
+    cd->drc_key.dk_sum = drc_args_sum(args, argslen);
+    cd->drc_keyed = true;
+    return (true);
+}
+
+/*
+ * Write as much of the queued replay as the socket takes now,
+ * without waiting.  What is left is written by the next writetcp(),
+ * ahead of the next reply, or by svctcp_release_idle().
+ * The caller holds the @type{SVCXPRT} lock.
+ */
+static void
+tcp_replay_push(SVCXPRT *xprt, struct tcp_conn *cd)
+{
+    ssize_t wlen;
+
+    while (cd->replay_off < cd->replay_len) {
+        wlen = sys_write(xprt->xp_sock, cd->replay + cd->replay_off,
+            cd->replay_len - cd->replay_off);
+        if (wlen < 0 && errno == EINTR) {
+            continue;
+        }
+        if (wlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (wlen < 0) {
+            cd->strm_stat = XPRT_DIED;
+            break;
+        }
+        cd->replay_off += (size_t)wlen;
+    }
+    free(cd->replay);
+    cd->replay = NULL;
+    cd->replay_len = 0;
+    cd->replay_off = 0;
+}
+
+/*
+ * Look up the call that was just decoded.
+ * If it is a retransmission, queue the cached reply, and return true.
+ *
+ * This runs in the dispatcher, so it must not wait for the client
+ * to read.  Like svctcp_reply(), it holds @var{poll_lock}, so the
+ * replay goes out in order with replies to pipelined calls.
+ * On a connection watched by the io_uring engine, the replay is
+ * queued on the engine, as a reply is.  Otherwise, it is copied
+ * to the connection and written as far as the socket takes it;
+ * see tcp_replay_push().
+ */
+static bool
+tcp_drc_replay(SVCXPRT *xprt, struct tcp_conn *cd, struct rpc_msg *msg)
+{
+    ssize_t rlen;
+
+    if (!tcp_drc_key(xprt, cd, msg)) {
+        return (false);
+    }
+    tcp_drc_buf_init();
+    rlen = drc_lookup(tcp_drc, &cd->drc_key, tcp_drc_tls.buf, tcp_drc_tls.size);
+    if (rlen < 0) {
+        return (false);
+    }
+    tprintf(2, "xprt=%s, xid=%lu: replay %zd bytes\n",
+        decode_addr(xprt), (u_long)msg->rm_xid, rlen);
+    cd->drc_keyed = false;
+    svc_mutex_lock(&poll_lock);
+    if (uring_watching(xprt->xp_sock)) {
+        if (uring_send(xprt->xp_sock, tcp_drc_tls.buf, (size_t)rlen) < 0
+            || uring_send_flush(xprt->xp_sock) != 0) {
+            cd->strm_stat = XPRT_DIED;
+        }
+    }
+    else {
+        cd->replay = (char *)guard_realloc(cd->replay,
+            cd->replay_len + (size_t)rlen);
+        memcpy(cd->replay + cd->replay_len, tcp_drc_tls.buf, (size_t)rlen);
+        cd->replay_len += (size_t)rlen;
+        tcp_replay_push(xprt, cd);
+    }
+    svc_mutex_unlock(&poll_lock);
+    return (true);
+}
+
+/*
+ * Turn on the duplicate request cache for all TCP connections.
+ * @var{budget} is the number of bytes of replies to hold, in all,
+ * and @var{ttl} is how many seconds a reply stays good; 0 means forever.
+ * Return 1 on success, 0 if it was already on.
+ */
+int
+svctcp_enablecache(size_t budget, unsigned int ttl)
+{
+    drc_t *drc;
+
+    drc = drc_create(budget, ttl);
+    if (!__sync_bool_compare_and_swap(&tcp_drc, NULL, drc)) {
+        drc_destroy(drc);
+        eprintf("svctcp_enablecache: cache already enabled\n");
+        return (0);
+    }
+    return (1);
+}
+
+int
+svctcp_cache_stats(struct drc_stats *statsp)
+{
+    if (tcp_drc == NULL) {
+        return (0);
+    }
+    drc_get_stats(tcp_drc, statsp);
+    return (1);
+}
+
+/*
+ * Write all of @var{buf} to the tcp connection, waiting for room
+ * in the socket send buffer, as needed.
+ * Return @var{len}, or -1 on error.
+ *
+ * The caller, svctcp_reply(), holds the @type{SVCXPRT} lock and
+ * @var{poll_lock}.  A client that does not read its replies must
+ * not hold up the dispatcher, so @var{poll_lock} is let go while
+ * we wait.  The @type{SVCXPRT} lock is kept, so nothing else is
+ * written to the connection in the middle of this record.
+ */
+static int
+tcp_write_all(SVCXPRT *xprt, char *buf, int len)
 {
-    SVCXPRT *xprt;
     int sock;
     int cnt;
     int wlen;
+    int writable;
 
-    xprt = (SVCXPRT *)xprtptr;
-    // XXX xprt_set_busy(xprt, 1);
     sock = xprt->xp_sock;
-    tprintf(2, "xprt=%s, sock=%d\n", decode_addr(xprt), sock);
-    // pthread_mutex_lock(&tcp_lock);
     for (cnt = len; cnt > 0; cnt -= wlen, buf += wlen) {
         wlen = sys_write(sock, buf, cnt);
+        if (wlen < 0 && errno == EINTR) {
+            wlen = 0;
+            continue;
+        }
+        if (wlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            /*
+             * Accepted sockets are non-blocking.
+             * Wait for room in the socket send buffer.
+             */
+            svc_mutex_unlock(&poll_lock);
+            writable = poll_writable(sock, 35 * 1000);
+            svc_mutex_lock(&poll_lock);
+            if (writable) {
+                wlen = 0;
+                continue;
+            }
+        }
         if (wlen < 0) {
             ((struct tcp_conn *)(xprt->xp_p1))->strm_stat = XPRT_DIED;
             len = -1;
             break;
         }
     }
-    // pthread_mutex_unlock(&tcp_lock);
-    // XXX xprt_set_busy(xprt, 0);
     return (len);
 }
 
+/*
+ * Writes data to the tcp connection.
+ * Any error is fatal and the connection is closed.
+ *
+ * If the connection is watched by the io_uring engine, then the data
+ * is only queued, here; svctcp_reply() submits the whole reply.
+ *
+ * A replay that tcp_drc_replay() could not write all of
+ * goes out first, so that replies stay whole, and in order.
+ */
+static int
+writetcp(char *xprtptr, char *buf, int len)
+{
+    SVCXPRT *xprt;
+    struct tcp_conn *cd;
+    int sock;
+
+    xprt = (SVCXPRT *)xprtptr;
+    cd = (struct tcp_conn *)(xprt->xp_p1);
+    sock = xprt->xp_sock;
+    tprintf(2, "xprt=%s, sock=%d\n", decode_addr(xprt), sock);
+    if (tcp_drc_tls.xprt == xprt) {
+        tcp_drc_capture(buf, (size_t)len);
+    }
+    if (uring_watching(sock)) {
+        if (uring_send(sock, buf, (size_t)len) < 0) {
+            cd->strm_stat = XPRT_DIED;
+            len = -1;
+        }
+        return (len);
+    }
+    if (cd->replay != NULL) {
+        if (tcp_write_all(xprt, cd->replay + cd->replay_off,
+                (int)(cd->replay_len - cd->replay_off)) < 0) {
+            return (-1);
+        }
+        free(cd->replay);
+        cd->replay = NULL;
+        cd->replay_len = 0;
+        cd->replay_off = 0;
+    }
+    return (tcp_write_all(xprt, buf, len));
+}
+
 static enum xprt_stat
 svctcp_stat(SVCXPRT *xprt)
 {
@@ -754,6 +1716,50 @@ svctcp_stat(SVCXPRT *xprt)
     return (XPRT_IDLE);
 }
 
+/*
+ * If @var{xprt} is a connection that has had no calls or replies
+ * for TCP_IDLE_RELEASE seconds, give its stream buffers back to
+ * the pool.  xdrrec_release() keeps them, if a record is loaded,
+ * or anything is buffered.
+ *
+ * Also, write more of a replay that the socket did not take all of,
+ * so that it does not wait for the next reply on the connection.
+ *
+ * Called by xprt_idle_sweep(), in svc.c, with @var{poll_lock} held,
+ * never for an @type{SVCXPRT} that might be destroyed while we look
+ * at it.  svctcp_reply() takes the @type{SVCXPRT} lock before
+ * @var{poll_lock}, so we only try for it.  If someone has it,
+ * the connection is not idle, anyway.
+ *
+ * Return 1 if the buffers were given back, else 0.
+ */
+int
+svctcp_release_idle(SVCXPRT *xprt, time_t now)
+{
+    struct tcp_conn *cd;
+    int released;
+
+    if (xprt->xp_ops != &svctcp_op && xprt->xp_ops != &svcunix_op) {
+        return (0);
+    }
+    if (!xprt_trylock(xprt)) {
+        return (0);
+    }
+    released = 0;
+    cd = (struct tcp_conn *)(xprt->xp_p1);
+    if (cd->replay != NULL && cd->strm_stat != XPRT_DIED) {
+        tcp_replay_push(xprt, cd);
+    }
+    // Whole seconds: a difference of TCP_IDLE_RELEASE can be a mere tick.
+    if (cd->strm_stat != XPRT_DIED && now - cd->last_active > TCP_IDLE_RELEASE) {
+        xdr_enter();
+        released = xdrrec_release(&(cd->xdrs));
+        xdr_exit();
+    }
+    xprt_unlock(xprt);
+    return (released);
+}
+
 static bool_t
 svctcp_recv(SVCXPRT *xprt, struct rpc_msg *msg)
 {
@@ -762,6 +1768,7 @@ svctcp_recv(SVCXPRT *xprt, struct rpc_msg *msg)
     struct tcp_conn *cd;
     XDR *xdrs;
     int rv;
+    bool replayed;
 
     mtxprt = xprt_to_mtxprt(xprt);
     id = mtxprt->mtxp_id;
@@ -774,9 +1781,23 @@ svctcp_recv(SVCXPRT *xprt, struct rpc_msg *msg)
     xdrs = &(cd->xdrs);
     xdrs->x_op = XDR_DECODE;
     (void) xdrrec_skiprecord(xdrs);
-    if (xdr_callmsg(xdrs, msg)) {
+    replayed = false;
+    cd->drc_keyed = false;
+    cd->last_active = time(NULL);
+    if (xdrrec_getrecord(xdrs) && xdr_callmsg(xdrs, msg)) {
         cd->x_id = msg->rm_xid;
         rv = TRUE;
+        /*
+         * There are no network blips on an AF_UNIX connection, and
+         * no peer address to tell one client's xids from another's.
+         */
+        if (tcp_drc != NULL && xprt->xp_ops != &svcunix_op
+            && tcp_drc_replay(xprt, cd, msg)) {
+            // Already answered.  Nothing to dispatch, or to decode.
+            xdrrec_donerecord(xdrs);
+            replayed = true;
+            rv = FALSE;
+        }
     }
     else {
         cd->strm_stat = XPRT_DIED;
@@ -788,7 +1809,7 @@ svctcp_recv(SVCXPRT *xprt, struct rpc_msg *msg)
 
 #ifdef CONFIG_DIE_ON_RECV_FAILURE
 
-    if (failfast && rv == 0) {
+    if (failfast && rv == 0 && !replayed) {
         // Die quickly in case of error.
         teprintf("rv = %d\n", rv);
         if (opt_svc_trace) {
@@ -818,7 +1839,7 @@ svctcp_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, caddr_t args_ptr)
     tprintf(2, "xprt=%s, args_ptr=%s, fd=%d\n",
         decode_addr(xprt), decode_addr(args_ptr), xprt->xp_sock);
 
-    pthread_mutex_lock(&poll_lock);
+    svc_mutex_lock(&poll_lock);
     xprt_set_busy(xprt, 1);
     xprt_lock(xprt);
 
@@ -828,9 +1849,17 @@ svctcp_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, caddr_t args_ptr)
     xdrs->x_op = XDR_DECODE;
     rv = (*xdr_args) (xdrs, args_ptr);
     tprintf(2, "rv = %d\n", rv);
+    // The call is decoded.  Its record need not stay in our buffers.
+    xdrrec_donerecord(xdrs);
+    // The next pipelined call may be received before we reply.
+    tcp_call_tls.xprt = xprt;
+    tcp_call_tls.x_id = cd->x_id;
+    tcp_call_tls.drc_key = cd->drc_key;
+    tcp_call_tls.drc_keyed = cd->drc_keyed;
+    cd->drc_keyed = false;
     xdr_exit();
     xprt_set_busy(xprt, 0);
-    pthread_mutex_unlock(&poll_lock);
+    svc_mutex_unlock(&poll_lock);
 
     if (failfast && rv == 0) {
         // Die quickly in case of error.
@@ -845,11 +1874,11 @@ svctcp_getargs(SVCXPRT *xprt, xdrproc_t xdr_args, caddr_t args_ptr)
     xprt_progress_setbits(xprt, XPRT_GETARGS);
     mtxprt_t *mtxprt;
     mtxprt = xprt_to_mtxprt(xprt);
-    if (wait_method_tcp == 1) {
-        xprt_set_busy(xprt, 1);
+    if (wait_method_tcp == WAIT_MUTEX) {
+        pthread_mutex_unlock(&mtxprt->mtxp_mtready);
     }
     else {
-        pthread_mutex_unlock(&mtxprt->mtxp_mtready);
+        xprt_set_busy(xprt, 1);
     }
     xprt_unlock(xprt);
     return (rv);
@@ -867,14 +1896,17 @@ svctcp_freeargs(SVCXPRT *xprt, xdrproc_t xdr_args, caddr_t args_ptr)
         decode_addr(xprt), decode_addr(args_ptr), xprt->xp_sock);
     __sync_fetch_and_add(&cnt_freeargs, 1);
     xprt_lock(xprt);
-    pthread_mutex_lock(&poll_lock);
+    svc_mutex_lock(&poll_lock);
     xdr_enter();
     cd = (struct tcp_conn *)(xprt->xp_p1);
     xdrs = &(cd->xdrs);
     xdrs->x_op = XDR_FREE;
     rv = ((*xdr_args) (xdrs, args_ptr));
     xdr_exit();
-    pthread_mutex_unlock(&poll_lock);
+    svc_mutex_unlock(&poll_lock);
+    if (tcp_call_tls.xprt == xprt) {
+        tcp_call_tls.xprt = NULL;
+    }
 
     if (failfast && rv == 0) {
         // Die quickly in case of error.
@@ -895,21 +1927,50 @@ svctcp_reply(SVCXPRT *xprt, struct rpc_msg *msg)
     struct tcp_conn *cd;
     XDR *xdrs;
     bool_t stat;
+    bool capture;
+    struct tcp_call call;
 
     tprintf(2, "xprt=%s, msg=%s, fd=%d\n",
         decode_addr(xprt), decode_addr(msg), xprt->xp_sock);
     __sync_fetch_and_add(&cnt_reply, 1);
     xprt_lock(xprt);
-    pthread_mutex_lock(&poll_lock);
+    svc_mutex_lock(&poll_lock);
     xdr_enter();
     cd = (struct tcp_conn *)(xprt->xp_p1);
     xdrs = &(cd->xdrs);
     xdrs->x_op = XDR_ENCODE;
-    msg->rm_xid = cd->x_id;
-    stat = xdr_replymsg(xdrs, msg);
-    (void) xdrrec_endofrecord(xdrs, TRUE);
+    if (tcp_call_tls.xprt == xprt) {
+        call = tcp_call_tls;
+        tcp_call_tls.xprt = NULL;
+    }
+    else {
+        call.xprt = xprt;
+        call.x_id = cd->x_id;
+        call.drc_key = cd->drc_key;
+        call.drc_keyed = cd->drc_keyed;
+        cd->drc_keyed = false;
+    }
+    msg->rm_xid = call.x_id;
+    capture = tcp_drc != NULL && call.drc_keyed;
+    if (capture) {
+        tcp_drc_buf_init();
+        tcp_drc_tls.xprt = xprt;
+        tcp_drc_tls.len = 0;
+        tcp_drc_tls.overflow = false;
+    }
+    stat = xdrrec_sized_record(xdrs, (xdrproc_t) xdr_replymsg, msg);
+    if (uring_watching(xprt->xp_sock) && uring_send_flush(xprt->xp_sock) != 0) {
+        cd->strm_stat = XPRT_DIED;
+    }
+    if (capture) {
+        tcp_drc_tls.xprt = NULL;
+        if (stat && !tcp_drc_tls.overflow && cd->strm_stat != XPRT_DIED) {
+            drc_insert(tcp_drc, &call.drc_key, tcp_drc_tls.buf, tcp_drc_tls.len);
+        }
+    }
+    cd->last_active = time(NULL);
     xdr_exit();
-    pthread_mutex_unlock(&poll_lock);
+    svc_mutex_unlock(&poll_lock);
     xprt_progress_setbits(xprt, XPRT_REPLY);
     xprt_unlock(xprt);
     return (stat);
@@ -52,7 +52,12 @@
 #endif
 
 #include "svc_mtxprt.h"
+#include "svc_reactor.h"
 #include "svc_debug.h"
+#include "svc_uring.h"
+#include "svc_drc.h"
+#include "svc_flight.h"
+#include "svc_memo.h"
 
 #define rpc_buffer(xprt) ((xprt)->xp_p1)
 #ifndef MAX
@@ -61,7 +66,6 @@
 
 extern void xports_global_lock(void);
 extern void xports_global_unlock(void);
-extern SVCXPRT *alloc_xprt(void);
 extern void xprt_lock(SVCXPRT *);
 extern void xprt_unlock(SVCXPRT *);
 extern int  xprt_progress_setbits(SVCXPRT *, int);
@@ -88,6 +92,8 @@ static const xp_ops_t svcudp_op = {
 
 static int cache_get(SVCXPRT *, struct rpc_msg *, char **replyp, u_long *replylenp);
 static void cache_set(SVCXPRT *xprt, u_long replylen);
+static int drc_get(SVCXPRT *, struct rpc_msg *, char **replyp, u_long *replylenp);
+static int memo_get(SVCXPRT *, struct rpc_msg *, char **replyp, u_long *replylenp);
 
 /*
  * kept in xprt->xp_p2
@@ -95,10 +101,18 @@ static void cache_set(SVCXPRT *xprt, u_long replylen);
 struct svcudp_data
 {
     u_int su_iosz;                      /* byte size of send.recv buffer */
+    u_int su_rlen;                      /* byte size of last request received */
     u_long su_xid;                      /* transaction id */
+    u_long su_prog;                     /* program number, for the cache */
+    u_long su_vers;                     /* version number, for the cache */
+    u_long su_proc;                     /* procedure number, for the cache */
     XDR su_xdrs;                        /* XDR handle */
     char su_verfbody[MAX_AUTH_BYTES];   /* verifier body */
     char *su_cache;                     /* cached data, NULL if no cache */
+    drc_t *su_drc;                      /* byte-bounded cache, or NULL */
+    struct drc_key su_drc_key;          /* key of this request, for su_drc */
+    svc_flight_t *su_flight;            /* single-flight led by this request */
+    memo_ticket_t *su_memo;             /* memoize the reply to this request */
 };
 
 #define su_data(xprt) ((struct svcudp_data *)(xprt->xp_p2))
@@ -156,6 +170,9 @@ svcudp_bufcreate(int sock, u_int sendsz, u_int recvsz)
         }
         tprintf(2, "socket() => %d\n", sock);
         madesock = TRUE;
+        if (svc_reactors > 1) {
+            svc_set_reuseport(sock);
+        }
     }
 
     bzero((char *)&addr, sizeof (addr));
@@ -172,7 +189,7 @@ svcudp_bufcreate(int sock, u_int sendsz, u_int recvsz)
     }
     bufsize = ((MAX(sendsz, recvsz) + 3) / 4) * 4;
 
-    xprt = alloc_xprt();
+    xprt = alloc_xprt(RQCRED_AREA_SIZE);
 
     /*
      * Constructor for @type{SVCXPRT}, including the additional @type{mtxprt_t}
@@ -186,15 +203,12 @@ svcudp_bufcreate(int sock, u_int sendsz, u_int recvsz)
      */
 
     mtxprt = xprt_to_mtxprt_nocheck(xprt);
+    xprt_ext_attach(xprt, RQCRED_AREA_SIZE);
 
     if (pthread_mutex_init(&(mtxprt->mtxp_lock), NULL) != 0) {
         abort();
     }
 
-    if (pthread_mutex_init(&(mtxprt->mtxp_progress_lock), NULL) != 0) {
-        abort();
-    }
-
     if (pthread_mutex_init(&(mtxprt->mtxp_mtready), NULL) != 0) {
         abort();
     }
@@ -208,7 +222,7 @@ svcudp_bufcreate(int sock, u_int sendsz, u_int recvsz)
      * Do not use xprt_lock(xprt) here.
      * The constructor has not progressed far enough, yet.
      */
-    if (pthread_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
+    if (svc_mutex_lock(&(mtxprt->mtxp_lock)) != 0) {
         abort();
     }
 
@@ -225,9 +239,14 @@ svcudp_bufcreate(int sock, u_int sendsz, u_int recvsz)
     buf = guard_malloc(bufsize);
 
     su->su_iosz = bufsize;
+    su->su_rlen = 0;
     rpc_buffer(xprt) = (char *)buf;
+    xprt_footprint_add(xprt, sizeof (*su) + bufsize);
     xdrmem_create(&(su->su_xdrs), rpc_buffer(xprt), su->su_iosz, XDR_DECODE);
     su->su_cache = NULL;
+    su->su_drc = NULL;
+    su->su_flight = NULL;
+    su->su_memo = NULL;
     xprt->xp_p2 = (caddr_t)su;
     xprt->xp_verf.oa_base = su->su_verfbody;
     xprt->xp_ops = &svcudp_op;
@@ -244,10 +263,6 @@ svcudp_bufcreate(int sock, u_int sendsz, u_int recvsz)
     mtxprt->mtxp_parent = NO_PARENT;
     mtxprt->mtxp_refcnt = 0;
     mtxprt->mtxp_progress = 0;
-    mtxprt->mtxp_busy = 0;
-#ifdef CHECK_CREDENTIALS
-    memset(mtxprt->mtxp_cred, 0, sizeof (mtxprt->mtxp_cred));
-#endif
     memcpy(mtxprt->mtxp_guard, MTXPRT_GUARD, sizeof (mtxprt->mtxp_guard));
     xprt_unlock(xprt);
 
@@ -290,13 +305,13 @@ svcudp_xprt_clone(SVCXPRT *xprt1)
     mtxprt_t *mtxprt1;
     mtxprt_t *mtxprt2;
     struct svc_req *rqstp2;
-    struct rpc_msg *msgp2;
     struct svcudp_data *su1;
     struct svcudp_data *su2;
     XDR *xdrs1;
     XDR *xdrs2;
     void *buf;
     size_t bufsize;
+    size_t credsz;
 
 #ifdef IP_PKTINFO
     struct msghdr *mesgp1;
@@ -304,24 +319,23 @@ svcudp_xprt_clone(SVCXPRT *xprt1)
     struct iovec *iovp;
 #endif
 
-    xprt2 = alloc_xprt();
+    credsz = xprt_cred_clone_size(xprt1);
+    xprt2 = alloc_xprt(credsz);
 
     /*
-     * Shallow copy
+     * Shallow copy, of just the SVCXPRT and the mtxprt.
+     * The credentials area is copied by xprt_cred_clone(), below.
      */
-    memcpy(xprt2, xprt1, sizeof (SVCXPRT) + sizeof (mtxprt_t));
+    memcpy(xprt2, xprt1, XPRT_ALLOC_SIZE);
     mtxprt1 = xprt_to_mtxprt(xprt1);
     mtxprt2 = xprt_to_mtxprt_nocheck(xprt2);
+    xprt_ext_attach(xprt2, credsz);
     bufsize = mtxprt1->mtxp_bufsz;
 
     if (pthread_mutex_init(&(mtxprt2->mtxp_lock), NULL) != 0) {
         abort();
     }
 
-    if (pthread_mutex_init(&(mtxprt2->mtxp_progress_lock), NULL) != 0) {
-        abort();
-    }
-
     if (pthread_mutex_init(&(mtxprt2->mtxp_mtready), NULL) != 0) {
         abort();
     }
@@ -335,7 +349,7 @@ svcudp_xprt_clone(SVCXPRT *xprt1)
      * Do not use xprt_lock(xprt2) here.
      * The constructor has not progressed far enough, yet.
      */
-    if (pthread_mutex_lock(&(mtxprt2->mtxp_lock)) != 0) {
+    if (svc_mutex_lock(&(mtxprt2->mtxp_lock)) != 0) {
         abort();
     }
 
@@ -352,6 +366,9 @@ svcudp_xprt_clone(SVCXPRT *xprt1)
     su2 = (struct svcudp_data *)guard_malloc(sizeof (*su2));
     memcpy(su2, su1, sizeof (*su2));
     su2->su_cache = su1->su_cache;
+    // The clone replies, so it leads the flight, if any.
+    su1->su_flight = NULL;
+    su1->su_memo = NULL;
     xprt2->xp_p2 = (caddr_t)su2;
     xprt2->xp_verf.oa_base = su2->su_verfbody;
     xprt2->xp_ops = &svcudp_op;
@@ -364,26 +381,15 @@ svcudp_xprt_clone(SVCXPRT *xprt1)
     mtxprt2->mtxp_parent = mtxprt1->mtxp_id;
     mtxprt2->mtxp_refcnt = 0;
     mtxprt2->mtxp_progress = 0;
-    mtxprt2->mtxp_busy = 0;
     rqstp2 = &(mtxprt2->mtxp_rqst);
-    msgp2 = &(mtxprt2->mtxp_msg);
-#ifdef CHECK_CREDENTIALS
-    rqstp2->rq_clntcred = &(mtxprt2->mtxp_cred[2 * MAX_AUTH_BYTES]);
-#else
-    rqstp2->rq_clntcred = NULL;
-#endif
     rqstp2->rq_xprt = xprt2;
-#ifdef CHECK_CREDENTIALS
-    msgp2->rm_call.cb_cred.oa_base = &(mtxprt2->mtxp_cred[0]);
-    msgp2->rm_call.cb_verf.oa_base = &(mtxprt2->mtxp_cred[MAX_AUTH_BYTES]);
-#else
-    msgp2->rm_call.cb_cred.oa_base = NULL;
-    msgp2->rm_call.cb_verf.oa_base = NULL;
-#endif
+    xprt_cred_clone(xprt2, xprt1);
     buf = guard_malloc(bufsize);
     rpc_buffer(xprt2) = (char *)buf;
     xdrmem_create(&(su2->su_xdrs), rpc_buffer(xprt2), su2->su_iosz, XDR_DECODE);
-    memcpy(rpc_buffer(xprt2), rpc_buffer(xprt1), bufsize);
+    // Only the datagram that was received is of any interest.
+    memcpy(rpc_buffer(xprt2), rpc_buffer(xprt1), su1->su_rlen);
+    xprt_footprint_add(xprt2, sizeof (*su2) + bufsize);
     xdrs1 = &(su1->su_xdrs);
     xdrs2 = &(su2->su_xdrs);
     xdrs2->x_op = xdrs1->x_op;
@@ -433,6 +439,34 @@ svcudp_create(int sock)
     return (xprt);
 }
 
+/*
+ * Make another UDP SVCXPRT, bound to the same address and port
+ * as @var{xprt}, with the same buffer size, for use by another reactor.
+ * See svc_reactor.h.
+ */
+SVCXPRT *
+svcudp_reuseport_clone(SVCXPRT *xprt)
+{
+    SVCXPRT *rxprt;
+    mtxprt_t *mtxprt;
+    int sock;
+
+    mtxprt = xprt_to_mtxprt(xprt);
+    sock = svc_reuseport_socket(xprt->xp_sock, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return ((SVCXPRT *)NULL);
+    }
+    rxprt = svcudp_bufcreate(sock, mtxprt->mtxp_bufsz, mtxprt->mtxp_bufsz);
+    if (rxprt == NULL) {
+        (void) close(sock);
+        return (rxprt);
+    }
+    // The reply cache is thread-safe; all replicas share it.
+    su_data(rxprt)->su_cache = su_data(xprt)->su_cache;
+    su_data(rxprt)->su_drc = su_data(xprt)->su_drc;
+    return (rxprt);
+}
+
 static enum xprt_stat
 svcudp_stat(SVCXPRT *xprt  __attribute__((unused)))
 {
@@ -444,6 +478,73 @@ svcudp_stat(SVCXPRT *xprt  __attribute__((unused)))
 #define SIMPLE_IP_PKTINFO_SIZE \
     (sizeof (struct cmsghdr) + sizeof (struct in_pktinfo))
 
+/*
+ * Socket I/O for UDP goes through these, so that it can be
+ * done by the io_uring engine, when the socket is watched by it.
+ * See svc_uring.h.
+ */
+
+static ssize_t
+udp_recvmsg(int sock, struct msghdr *mesgp)
+{
+    if (uring_watching(sock)) {
+        return (uring_recvmsg(sock, mesgp));
+    }
+    return (recvmsg(sock, mesgp, 0));
+}
+
+static ssize_t
+udp_recvfrom(int sock, void *buf, size_t len, struct sockaddr *addr,
+    socklen_t *addrlenp)
+{
+    struct msghdr mesg;
+    struct iovec iov;
+    ssize_t rlen;
+
+    if (!uring_watching(sock)) {
+        return (recvfrom(sock, buf, len, 0, addr, addrlenp));
+    }
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    memset(&mesg, 0, sizeof (mesg));
+    mesg.msg_iov = &iov;
+    mesg.msg_iovlen = 1;
+    mesg.msg_name = addr;
+    mesg.msg_namelen = *addrlenp;
+    rlen = uring_recvmsg(sock, &mesg);
+    *addrlenp = mesg.msg_namelen;
+    return (rlen);
+}
+
+static ssize_t
+udp_sendmsg(int sock, const struct msghdr *mesgp)
+{
+    if (uring_watching(sock)) {
+        return (uring_sendmsg(sock, mesgp));
+    }
+    return (sendmsg(sock, mesgp, 0));
+}
+
+static ssize_t
+udp_sendto(int sock, const void *buf, size_t len,
+    const struct sockaddr *addr, socklen_t addrlen)
+{
+    struct msghdr mesg;
+    struct iovec iov;
+
+    if (!uring_watching(sock)) {
+        return (sendto(sock, buf, len, 0, addr, addrlen));
+    }
+    iov.iov_base = (void *)buf;
+    iov.iov_len = len;
+    memset(&mesg, 0, sizeof (mesg));
+    mesg.msg_iov = &iov;
+    mesg.msg_iovlen = 1;
+    mesg.msg_name = (void *)addr;
+    mesg.msg_namelen = addrlen;
+    return (uring_sendmsg(sock, &mesg));
+}
+
 static inline int
 is_simple_ip_pktinfo(struct msghdr *mesgp, struct cmsghdr *cmsg)
 {
@@ -469,6 +570,7 @@ svcudp_recv_with_id_lock(SVCXPRT *xprt, struct rpc_msg *msg)
     char *reply;
     u_long replylen;
     socklen_t len;
+    int found;
 
 #ifdef IP_PKTINFO
     struct iovec *iovp;
@@ -489,6 +591,19 @@ svcudp_recv_with_id_lock(SVCXPRT *xprt, struct rpc_msg *msg)
     su = su_data(xprt);
     xdrs = &(su->su_xdrs);
 
+    /*
+     * Not cloned, and never replied to; the followers will have to
+     * retransmit.
+     */
+    if (su->su_flight != NULL) {
+        sf_abandon(su->su_flight);
+        su->su_flight = NULL;
+    }
+    if (su->su_memo != NULL) {
+        memo_ticket_free(su->su_memo);
+        su->su_memo = NULL;
+    }
+
     /*
      * It is very tricky when you have IP aliases.
      * We want to make sure that we are sending the packet
@@ -513,7 +628,7 @@ svcudp_recv_with_id_lock(SVCXPRT *xprt, struct rpc_msg *msg)
         mesgp->msg_control = &xprt->xp_pad[sizeof (struct iovec) + sizeof (struct msghdr)];
         mesgp->msg_controllen = sizeof (xprt->xp_pad)
             - sizeof (struct iovec) - sizeof (struct msghdr);
-        rlen = recvmsg(xprt->xp_sock, mesgp, 0);
+        rlen = udp_recvmsg(xprt->xp_sock, mesgp);
         if (rlen >= 0) {
             struct cmsghdr *cmsg;
 
@@ -536,12 +651,12 @@ svcudp_recv_with_id_lock(SVCXPRT *xprt, struct rpc_msg *msg)
         }
     }
     else {
-        rlen = recvfrom(xprt->xp_sock, rpc_buffer(xprt), (int)su->su_iosz, 0, (struct sockaddr *)&(xprt->xp_raddr), &len);
+        rlen = udp_recvfrom(xprt->xp_sock, rpc_buffer(xprt), su->su_iosz, (struct sockaddr *)&(xprt->xp_raddr), &len);
     }
 #else
     tprintf(2, "recvfrom(%d, _, %d, 0, _, %d)\n",
         xprt->xp_sock, (int)su->su_iosz, *len);
-    rlen = recvfrom(xprt->xp_sock, rpc_buffer(xprt), (int)su->su_iosz, 0, (struct sockaddr *)&(xprt->xp_raddr), &len);
+    rlen = udp_recvfrom(xprt->xp_sock, rpc_buffer(xprt), su->su_iosz, (struct sockaddr *)&(xprt->xp_raddr), &len);
 #endif
 
     xprt->xp_addrlen = len;
@@ -549,32 +664,64 @@ svcudp_recv_with_id_lock(SVCXPRT *xprt, struct rpc_msg *msg)
         if (errno == EINTR) {
             goto again;
         }
+        if (errno == EAGAIN) {
+            /* io_uring engine: nothing queued, after all */
+            return (FALSE);
+        }
         svc_accept_failed();
     }
 
     if ((size_t)rlen < (4 * sizeof (uint32_t))) { /* < 4 32-bit ints? */
         return (FALSE);
     }
+    su->su_rlen = (u_int)rlen;
     xdrs->x_op = XDR_DECODE;
     XDR_SETPOS(xdrs, 0);
     if (!xdr_callmsg(xdrs, msg))
         return (FALSE);
     su->su_xid = msg->rm_xid;
+    found = 0;
     if (su->su_cache != NULL) {
-        if (cache_get(xprt, msg, &reply, &replylen)) {
+        found = cache_get(xprt, msg, &reply, &replylen);
+    }
+    else if (su->su_drc != NULL) {
+        found = drc_get(xprt, msg, &reply, &replylen);
+    }
+    if (!found) {
+        found = memo_get(xprt, msg, &reply, &replylen);
+    }
+    if (found) {
 
 #ifdef IP_PKTINFO
-            if (mesgp->msg_iovlen) {
-                iovp->iov_base = reply;
-                iovp->iov_len = replylen;
-                (void) sendmsg(xprt->xp_sock, mesgp, 0);
-            } else {
-                (void) sendto(xprt->xp_sock, reply, (int)replylen, 0, (struct sockaddr *)&xprt->xp_raddr, len);
-            }
+        if (mesgp->msg_iovlen) {
+            iovp->iov_base = reply;
+            iovp->iov_len = replylen;
+            (void) udp_sendmsg(xprt->xp_sock, mesgp);
+        } else {
+            (void) udp_sendto(xprt->xp_sock, reply, (size_t)replylen, (struct sockaddr *)&xprt->xp_raddr, len);
+        }
 #else
-            (void) sendto(xprt->xp_sock, reply, (int)replylen, 0, (struct sockaddr *)&xprt->xp_raddr, len);
+        (void) udp_sendto(xprt->xp_sock, reply, (size_t)replylen, (struct sockaddr *)&xprt->xp_raddr, len);
 #endif
-            return (TRUE);
+        /*
+         * A retransmission, or a call to a memoized procedure,
+         * and we have already sent the reply.  There is nothing
+         * to dispatch.
+         */
+        return (FALSE);
+    }
+
+    if (sf_enabled(msg->rm_call.cb_prog, msg->rm_call.cb_vers, msg->rm_call.cb_proc)) {
+        u_int pos;
+        int sf;
+
+        pos = XDR_GETPOS(xdrs);
+        sf = sf_join(msg, rpc_buffer(xprt) + pos, su->su_rlen - pos,
+            xprt->xp_sock, (struct sockaddr *)&xprt->xp_raddr, len,
+            &su->su_flight);
+        if (sf == SF_FOLLOWER) {
+            // An identical call is in flight.  Its reply will do.
+            return (FALSE);
         }
     }
     return (TRUE);
@@ -592,6 +739,37 @@ svcudp_recv(SVCXPRT *xprt, struct rpc_msg *msg)
     return (rv);
 }
 
+/*
+ * Send the reply of the leader of a single-flight to all its followers,
+ * each with its own xid, which is the first word of the reply.
+ * The xid is patched in place; udp_sendto() has copied or sent the
+ * datagram before it returns, so the buffer can be reused right away.
+ * The leader's own xid is put back, in case the reply gets cached.
+ */
+static void
+udp_fanout(svc_flight_t *flight, char *reply, size_t len)
+{
+    struct sf_waiter *list;
+    struct sf_waiter *w;
+    uint32_t xid;
+    uint32_t leader_xid;
+
+    list = sf_finish(flight);
+    if (list == NULL || len < sizeof (xid)) {
+        sf_waiters_free(list);
+        return;
+    }
+    memcpy(&leader_xid, reply, sizeof (leader_xid));
+    for (w = list; w != NULL; w = w->sw_next) {
+        xid = htonl(w->sw_xid);
+        memcpy(reply, &xid, sizeof (xid));
+        (void) udp_sendto(w->sw_sock, reply, len,
+            (struct sockaddr *)&w->sw_addr, w->sw_addrlen);
+    }
+    memcpy(reply, &leader_xid, sizeof (leader_xid));
+    sf_waiters_free(list);
+}
+
 static ssize_t
 xprt_sendto(SVCXPRT *xprt, size_t slen)
 {
@@ -601,7 +779,7 @@ xprt_sendto(SVCXPRT *xprt, size_t slen)
 
     addr = (struct sockaddr *)&(xprt->xp_raddr);
     alen = xprt->xp_addrlen;
-    sent = sendto(xprt->xp_sock, rpc_buffer(xprt), slen, 0, addr, alen);
+    sent = udp_sendto(xprt->xp_sock, rpc_buffer(xprt), slen, addr, alen);
     return (sent);
 }
 
@@ -648,7 +826,7 @@ svcudp_reply(SVCXPRT *xprt, struct rpc_msg *msg)
             mesgp->msg_name = &(xprt->xp_raddr);
             mesgp->msg_namelen = (socklen_t) sizeof (struct sockaddr_in);
             tprintf(2, "sendmsg(%d, _, 0)\n", xprt->xp_sock);
-            rsent = sendmsg(xprt->xp_sock, mesgp, 0);
+            rsent = udp_sendmsg(xprt->xp_sock, mesgp);
         }
         else {
             rsent = xprt_sendto(xprt, slen);
@@ -662,11 +840,28 @@ svcudp_reply(SVCXPRT *xprt, struct rpc_msg *msg)
         }
         sent = (size_t)rsent;
         tprintf(2, "slen=%zu, sent=%zd\n", slen, sent);
+        if (su->su_flight != NULL) {
+            udp_fanout(su->su_flight, rpc_buffer(xprt), slen);
+            su->su_flight = NULL;
+        }
+        if (su->su_memo != NULL) {
+            if (msg->rm_reply.rp_stat == MSG_ACCEPTED
+                && msg->acpted_rply.ar_stat == SUCCESS) {
+                memo_insert(su->su_memo, rpc_buffer(xprt), slen);
+            }
+            else {
+                memo_ticket_free(su->su_memo);
+            }
+            su->su_memo = NULL;
+        }
         if (sent == slen) {
             stat = TRUE;
             if (su->su_cache) {
                 cache_set(xprt, (u_long)slen);
             }
+            else if (su->su_drc != NULL) {
+                drc_insert(su->su_drc, &su->su_drc_key, rpc_buffer(xprt), slen);
+            }
         }
         xprt_progress_setbits(xprt, XPRT_REPLY);
     }
@@ -728,6 +923,15 @@ svcudp_destroy(SVCXPRT *xprt)
     mtxprt = xprt_to_mtxprt(xprt);
     id = mtxprt->mtxp_id;
     tprintf(2, "xprt=%s, id=%d\n", decode_addr(xprt), id);
+    /*
+     * Unregister first, then close.  As soon as the fd is closed,
+     * a new socket can get the same number, and must not lose
+     * its slot, or its poll entry, to us.
+     */
+    xports_global_lock();
+    xprt_unregister(xprt);
+    xports_global_unlock();
+
     xprt_lock(xprt);
     /*
      * Close socket if this xprt is not a clone.
@@ -767,6 +971,12 @@ svcudp_destroy(SVCXPRT *xprt)
      */
     su = su_data(xprt);
     if (su != NULL) {
+        if (su->su_flight != NULL) {
+            sf_abandon(su->su_flight);
+        }
+        if (su->su_memo != NULL) {
+            memo_ticket_free(su->su_memo);
+        }
         xdrs = &(su->su_xdrs);
         if (xdrs != NULL) {
             XDR_DESTROY(xdrs);
@@ -780,7 +990,7 @@ svcudp_destroy(SVCXPRT *xprt)
     xprt_unlock(xprt);
 
     xports_global_lock();
-    xprt_unregister(xprt);
+    xprt_footprint_release(xprt);
     free(xprt);
     xports_global_unlock();
 }
@@ -792,10 +1002,29 @@ svcudp_destroy(SVCXPRT *xprt)
  * Fifo cache for udp server
  * Copies pointers to reply buffers into fifo cache
  * Buffers are sent again if retransmissions are detected.
+ *
+ * The cache is shared by an original UDP SVCXPRT, all its clones,
+ * and all its SO_REUSEPORT replicas, so it is looked up and updated
+ * by many threads at once.  It is split into shards, by a hash of
+ * the xid, and each shard has its own lock, its own hash table,
+ * and its own fifo.  A lookup or an update locks just one shard,
+ * so retransmit detection does not serialize all the workers.
+ *
+ * Nothing about the request being looked up is kept in the cache;
+ * the key (xid, prog, vers, proc) is kept in the private
+ * @type{struct svcudp_data} of the (clone) SVCXPRT that is serving
+ * the request, and the address is in its xp_raddr.
+ *
+ * A cached reply is never handed out by pointer.
+ * On a hit, it is copied into the buffer of the SVCXPRT that received
+ * the retransmission, while the shard is locked, because as soon as
+ * the lock is let go, the entry can be evicted and its buffer reused.
  */
 
 #define SPARSENESS 4            /* 75% sparse */
 
+#define UC_MAX_SHARDS 16        /* power of 2 */
+
 #define CACHE_PERROR(msg)       \
     (void) eprintf("%s\n", msg)
 
@@ -830,28 +1059,46 @@ struct cache_node {
     cache_ptr cache_next;
 };
 
-
+/*
+ * One shard of the cache
+ */
+struct udp_cache_shard {
+    pthread_mutex_t ucs_lock;   /* protects everything below */
+    cache_ptr *ucs_entries;     /* hash table of entries in this shard */
+    cache_ptr *ucs_fifo;        /* fifo list of entries in this shard */
+    u_long ucs_nextvictim;      /* points to next victim in fifo list */
+} CACHE_ALIGNED;
 
 /*
  * The entire cache
  */
 struct udp_cache {
-    u_long uc_size;             /* size of cache */
-    cache_ptr *uc_entries;      /* hash table of entries in cache */
-    cache_ptr *uc_fifo;         /* fifo list of entries in cache */
-    u_long uc_nextvictim;       /* points to next victim in fifo list */
-    u_long uc_prog;             /* saved program number */
-    u_long uc_vers;             /* saved version number */
-    u_long uc_proc;             /* saved procedure number */
-    struct sockaddr_in uc_addr; /* saved caller's address */
+    u_long uc_size;             /* size of cache, per shard */
+    u_long uc_nbuckets;         /* hash table size, per shard */
+    u_int uc_nshards;           /* number of shards, a power of 2 */
+    u_int uc_iosz;              /* size of each reply buffer */
+    struct udp_cache_shard *uc_shards;
 };
 
 
 /*
- * the hashing function
+ * the hashing functions
+ *
+ * The shard is picked by the high bits of a multiplicative hash
+ * of the xid, so that consecutive xids from one client are spread
+ * over all shards.  The bucket within the shard is just the xid,
+ * modulo the number of buckets, as it always was.
  */
-#define CACHE_LOC(transp, xid) \
- (xid % (SPARSENESS*((struct udp_cache *) su_data(transp)->su_cache)->uc_size))
+static inline struct udp_cache_shard *
+cache_shard(struct udp_cache *uc, u_long xid)
+{
+    uint32_t h;
+
+    h = (uint32_t)xid * 0x9e3779b1U;
+    return (&uc->uc_shards[(h >> 16) & (uc->uc_nshards - 1)]);
+}
+
+#define CACHE_LOC(uc, xid) ((xid) % (uc)->uc_nbuckets)
 
 
 /*
@@ -863,30 +1110,52 @@ svcudp_enablecache(SVCXPRT *transp, u_long size)
 {
     struct svcudp_data *su = su_data(transp);
     struct udp_cache *uc;
+    struct udp_cache_shard *ucs;
+    u_int nshards;
+    u_int i;
 
     if (su->su_cache != NULL) {
         CACHE_PERROR("enablecache: cache already enabled");
         return (0);
     }
+    if (size == 0) {
+        CACHE_PERROR("enablecache: cache size must be > 0");
+        return (0);
+    }
     uc = ALLOC(struct udp_cache, 1);
     if (uc == NULL) {
         CACHE_PERROR("enablecache: could not allocate cache");
         return (0);
     }
-    uc->uc_size = size;
-    uc->uc_nextvictim = 0;
-    uc->uc_entries = CALLOC(cache_ptr, size * SPARSENESS);
-    if (uc->uc_entries == NULL) {
-        free(uc);
-        CACHE_PERROR("enablecache: could not allocate cache data");
-        return (0);
+
+    // Keep at least 4 fifo slots per shard.
+    nshards = UC_MAX_SHARDS;
+    while (nshards > 1 && size / nshards < 4) {
+        nshards /= 2;
     }
-    uc->uc_fifo = CALLOC(cache_ptr, size);
-    if (uc->uc_fifo == NULL) {
-        free(uc->uc_entries);
-        free(uc);
-        CACHE_PERROR("enablecache: could not allocate cache fifo");
-        return (0);
+    uc->uc_nshards = nshards;
+    uc->uc_size = (size + nshards - 1) / nshards;
+    uc->uc_nbuckets = uc->uc_size * SPARSENESS;
+    uc->uc_iosz = su->su_iosz;
+    uc->uc_shards = (struct udp_cache_shard *)
+        guard_memalign(CACHE_LINE_SIZE, nshards * sizeof (struct udp_cache_shard));
+
+    for (i = 0; i < nshards; ++i) {
+        ucs = &uc->uc_shards[i];
+        pthread_mutex_init(&ucs->ucs_lock, NULL);
+        ucs->ucs_nextvictim = 0;
+        ucs->ucs_entries = CALLOC(cache_ptr, uc->uc_nbuckets);
+        ucs->ucs_fifo = CALLOC(cache_ptr, uc->uc_size);
+        if (ucs->ucs_entries == NULL || ucs->ucs_fifo == NULL) {
+            CACHE_PERROR("enablecache: could not allocate cache data");
+            do {
+                free(uc->uc_shards[i].ucs_entries);
+                free(uc->uc_shards[i].ucs_fifo);
+            } while (i-- != 0);
+            free(uc->uc_shards);
+            free(uc);
+            return (0);
+        }
     }
     su->su_cache = (char *)uc;
     return (1);
@@ -895,6 +1164,10 @@ svcudp_enablecache(SVCXPRT *transp, u_long size)
 
 /*
  * Set an entry in the cache
+ *
+ * The reply buffer of @var{xprt} becomes the cached reply,
+ * and @var{xprt} gets the buffer of the evicted entry, or a new one.
+ * Caller holds the lock on @var{xprt}.
  */
 static void
 cache_set(SVCXPRT *xprt, u_long replylen)
@@ -903,21 +1176,26 @@ cache_set(SVCXPRT *xprt, u_long replylen)
     cache_ptr *vicp;
     struct svcudp_data *su;
     struct udp_cache *uc;
+    struct udp_cache_shard *ucs;
     u_int loc;
     char *newbuf;
 
     su = su_data(xprt);
     uc = (struct udp_cache *)su->su_cache;
+    ucs = cache_shard(uc, su->su_xid);
+
+    pthread_mutex_lock(&ucs->ucs_lock);
 
     /*
      * Find space for the new entry, either by
      * reusing an old entry, or by mallocing a new one
      */
-    victim = uc->uc_fifo[uc->uc_nextvictim];
+    victim = ucs->ucs_fifo[ucs->ucs_nextvictim];
     if (victim != NULL) {
-        loc = CACHE_LOC(xprt, victim->cache_xid);
-        for (vicp = &uc->uc_entries[loc]; *vicp != NULL && *vicp != victim; vicp = &(*vicp)->cache_next);
+        loc = CACHE_LOC(uc, victim->cache_xid);
+        for (vicp = &ucs->ucs_entries[loc]; *vicp != NULL && *vicp != victim; vicp = &(*vicp)->cache_next);
         if (*vicp == NULL) {
+            pthread_mutex_unlock(&ucs->ucs_lock);
             CACHE_PERROR("cache_set: victim not found");
             return;
         }
@@ -926,12 +1204,14 @@ cache_set(SVCXPRT *xprt, u_long replylen)
     } else {
         victim = ALLOC(struct cache_node, 1);
         if (victim == NULL) {
+            pthread_mutex_unlock(&ucs->ucs_lock);
             CACHE_PERROR("cache_set: victim alloc failed");
             return;
         }
-        newbuf = (char *)malloc(su->su_iosz);
+        newbuf = (char *)malloc(uc->uc_iosz);
         if (newbuf == NULL) {
             free(victim);
+            pthread_mutex_unlock(&ucs->ucs_lock);
             CACHE_PERROR("cache_set: could not allocate new rpc_buffer");
             return;
         }
@@ -945,35 +1225,41 @@ cache_set(SVCXPRT *xprt, u_long replylen)
     rpc_buffer(xprt) = newbuf;
     xdrmem_create(&(su->su_xdrs), rpc_buffer(xprt), su->su_iosz, XDR_ENCODE);
     victim->cache_xid = su->su_xid;
-    victim->cache_proc = uc->uc_proc;
-    victim->cache_vers = uc->uc_vers;
-    victim->cache_prog = uc->uc_prog;
-    victim->cache_addr = uc->uc_addr;
-    loc = CACHE_LOC(xprt, victim->cache_xid);
-    victim->cache_next = uc->uc_entries[loc];
-    uc->uc_entries[loc] = victim;
-    uc->uc_fifo[uc->uc_nextvictim++] = victim;
-    uc->uc_nextvictim %= uc->uc_size;
+    victim->cache_proc = su->su_proc;
+    victim->cache_vers = su->su_vers;
+    victim->cache_prog = su->su_prog;
+    memcpy(&victim->cache_addr, &xprt->xp_raddr, sizeof (victim->cache_addr));
+    loc = CACHE_LOC(uc, victim->cache_xid);
+    victim->cache_next = ucs->ucs_entries[loc];
+    ucs->ucs_entries[loc] = victim;
+    ucs->ucs_fifo[ucs->ucs_nextvictim++] = victim;
+    ucs->ucs_nextvictim %= uc->uc_size;
+
+    pthread_mutex_unlock(&ucs->ucs_lock);
 }
 
-#define EQADDR(a1, a2) (memcmp((char *)&a1, (char *)&a2, sizeof (a1)) == 0)
-
 static inline int
-cache_match(cache_ptr ent, struct svcudp_data *su, struct udp_cache *uc)
+cache_match(cache_ptr ent, struct svcudp_data *su, const struct sockaddr_in *addr)
 {
     int match;
 
     match = ent->cache_xid == su->su_xid
-        && ent->cache_proc == uc->uc_proc
-        && ent->cache_vers == uc->uc_vers
-        && ent->cache_prog == uc->uc_prog
-        && EQADDR(ent->cache_addr, uc->uc_addr);
+        && ent->cache_proc == su->su_proc
+        && ent->cache_vers == su->su_vers
+        && ent->cache_prog == su->su_prog
+        && ent->cache_addr.sin_port == addr->sin_port
+        && ent->cache_addr.sin_addr.s_addr == addr->sin_addr.s_addr
+        && ent->cache_addr.sin_family == addr->sin_family;
     return (match);
 }
 
 /*
  * Try to get an entry from the cache
  * return 1 if found, 0 if not found
+ *
+ * On a hit, the cached reply is copied into the buffer of @var{xprt};
+ * *replyp points to it.  Either way, the key of the request is left
+ * in the private data of @var{xprt}, to be used by cache_set().
  */
 static int
 cache_get(SVCXPRT *xprt, struct rpc_msg *msg, char **replyp, u_long *replylenp)
@@ -982,25 +1268,124 @@ cache_get(SVCXPRT *xprt, struct rpc_msg *msg, char **replyp, u_long *replylenp)
     cache_ptr ent;
     struct svcudp_data *su;
     struct udp_cache *uc;
+    struct udp_cache_shard *ucs;
+    struct sockaddr_in addr;
+    int found;
 
     su = su_data(xprt);
     uc = (struct udp_cache *)su->su_cache;
 
-    loc = CACHE_LOC(xprt, su->su_xid);
-    for (ent = uc->uc_entries[loc]; ent != NULL; ent = ent->cache_next) {
-        if (cache_match(ent, su, uc)) {
-            *replyp = ent->cache_reply;
-            *replylenp = ent->cache_replylen;
-            return (1);
-        }
-    }
     /*
-     * Failed to find entry
      * Remember a few things so we can do a set later
      */
-    uc->uc_proc = msg->rm_call.cb_proc;
-    uc->uc_vers = msg->rm_call.cb_vers;
-    uc->uc_prog = msg->rm_call.cb_prog;
-    memcpy(&uc->uc_addr, &xprt->xp_raddr, sizeof (uc->uc_addr));
-    return (0);
+    su->su_proc = msg->rm_call.cb_proc;
+    su->su_vers = msg->rm_call.cb_vers;
+    su->su_prog = msg->rm_call.cb_prog;
+    memcpy(&addr, &xprt->xp_raddr, sizeof (addr));
+
+    found = 0;
+    ucs = cache_shard(uc, su->su_xid);
+    loc = CACHE_LOC(uc, su->su_xid);
+    pthread_mutex_lock(&ucs->ucs_lock);
+    for (ent = ucs->ucs_entries[loc]; ent != NULL; ent = ent->cache_next) {
+        if (cache_match(ent, su, &addr)) {
+            if (ent->cache_replylen <= su->su_iosz) {
+                memcpy(rpc_buffer(xprt), ent->cache_reply, ent->cache_replylen);
+                *replyp = rpc_buffer(xprt);
+                *replylenp = ent->cache_replylen;
+                found = 1;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ucs->ucs_lock);
+    return (found);
+}
+
+/*
+ * Byte-bounded cache.  See svc_drc.h.
+ *
+ * Enable it instead of svcudp_enablecache(), not as well.
+ * @var{budget} is the number of bytes of replies to hold,
+ * and @var{ttl} is how many seconds a reply stays good; 0 means forever.
+ */
+int
+svcudp_enablecache_bytes(SVCXPRT *transp, size_t budget, unsigned int ttl)
+{
+    struct svcudp_data *su = su_data(transp);
+
+    if (su->su_cache != NULL || su->su_drc != NULL) {
+        CACHE_PERROR("enablecache_bytes: cache already enabled");
+        return (0);
+    }
+    su->su_drc = drc_create(budget, ttl);
+    return (1);
+}
+
+int
+svcudp_cache_stats(SVCXPRT *transp, struct drc_stats *statsp)
+{
+    struct svcudp_data *su = su_data(transp);
+
+    if (su->su_drc == NULL) {
+        return (0);
+    }
+    drc_get_stats(su->su_drc, statsp);
+    return (1);
+}
+
+/*
+ * Try to get an entry from the byte-bounded cache.
+ * return 1 if found, 0 if not found
+ *
+ * On a hit, the reply has been copied into the buffer of @var{xprt}.
+ * Either way, the key is left in the private data of @var{xprt},
+ * for svcudp_reply() to insert the reply under.
+ */
+static int
+drc_get(SVCXPRT *xprt, struct rpc_msg *msg, char **replyp, u_long *replylenp)
+{
+    struct svcudp_data *su;
+    ssize_t rlen;
+
+    su = su_data(xprt);
+    drc_key_init(&su->su_drc_key, (uint32_t)su->su_xid,
+        (uint32_t)msg->rm_call.cb_prog, (uint32_t)msg->rm_call.cb_vers,
+        (uint32_t)msg->rm_call.cb_proc,
+        (struct sockaddr *)&xprt->xp_raddr, xprt->xp_addrlen);
+    rlen = drc_lookup(su->su_drc, &su->su_drc_key, rpc_buffer(xprt), su->su_iosz);
+    if (rlen < 0) {
+        return (0);
+    }
+    *replyp = rpc_buffer(xprt);
+    *replylenp = (u_long)rlen;
+    return (1);
+}
+
+/*
+ * Try to answer a call to a memoized procedure from the reply cache.
+ * return 1 if found, 0 if not found
+ *
+ * The key is the raw argument bytes, which follow the call header
+ * in the buffer of @var{xprt}.  On a hit, the reply, with this call's
+ * xid, has been copied over them.  On a miss, the private data of
+ * @var{xprt} holds a ticket, for svcudp_reply() to keep the reply with.
+ */
+static int
+memo_get(SVCXPRT *xprt, struct rpc_msg *msg, char **replyp, u_long *replylenp)
+{
+    struct svcudp_data *su;
+    ssize_t rlen;
+    u_int pos;
+
+    su = su_data(xprt);
+    pos = XDR_GETPOS(&su->su_xdrs);
+    rlen = memo_lookup(msg, rpc_buffer(xprt) + pos, su->su_rlen - pos,
+        rpc_buffer(xprt), su->su_iosz, &su->su_memo);
+    if (rlen < 0) {
+        return (0);
+    }
+    *replyp = rpc_buffer(xprt);
+    *replylenp = (u_long)rlen;
+    return (1);
 }
@@ -0,0 +1,1436 @@
+/*
+ * Filename: svc_uring.c
+ * Project: rpc-mt
+ * Brief: Optional io_uring I/O engine for svc_run()
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+    // Import var EAGAIN, EBADF, ECANCELED, ENOBUFS, EPIPE, ETIMEDOUT
+#include <stdint.h>
+    // Import type uint64_t, uintptr_t
+#include <string.h>
+    // Import memcpy()
+    // Import memset()
+#include <time.h>
+    // Import clock_gettime()
+#include <unistd.h>
+    // Import close()
+#include <pthread.h>
+    // Import pthread_mutex_lock(), pthread_mutex_trylock()
+#include <sys/mman.h>
+    // Import mmap()
+    // Import munmap()
+#include <sys/socket.h>
+    // Import getpeername()
+    // Import getsockopt()
+    // Import constant SO_ACCEPTCONN, SO_TYPE
+#include <netinet/in.h>
+    // Import type struct sockaddr_in6
+#include <linux/io_uring.h>
+    // Import struct io_uring_params, io_uring_sqe, io_uring_cqe
+    // Import struct io_uring_buf_ring, io_uring_buf_reg
+    // Import struct io_uring_recvmsg_out, io_uring_getevents_arg
+#include <linux/time_types.h>
+    // Import struct __kernel_timespec
+
+#include "svc_debug.h"
+#include "svc_uring.h"
+#include "futex.h"
+
+extern int _rpc_dtablesize(void);
+
+/*
+ * Number of submission queue entries.  The completion queue is
+ * made bigger, because multishot requests post many completions
+ * for each submission.
+ */
+#define URING_DEPTH      256
+#define URING_CQ_DEPTH   (4 * URING_DEPTH)
+
+/*
+ * Provided buffers, for recv and recvmsg.
+ * One buffer group, shared by all sockets.
+ * The number of buffers must be a power of 2.
+ * A buffer must be big enough to hold the biggest UDP datagram
+ * we accept (UDPMSGSIZE), plus the struct io_uring_recvmsg_out
+ * header, address and control message that recvmsg puts in front.
+ */
+#define URING_NBUFS      256
+#define URING_BUFSZ      16384
+#define URING_BGID       0
+
+/*
+ * No one socket may hold more than URING_WATCH_BUFS of the provided
+ * buffers.  When it has that many queued, its multishot request is
+ * cancelled, so that the rest of the data waits in the socket buffer,
+ * and the sender feels TCP flow control, instead of every other socket
+ * getting ENOBUFS.  It is armed again once the reader has brought the
+ * queue down to URING_WATCH_LOW.
+ */
+#define URING_WATCH_BUFS (URING_NBUFS / 8)
+#define URING_WATCH_LOW  (URING_WATCH_BUFS / 2)
+
+/*
+ * Room for the source address and for an IP_PKTINFO control message,
+ * in front of each datagram received by multishot recvmsg.
+ */
+#define URING_NAMESZ     ((socklen_t) sizeof (struct sockaddr_in6))
+#define URING_CTLSZ      64
+
+#define URING_REAP_BATCH 64
+
+enum uring_kind {
+    URING_ACCEPT = 1,
+    URING_STREAM,
+    URING_DGRAM
+};
+
+enum uring_op_kind {
+    UOP_MULTI = 1,
+    UOP_SEND
+};
+
+typedef struct uring_watch uring_watch_t;
+typedef struct uring_op uring_op_t;
+
+/*
+ * The user_data of every SQE we submit is the address of
+ * a @type{struct uring_op}, or 0 for requests whose completion
+ * we do not care about (cancellations).
+ *
+ * Sends are allocated with their data, and freed on completion.
+ * The multishot request of a watch is embedded in the watch.
+ */
+struct uring_op {
+    int             op_kind;
+    uring_watch_t  *op_watch;
+    uring_op_t     *op_next;
+    char           *op_buf;
+    size_t          op_len;
+    struct msghdr   op_msg;
+    struct iovec    op_iov;
+};
+
+/*
+ * One queued item: a provided buffer with data in it,
+ * or an accepted socket.
+ */
+typedef struct {
+    int     c_bid;
+    int     c_res;
+} uring_chunk_t;
+
+/*
+ * Fields of @type{struct uring_watch}
+ * -----------------------------------
+ *
+ * w_refcnt:
+ *     One for the watch table, one while the multishot request
+ *     is armed, and one for each send in flight.
+ *     The watch is freed when the last reference goes away,
+ *     which can be well after uring_unwatch().
+ *
+ * w_armed, w_rearm:
+ *     The multishot request is outstanding.  Or, it has stopped,
+ *     because we ran out of provided buffers, or because of
+ *     a transient error, and should be armed again.
+ *
+ * w_paused:
+ *     The multishot request has been cancelled, because the socket
+ *     holds URING_WATCH_BUFS buffers.  See watch_pause().
+ *
+ * w_eof, w_err:
+ *     No more data will arrive.  w_err is 0 for an orderly
+ *     end of stream, or else an errno value.
+ *
+ * w_q, w_qhead, w_qlen, w_qsize, w_off:
+ *     Circular queue of received chunks, in arrival order.
+ *     w_off is the number of bytes already consumed from the
+ *     chunk at the head of the queue.
+ *
+ * w_chain, w_chain_tail:
+ *     Sends queued by uring_send(), not yet submitted.
+ *     If a chain is still in flight, uring_send_flush() leaves the
+ *     next one here, and complete_send() submits it.
+ *
+ * w_inflight:
+ *     Number of sends submitted, but not yet complete.
+ */
+struct uring_watch {
+    int             w_fd;
+    int             w_kind;
+    int             w_refcnt;
+    int             w_armed;
+    int             w_rearm;
+    int             w_paused;
+    int             w_dead;
+    int             w_eof;
+    int             w_err;
+    uring_op_t      w_op;
+    struct msghdr   w_msg;
+    uring_chunk_t  *w_q;
+    unsigned int    w_qhead;
+    unsigned int    w_qlen;
+    unsigned int    w_qsize;
+    size_t          w_off;
+    uring_op_t     *w_chain;
+    uring_op_t     *w_chain_tail;
+    int             w_inflight;
+};
+
+/*
+ * Locking
+ * -------
+ *
+ * ur_lock:
+ *     Protects the watch table, all watches, and the tail of
+ *     the provided buffer ring.  Taken by the reaper while it
+ *     processes completions, and by readers and writers.
+ *
+ * ur_sq_lock:
+ *     Protects the submission queue.  Taken after ur_lock,
+ *     never before it.
+ *
+ * ur_cq_lock:
+ *     Held by the one thread that is reaping completions.
+ *     The reaper copies completions out of the ring before
+ *     it takes ur_lock, so that the completion queue keeps
+ *     draining, no matter who holds ur_lock.
+ *
+ * ur_seq:
+ *     Bumped, and all futex waiters woken, after every batch
+ *     of completions has been processed.
+ */
+struct uring {
+    int                     ur_fd;
+    pthread_mutex_t         ur_lock;
+    pthread_mutex_t         ur_sq_lock;
+    pthread_mutex_t         ur_cq_lock;
+    int                     ur_seq;
+
+    void                   *ur_ring_mem;
+    size_t                  ur_ring_size;
+    struct io_uring_sqe    *ur_sqes;
+    size_t                  ur_sqes_size;
+    unsigned int           *ur_sq_head;
+    unsigned int           *ur_sq_tail;
+    unsigned int           *ur_sq_array;
+    unsigned int            ur_sq_mask;
+    unsigned int            ur_sq_entries;
+    unsigned int            ur_sq_local_tail;
+    unsigned int            ur_sq_submitted;
+    unsigned int           *ur_cq_head;
+    unsigned int           *ur_cq_tail;
+    unsigned int            ur_cq_mask;
+    struct io_uring_cqe    *ur_cqes;
+
+    struct io_uring_buf_ring *ur_br;
+    size_t                  ur_br_size;
+    unsigned short          ur_br_tail;
+    char                   *ur_bufs;
+
+    uring_watch_t         **ur_watchv;
+    size_t                  ur_watchv_size;
+};
+
+static struct uring *ur;
+
+static inline char *
+buf_addr(int bid)
+{
+    return (ur->ur_bufs + ((size_t)bid * URING_BUFSZ));
+}
+
+/*
+ * Give a provided buffer back to the kernel.
+ * Caller holds ur_lock.
+ */
+static void
+buf_recycle(int bid)
+{
+    struct io_uring_buf *b;
+
+    b = &ur->ur_br->bufs[ur->ur_br_tail & (URING_NBUFS - 1)];
+    b->addr = (uint64_t)(uintptr_t)buf_addr(bid);
+    b->len = URING_BUFSZ;
+    b->bid = (unsigned short)bid;
+    ++ur->ur_br_tail;
+    __atomic_store_n(&ur->ur_br->tail, ur->ur_br_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Push all SQEs filled so far to the kernel.
+ * Caller holds ur_sq_lock.
+ *
+ * If the kernel cannot take them right now (EBUSY, because the
+ * completion queue is backed up), they stay queued, and go out
+ * with the next submission, or the next time the reaper comes around.
+ */
+static void
+sq_submit_with_lock(void)
+{
+    unsigned int pending;
+    int rv;
+
+    __atomic_store_n(ur->ur_sq_tail, ur->ur_sq_local_tail, __ATOMIC_RELEASE);
+    pending = ur->ur_sq_local_tail - ur->ur_sq_submitted;
+    while (pending != 0) {
+        rv = sys_io_uring_enter(ur->ur_fd, pending, 0, 0, NULL, 0);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ur->ur_sq_submitted += (unsigned int)rv;
+        pending -= (unsigned int)rv;
+        if (rv == 0) {
+            break;
+        }
+    }
+}
+
+static void
+sq_submit(void)
+{
+    pthread_mutex_lock(&ur->ur_sq_lock);
+    if (ur->ur_sq_local_tail != ur->ur_sq_submitted) {
+        sq_submit_with_lock();
+    }
+    pthread_mutex_unlock(&ur->ur_sq_lock);
+}
+
+/*
+ * Get a blank SQE.  Caller holds ur_sq_lock.
+ * If the submission queue is full, push it out, first.
+ */
+static struct io_uring_sqe *
+sqe_get(void)
+{
+    struct io_uring_sqe *sqe;
+    unsigned int head;
+    unsigned int idx;
+
+    for (;;) {
+        head = __atomic_load_n(ur->ur_sq_head, __ATOMIC_ACQUIRE);
+        if (ur->ur_sq_local_tail - head < ur->ur_sq_entries) {
+            break;
+        }
+        sq_submit_with_lock();
+        if (ur->ur_sq_local_tail - head >= ur->ur_sq_entries) {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    idx = ur->ur_sq_local_tail & ur->ur_sq_mask;
+    sqe = &ur->ur_sqes[idx];
+    memset(sqe, 0, sizeof (*sqe));
+    ur->ur_sq_array[idx] = idx;
+    ++ur->ur_sq_local_tail;
+    return (sqe);
+}
+
+static void
+watch_release(uring_watch_t *w)
+{
+    --w->w_refcnt;
+    if (w->w_refcnt == 0) {
+        free(w->w_q);
+        free(w);
+    }
+}
+
+/*
+ * Arm the multishot request of a watch.
+ * Caller holds ur_lock.
+ */
+static void
+watch_arm(uring_watch_t *w)
+{
+    struct io_uring_sqe *sqe;
+
+    pthread_mutex_lock(&ur->ur_sq_lock);
+    sqe = sqe_get();
+    sqe->fd = w->w_fd;
+    switch (w->w_kind) {
+    case URING_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+        break;
+    case URING_STREAM:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BGID;
+        break;
+    case URING_DGRAM:
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->addr = (uint64_t)(uintptr_t)&w->w_msg;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BGID;
+        break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)&w->w_op;
+    sq_submit_with_lock();
+    pthread_mutex_unlock(&ur->ur_sq_lock);
+
+    w->w_armed = 1;
+    w->w_rearm = 0;
+    w->w_paused = 0;
+    ++w->w_refcnt;
+}
+
+/*
+ * Should the multishot request of @var{w} be armed again, now?
+ * Not while the socket still holds most of its share of buffers.
+ */
+static inline int
+watch_want_arm(uring_watch_t *w)
+{
+    if (!w->w_rearm || w->w_armed) {
+        return (0);
+    }
+    return (w->w_kind == URING_ACCEPT || w->w_qlen <= URING_WATCH_LOW);
+}
+
+/*
+ * Cancel the multishot request of @var{w}, without detaching it.
+ * Its last completion (-ECANCELED) asks for it to be armed again.
+ * Caller holds ur_lock.
+ */
+static void
+watch_pause(uring_watch_t *w)
+{
+    struct io_uring_sqe *sqe;
+
+    pthread_mutex_lock(&ur->ur_sq_lock);
+    sqe = sqe_get();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&w->w_op;
+    sqe->user_data = 0;
+    sq_submit_with_lock();
+    pthread_mutex_unlock(&ur->ur_sq_lock);
+    w->w_paused = 1;
+}
+
+static void
+watch_enqueue(uring_watch_t *w, int bid, int res)
+{
+    unsigned int tail;
+
+    if (w->w_qlen == w->w_qsize) {
+        uring_chunk_t *newq;
+        unsigned int newsize;
+        unsigned int i;
+
+        newsize = (w->w_qsize == 0) ? 8 : 2 * w->w_qsize;
+        newq = (uring_chunk_t *)guard_malloc(newsize * sizeof (uring_chunk_t));
+        for (i = 0; i < w->w_qlen; ++i) {
+            newq[i] = w->w_q[(w->w_qhead + i) % w->w_qsize];
+        }
+        free(w->w_q);
+        w->w_q = newq;
+        w->w_qsize = newsize;
+        w->w_qhead = 0;
+    }
+    tail = (w->w_qhead + w->w_qlen) % w->w_qsize;
+    w->w_q[tail].c_bid = bid;
+    w->w_q[tail].c_res = res;
+    ++w->w_qlen;
+}
+
+static void
+watch_dequeue(uring_watch_t *w)
+{
+    w->w_qhead = (w->w_qhead + 1) % w->w_qsize;
+    --w->w_qlen;
+    w->w_off = 0;
+}
+
+/*
+ * Throw away everything queued on a watch.
+ */
+static void
+watch_drain(uring_watch_t *w)
+{
+    uring_op_t *op;
+    uring_op_t *next;
+
+    while (w->w_qlen != 0) {
+        uring_chunk_t *c;
+
+        c = &w->w_q[w->w_qhead];
+        if (w->w_kind == URING_ACCEPT) {
+            (void) close(c->c_res);
+        }
+        else {
+            buf_recycle(c->c_bid);
+        }
+        watch_dequeue(w);
+    }
+
+    for (op = w->w_chain; op != NULL; op = next) {
+        next = op->op_next;
+        free(op);
+    }
+    w->w_chain = NULL;
+    w->w_chain_tail = NULL;
+}
+
+/*
+ * Detach a watch from its socket, and cancel its multishot request.
+ * The watch itself lives on until the last completion for it is in.
+ * Caller holds ur_lock.
+ */
+static void
+watch_detach(uring_watch_t *w)
+{
+    w->w_dead = 1;
+    watch_drain(w);
+    if (w->w_armed) {
+        struct io_uring_sqe *sqe;
+
+        pthread_mutex_lock(&ur->ur_sq_lock);
+        sqe = sqe_get();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)&w->w_op;
+        sqe->user_data = 0;
+        sq_submit_with_lock();
+        pthread_mutex_unlock(&ur->ur_sq_lock);
+    }
+    watch_release(w);
+}
+
+static void
+complete_multi(uring_watch_t *w, struct io_uring_cqe *cqe)
+{
+    int res;
+    int bid;
+
+    res = cqe->res;
+    bid = -1;
+    if ((cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+        bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+
+    if (w->w_dead) {
+        if (bid >= 0) {
+            buf_recycle(bid);
+        }
+        if (w->w_kind == URING_ACCEPT && res >= 0) {
+            (void) close(res);
+        }
+    }
+    else if (res > 0 || (res == 0 && w->w_kind == URING_ACCEPT)) {
+        watch_enqueue(w, bid, res);
+        if (w->w_kind != URING_ACCEPT && w->w_qlen >= URING_WATCH_BUFS
+            && w->w_armed && !w->w_paused) {
+            watch_pause(w);
+        }
+    }
+    else {
+        if (bid >= 0) {
+            buf_recycle(bid);
+        }
+        if (res == 0) {
+            w->w_eof = 1;
+        }
+        else if (res == -ENOBUFS || res == -ECANCELED || w->w_kind != URING_STREAM) {
+            /*
+             * Out of provided buffers, paused by watch_pause(),
+             * or a transient error on a rendezvous or UDP socket.
+             * Try again later.
+             */
+            tprintf(2, "fd=%d, res=%d -- rearm\n", w->w_fd, res);
+            w->w_rearm = 1;
+        }
+        else {
+            w->w_eof = 1;
+            w->w_err = -res;
+        }
+    }
+
+    if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+        w->w_armed = 0;
+        if (!w->w_eof && !w->w_dead) {
+            w->w_rearm = 1;
+        }
+        watch_release(w);
+    }
+}
+
+static void chain_submit(uring_watch_t *w);
+
+static void
+complete_send(uring_op_t *op, struct io_uring_cqe *cqe)
+{
+    uring_watch_t *w;
+
+    w = op->op_watch;
+    sys_io_trace("uring-send", w->w_fd, op->op_buf, (ssize_t)cqe->res);
+    if (cqe->res < 0 || (size_t)cqe->res != op->op_len) {
+        if (w->w_kind == URING_STREAM && !w->w_eof) {
+            w->w_eof = 1;
+            w->w_err = (cqe->res < 0) ? -cqe->res : EPIPE;
+        }
+    }
+    --w->w_inflight;
+    free(op);
+    // The previous chain is done.  Send the one that waited for it.
+    if (w->w_inflight == 0 && w->w_chain != NULL && !w->w_dead) {
+        if (w->w_eof && w->w_err != 0) {
+            watch_drain(w);
+        }
+        else {
+            chain_submit(w);
+        }
+    }
+    watch_release(w);
+}
+
+/*
+ * Reap completions.  Caller holds ur_cq_lock.
+ * If there are none, and @var{timeout} > 0 (milliseconds),
+ * then wait up to that long for at least one.
+ * Return the number of completions processed.
+ */
+static int
+uring_reap(int timeout)
+{
+    struct io_uring_cqe cqev[URING_REAP_BATCH];
+    unsigned int head;
+    unsigned int tail;
+    unsigned int n;
+    unsigned int i;
+    int total;
+
+    total = 0;
+    for (;;) {
+        head = *ur->ur_cq_head;
+        tail = __atomic_load_n(ur->ur_cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail && total == 0 && timeout > 0) {
+            struct io_uring_getevents_arg arg;
+            struct __kernel_timespec ts;
+
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000;
+            memset(&arg, 0, sizeof (arg));
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+            (void) sys_io_uring_enter(ur->ur_fd, 0, 1,
+                IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                &arg, sizeof (arg));
+            timeout = 0;
+            tail = __atomic_load_n(ur->ur_cq_tail, __ATOMIC_ACQUIRE);
+        }
+        n = tail - head;
+        if (n == 0) {
+            break;
+        }
+        if (n > URING_REAP_BATCH) {
+            n = URING_REAP_BATCH;
+        }
+        for (i = 0; i < n; ++i) {
+            cqev[i] = ur->ur_cqes[(head + i) & ur->ur_cq_mask];
+        }
+        __atomic_store_n(ur->ur_cq_head, head + n, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&ur->ur_lock);
+        for (i = 0; i < n; ++i) {
+            uring_op_t *op;
+
+            op = (uring_op_t *)(uintptr_t)cqev[i].user_data;
+            if (op == NULL) {
+                continue;
+            }
+            if (op->op_kind == UOP_MULTI) {
+                complete_multi(op->op_watch, &cqev[i]);
+            }
+            else {
+                complete_send(op, &cqev[i]);
+            }
+        }
+        pthread_mutex_unlock(&ur->ur_lock);
+        total += (int)n;
+    }
+
+    if (total != 0) {
+        __atomic_add_fetch(&ur->ur_seq, 1, __ATOMIC_RELEASE);
+        futex_wake_all(&ur->ur_seq);
+    }
+    return (total);
+}
+
+/*
+ * Wait for something to happen, after having seen @var{seq}.
+ * If no other thread is reaping completions, reap them ourselves;
+ * otherwise, sleep until the reaper has processed a batch.
+ */
+static void
+uring_wait(int seq, int timeout)
+{
+    if (pthread_mutex_trylock(&ur->ur_cq_lock) == 0) {
+        sq_submit();
+        (void) uring_reap(timeout);
+        pthread_mutex_unlock(&ur->ur_cq_lock);
+    }
+    else {
+        struct timespec ts;
+
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        (void) futex_wait(&ur->ur_seq, seq, &ts);
+    }
+}
+
+static void
+uring_teardown(struct uring *u)
+{
+    if (u->ur_br != NULL) {
+        (void) munmap(u->ur_br, u->ur_br_size);
+    }
+    if (u->ur_sqes != NULL) {
+        (void) munmap(u->ur_sqes, u->ur_sqes_size);
+    }
+    if (u->ur_ring_mem != NULL) {
+        (void) munmap(u->ur_ring_mem, u->ur_ring_size);
+    }
+    if (u->ur_fd >= 0) {
+        (void) close(u->ur_fd);
+    }
+    free(u->ur_bufs);
+    free(u->ur_watchv);
+    free(u);
+}
+
+/*
+ * Set up the io_uring, its provided buffers, and the watch table.
+ * Return 0, or an errno value if this kernel cannot do
+ * what we need; in that case, the caller should fall back to poll().
+ */
+int
+uring_init(void)
+{
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    struct uring *u;
+    size_t sq_size;
+    size_t cq_size;
+    char *ring;
+    int bid;
+    int err;
+
+    if (ur != NULL) {
+        return (0);
+    }
+
+    u = (struct uring *)guard_calloc(1, sizeof (struct uring));
+    u->ur_fd = -1;
+    pthread_mutex_init(&u->ur_lock, NULL);
+    pthread_mutex_init(&u->ur_sq_lock, NULL);
+    pthread_mutex_init(&u->ur_cq_lock, NULL);
+
+    memset(&params, 0, sizeof (params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_DEPTH;
+    u->ur_fd = sys_io_uring_setup(URING_DEPTH, &params);
+    if (u->ur_fd < 0) {
+        err = errno;
+        u->ur_fd = -1;
+        goto fail;
+    }
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 ||
+        (params.features & IORING_FEAT_NODROP) == 0 ||
+        (params.features & IORING_FEAT_EXT_ARG) == 0) {
+        err = ENOSYS;
+        goto fail;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+    cq_size = params.cq_off.cqes +
+        params.cq_entries * sizeof (struct io_uring_cqe);
+    u->ur_ring_size = (sq_size > cq_size) ? sq_size : cq_size;
+    ring = (char *)mmap(NULL, u->ur_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->ur_fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        err = errno;
+        goto fail;
+    }
+    u->ur_ring_mem = ring;
+
+    u->ur_sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+    u->ur_sqes = (struct io_uring_sqe *)mmap(NULL, u->ur_sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        u->ur_fd, IORING_OFF_SQES);
+    if (u->ur_sqes == MAP_FAILED) {
+        err = errno;
+        u->ur_sqes = NULL;
+        goto fail;
+    }
+
+    u->ur_sq_head    = (unsigned int *)(ring + params.sq_off.head);
+    u->ur_sq_tail    = (unsigned int *)(ring + params.sq_off.tail);
+    u->ur_sq_array   = (unsigned int *)(ring + params.sq_off.array);
+    u->ur_sq_mask    = *(unsigned int *)(ring + params.sq_off.ring_mask);
+    u->ur_sq_entries = params.sq_entries;
+    u->ur_sq_local_tail = *u->ur_sq_tail;
+    u->ur_sq_submitted = u->ur_sq_local_tail;
+    u->ur_cq_head    = (unsigned int *)(ring + params.cq_off.head);
+    u->ur_cq_tail    = (unsigned int *)(ring + params.cq_off.tail);
+    u->ur_cq_mask    = *(unsigned int *)(ring + params.cq_off.ring_mask);
+    u->ur_cqes       = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    u->ur_br_size = URING_NBUFS * sizeof (struct io_uring_buf);
+    u->ur_br = (struct io_uring_buf_ring *)mmap(NULL, u->ur_br_size,
+        PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (u->ur_br == MAP_FAILED) {
+        err = errno;
+        u->ur_br = NULL;
+        goto fail;
+    }
+    memset(&reg, 0, sizeof (reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->ur_br;
+    reg.ring_entries = URING_NBUFS;
+    reg.bgid = URING_BGID;
+    if (sys_io_uring_register(u->ur_fd, IORING_REGISTER_PBUF_RING,
+            &reg, 1) < 0) {
+        err = errno;
+        goto fail;
+    }
+
+    u->ur_bufs = (char *)guard_memalign(4096, URING_NBUFS * URING_BUFSZ);
+    u->ur_watchv_size = (size_t) _rpc_dtablesize();
+    u->ur_watchv = (uring_watch_t **)guard_calloc(u->ur_watchv_size,
+        sizeof (uring_watch_t *));
+
+    ur = u;
+    for (bid = 0; bid < URING_NBUFS; ++bid) {
+        buf_recycle(bid);
+    }
+    tprintf(2, "io_uring fd=%d, sq=%u, cq=%u\n",
+        u->ur_fd, params.sq_entries, params.cq_entries);
+    return (0);
+
+  fail:
+    uring_teardown(u);
+    return (err);
+}
+
+void
+uring_fini(void)
+{
+    struct uring *u;
+
+    u = ur;
+    if (u == NULL) {
+        return;
+    }
+    ur = NULL;
+    uring_teardown(u);
+}
+
+int
+uring_active(void)
+{
+    return (ur != NULL);
+}
+
+/*
+ * This is called without taking ur_lock.  The watch table never moves,
+ * and the entry for a socket changes only when that socket is
+ * registered or unregistered, which does not race with I/O on it.
+ */
+int
+uring_watching(int fd)
+{
+    return (ur != NULL && fd >= 0 && (size_t)fd < ur->ur_watchv_size &&
+        ur->ur_watchv[fd] != NULL);
+}
+
+static uring_watch_t *
+watch_lookup(int fd)
+{
+    if (fd < 0 || (size_t)fd >= ur->ur_watchv_size) {
+        return (NULL);
+    }
+    return (ur->ur_watchv[fd]);
+}
+
+void
+uring_watch(int fd)
+{
+    uring_watch_t *w;
+    socklen_t optlen;
+    int type;
+    int listening;
+    int kind;
+
+    if (ur == NULL || fd < 0 || (size_t)fd >= ur->ur_watchv_size) {
+        return;
+    }
+
+    optlen = sizeof (type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optlen) != 0) {
+        return;
+    }
+    if (type == SOCK_STREAM) {
+        listening = 0;
+        optlen = sizeof (listening);
+        (void) getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optlen);
+        kind = listening ? URING_ACCEPT : URING_STREAM;
+    }
+    else if (type == SOCK_DGRAM) {
+        kind = URING_DGRAM;
+    }
+    else {
+        return;
+    }
+
+    w = (uring_watch_t *)guard_calloc(1, sizeof (uring_watch_t));
+    w->w_fd = fd;
+    w->w_kind = kind;
+    w->w_refcnt = 1;
+    w->w_op.op_kind = UOP_MULTI;
+    w->w_op.op_watch = w;
+    w->w_msg.msg_namelen = URING_NAMESZ;
+    w->w_msg.msg_controllen = URING_CTLSZ;
+
+    pthread_mutex_lock(&ur->ur_lock);
+    if (ur->ur_watchv[fd] != NULL) {
+        watch_detach(ur->ur_watchv[fd]);
+    }
+    ur->ur_watchv[fd] = w;
+    watch_arm(w);
+    pthread_mutex_unlock(&ur->ur_lock);
+    tprintf(2, "fd=%d, kind=%d\n", fd, kind);
+}
+
+void
+uring_unwatch(int fd)
+{
+    uring_watch_t *w;
+
+    if (ur == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ur->ur_lock);
+    w = watch_lookup(fd);
+    if (w != NULL) {
+        ur->ur_watchv[fd] = NULL;
+        watch_detach(w);
+    }
+    pthread_mutex_unlock(&ur->ur_lock);
+}
+
+/*
+ * Collect the sockets that are ready, as if poll() had said so.
+ * Re-arm any multishot requests that stopped.
+ */
+static nfds_t
+uring_collect(struct pollfd **pollfdvp, nfds_t *sizep, uring_filter_t filter)
+{
+    struct pollfd *pollfdv;
+    nfds_t n;
+    size_t fd;
+
+    pollfdv = *pollfdvp;
+    n = 0;
+    pthread_mutex_lock(&ur->ur_lock);
+    for (fd = 0; fd < ur->ur_watchv_size; ++fd) {
+        uring_watch_t *w;
+
+        w = ur->ur_watchv[fd];
+        if (w == NULL) {
+            continue;
+        }
+        if (watch_want_arm(w)) {
+            watch_arm(w);
+        }
+        if (w->w_qlen == 0 && !w->w_eof) {
+            continue;
+        }
+        if (!(*filter)((int)fd)) {
+            continue;
+        }
+        if (n >= *sizep) {
+            *sizep = (*sizep == 0) ? 64 : 2 * *sizep;
+            pollfdv = (struct pollfd *)guard_realloc(pollfdv,
+                *sizep * sizeof (struct pollfd));
+        }
+        pollfdv[n].fd = (int)fd;
+        pollfdv[n].events = POLLIN;
+        pollfdv[n].revents = w->w_eof ? (POLLIN | POLLHUP) : POLLIN;
+        ++n;
+    }
+    pthread_mutex_unlock(&ur->ur_lock);
+    *pollfdvp = pollfdv;
+    return (n);
+}
+
+/*
+ * The io_uring equivalent of one call to poll().
+ *
+ * Fill in *@var{pollfdvp} (reallocating it as needed; *@var{sizep}
+ * is its capacity) with the sockets that are ready, and accepted by
+ * @var{filter}.  If none are ready, wait up to @var{timeout}
+ * milliseconds for completions.  Return the number of sockets.
+ */
+nfds_t
+uring_poll(struct pollfd **pollfdvp, nfds_t *sizep, int timeout,
+    uring_filter_t filter)
+{
+    nfds_t n;
+
+    if (pthread_mutex_trylock(&ur->ur_cq_lock) == 0) {
+        sq_submit();
+        (void) uring_reap(0);
+        pthread_mutex_unlock(&ur->ur_cq_lock);
+    }
+
+    n = uring_collect(pollfdvp, sizep, filter);
+    if (n != 0) {
+        return (n);
+    }
+
+    pthread_mutex_lock(&ur->ur_cq_lock);
+    sq_submit();
+    (void) uring_reap(timeout);
+    pthread_mutex_unlock(&ur->ur_cq_lock);
+    return (uring_collect(pollfdvp, sizep, filter));
+}
+
+/*
+ * Take the next connection accepted on rendezvous socket, @var{fd}.
+ * Never blocks.  If there is none, return -1, with errno EAGAIN.
+ */
+int
+uring_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    uring_watch_t *w;
+    int sock;
+
+    pthread_mutex_lock(&ur->ur_lock);
+    w = watch_lookup(fd);
+    if (w == NULL || w->w_kind != URING_ACCEPT) {
+        pthread_mutex_unlock(&ur->ur_lock);
+        errno = EBADF;
+        return (-1);
+    }
+    if (w->w_qlen == 0) {
+        pthread_mutex_unlock(&ur->ur_lock);
+        errno = EAGAIN;
+        return (-1);
+    }
+    sock = w->w_q[w->w_qhead].c_res;
+    watch_dequeue(w);
+    pthread_mutex_unlock(&ur->ur_lock);
+
+    if (getpeername(sock, addr, addrlen) != 0) {
+        *addrlen = 0;
+    }
+    sys_io_trace("uring-accept", fd, NULL, (ssize_t)sock);
+    return (sock);
+}
+
+/*
+ * Copy out up to @var{count} bytes of queued stream data.
+ * Caller holds ur_lock.
+ */
+static size_t
+watch_copyout(uring_watch_t *w, char *buf, size_t count)
+{
+    size_t copied;
+
+    copied = 0;
+    while (copied < count && w->w_qlen != 0) {
+        uring_chunk_t *c;
+        size_t avail;
+        size_t n;
+
+        c = &w->w_q[w->w_qhead];
+        avail = (size_t)c->c_res - w->w_off;
+        n = (avail < count - copied) ? avail : count - copied;
+        memcpy(buf + copied, buf_addr(c->c_bid) + w->w_off, n);
+        copied += n;
+        w->w_off += n;
+        if (w->w_off == (size_t)c->c_res) {
+            buf_recycle(c->c_bid);
+            watch_dequeue(w);
+        }
+    }
+    return (copied);
+}
+
+/*
+ * Read from a TCP connection, like read(2), except that
+ * it waits at most @var{timeout} milliseconds for data to arrive.
+ * Return the number of bytes, 0 at end of stream,
+ * or -1 with errno set.
+ */
+ssize_t
+uring_read(int fd, void *buf, size_t count, int timeout)
+{
+    struct timespec now;
+    struct timespec deadline;
+    uring_watch_t *w;
+    ssize_t rsize;
+    int remain;
+    int seq;
+    int err;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&ur->ur_lock);
+    for (;;) {
+        w = watch_lookup(fd);
+        if (w == NULL || w->w_kind != URING_STREAM) {
+            pthread_mutex_unlock(&ur->ur_lock);
+            errno = EBADF;
+            return (-1);
+        }
+        if (w->w_qlen != 0) {
+            rsize = (ssize_t)watch_copyout(w, (char *)buf, count);
+            pthread_mutex_unlock(&ur->ur_lock);
+            sys_io_trace("uring-recv", fd, buf, rsize);
+            return (rsize);
+        }
+        if (w->w_eof) {
+            err = w->w_err;
+            pthread_mutex_unlock(&ur->ur_lock);
+            sys_io_trace("uring-recv", fd, buf, err ? -1 : 0);
+            if (err != 0) {
+                errno = err;
+                return (-1);
+            }
+            return (0);
+        }
+        if (watch_want_arm(w)) {
+            watch_arm(w);
+        }
+        seq = __atomic_load_n(&ur->ur_seq, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&ur->ur_lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remain = (int)((deadline.tv_sec - now.tv_sec) * 1000 +
+            (deadline.tv_nsec - now.tv_nsec) / 1000000);
+        if (remain <= 0) {
+            errno = ETIMEDOUT;
+            return (-1);
+        }
+        uring_wait(seq, (remain < 10) ? remain : 10);
+        pthread_mutex_lock(&ur->ur_lock);
+    }
+}
+
+/*
+ * Take the next datagram received on UDP socket, @var{fd},
+ * like recvmsg(2).  Never blocks.  If there is none,
+ * return -1, with errno EAGAIN.
+ */
+ssize_t
+uring_recvmsg(int fd, struct msghdr *msg)
+{
+    struct io_uring_recvmsg_out *out;
+    uring_watch_t *w;
+    uring_chunk_t *c;
+    char *name;
+    char *control;
+    char *payload;
+    size_t hdrsz;
+    size_t paylen;
+    size_t copied;
+    size_t len;
+    size_t i;
+
+    pthread_mutex_lock(&ur->ur_lock);
+    w = watch_lookup(fd);
+    if (w == NULL || w->w_kind != URING_DGRAM) {
+        pthread_mutex_unlock(&ur->ur_lock);
+        errno = EBADF;
+        return (-1);
+    }
+
+    hdrsz = sizeof (struct io_uring_recvmsg_out)
+        + w->w_msg.msg_namelen + w->w_msg.msg_controllen;
+    for (;;) {
+        if (w->w_qlen == 0) {
+            pthread_mutex_unlock(&ur->ur_lock);
+            errno = EAGAIN;
+            return (-1);
+        }
+        c = &w->w_q[w->w_qhead];
+        if ((size_t)c->c_res >= hdrsz) {
+            break;
+        }
+        buf_recycle(c->c_bid);
+        watch_dequeue(w);
+    }
+
+    out = (struct io_uring_recvmsg_out *)buf_addr(c->c_bid);
+    name = (char *)(out + 1);
+    control = name + w->w_msg.msg_namelen;
+    payload = control + w->w_msg.msg_controllen;
+    paylen = (size_t)c->c_res - hdrsz;
+
+    len = out->namelen;
+    if (len > w->w_msg.msg_namelen) {
+        len = w->w_msg.msg_namelen;
+    }
+    if (msg->msg_name == NULL || len > msg->msg_namelen) {
+        len = (msg->msg_name == NULL) ? 0 : msg->msg_namelen;
+    }
+    if (len != 0) {
+        memcpy(msg->msg_name, name, len);
+    }
+    msg->msg_namelen = (socklen_t)len;
+
+    len = out->controllen;
+    if (msg->msg_control == NULL || len > msg->msg_controllen) {
+        len = (msg->msg_control == NULL) ? 0 : msg->msg_controllen;
+    }
+    if (len != 0) {
+        memcpy(msg->msg_control, control, len);
+    }
+    msg->msg_controllen = len;
+    msg->msg_flags = (int)out->flags;
+
+    copied = 0;
+    for (i = 0; i < msg->msg_iovlen && copied < paylen; ++i) {
+        len = msg->msg_iov[i].iov_len;
+        if (len > paylen - copied) {
+            len = paylen - copied;
+        }
+        memcpy(msg->msg_iov[i].iov_base, payload + copied, len);
+        copied += len;
+    }
+
+    buf_recycle(c->c_bid);
+    watch_dequeue(w);
+    pthread_mutex_unlock(&ur->ur_lock);
+    sys_io_trace("uring-recvmsg", fd, payload, (ssize_t)copied);
+    return ((ssize_t)copied);
+}
+
+static uring_op_t *
+send_op_alloc(uring_watch_t *w, size_t len)
+{
+    uring_op_t *op;
+
+    op = (uring_op_t *)guard_malloc(sizeof (uring_op_t) + len);
+    memset(op, 0, sizeof (uring_op_t));
+    op->op_kind = UOP_SEND;
+    op->op_watch = w;
+    op->op_buf = (char *)(op + 1);
+    op->op_len = len;
+    return (op);
+}
+
+/*
+ * Queue @var{count} bytes to be sent on TCP connection, @var{fd}.
+ * The data is copied.  Nothing is submitted until uring_send_flush().
+ */
+ssize_t
+uring_send(int fd, const void *buf, size_t count)
+{
+    uring_watch_t *w;
+    uring_op_t *op;
+
+    pthread_mutex_lock(&ur->ur_lock);
+    w = watch_lookup(fd);
+    if (w == NULL || w->w_kind != URING_STREAM) {
+        pthread_mutex_unlock(&ur->ur_lock);
+        errno = EBADF;
+        return (-1);
+    }
+    if (w->w_eof && w->w_err != 0) {
+        errno = w->w_err;
+        pthread_mutex_unlock(&ur->ur_lock);
+        return (-1);
+    }
+    op = send_op_alloc(w, count);
+    memcpy(op->op_buf, buf, count);
+    if (w->w_chain_tail == NULL) {
+        w->w_chain = op;
+    }
+    else {
+        w->w_chain_tail->op_next = op;
+    }
+    w->w_chain_tail = op;
+    pthread_mutex_unlock(&ur->ur_lock);
+    return ((ssize_t)count);
+}
+
+/*
+ * Submit the chain of sends queued on @var{w}, as linked SQEs,
+ * so that the kernel sends the fragments of a reply in order,
+ * and stops at the first failure.
+ * Caller holds ur_lock.
+ */
+static void
+chain_submit(uring_watch_t *w)
+{
+    uring_op_t *op;
+    uring_op_t *next;
+
+    pthread_mutex_lock(&ur->ur_sq_lock);
+    for (op = w->w_chain; op != NULL; op = next) {
+        struct io_uring_sqe *sqe;
+
+        next = op->op_next;
+        sqe = sqe_get();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = w->w_fd;
+        sqe->addr = (uint64_t)(uintptr_t)op->op_buf;
+        sqe->len = (unsigned int)op->op_len;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        if (next != NULL) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        ++w->w_inflight;
+        ++w->w_refcnt;
+    }
+    sq_submit_with_lock();
+    pthread_mutex_unlock(&ur->ur_sq_lock);
+
+    w->w_chain = NULL;
+    w->w_chain_tail = NULL;
+}
+
+/*
+ * Submit everything queued by uring_send() on @var{fd}.
+ *
+ * A new chain is not started until the previous one on the same
+ * connection has completed, so that replies do not overtake each other.
+ * If one is still in flight, the new chain is left queued, and
+ * complete_send() submits it when the last send of the old one is in.
+ * Either way, we do not wait: the caller may hold @var{poll_lock}.
+ */
+int
+uring_send_flush(int fd)
+{
+    uring_watch_t *w;
+
+    pthread_mutex_lock(&ur->ur_lock);
+    w = watch_lookup(fd);
+    if (w == NULL || w->w_chain == NULL) {
+        pthread_mutex_unlock(&ur->ur_lock);
+        return (0);
+    }
+
+    if (w->w_dead || (w->w_eof && w->w_err != 0)) {
+        watch_drain(w);
+        pthread_mutex_unlock(&ur->ur_lock);
+        errno = EPIPE;
+        return (-1);
+    }
+
+    if (w->w_inflight == 0) {
+        chain_submit(w);
+    }
+    pthread_mutex_unlock(&ur->ur_lock);
+    return (0);
+}
+
+/*
+ * Send a datagram on UDP socket, @var{fd}, like sendmsg(2).
+ * The data, address and control messages are copied,
+ * and the send is submitted, but not waited for.
+ */
+ssize_t
+uring_sendmsg(int fd, const struct msghdr *msg)
+{
+    struct io_uring_sqe *sqe;
+    uring_watch_t *w;
+    uring_op_t *op;
+    size_t paylen;
+    size_t pos;
+    size_t i;
+
+    paylen = 0;
+    for (i = 0; i < msg->msg_iovlen; ++i) {
+        paylen += msg->msg_iov[i].iov_len;
+    }
+
+    pthread_mutex_lock(&ur->ur_lock);
+    w = watch_lookup(fd);
+    if (w == NULL) {
+        pthread_mutex_unlock(&ur->ur_lock);
+        errno = EBADF;
+        return (-1);
+    }
+
+    /*
+     * The control messages go last, at a CMSG_ALIGN()ed offset,
+     * because the kernel reads them as struct cmsghdr.
+     * op_buf itself is aligned at least that well.
+     */
+    op = send_op_alloc(w,
+        CMSG_ALIGN(paylen + msg->msg_namelen) + msg->msg_controllen);
+    op->op_len = paylen;
+    pos = 0;
+    for (i = 0; i < msg->msg_iovlen; ++i) {
+        memcpy(op->op_buf + pos, msg->msg_iov[i].iov_base,
+            msg->msg_iov[i].iov_len);
+        pos += msg->msg_iov[i].iov_len;
+    }
+    op->op_iov.iov_base = op->op_buf;
+    op->op_iov.iov_len = paylen;
+    op->op_msg.msg_iov = &op->op_iov;
+    op->op_msg.msg_iovlen = 1;
+    if (msg->msg_name != NULL && msg->msg_namelen != 0) {
+        op->op_msg.msg_name = op->op_buf + pos;
+        op->op_msg.msg_namelen = msg->msg_namelen;
+        memcpy(op->op_msg.msg_name, msg->msg_name, msg->msg_namelen);
+        pos += msg->msg_namelen;
+    }
+    if (msg->msg_control != NULL && msg->msg_controllen != 0) {
+        pos = CMSG_ALIGN(pos);
+        op->op_msg.msg_control = op->op_buf + pos;
+        op->op_msg.msg_controllen = msg->msg_controllen;
+        memcpy(op->op_msg.msg_control, msg->msg_control,
+            msg->msg_controllen);
+    }
+
+    ++w->w_inflight;
+    ++w->w_refcnt;
+    pthread_mutex_lock(&ur->ur_sq_lock);
+    sqe = sqe_get();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&op->op_msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    sq_submit_with_lock();
+    pthread_mutex_unlock(&ur->ur_sq_lock);
+    pthread_mutex_unlock(&ur->ur_lock);
+    return ((ssize_t)paylen);
+}
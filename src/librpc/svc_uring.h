@@ -0,0 +1,103 @@
+/*
+ * Filename: svc_uring.h
+ * Project: rpc-mt
+ * Brief: Interface to the optional io_uring I/O engine
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SVC_URING_H
+#define _SVC_URING_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <poll.h>        // Import struct pollfd, nfds_t
+#include <sys/socket.h>  // Import struct msghdr, struct sockaddr, socklen_t
+#include <sys/types.h>   // Import ssize_t
+
+/*
+ * With svc_config("io=uring"), svc_run() drives all socket I/O
+ * through a single io_uring, instead of poll(2) + read(2)/write(2),
+ * accept(2), recvmsg(2) and sendmsg(2).
+ *
+ * Every socket that is registered with xprt_register() is "watched".
+ * What that means depends on the kind of socket:
+ *
+ *   TCP rendezvous socket:
+ *       a multishot accept is armed.  Accepted sockets are queued
+ *       on the watch, and handed out by uring_accept(), which
+ *       rendezvous_request() calls instead of sys_accept().
+ *
+ *   TCP connection:
+ *       a multishot recv is armed, using provided buffers.
+ *       Data is queued on the watch, in arrival order, and
+ *       readtcp() copies it out with uring_read(), instead of
+ *       calling poll() and sys_read().
+ *       writetcp() queues each fragment with uring_send();
+ *       svctcp_reply() then submits the whole reply as one chain
+ *       of linked send SQEs, with uring_send_flush().
+ *
+ *   UDP socket:
+ *       a multishot recvmsg is armed, using provided buffers.
+ *       svcudp_recv() takes one datagram at a time with uring_recvmsg().
+ *       Replies are queued with uring_sendmsg().
+ *
+ * uring_poll() takes the place of poll() in the main loop.
+ * A socket is "ready" when it has queued data, queued connections,
+ * or a pending end-of-file or error.
+ * Completions are reaped in batches, so a busy server gets
+ * many operations done for each io_uring_enter(2) system call.
+ *
+ * Any thread that must wait for a completion, for example a worker
+ * thread in readtcp(), reaps completions itself, if no other thread
+ * is already doing so; otherwise it sleeps until the reaper wakes it.
+ *
+ * The engine needs Linux 6.0 or later (multishot recv and
+ * provided buffer rings).  If the io_uring cannot be set up,
+ * svc_run() says so and falls back to poll().
+ */
+
+#define IO_ENGINE_POLL  0
+#define IO_ENGINE_URING 1
+
+extern int svc_io_engine;
+
+typedef int (*uring_filter_t)(int fd);
+
+extern int  uring_init(void);
+extern void uring_fini(void);
+extern int  uring_active(void);
+extern int  uring_watching(int fd);
+extern void uring_watch(int fd);
+extern void uring_unwatch(int fd);
+extern nfds_t uring_poll(struct pollfd **pollfdvp, nfds_t *sizep,
+                int timeout, uring_filter_t filter);
+
+extern int  uring_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+extern ssize_t uring_read(int fd, void *buf, size_t count, int timeout);
+extern ssize_t uring_recvmsg(int fd, struct msghdr *msg);
+extern ssize_t uring_send(int fd, const void *buf, size_t count);
+extern int  uring_send_flush(int fd);
+extern ssize_t uring_sendmsg(int fd, const struct msghdr *msg);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _SVC_URING_H */
@@ -56,6 +56,20 @@ guard_calloc(size_t nelem, size_t size)
     return (mem);
 }
 
+void *
+guard_memalign(size_t alignment, size_t size)
+{
+    void *mem;
+    int rv;
+
+    rv = posix_memalign(&mem, alignment, size);
+    if (rv != 0) {
+        teprintf("posix_memalign(%zu, %zu) failed.\n", alignment, size);
+        svc_die();
+    }
+    return (mem);
+}
+
 void *
 guard_realloc(void *old_mem, size_t size)
 {
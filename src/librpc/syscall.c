@@ -29,7 +29,12 @@
     // Import var stderr
 #include <unistd.h>
     // Import type size_t
+    // Import syscall()
     // Import write()
+#include <sys/syscall.h>
+    // Import constant __NR_io_uring_setup
+    // Import constant __NR_io_uring_enter
+    // Import constant __NR_io_uring_register
 
 #include "svc_debug.h"
 
@@ -106,3 +111,105 @@ sys_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
     }
     return (rv);
 }
+
+int
+sys_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+    int rv;
+
+    if (sys_break) {
+        gdb_syscall();
+    }
+
+    rv = accept4(sockfd, addr, addrlen, flags);
+
+    if (io_trace) {
+        tprintf(1, "accept4(sockfd=%d, addr=%p, %u, flags=x%x) => %d\n",
+            sockfd, addr, *addrlen, flags, rv);
+        if (rv >= 0) {
+            fprintf(stderr, "addr=");
+            fhexdump(stderr, 0, 4, addr, (size_t)(*addrlen));
+        }
+    }
+    return (rv);
+}
+
+/*
+ * There is no glibc wrapper for the io_uring system calls,
+ * so these are the only interface to them.
+ */
+
+int
+sys_io_uring_setup(unsigned int entries, void *params)
+{
+    int rv;
+
+    if (sys_break) {
+        gdb_syscall();
+    }
+
+    rv = (int) syscall(__NR_io_uring_setup, entries, params);
+
+    if (io_trace) {
+        tprintf(1, "io_uring_setup(entries=%u, params=%p) => %d\n",
+            entries, params, rv);
+    }
+    return (rv);
+}
+
+int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+    unsigned int flags, const void *arg, size_t argsz)
+{
+    int rv;
+
+    if (sys_break) {
+        gdb_syscall();
+    }
+
+    rv = (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+        flags, arg, argsz);
+
+    if (io_trace && (to_submit != 0 || rv != 0)) {
+        tprintf(1, "io_uring_enter(fd=%d, submit=%u, wait=%u, flags=x%x)"
+            " => %d\n", fd, to_submit, min_complete, flags, rv);
+    }
+    return (rv);
+}
+
+int
+sys_io_uring_register(int fd, unsigned int opcode, void *arg,
+    unsigned int nr_args)
+{
+    int rv;
+
+    if (sys_break) {
+        gdb_syscall();
+    }
+
+    rv = (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+
+    if (io_trace) {
+        tprintf(1, "io_uring_register(fd=%d, opcode=%u, arg=%p, %u) => %d\n",
+            fd, opcode, arg, nr_args, rv);
+    }
+    return (rv);
+}
+
+/*
+ * Trace the completion of an operation that was done on our behalf
+ * by the io_uring engine, in the same form as sys_read() and sys_write().
+ * There is no system call to break on, here; sys_io_uring_enter()
+ * is where the work actually gets done.
+ */
+void
+sys_io_trace(const char *op, int fd, const void *buf, ssize_t rsize)
+{
+    if (io_trace) {
+        tprintf(1, "%s(fd=%d, buf=%p) => %zd\n", op, fd, buf, rsize);
+        if (rsize > 0 && buf != NULL) {
+            fprintf(stderr, "buf:\n");
+            fhexdump(stderr, (rsize >= 16) ? 16: 0, 4, buf, (size_t)rsize);
+        }
+    }
+}
@@ -49,8 +49,11 @@
 #include <rpc/rpc.h>
 #include <libintl.h>
 #include <wchar.h>
+#include <pthread.h>
 
+#include <cache-align.h>
 #include <xdr_error.h>
+#include <xdr_rec.h>
 
 #define internal_function
 
@@ -64,6 +67,12 @@ static int32_t *xdrrec_inline(XDR *, u_int);
 static void xdrrec_destroy(XDR *);
 static bool_t xdrrec_getint32(XDR *, int32_t *);
 static bool_t xdrrec_putint32(XDR *, const int32_t *);
+static bool_t xdrrec_rec_getlong(XDR *, long *);
+static bool_t xdrrec_rec_getbytes(XDR *, caddr_t, u_int);
+static u_int xdrrec_rec_getpos(const XDR *);
+static bool_t xdrrec_rec_setpos(XDR *, u_int);
+static int32_t *xdrrec_rec_inline(XDR *, u_int);
+static bool_t xdrrec_rec_getint32(XDR *, int32_t *);
 
 static const struct xdr_ops xdrrec_ops = {
     xdrrec_getlong,
@@ -78,6 +87,24 @@ static const struct xdr_ops xdrrec_ops = {
     xdrrec_putint32
 };
 
+/*
+ * The ops of a stream in record mode, while a record is loaded.
+ * Decoding runs over the loaded record, like xdrmem;
+ * encoding is the same as always.
+ */
+static const struct xdr_ops xdrrec_rec_ops = {
+    xdrrec_rec_getlong,
+    xdrrec_putlong,
+    xdrrec_rec_getbytes,
+    xdrrec_putbytes,
+    xdrrec_rec_getpos,
+    xdrrec_rec_setpos,
+    xdrrec_rec_inline,
+    xdrrec_destroy,
+    xdrrec_rec_getint32,
+    xdrrec_putint32
+};
+
 /*
  * A record is composed of one or more record fragments.
  * A record fragment is a two-byte header followed by zero to
@@ -117,6 +144,24 @@ struct rec_strm {
     bool_t last_frag;
     u_int sendsize;
     u_int recvsize;
+    /*
+     * record mode
+     */
+    u_int rec_max;              /* largest record to load; 0 => off */
+    caddr_t rec_buf;            /* for records not already in in_base */
+    u_int rec_bufsize;
+    caddr_t rec_start;          /* the loaded record */
+    caddr_t rec_finger;
+    caddr_t rec_end;
+    /*
+     * adaptive buffers
+     */
+    bool_t adaptive;            /* buffers come from the pool */
+    bool_t released;            /* buffers are back in the pool */
+    u_long in_reclen;           /* bytes of the incoming record, so far */
+    u_long out_reclen;          /* bytes of the outgoing record, so far */
+    u_int in_hw;                /* recent size of incoming records */
+    u_int out_hw;               /* recent size of outgoing records */
 };
 
 typedef struct rec_strm RECSTREAM;
@@ -129,6 +174,13 @@ static bool_t skip_input_bytes(RECSTREAM *, long);
 static bool_t flush_out(RECSTREAM *, bool_t);
 static bool_t set_input_fragment(RECSTREAM *);
 static bool_t get_input_bytes(RECSTREAM *, caddr_t, int);
+static bool_t read_input_direct(RECSTREAM *, caddr_t, u_int);
+static bool_t make_room(RECSTREAM *);
+static bool_t rec_acquire(RECSTREAM *);
+static void rec_observe(u_int *, u_long);
+static caddr_t pool_get(u_int, u_int *);
+static void pool_put(caddr_t, u_int);
+static u_int pool_sizeof(u_int);
 
 /*
  * Create an xdr handle for xdrrec
@@ -204,6 +256,14 @@ xdrrec_create(
     rstrm->in_finger = (rstrm->in_boundry += recvsize);
     rstrm->fbtbc = 0;
     rstrm->last_frag = TRUE;
+    rstrm->rec_max = 0;
+    rstrm->rec_buf = NULL;
+    rstrm->rec_bufsize = 0;
+    rstrm->rec_start = rstrm->rec_finger = rstrm->rec_end = NULL;
+    rstrm->adaptive = FALSE;
+    rstrm->released = FALSE;
+    rstrm->in_reclen = rstrm->out_reclen = 0;
+    rstrm->in_hw = rstrm->out_hw = 0;
 }
 
 /*
@@ -245,8 +305,7 @@ xdrrec_putlong(XDR *xdrs, const long *lp)
          * so the code is inefficient.
          */
         rstrm->out_finger -= BYTES_PER_XDR_UNIT;
-        rstrm->frag_sent = TRUE;
-        if (!flush_out(rstrm, FALSE)) {
+        if (!make_room(rstrm)) {
             return (FALSE);
         }
         dest_lp = (int32_t *) rstrm->out_finger;
@@ -304,8 +363,7 @@ xdrrec_putbytes(XDR *xdrs, const char *addr, u_int len)
         addr += current;
         len -= current;
         if (rstrm->out_finger == rstrm->out_boundry && len > 0) {
-            rstrm->frag_sent = TRUE;
-            if (!flush_out(rstrm, FALSE))
+            if (!make_room(rstrm))
                 return (FALSE);
         }
     }
@@ -419,7 +477,16 @@ xdrrec_destroy(XDR *xdrs)
 {
     RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
 
-    mem_free(rstrm->the_buffer, rstrm->sendsize + rstrm->recvsize + BYTES_PER_XDR_UNIT);
+    if (!rstrm->adaptive) {
+        mem_free(rstrm->the_buffer, rstrm->sendsize + rstrm->recvsize + BYTES_PER_XDR_UNIT);
+    }
+    else if (!rstrm->released) {
+        pool_put(rstrm->out_base, rstrm->sendsize);
+        pool_put(rstrm->in_base, rstrm->recvsize);
+    }
+    if (rstrm->rec_buf != NULL) {
+        pool_put(rstrm->rec_buf, rstrm->rec_bufsize);
+    }
     mem_free((caddr_t) rstrm, sizeof (RECSTREAM));
 }
 
@@ -457,8 +524,7 @@ xdrrec_putint32(XDR *xdrs, const int32_t *ip)
          * inefficient
          */
         rstrm->out_finger -= BYTES_PER_XDR_UNIT;
-        rstrm->frag_sent = TRUE;
-        if (!flush_out(rstrm, FALSE)) {
+        if (!make_room(rstrm)) {
             return (FALSE);
         }
         dest_ip = (int32_t *) rstrm->out_finger;
@@ -468,6 +534,135 @@ xdrrec_putint32(XDR *xdrs, const int32_t *ip)
     return (TRUE);
 }
 
+/*
+ * Record mode
+ *
+ * When record mode is on, xdrrec_getrecord() loads a whole record
+ * before it is decoded.  If the record is already in the input buffer,
+ * as one fragment, it is decoded right there; otherwise its fragments
+ * are gathered into rec_buf, and what is not in the input buffer yet
+ * is read straight into rec_buf.  Either way, the ops below decode
+ * from memory, at the cost of xdrmem: one bounds check, no copy,
+ * and x_inline can hand out any span of the record.
+ *
+ * A record bigger than rec_max is loaded only up to the last fragment
+ * that fits.  When decoding runs past the end of what was loaded,
+ * the stream falls back to the ordinary ops, for the rest of it.
+ */
+
+static void
+rec_unload(XDR *xdrs, RECSTREAM *rstrm)
+{
+    if (xdrs->x_ops == &xdrrec_rec_ops) {
+        xdrs->x_ops = (struct xdr_ops *) &xdrrec_ops;
+    }
+    rstrm->rec_start = rstrm->rec_finger = rstrm->rec_end = NULL;
+}
+
+static bool_t
+xdrrec_rec_getbytes(XDR *xdrs, caddr_t addr, u_int len)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+    u_int avail;
+
+    avail = rstrm->rec_end - rstrm->rec_finger;
+    if (len <= avail) {
+        memcpy(addr, rstrm->rec_finger, len);
+        rstrm->rec_finger += len;
+        return (TRUE);
+    }
+    if (rstrm->fbtbc == 0 && rstrm->last_frag) {
+        return (FALSE);
+    }
+    // Only part of the record was loaded.  Stream the rest of it.
+    memcpy(addr, rstrm->rec_finger, avail);
+    rec_unload(xdrs, rstrm);
+    return (xdrrec_getbytes(xdrs, addr + avail, len - avail));
+}
+
+static bool_t
+xdrrec_rec_getlong(XDR *xdrs, long *lp)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+    int32_t mylong;
+
+    if (rstrm->rec_end - rstrm->rec_finger >= BYTES_PER_XDR_UNIT) {
+        *lp = (int32_t) ntohl(*(int32_t *) rstrm->rec_finger);
+        rstrm->rec_finger += BYTES_PER_XDR_UNIT;
+        return (TRUE);
+    }
+    if (!xdrrec_rec_getbytes(xdrs, (caddr_t) &mylong, BYTES_PER_XDR_UNIT)) {
+        return (FALSE);
+    }
+    *lp = (int32_t) ntohl(mylong);
+    return (TRUE);
+}
+
+static bool_t
+xdrrec_rec_getint32(XDR *xdrs, int32_t *ip)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+    int32_t mylong;
+
+    if (rstrm->rec_end - rstrm->rec_finger >= BYTES_PER_XDR_UNIT) {
+        *ip = ntohl(*(int32_t *) rstrm->rec_finger);
+        rstrm->rec_finger += BYTES_PER_XDR_UNIT;
+        return (TRUE);
+    }
+    if (!xdrrec_rec_getbytes(xdrs, (caddr_t) &mylong, BYTES_PER_XDR_UNIT)) {
+        return (FALSE);
+    }
+    *ip = ntohl(mylong);
+    return (TRUE);
+}
+
+/*
+ * While decoding, the position is the offset into the loaded record.
+ */
+static u_int
+xdrrec_rec_getpos(const XDR *xdrs)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    if (xdrs->x_op == XDR_DECODE) {
+        return ((u_int) (rstrm->rec_finger - rstrm->rec_start));
+    }
+    return (xdrrec_getpos(xdrs));
+}
+
+static bool_t
+xdrrec_rec_setpos(XDR *xdrs, u_int pos)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    if (xdrs->x_op == XDR_DECODE) {
+        if (pos > (u_int) (rstrm->rec_end - rstrm->rec_start)) {
+            xdr_overflow(__FILE__, __FUNCTION__);
+            return (FALSE);
+        }
+        rstrm->rec_finger = rstrm->rec_start + pos;
+        return (TRUE);
+    }
+    return (xdrrec_setpos(xdrs, pos));
+}
+
+static int32_t *
+xdrrec_rec_inline(XDR *xdrs, u_int len)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+    int32_t *buf;
+
+    if (xdrs->x_op != XDR_DECODE) {
+        return (xdrrec_inline(xdrs, len));
+    }
+    if (len > (u_int) (rstrm->rec_end - rstrm->rec_finger)) {
+        return (NULL);
+    }
+    buf = (int32_t *) rstrm->rec_finger;
+    rstrm->rec_finger += len;
+    return (buf);
+}
+
 /*
  * Exported routines to manage xdr records
  */
@@ -481,6 +676,7 @@ xdrrec_skiprecord(XDR *xdrs)
 {
     RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
 
+    rec_unload(xdrs, rstrm);
     while (rstrm->fbtbc > 0 || (!rstrm->last_frag)) {
         if (!skip_input_bytes(rstrm, rstrm->fbtbc)) {
             return (FALSE);
@@ -531,17 +727,322 @@ xdrrec_endofrecord(XDR *xdrs, bool_t sendnow)
     RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
     u_long len;                 /* fragment length */
 
+    if (rstrm->released && !rec_acquire(rstrm)) {
+        return (FALSE);
+    }
     if (sendnow || rstrm->frag_sent || rstrm->out_finger + BYTES_PER_XDR_UNIT >= rstrm->out_boundry) {
         rstrm->frag_sent = FALSE;
         return (flush_out(rstrm, TRUE));
     }
     len = (rstrm->out_finger - (char *)rstrm->frag_header - BYTES_PER_XDR_UNIT);
     *rstrm->frag_header = htonl((u_long) len | LAST_FRAG);
+    rec_observe(&rstrm->out_hw, rstrm->out_reclen + len);
+    rstrm->out_reclen = 0;
     rstrm->frag_header = (u_int32_t *) rstrm->out_finger;
     rstrm->out_finger += BYTES_PER_XDR_UNIT;
     return (TRUE);
 }
 
+/*
+ * Turn record mode on, for records of up to @var{maxrec} bytes,
+ * or off, if @var{maxrec} is 0.
+ */
+void
+xdrrec_recordmode(XDR *xdrs, u_int maxrec)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    rstrm->rec_max = maxrec;
+}
+
+/*
+ * Load the next record, in record mode.  Call it right after
+ * xdrrec_skiprecord(), before decoding.  If record mode is off,
+ * or the first fragment alone is too big, it does nothing, and
+ * the record is decoded as a stream, as usual.
+ */
+bool_t
+xdrrec_getrecord(XDR *xdrs)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+    u_int total;
+    u_int need;
+    u_int avail;
+    u_int n;
+    caddr_t newbuf;
+
+    rec_unload(xdrs, rstrm);
+    if (rstrm->rec_max == 0) {
+        return (TRUE);
+    }
+    if (!set_input_fragment(rstrm)) {
+        return (FALSE);
+    }
+    if ((u_long) rstrm->fbtbc > rstrm->rec_max) {
+        return (TRUE);
+    }
+
+    avail = rstrm->in_boundry - rstrm->in_finger;
+    if (rstrm->last_frag && (u_long) rstrm->fbtbc <= avail) {
+        // The whole record is in the input buffer already.
+        rstrm->rec_start = rstrm->in_finger;
+        rstrm->rec_end = rstrm->in_finger + rstrm->fbtbc;
+        rstrm->in_finger = rstrm->rec_end;
+        rstrm->fbtbc = 0;
+    }
+    else {
+        total = 0;
+        for (;;) {
+            need = total + (u_int) rstrm->fbtbc;
+            if (need > rstrm->rec_bufsize) {
+                newbuf = pool_get(need, &n);
+                if (newbuf == NULL) {
+                    return (FALSE);
+                }
+                if (rstrm->rec_buf != NULL) {
+                    memcpy(newbuf, rstrm->rec_buf, total);
+                    pool_put(rstrm->rec_buf, rstrm->rec_bufsize);
+                }
+                rstrm->rec_buf = newbuf;
+                rstrm->rec_bufsize = n;
+            }
+            n = (u_int) rstrm->fbtbc;
+            avail = rstrm->in_boundry - rstrm->in_finger;
+            if (n <= avail || n - avail <= rstrm->in_size / 2) {
+                // Small remainder: buffer it, and read ahead.
+                if (!get_input_bytes(rstrm, rstrm->rec_buf + total, (int) n)) {
+                    return (FALSE);
+                }
+            }
+            else {
+                memcpy(rstrm->rec_buf + total, rstrm->in_finger, avail);
+                rstrm->in_finger += avail;
+                if (!read_input_direct(rstrm, rstrm->rec_buf + total + avail, n - avail)) {
+                    return (FALSE);
+                }
+            }
+            total += n;
+            rstrm->fbtbc = 0;
+            if (rstrm->last_frag) {
+                break;
+            }
+            if (!set_input_fragment(rstrm)) {
+                return (FALSE);
+            }
+            if ((u_long) total + rstrm->fbtbc > rstrm->rec_max) {
+                // Leave the rest of the record to be streamed.
+                break;
+            }
+        }
+        rstrm->rec_start = rstrm->rec_buf;
+        rstrm->rec_end = rstrm->rec_buf + total;
+    }
+    rstrm->rec_finger = rstrm->rec_start;
+    xdrs->x_ops = (struct xdr_ops *) &xdrrec_rec_ops;
+    return (TRUE);
+}
+
+/*
+ * The caller is done decoding the loaded record.
+ * What was not decoded is skipped by the next xdrrec_skiprecord().
+ */
+void
+xdrrec_donerecord(XDR *xdrs)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    rec_unload(xdrs, rstrm);
+}
+
+/*
+ * Point *@var{bufp} at what is left of the loaded record,
+ * and set *@var{lenp} to its length.  Nothing is consumed.
+ */
+bool_t
+xdrrec_peekrecord(XDR *xdrs, caddr_t *bufp, u_int *lenp)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    if (xdrs->x_ops != &xdrrec_rec_ops) {
+        return (FALSE);
+    }
+    *bufp = rstrm->rec_finger;
+    *lenp = (u_int) (rstrm->rec_end - rstrm->rec_finger);
+    return (TRUE);
+}
+/*
+ * Adaptive buffers
+ *
+ * A stream in adaptive mode gets its send and receive buffers from
+ * a pool shared by all streams, sized from the records it has seen
+ * lately, and gives them back when xdrrec_release() finds it idle.
+ * A released stream points at a dummy, empty buffer, so the next
+ * attempt to read or write finds no room, and lands in the slow path,
+ * which takes buffers from the pool again.
+ */
+
+static char rec_dummy[BYTES_PER_XDR_UNIT];
+
+static void
+rec_set_released(RECSTREAM *rstrm)
+{
+    rstrm->out_base = rstrm->out_finger = rstrm->out_boundry = rec_dummy;
+    rstrm->frag_header = (u_int32_t *) rec_dummy;
+    rstrm->frag_sent = FALSE;
+    rstrm->in_base = rstrm->in_finger = rstrm->in_boundry = rec_dummy;
+    rstrm->in_size = 0;
+    rstrm->sendsize = rstrm->recvsize = 0;
+    rstrm->released = TRUE;
+}
+
+/*
+ * Switch a stream, just created, to adaptive, pooled buffers.
+ */
+void
+xdrrec_adaptive(XDR *xdrs)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    if (rstrm->adaptive) {
+        return;
+    }
+    mem_free(rstrm->the_buffer, rstrm->sendsize + rstrm->recvsize + BYTES_PER_XDR_UNIT);
+    rstrm->the_buffer = NULL;
+    rstrm->adaptive = TRUE;
+    rec_set_released(rstrm);
+}
+
+/*
+ * If the stream is between records, with no record loaded,
+ * no input buffered, and no output pending, give its buffers
+ * back to the pool.
+ * Return TRUE if the stream holds no buffers, now.
+ */
+bool_t
+xdrrec_release(XDR *xdrs)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+
+    if (!rstrm->adaptive) {
+        return (FALSE);
+    }
+    if (rstrm->released) {
+        return (TRUE);
+    }
+    // A loaded record may be decoded in place, in in_base or rec_buf.
+    if (rstrm->rec_start != NULL || xdrs->x_ops == &xdrrec_rec_ops) {
+        return (FALSE);
+    }
+    if (rstrm->in_finger != rstrm->in_boundry || rstrm->fbtbc != 0 || !rstrm->last_frag) {
+        return (FALSE);
+    }
+    if (rstrm->frag_sent || rstrm->out_finger != rstrm->out_base + BYTES_PER_XDR_UNIT) {
+        return (FALSE);
+    }
+    rec_unload(xdrs, rstrm);
+    pool_put(rstrm->out_base, rstrm->sendsize);
+    pool_put(rstrm->in_base, rstrm->recvsize);
+    if (rstrm->rec_buf != NULL) {
+        pool_put(rstrm->rec_buf, rstrm->rec_bufsize);
+        rstrm->rec_buf = NULL;
+        rstrm->rec_bufsize = 0;
+    }
+    rec_set_released(rstrm);
+    return (TRUE);
+}
+
+/*
+ * Measure and encode
+ *
+ * Records that have lately outgrown the send buffer are sized ahead
+ * of time, encoded into a pooled buffer of just the right size,
+ * and sent as one fragment, with one write.
+ */
+
+/*
+ * Is the next record likely not to fit the send buffer?
+ */
+static inline bool_t
+rec_outgrown(RECSTREAM *rstrm)
+{
+    u_int room;
+
+    room = rstrm->adaptive ? XDRREC_POOL_MAX : rstrm->sendsize;
+    return (rstrm->out_hw + 2 * BYTES_PER_XDR_UNIT > room);
+}
+
+/*
+ * Is the stream between records, with no output pending?
+ */
+static inline bool_t
+rec_out_empty(RECSTREAM *rstrm)
+{
+    if (rstrm->released) {
+        return (TRUE);
+    }
+    return (!rstrm->frag_sent && rstrm->out_finger == rstrm->out_base + BYTES_PER_XDR_UNIT);
+}
+
+caddr_t
+xdr_encode_pooled(xdrproc_t func, void *data, u_int *lenp)
+{
+    XDR mx;
+    caddr_t buf;
+    u_long len;
+    u_int size;
+
+    len = xdr_sizeof(func, data);
+    if (len == 0 || len > LAST_FRAG - 1 - BYTES_PER_XDR_UNIT) {
+        return (NULL);
+    }
+    buf = pool_get((u_int) len + BYTES_PER_XDR_UNIT, &size);
+    if (buf == NULL) {
+        return (NULL);
+    }
+    xdrmem_create(&mx, buf + BYTES_PER_XDR_UNIT, (u_int) len, XDR_ENCODE);
+    if (!(*func) (&mx, data) || XDR_GETPOS(&mx) != len) {
+        pool_put(buf, size);
+        return (NULL);
+    }
+    *lenp = (u_int) len;
+    return (buf + BYTES_PER_XDR_UNIT);
+}
+
+void
+xdr_pool_free(caddr_t buf, u_int len)
+{
+    u_int size;
+
+    size = pool_sizeof(len + BYTES_PER_XDR_UNIT);
+    pool_put(buf - BYTES_PER_XDR_UNIT, size);
+}
+
+bool_t
+xdrrec_sized_record(XDR *xdrs, xdrproc_t func, void *data)
+{
+    RECSTREAM *rstrm = (RECSTREAM *) xdrs->x_private;
+    caddr_t buf;
+    u_int len;
+    int n;
+    bool_t stat;
+
+    if (rec_outgrown(rstrm) && rec_out_empty(rstrm)) {
+        buf = xdr_encode_pooled(func, data, &len);
+        if (buf != NULL) {
+            *(u_int32_t *) (buf - BYTES_PER_XDR_UNIT) = htonl((u_long) len | LAST_FRAG);
+            n = (int) len + BYTES_PER_XDR_UNIT;
+            stat = (*(rstrm->writeit)) (rstrm->tcp_handle, buf - BYTES_PER_XDR_UNIT, n) == n;
+            rec_observe(&rstrm->out_hw, len);
+            xdr_pool_free(buf, len);
+            return (stat);
+        }
+    }
+    stat = (*func) (xdrs, data);
+    if (!xdrrec_endofrecord(xdrs, TRUE)) {
+        stat = FALSE;
+    }
+    return (stat);
+}
 
 /*
  * Internal useful routines
@@ -554,6 +1055,11 @@ flush_out(RECSTREAM *rstrm, bool_t eor)
     u_long len = (rstrm->out_finger - (char *)rstrm->frag_header - BYTES_PER_XDR_UNIT);
 
     *rstrm->frag_header = htonl(len | eormask);
+    rstrm->out_reclen += len;
+    if (eor) {
+        rec_observe(&rstrm->out_hw, rstrm->out_reclen);
+        rstrm->out_reclen = 0;
+    }
     len = rstrm->out_finger - rstrm->out_base;
     if ((*(rstrm->writeit)) (rstrm->tcp_handle, rstrm->out_base, (int)len) != (int)len) {
         return (FALSE);
@@ -576,6 +1082,9 @@ fill_input_buf(RECSTREAM *rstrm)
     size_t i;
     int len;
 
+    if (rstrm->released && !rec_acquire(rstrm)) {
+        return (FALSE);
+    }
     where = rstrm->in_base;
     i = (size_t) rstrm->in_boundry % BYTES_PER_XDR_UNIT;
     where += i;
@@ -618,6 +1127,30 @@ get_input_bytes(RECSTREAM *rstrm, caddr_t addr, int len)
     return (TRUE);
 }
 
+/*
+ * read_input_direct()
+ *
+ * reads exactly @var{len} bytes, bypassing the input buffer,
+ * which must be empty
+ */
+
+internal_function
+static bool_t
+read_input_direct(RECSTREAM *rstrm, caddr_t addr, u_int len)
+{
+    int current;
+
+    while (len > 0) {
+        current = (*(rstrm->readit)) (rstrm->tcp_handle, addr, (int) len);
+        if (current <= 0) {
+            return (FALSE);
+        }
+        addr += current;
+        len -= current;
+    }
+    return (TRUE);
+}
+
 /*
  * set_input_fragment()
  *
@@ -649,6 +1182,11 @@ set_input_fragment(RECSTREAM *rstrm)
         return (FALSE);
     }
     rstrm->fbtbc = header & ~LAST_FRAG;
+    rstrm->in_reclen += rstrm->fbtbc;
+    if (rstrm->last_frag) {
+        rec_observe(&rstrm->in_hw, rstrm->in_reclen);
+        rstrm->in_reclen = 0;
+    }
     return (TRUE);
 }
 
@@ -688,3 +1226,253 @@ fix_buf_size(u_int s)
     }
     return (RNDUP(s));
 }
+
+/*
+ * Make room in the output buffer: send what is in it,
+ * or, if the stream has released its buffers, get them back.
+ */
+internal_function
+static bool_t
+make_room(RECSTREAM *rstrm)
+{
+    if (rstrm->released) {
+        return (rec_acquire(rstrm));
+    }
+    rstrm->frag_sent = TRUE;
+    return (flush_out(rstrm, FALSE));
+}
+
+/*
+ * Size of a buffer for records of about @var{hw} bytes,
+ * plus a fragment header and a little slack.
+ */
+static inline u_int
+rec_size_for(u_int hw)
+{
+    u_int size;
+
+    size = hw + 2 * BYTES_PER_XDR_UNIT;
+    if (size > XDRREC_POOL_MAX) {
+        size = XDRREC_POOL_MAX;
+    }
+    return (size);
+}
+
+/*
+ * Take send and receive buffers from the pool,
+ * sized for the records seen lately.
+ */
+internal_function
+static bool_t
+rec_acquire(RECSTREAM *rstrm)
+{
+    caddr_t out;
+    caddr_t in;
+    u_int outsize;
+    u_int insize;
+
+    out = pool_get(rec_size_for(rstrm->out_hw), &outsize);
+    in = pool_get(rec_size_for(rstrm->in_hw), &insize);
+    if (out == NULL || in == NULL) {
+        if (out != NULL) {
+            pool_put(out, outsize);
+        }
+        if (in != NULL) {
+            pool_put(in, insize);
+        }
+        return (FALSE);
+    }
+    rstrm->sendsize = outsize;
+    rstrm->out_base = out;
+    rstrm->frag_header = (u_int32_t *) out;
+    rstrm->out_finger = out + BYTES_PER_XDR_UNIT;
+    rstrm->out_boundry = out + outsize;
+    rstrm->frag_sent = FALSE;
+    rstrm->recvsize = insize;
+    rstrm->in_size = insize;
+    rstrm->in_base = in;
+    rstrm->in_finger = rstrm->in_boundry = in + insize;
+    rstrm->released = FALSE;
+    return (TRUE);
+}
+
+/*
+ * Track the recent size of records: jump up to a bigger record,
+ * and decay slowly toward smaller ones.
+ */
+internal_function
+static void
+rec_observe(u_int *hwp, u_long len)
+{
+    if (len > UINT32_MAX) {
+        len = UINT32_MAX;
+    }
+    if (len >= *hwp) {
+        *hwp = (u_int) len;
+    }
+    else {
+        *hwp -= (*hwp - (u_int) len) / 8;
+    }
+}
+
+/*
+ * The buffer pool
+ *
+ * Buffers come in power-of-2 size classes, from XDRREC_POOL_MIN
+ * to XDRREC_POOL_MAX bytes.  Each class has a free list, and its own
+ * lock, and keeps up to pool_keep bytes of idle buffers; beyond that,
+ * buffers are freed.  Bigger requests are plain malloc() and free().
+ */
+
+#define POOL_MIN_SHIFT  9
+#define POOL_MAX_SHIFT  18
+#define POOL_NCLASSES   (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+struct pool_class {
+    pthread_mutex_t pc_lock;
+    void           *pc_free;        /* linked through the first word */
+    size_t          pc_idle;        /* bytes on the free list */
+} CACHE_ALIGNED;
+
+static struct pool_class pool_classes[POOL_NCLASSES];
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static size_t pool_keep = XDRREC_POOL_KEEP;
+
+static size_t pool_cnt_get;
+static size_t pool_cnt_hit;
+static size_t pool_cnt_put;
+static size_t pool_bytes_busy;
+
+static void
+pool_init(void)
+{
+    size_t i;
+
+    for (i = 0; i < POOL_NCLASSES; ++i) {
+        pthread_mutex_init(&pool_classes[i].pc_lock, NULL);
+    }
+}
+
+static inline int
+pool_classof(u_int size)
+{
+    u_int cls;
+
+    for (cls = 0; cls < POOL_NCLASSES; ++cls) {
+        if (size <= (1U << (cls + POOL_MIN_SHIFT))) {
+            return ((int) cls);
+        }
+    }
+    return (-1);
+}
+
+internal_function
+static caddr_t
+pool_get(u_int want, u_int *sizep)
+{
+    struct pool_class *pc;
+    caddr_t buf;
+    u_int size;
+    int cls;
+
+    pthread_once(&pool_once, pool_init);
+    __sync_fetch_and_add(&pool_cnt_get, 1);
+    cls = pool_classof(want);
+    if (cls < 0) {
+        size = RNDUP(want);
+        buf = (caddr_t) mem_alloc(size);
+    }
+    else {
+        size = 1U << (cls + POOL_MIN_SHIFT);
+        pc = &pool_classes[cls];
+        pthread_mutex_lock(&pc->pc_lock);
+        buf = (caddr_t) pc->pc_free;
+        if (buf != NULL) {
+            pc->pc_free = *(void **) buf;
+            pc->pc_idle -= size;
+        }
+        pthread_mutex_unlock(&pc->pc_lock);
+        if (buf != NULL) {
+            __sync_fetch_and_add(&pool_cnt_hit, 1);
+        }
+        else {
+            buf = (caddr_t) mem_alloc(size);
+        }
+    }
+    if (buf == NULL) {
+        xdr_out_of_memory(__FILE__, __FUNCTION__);
+        return (NULL);
+    }
+    __sync_fetch_and_add(&pool_bytes_busy, size);
+    *sizep = size;
+    return (buf);
+}
+
+internal_function
+static void
+pool_put(caddr_t buf, u_int size)
+{
+    struct pool_class *pc;
+    int cls;
+
+    __sync_fetch_and_add(&pool_cnt_put, 1);
+    __sync_fetch_and_sub(&pool_bytes_busy, size);
+    cls = pool_classof(size);
+    if (cls >= 0 && size == (1U << (cls + POOL_MIN_SHIFT))) {
+        pc = &pool_classes[cls];
+        pthread_mutex_lock(&pc->pc_lock);
+        if (pc->pc_idle + size <= pool_keep) {
+            *(void **) buf = pc->pc_free;
+            pc->pc_free = buf;
+            pc->pc_idle += size;
+            buf = NULL;
+        }
+        pthread_mutex_unlock(&pc->pc_lock);
+    }
+    if (buf != NULL) {
+        mem_free(buf, size);
+    }
+}
+
+/*
+ * The size of the buffer that pool_get(@var{want}) hands out.
+ */
+static u_int
+pool_sizeof(u_int want)
+{
+    int cls;
+
+    cls = pool_classof(want);
+    if (cls < 0) {
+        return (RNDUP(want));
+    }
+    return (1U << (cls + POOL_MIN_SHIFT));
+}
+
+/*
+ * Set how many bytes of idle buffers each size class of the pool
+ * may keep.
+ */
+void
+xdrrec_pool_limit(size_t bytes)
+{
+    pool_keep = bytes;
+}
+
+void
+xdrrec_pool_stats(struct xdrrec_pool_stats *statsp)
+{
+    size_t i;
+
+    pthread_once(&pool_once, pool_init);
+    statsp->gets = pool_cnt_get;
+    statsp->hits = pool_cnt_hit;
+    statsp->puts = pool_cnt_put;
+    statsp->busy_bytes = pool_bytes_busy;
+    statsp->idle_bytes = 0;
+    for (i = 0; i < POOL_NCLASSES; ++i) {
+        pthread_mutex_lock(&pool_classes[i].pc_lock);
+        statsp->idle_bytes += pool_classes[i].pc_idle;
+        pthread_mutex_unlock(&pool_classes[i].pc_lock);
+    }
+}
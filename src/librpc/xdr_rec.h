@@ -0,0 +1,125 @@
+/*
+ * Filename: xdr_rec.h
+ * Project: rpc-mt
+ * Brief: Extensions to xdrrec streams
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _XDR_REC_H
+#define _XDR_REC_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>      // Import size_t
+#include <rpc/xdr.h>     // Import XDR, bool_t, u_int
+
+/*
+ * Record mode
+ * -----------
+ * xdrrec_recordmode(xdrs, maxrec) makes an xdrrec stream load each
+ * record, up to @var{maxrec} bytes, into memory before it is decoded.
+ * xdrrec_getrecord() loads the next record; call it right after
+ * xdrrec_skiprecord().  xdrrec_donerecord() says that the caller has
+ * decoded all that it wants of the loaded record; until then, the
+ * record may live in the stream's buffers, and they are not released.
+ * xdrrec_peekrecord(xdrs, &buf, &len) points at the part of the
+ * loaded record that has not been decoded yet, without consuming it;
+ * it returns FALSE if no record is loaded.
+ *
+ * A record that arrived in one piece is decoded in place, in the
+ * input buffer.  Decoding a loaded record costs what xdrmem costs,
+ * and x_inline can return any span of it.  While decoding,
+ * XDR_GETPOS() is the offset into the record.
+ */
+
+extern void   xdrrec_recordmode(XDR *xdrs, u_int maxrec);
+extern bool_t xdrrec_getrecord(XDR *xdrs);
+extern void   xdrrec_donerecord(XDR *xdrs);
+extern bool_t xdrrec_peekrecord(XDR *xdrs, caddr_t *bufp, u_int *lenp);
+
+/*
+ * Adaptive buffers
+ * ----------------
+ * xdrrec_adaptive(xdrs), called right after xdrrec_create(), makes the
+ * stream take its send and receive buffers from a pool shared by all
+ * streams, instead of holding the fixed-size buffer it was created
+ * with.  Each time it takes them, they are sized from the records it
+ * has sent and received lately, from XDRREC_POOL_MIN up to
+ * XDRREC_POOL_MAX bytes, so that a stream of small records gets small
+ * buffers, and a stream of bulk records gets buffers that hold a whole
+ * record, and can be sent as one fragment, in one write.
+ *
+ * xdrrec_release() gives the buffers back, if the stream is between
+ * records, with nothing buffered, and no record loaded.  An idle
+ * connection that has been released holds no buffer memory at all.
+ * Taking buffers from the pool, and giving them back, costs a lock
+ * on the size class, so release a stream only once it has been idle
+ * for a while, not after every record.
+ */
+
+#define XDRREC_POOL_MIN  512
+#define XDRREC_POOL_MAX  (256 * 1024)
+#define XDRREC_POOL_KEEP (4 * 1024 * 1024)   /* idle bytes, per size class */
+
+struct xdrrec_pool_stats {
+    size_t gets;            /* buffers taken */
+    size_t hits;            /* ... of which came from a free list */
+    size_t puts;            /* buffers given back */
+    size_t busy_bytes;      /* bytes of buffers held by streams */
+    size_t idle_bytes;      /* bytes of buffers on free lists */
+};
+
+extern void   xdrrec_adaptive(XDR *xdrs);
+extern bool_t xdrrec_release(XDR *xdrs);
+extern void   xdrrec_pool_limit(size_t bytes);
+extern void   xdrrec_pool_stats(struct xdrrec_pool_stats *statsp);
+
+/*
+ * Measure and encode
+ * ------------------
+ * A record bigger than the send buffer goes out in fragments, one
+ * write per buffer-full, and an adaptive stream keeps growing its
+ * buffer, up to XDRREC_POOL_MAX, to catch up with it.
+ *
+ * xdrrec_sized_record(xdrs, func, data) encodes @var{data} with
+ * @var{func}, as one whole record, and sends it.  If the records that
+ * the stream has sent lately have fit its send buffer, that is just
+ * @var{func}, then xdrrec_endofrecord(xdrs, TRUE).  Otherwise, it
+ * measures the record, with xdr_sizeof(), which allocates nothing,
+ * then encodes it, with xdrmem, into a pooled buffer of just that size,
+ * plus the record mark, and writes the whole record at once,
+ * as a single fragment.
+ *
+ * xdr_encode_pooled(func, data, &len) is the measure and encode step
+ * on its own.  It returns a pooled buffer, holding @var{len} bytes of
+ * XDR, or NULL.  The buffer has BYTES_PER_XDR_UNIT bytes of headroom,
+ * just before the returned address, for a record mark.
+ * Give it back with xdr_pool_free(buf, len).
+ */
+
+extern bool_t  xdrrec_sized_record(XDR *xdrs, xdrproc_t func, void *data);
+extern caddr_t xdr_encode_pooled(xdrproc_t func, void *data, u_int *lenp);
+extern void    xdr_pool_free(caddr_t buf, u_int len);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _XDR_REC_H */
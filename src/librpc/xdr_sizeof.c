@@ -39,6 +39,19 @@
 #include <sys/types.h>
 #include <stdlib.h>
 
+/*
+ * Where x_inline() points callers that ask for inline space.
+ * Encoders only ever write to inline space, and nothing here ever
+ * reads it, so sizing never needs to allocate any.  The sink is
+ * per-thread only so that concurrent sizing passes are not reported
+ * as races by helgrind and drd.  Anyone who asks for more than fits
+ * is told no (NULL), and falls back to x_putlong() or x_putbytes(),
+ * which count the same bytes.
+ */
+#define SIZEOF_SINK 4096
+
+static __thread int32_t sizeof_sink[SIZEOF_SINK / sizeof (int32_t)];
+
 static bool_t
 x_putlong(XDR *xdrs, const long *longp)
 {
@@ -78,28 +91,14 @@ x_setpostn(XDR *xdrs, u_int len)
 static int32_t *
 x_inline(XDR *xdrs, u_int len)
 {
-    if (len == 0) {
+    if (len == 0 || len > SIZEOF_SINK) {
         return (NULL);
     }
     if (xdrs->x_op != XDR_ENCODE) {
         return (NULL);
     }
-    if (len < (u_int) (long int)xdrs->x_base) {
-        /* x_private was already allocated */
-        xdrs->x_handy += len;
-        return ((int32_t *) xdrs->x_private);
-    }
-    else {
-        /* Free the earlier space and allocate new area */
-        free(xdrs->x_private);
-        if ((xdrs->x_private = (caddr_t) malloc(len)) == NULL) {
-            xdrs->x_base = 0;
-            return (NULL);
-        }
-        xdrs->x_base = (caddr_t)(long)len;
-        xdrs->x_handy += len;
-        return ((int32_t *) xdrs->x_private);
-    }
+    xdrs->x_handy += len;
+    return (sizeof_sink);
 }
 
 static int
@@ -113,11 +112,6 @@ static void
 x_destroy(XDR *xdrs)
 {
     xdrs->x_handy = 0;
-    xdrs->x_base = 0;
-    if (xdrs->x_private) {
-        free(xdrs->x_private);
-        xdrs->x_private = NULL;
-    }
 }
 
 static bool_t
@@ -160,6 +154,5 @@ xdr_sizeof(xdrproc_t func, void *data)
     x.x_base = (caddr_t) 0;
 
     stat = func(&x, data);
-    free(x.x_private);
     return (stat == TRUE ? x.x_handy : 0);
 }
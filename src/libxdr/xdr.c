@@ -36,16 +36,19 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <limits.h>
 #include <string.h>
 #include <libintl.h>
 #include <wchar.h>
 #include <stdint.h>
+#include <arpa/inet.h>
 
 #include <rpc/types.h>
 #include <rpc/xdr.h>
 
 #include <xdr_error.h>
+#include <xdr_string.h>
 
 /*
  * constants specific to the xdr "protocol"
@@ -59,6 +62,26 @@
  */
 static const char xdr_zero[BYTES_PER_XDR_UNIT] = { 0, 0, 0, 0 };
 
+/*
+ * Opaque data and strings are first tried with XDR_INLINE(), so that
+ * the bytes and the padding are done in one step, not two calls through
+ * x_ops.  Streams that cannot give out that much contiguous memory
+ * say no, and the bytes go the usual way.
+ *
+ * Store @var{cnt} bytes, then @var{rndup} bytes of zero padding,
+ * at @var{buf}.  The padding is zeroed with one store of a whole word,
+ * over the last XDR unit, and then the data is copied over the front
+ * of that unit, so there is no loop over the 1 to 3 bytes of padding.
+ */
+static inline void
+opaque_put(char *buf, const char *cp, u_int cnt, u_int rndup)
+{
+    if (rndup != 0) {
+        memcpy(buf + cnt + rndup - BYTES_PER_XDR_UNIT, xdr_zero, BYTES_PER_XDR_UNIT);
+    }
+    memcpy(buf, cp, cnt);
+}
+
 /*
  * Free a data structure using XDR
  * Not a filter, but a convenient utility nonetheless
@@ -471,6 +494,7 @@ bool_t
 xdr_opaque(XDR *xdrs, caddr_t cp, u_int cnt)
 {
     u_int rndup;
+    char *buf;
     static char crud[BYTES_PER_XDR_UNIT];
 
     /*
@@ -494,6 +518,13 @@ xdr_opaque(XDR *xdrs, caddr_t cp, u_int cnt)
         return (FALSE);
         break;
     case XDR_DECODE:
+        if (cnt <= LASTUNSIGNED - rndup) {
+            buf = (char *) XDR_INLINE(xdrs, cnt + rndup);
+            if (buf != NULL) {
+                memcpy(cp, buf, cnt);
+                return (TRUE);
+            }
+        }
         if (!XDR_GETBYTES(xdrs, cp, cnt)) {
             return (FALSE);
         }
@@ -502,6 +533,13 @@ xdr_opaque(XDR *xdrs, caddr_t cp, u_int cnt)
         }
         return (XDR_GETBYTES(xdrs, (caddr_t) crud, rndup));
     case XDR_ENCODE:
+        if (cnt <= LASTUNSIGNED - rndup) {
+            buf = (char *) XDR_INLINE(xdrs, cnt + rndup);
+            if (buf != NULL) {
+                opaque_put(buf, cp, cnt, rndup);
+                return (TRUE);
+            }
+        }
         if (!XDR_PUTBYTES(xdrs, cp, cnt)) {
             return (FALSE);
         }
@@ -687,6 +725,9 @@ xdr_string(XDR *xdrs, char **cpp, u_int maxsize)
         break;
     }
 
+    if (xdrs->x_op == XDR_ENCODE) {
+        return (xdr_string_len(xdrs, sp, size, maxsize));
+    }
     if (!xdr_u_int(xdrs, &size)) {
         return (FALSE);
     }
@@ -720,8 +761,6 @@ xdr_string(XDR *xdrs, char **cpp, u_int maxsize)
             return (FALSE);
         }
         sp[size] = 0;
-        __attribute__ ((fallthrough));
-    case XDR_ENCODE:
         return (xdr_opaque(xdrs, sp, size));
     case XDR_FREE:
         mem_free(sp, nodesize);
@@ -743,3 +782,188 @@ xdr_wrapstring(XDR *xdrs, char **cpp)
     }
     return (FALSE);
 }
+
+/*
+ * Encode a string of known length, @var{len}, without strlen().
+ * The count and the bytes are done with one XDR_INLINE(),
+ * if the stream can give out that much at once.
+ */
+bool_t
+xdr_string_len(XDR *xdrs, const char *sp, u_int len, u_int maxsize)
+{
+    char *buf;
+    u_int rndup;
+    uint32_t n;
+
+    if (xdrs->x_op != XDR_ENCODE) {
+        xdr_bad_op(__FILE__, __FUNCTION__, xdrs->x_op);
+        return (FALSE);
+    }
+    if (sp == NULL || len > maxsize) {
+        return (FALSE);
+    }
+    if (len <= LASTUNSIGNED - 2 * BYTES_PER_XDR_UNIT) {
+        rndup = (BYTES_PER_XDR_UNIT - len % BYTES_PER_XDR_UNIT) % BYTES_PER_XDR_UNIT;
+        buf = (char *) XDR_INLINE(xdrs, BYTES_PER_XDR_UNIT + len + rndup);
+        if (buf != NULL) {
+            n = htonl(len);
+            memcpy(buf, &n, sizeof (n));
+            opaque_put(buf + BYTES_PER_XDR_UNIT, sp, len, rndup);
+            return (TRUE);
+        }
+    }
+    if (!xdr_u_int(xdrs, &len)) {
+        return (FALSE);
+    }
+    return (xdr_opaque(xdrs, (caddr_t) sp, len));
+}
+
+/*
+ * Encode an array of @var{n} strings, whose lengths are known.
+ */
+bool_t
+xdr_strarray_len(XDR *xdrs, char **val, const u_int *lens, u_int n, u_int maxsize)
+{
+    u_int i;
+
+    if (!xdr_u_int(xdrs, &n)) {
+        return (FALSE);
+    }
+    for (i = 0; i < n; ++i) {
+        if (!xdr_string_len(xdrs, val[i], lens[i], maxsize)) {
+            return (FALSE);
+        }
+    }
+    return (TRUE);
+}
+
+/*
+ * First guess at the average length of a string in an array,
+ * for sizing the arena.  The arena grows, if need be.
+ */
+#define STRARRAY_GUESS 32
+
+/*
+ * Decode an array of strings into one arena: first the array of
+ * pointers, then the strings, each with its NUL.  The arena may move,
+ * as it grows, so, until the end, each slot of the array holds
+ * the offset of its string, rather than its address.
+ */
+static bool_t
+strarray_decode(XDR *xdrs, char ***valp, u_int *lenp, u_int maxlen, u_int maxsize)
+{
+    char *arena;
+    char *newarena;
+    size_t *offv;
+    char **vec;
+    size_t size;
+    size_t newsize;
+    size_t used;
+    u_int n;
+    u_int i;
+    u_int len;
+
+    if (*valp != NULL) {
+        return (FALSE);
+    }
+    if (!xdr_u_int(xdrs, lenp)) {
+        return (FALSE);
+    }
+    n = *lenp;
+    if (n > maxlen || n > LASTUNSIGNED / sizeof (char *)) {
+        return (FALSE);
+    }
+    if (n == 0) {
+        return (TRUE);
+    }
+
+    used = (size_t) n * sizeof (char *);
+    size = used + (size_t) n * STRARRAY_GUESS;
+    arena = (char *) malloc(size);
+    if (arena == NULL) {
+        xdr_out_of_memory(__FILE__, __FUNCTION__);
+        return (FALSE);
+    }
+    for (i = 0; i < n; ++i) {
+        if (!xdr_u_int(xdrs, &len) || len > maxsize) {
+            free(arena);
+            return (FALSE);
+        }
+        if (size - used < (size_t) len + 1) {
+            newsize = 2 * size;
+            while (newsize - used < (size_t) len + 1) {
+                newsize *= 2;
+            }
+            newarena = (char *) realloc(arena, newsize);
+            if (newarena == NULL) {
+                free(arena);
+                xdr_out_of_memory(__FILE__, __FUNCTION__);
+                return (FALSE);
+            }
+            arena = newarena;
+            size = newsize;
+        }
+        if (!xdr_opaque(xdrs, arena + used, len)) {
+            free(arena);
+            return (FALSE);
+        }
+        arena[used + len] = 0;
+        offv = (size_t *)(void *) arena;
+        offv[i] = used;
+        used += (size_t) len + 1;
+    }
+
+    /*
+     * Give back a lot of slack, before the addresses are fixed.
+     */
+    if (size - used > size / 4) {
+        newarena = (char *) realloc(arena, used);
+        if (newarena != NULL) {
+            arena = newarena;
+        }
+    }
+    offv = (size_t *)(void *) arena;
+    vec = (char **)(void *) arena;
+    for (i = 0; i < n; ++i) {
+        vec[i] = arena + offv[i];
+    }
+    *valp = vec;
+    return (TRUE);
+}
+
+/*
+ * XDR an array of strings, like xdr_array() of xdr_wrapstring(),
+ * but decoded into one allocation.  See xdr_string.h.
+ */
+bool_t
+xdr_strarray(XDR *xdrs, char ***valp, u_int *lenp, u_int maxlen, u_int maxsize)
+{
+    u_int i;
+
+    switch (xdrs->x_op) {
+    default:
+        xdr_bad_op(__FILE__, __FUNCTION__, xdrs->x_op);
+        return (FALSE);
+        break;
+    case XDR_DECODE:
+        return (strarray_decode(xdrs, valp, lenp, maxlen, maxsize));
+    case XDR_ENCODE:
+        if (!xdr_u_int(xdrs, lenp)) {
+            return (FALSE);
+        }
+        if (*lenp > maxlen) {
+            return (FALSE);
+        }
+        for (i = 0; i < *lenp; ++i) {
+            if (!xdr_string(xdrs, &(*valp)[i], maxsize)) {
+                return (FALSE);
+            }
+        }
+        return (TRUE);
+    case XDR_FREE:
+        free(*valp);
+        *valp = NULL;
+        return (TRUE);
+    }
+    return (FALSE);
+}
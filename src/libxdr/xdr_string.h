@@ -0,0 +1,80 @@
+/*
+ * Filename: xdr_string.h
+ * Project: rpc-mt
+ * Brief: Strings of known length, and arrays of strings in one allocation
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _XDR_STRING_H
+#define _XDR_STRING_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <rpc/xdr.h>     // Import XDR, bool_t, u_int
+
+/*
+ * Encoding strings of known length
+ * --------------------------------
+ * xdr_string() finds the length of each string it encodes with strlen().
+ * A caller that already knows the lengths, for example, of names and
+ * paths it keeps in a table, can skip that.
+ *
+ * xdr_string_len(xdrs, sp, len, maxsize) encodes the string @var{sp},
+ * of @var{len} bytes, not counting the NUL, which need not be there.
+ * The bytes on the wire are the same as from xdr_string().
+ *
+ * xdr_strarray_len(xdrs, val, lens, n, maxsize) encodes an array of
+ * @var{n} strings, @var{val}[i], of length @var{lens}[i], as
+ * xdr_strarray() would.
+ *
+ * Both are for XDR_ENCODE streams only (xdr_sizeof() included).
+ *
+ * Decoding arrays of strings
+ * --------------------------
+ * xdr_array() of xdr_wrapstring() allocates the array of pointers,
+ * then each string on its own.  A reply that carries hundreds of names
+ * costs hundreds of calls to malloc(), and as many to free().
+ *
+ * xdr_strarray(xdrs, valp, lenp, maxlen, maxsize) is a drop-in
+ * replacement for
+ *
+ *     xdr_array(xdrs, (char **)valp, lenp, maxlen,
+ *         sizeof (char *), (xdrproc_t)xdr_wrapstring)
+ *
+ * with strings of up to @var{maxsize} bytes, except that, when decoding,
+ * the array of pointers and all the strings are one allocation, an arena.
+ * @var{*valp} must be NULL, when decoding.  XDR_FREE frees the arena,
+ * with one call to free(); an array that xdr_strarray() did not decode
+ * must not be freed with it.
+ *
+ * Encoding with xdr_strarray() is the same as with xdr_array().
+ */
+
+extern bool_t xdr_string_len(XDR *xdrs, const char *sp, u_int len, u_int maxsize);
+extern bool_t xdr_strarray_len(XDR *xdrs, char **val, const u_int *lens, u_int n,
+    u_int maxsize);
+extern bool_t xdr_strarray(XDR *xdrs, char ***valp, u_int *lenp, u_int maxlen,
+    u_int maxsize);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _XDR_STRING_H */
@@ -0,0 +1,103 @@
+/*
+ * Filename: drc_key.c
+ * Project: rpc-mt
+ * Brief: Regression test: TCP duplicate request cache keys
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: drc_key [svc_config commands...]
+ *
+ * With the TCP duplicate request cache on, a retransmission must be
+ * answered from the cache, even though the client reconnected from
+ * another port.  A call that shares an xid, but carries other arguments,
+ * must run.  Each call of a pipelined batch must be cached on its own,
+ * so that the whole batch, sent again, is answered from the cache.
+ *
+ * Exit status is 0 if all is well.
+ */
+
+#include <stdio.h>
+    // Import printf(), fprintf()
+#include <unistd.h>
+    // Import getpid()
+
+#include "regress.h"
+#include "svc_drc.h"
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_in sin;
+    struct drc_stats st;
+    static const uint32_t xid7[] = { 7 };
+    static const uint32_t arg5[] = { 5 };
+    static const uint32_t arg6[] = { 6 };
+    static const uint32_t xidp[] = { 20, 21, 22, 23 };
+    static const uint32_t argp[] = { 1, 2, 3, 4 };
+    int port;
+    int sock;
+    int bad;
+
+    svctcp_enablecache(1 << 20, 0);
+    sin = regress_server(argc - 1, argv + 1);
+    port = 40000 + (int)(getpid() % 10000);
+    bad = 0;
+
+    sock = regress_connect(&sin, port);
+    bad += regress_calls_raw(sock, 1, xid7, arg5);
+    bad += regress_expect(1, "first call");
+    regress_abort(sock);
+
+    // Same xid and arguments, from a new port: a retransmission.
+    sock = regress_connect(&sin, port + 1);
+    bad += regress_calls_raw(sock, 1, xid7, arg5);
+    bad += regress_expect(1, "retransmission from another port");
+    // Same xid, new arguments: a new call.
+    bad += regress_calls_raw(sock, 1, xid7, arg6);
+    bad += regress_expect(2, "same xid, other arguments");
+    regress_abort(sock);
+
+    // Both calls, once more, from any port: both are retransmissions.
+    sock = regress_connect(&sin, 0);
+    bad += regress_calls_raw(sock, 1, xid7, arg5);
+    bad += regress_calls_raw(sock, 1, xid7, arg6);
+    bad += regress_expect(2, "retransmissions from an ephemeral port");
+    regress_abort(sock);
+
+    sock = regress_connect(&sin, 0);
+    bad += regress_calls_raw(sock, 4, xidp, argp);
+    bad += regress_expect(6, "pipelined calls");
+    regress_abort(sock);
+
+    sock = regress_connect(&sin, 0);
+    bad += regress_calls_raw(sock, 4, xidp, argp);
+    bad += regress_expect(6, "pipelined retransmission");
+    regress_abort(sock);
+
+    svctcp_cache_stats(&st);
+    if (st.hits != 7 || st.inserts != 6 || st.entries != 6) {
+        fprintf(stderr, "cache stats: hits=%zu, inserts=%zu, entries=%zu;"
+            " expected 7, 6, 6\n", st.hits, st.inserts, st.entries);
+        ++bad;
+    }
+
+    printf("drc_key: %s\n", bad ? "FAIL" : "ok");
+    fflush(stdout);
+    _exit(bad != 0);
+}
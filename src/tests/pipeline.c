@@ -0,0 +1,97 @@
+/*
+ * Filename: pipeline.c
+ * Project: rpc-mt
+ * Brief: Regression test: pipelined TCP records, and idle buffer release
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: pipeline [svc_config commands...]
+ *
+ * A client writes batches of calls, each batch in one write(), so that
+ * the server finds several records in one read.  Every call must get
+ * its own reply.  Between batches, the connection is left idle long
+ * enough for its stream buffers to go back to the pool, which must
+ * neither lose nor replay a record, and, once the connection is idle,
+ * no stream may still hold buffer memory.
+ *
+ * Exit status is 0 if all is well.
+ */
+
+#include <stdio.h>
+    // Import printf(), fprintf()
+#include <unistd.h>
+    // Import sleep(), close()
+
+#include "regress.h"
+#include "xdr_rec.h"
+
+#define ROUNDS 200
+#define BATCH  8
+
+static size_t
+busy_bytes(void)
+{
+    struct xdrrec_pool_stats st;
+
+    xdrrec_pool_stats(&st);
+    return (st.busy_bytes);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_in sin;
+    uint32_t xidv[BATCH];
+    uint32_t argsv[BATCH];
+    size_t busy;
+    int round;
+    int sock;
+    int bad;
+    int q;
+
+    sin = regress_server(argc - 1, argv + 1);
+    sock = regress_connect(&sin, 0);
+    bad = 0;
+    for (round = 0; round < ROUNDS; ++round) {
+        for (q = 0; q < BATCH; ++q) {
+            xidv[q] = (uint32_t)(round * BATCH + q + 1);
+            argsv[q] = xidv[q] * 3;
+        }
+        bad += regress_calls_raw(sock, BATCH, xidv, argsv);
+        if (round == ROUNDS / 2) {
+            if (busy_bytes() == 0) {
+                fprintf(stderr, "busy connection holds no buffers\n");
+                ++bad;
+            }
+            // Long enough for the idle sweep to release the buffers.
+            sleep(3);
+            busy = busy_bytes();
+            if (busy != 0) {
+                fprintf(stderr, "idle connection holds %zu bytes\n", busy);
+                ++bad;
+            }
+        }
+    }
+    bad += regress_expect(ROUNDS * BATCH, "pipelined calls");
+    close(sock);
+
+    printf("pipeline: %s\n", bad ? "FAIL" : "ok");
+    fflush(stdout);
+    _exit(bad != 0);
+}
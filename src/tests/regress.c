@@ -0,0 +1,284 @@
+/*
+ * Filename: regress.c
+ * Project: rpc-mt
+ * Brief: Shared server and raw-socket client for the regression tests
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+    // Import fprintf()
+#include <stdlib.h>
+    // Import exit(), malloc(), free()
+#include <string.h>
+    // Import memset(), memcpy(), strncmp(), strerror()
+#include <unistd.h>
+    // Import read(), write(), close(), usleep()
+#include <errno.h>
+    // Import errno
+#include <pthread.h>
+    // Import pthread_create(), pthread_detach()
+#include <sys/socket.h>
+    // Import socket(), bind(), connect(), setsockopt()
+#include <arpa/inet.h>
+    // Import htonl(), ntohl(), htons()
+#include <rpc/rpc.h>
+    // Import svctcp_create(), svc_register(), svc_run(), xdr_u_int()
+
+#include "regress.h"
+
+extern int  svc_config(const char *cmd);
+extern void svc_return(SVCXPRT *xprt);
+
+volatile int regress_calls;
+
+static int regress_mtmode;
+
+static void
+die(const char *what)
+{
+    fprintf(stderr, "%s: %s\n", what, strerror(errno));
+    exit(2);
+}
+
+/*
+ * Do the call, as a worker.  As librpc requires, that is
+ * svc_getargs(), svc_sendreply(), then svc_return().
+ */
+static void *
+regress_work(void *arg)
+{
+    SVCXPRT *xprt;
+    u_int v;
+
+    xprt = (SVCXPRT *)arg;
+    v = 0;
+    if (!svc_getargs(xprt, (xdrproc_t)xdr_u_int, (caddr_t)&v)) {
+        svcerr_decode(xprt);
+    }
+    else {
+        __sync_fetch_and_add(&regress_calls, 1);
+        ++v;
+        (void) svc_sendreply(xprt, (xdrproc_t)xdr_u_int, (caddr_t)&v);
+    }
+    svc_return(xprt);
+    return (NULL);
+}
+
+static void
+regress_dispatch(struct svc_req *rqstp, SVCXPRT *xprt)
+{
+    pthread_t thr;
+
+    (void) rqstp;
+    if (regress_mtmode == 0) {
+        (void) regress_work(xprt);
+        return;
+    }
+    if (pthread_create(&thr, NULL, regress_work, xprt) != 0) {
+        die("pthread_create");
+    }
+    (void) pthread_detach(thr);
+}
+
+static void *
+regress_run(void *arg)
+{
+    svc_run();
+    return (arg);
+}
+
+struct sockaddr_in
+regress_server(int argc, char **argv)
+{
+    struct sockaddr_in sin;
+    socklen_t len;
+    SVCXPRT *xprt;
+    pthread_t thr;
+    int sock;
+    int i;
+
+    for (i = 0; i < argc; ++i) {
+        if (svc_config(argv[i]) != 0) {
+            fprintf(stderr, "svc_config(\"%s\") failed.\n", argv[i]);
+            exit(2);
+        }
+        if (strncmp(argv[i], "mtmode=", 7) == 0) {
+            regress_mtmode = atoi(argv[i] + 7);
+        }
+    }
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        die("socket");
+    }
+    memset(&sin, 0, sizeof (sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&sin, sizeof (sin)) != 0) {
+        die("bind");
+    }
+    len = sizeof (sin);
+    if (getsockname(sock, (struct sockaddr *)&sin, &len) != 0) {
+        die("getsockname");
+    }
+    xprt = svctcp_create(sock, 0, 0);
+    if (xprt == NULL) {
+        fprintf(stderr, "svctcp_create failed.\n");
+        exit(2);
+    }
+    if (!svc_register(xprt, REGRESS_PROG, REGRESS_VERS, regress_dispatch, 0)) {
+        fprintf(stderr, "svc_register failed.\n");
+        exit(2);
+    }
+    if (pthread_create(&thr, NULL, regress_run, NULL) != 0) {
+        die("pthread_create");
+    }
+    return (sin);
+}
+
+int
+regress_connect(const struct sockaddr_in *sin, int port)
+{
+    struct sockaddr_in me;
+    int sock;
+    int on;
+
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        die("socket");
+    }
+    if (port != 0) {
+        on = 1;
+        (void) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+        memset(&me, 0, sizeof (me));
+        me.sin_family = AF_INET;
+        me.sin_port = htons(port);
+        me.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(sock, (struct sockaddr *)&me, sizeof (me)) != 0) {
+            die("bind");
+        }
+    }
+    if (connect(sock, (const struct sockaddr *)sin, sizeof (*sin)) != 0) {
+        die("connect");
+    }
+    return (sock);
+}
+
+void
+regress_abort(int sock)
+{
+    struct linger lg;
+
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    (void) setsockopt(sock, SOL_SOCKET, SO_LINGER, &lg, sizeof (lg));
+    close(sock);
+    usleep(100000);
+}
+
+static int
+read_all(int fd, void *buf, size_t len)
+{
+    size_t got;
+    ssize_t rv;
+
+    got = 0;
+    while (got < len) {
+        rv = read(fd, (char *)buf + got, len - got);
+        if (rv <= 0) {
+            return (-1);
+        }
+        got += (size_t)rv;
+    }
+    return (0);
+}
+
+/*
+ * A call is 12 words: the record mark, xid, CALL, RPC version 2,
+ * program, version, procedure, AUTH_NONE credential and verifier,
+ * and the argument.  A reply is 8 words: the record mark, xid, REPLY,
+ * MSG_ACCEPTED, AUTH_NONE verifier, SUCCESS, and the result.
+ */
+#define CALL_WORDS  12
+#define REPLY_WORDS 8
+
+int
+regress_calls_raw(int sock, int n, const uint32_t *xidv, const uint32_t *argv)
+{
+    uint32_t buf[REGRESS_BATCH_MAX * CALL_WORDS];
+    uint32_t *w;
+    uint32_t rp[REPLY_WORDS];
+    uint32_t xid;
+    size_t len;
+    int bad;
+    int ok;
+    int q;
+    int i;
+
+    if (n > REGRESS_BATCH_MAX) {
+        n = REGRESS_BATCH_MAX;
+    }
+    memset(buf, 0, sizeof (buf));
+    for (q = 0; q < n; ++q) {
+        w = &buf[q * CALL_WORDS];
+        w[0] = htonl(0x80000000U | ((CALL_WORDS - 1) * 4));
+        w[1] = htonl(xidv[q]);
+        w[3] = htonl(2);
+        w[4] = htonl(REGRESS_PROG);
+        w[5] = htonl(REGRESS_VERS);
+        w[6] = htonl(REGRESS_INC);
+        w[11] = htonl(argv[q]);
+    }
+    len = (size_t)n * CALL_WORDS * 4;
+    if (write(sock, buf, len) != (ssize_t)len) {
+        fprintf(stderr, "short write of %d calls\n", n);
+        return (n);
+    }
+
+    bad = 0;
+    for (q = 0; q < n; ++q) {
+        if (read_all(sock, rp, sizeof (rp)) != 0) {
+            fprintf(stderr, "%d replies missing\n", n - q);
+            return (bad + n - q);
+        }
+        xid = ntohl(rp[1]);
+        ok = 0;
+        for (i = 0; i < n; ++i) {
+            if (xid == xidv[i] && ntohl(rp[7]) == argv[i] + 1) {
+                ok = 1;
+            }
+        }
+        if (!ok) {
+            fprintf(stderr, "bad reply: xid=%u, result=%u\n", xid, ntohl(rp[7]));
+            ++bad;
+        }
+    }
+    return (bad);
+}
+
+int
+regress_expect(int want, const char *what)
+{
+    usleep(50000);
+    if (regress_calls != want) {
+        fprintf(stderr, "%s: %d calls run, expected %d\n",
+            what, regress_calls, want);
+        return (1);
+    }
+    return (0);
+}
@@ -0,0 +1,77 @@
+/*
+ * Filename: regress.h
+ * Project: rpc-mt
+ * Brief: Shared server and raw-socket client for the regression tests
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REGRESS_H
+#define _REGRESS_H 1
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>      // Import uint32_t
+#include <netinet/in.h>  // Import struct sockaddr_in
+
+/*
+ * The test program has one procedure, REGRESS_INC, u_int -> u_int,
+ * which returns its argument plus one, and counts the calls it ran
+ * in @var{regress_calls}.
+ *
+ * regress_server() applies each of @var{argv} with svc_config(),
+ * for example "mtmode=1", and serves the program over TCP on the
+ * loopback interface, with svc_run() on a thread of its own.
+ * In mtmode 0, calls run in the dispatcher; otherwise, each call
+ * gets a worker thread.  Return the address to connect to.
+ *
+ * regress_connect() connects to @var{sin} from local port @var{port},
+ * or from any port, if @var{port} is 0.  regress_abort() resets the
+ * connection, so that the local port can be used again right away.
+ *
+ * regress_calls_raw() writes @var{n} calls, all in one write(),
+ * with the xids @var{xidv} and arguments @var{argv}, then reads
+ * @var{n} replies, in any order, and checks each one by its xid.
+ * Return the number of replies that are missing or wrong.
+ *
+ * regress_expect() waits for the server to settle, then checks that
+ * it has run @var{want} calls in all, and complains about @var{what},
+ * if not.  Return 1 for a failure, else 0.
+ */
+
+#define REGRESS_PROG 0x20000b0cU
+#define REGRESS_VERS 1
+#define REGRESS_INC  1
+
+#define REGRESS_BATCH_MAX 16
+
+extern volatile int regress_calls;
+
+extern struct sockaddr_in regress_server(int argc, char **argv);
+extern int  regress_connect(const struct sockaddr_in *sin, int port);
+extern void regress_abort(int sock);
+extern int  regress_calls_raw(int sock, int n, const uint32_t *xidv,
+                const uint32_t *argv);
+extern int  regress_expect(int want, const char *what);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* _REGRESS_H */
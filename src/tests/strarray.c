@@ -0,0 +1,251 @@
+/*
+ * Filename: strarray.c
+ * Project: rpc-mt
+ * Brief: Regression test: xdr_strarray() decode, encode and free
+ *
+ * Copyright (C) 2019 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Usage: strarray
+ *
+ * For arrays of strings of many lengths, xdr_strarray() must encode
+ * the same bytes as xdr_array() of xdr_wrapstring(), and decode them
+ * back, from memory and from a record stream with buffers smaller than
+ * one string, into an arena that XDR_FREE gives back.  Arrays or
+ * strings that are too long must be refused, and leave nothing behind.
+ *
+ * Exit status is 0 if all is well.
+ */
+
+#include <stdio.h>
+    // Import printf(), fprintf()
+#include <stdlib.h>
+    // Import malloc(), calloc(), free(), rand(), srand()
+#include <string.h>
+    // Import memcmp(), memcpy(), strcmp(), strdup()
+#include <rpc/rpc.h>
+    // Import xdrmem_create(), xdrrec_create(), xdr_array(), xdr_wrapstring()
+
+#include "xdr_string.h"
+
+#define MAXLEN   300
+#define MAXSIZE  255
+#define BUFSIZE  (1 << 20)
+
+static char encbuf[BUFSIZE];
+static char strbuf[BUFSIZE];
+
+/*
+ * A record stream over a buffer in memory.
+ */
+static char pipebuf[BUFSIZE];
+static int pipe_wpos;
+static int pipe_rpos;
+
+static int
+pipe_write(char *handle, char *buf, int len)
+{
+    (void) handle;
+    memcpy(pipebuf + pipe_wpos, buf, (size_t)len);
+    pipe_wpos += len;
+    return (len);
+}
+
+static int
+pipe_read(char *handle, char *buf, int len)
+{
+    (void) handle;
+    if (len > pipe_wpos - pipe_rpos) {
+        len = pipe_wpos - pipe_rpos;
+    }
+    if (len == 0) {
+        return (-1);
+    }
+    memcpy(buf, pipebuf + pipe_rpos, (size_t)len);
+    pipe_rpos += len;
+    return (len);
+}
+
+static char **
+make_strings(u_int n, u_int maxsize)
+{
+    char **v;
+    u_int i;
+    u_int len;
+    u_int k;
+
+    v = (char **)calloc(n + 1, sizeof (char *));
+    for (i = 0; i < n; ++i) {
+        len = (u_int)rand() % (maxsize + 1);
+        v[i] = (char *)malloc(len + 1);
+        for (k = 0; k < len; ++k) {
+            v[i][k] = (char)('a' + rand() % 26);
+        }
+        v[i][len] = '\0';
+    }
+    return (v);
+}
+
+static void
+free_strings(char **v, u_int n)
+{
+    u_int i;
+
+    for (i = 0; i < n; ++i) {
+        free(v[i]);
+    }
+    free(v);
+}
+
+static int
+same_strings(char **a, char **b, u_int n)
+{
+    u_int i;
+
+    for (i = 0; i < n; ++i) {
+        if (strcmp(a[i], b[i]) != 0) {
+            return (0);
+        }
+    }
+    return (1);
+}
+
+/*
+ * Decode what @var{xdrs} holds, compare it with @var{v},
+ * then free it with XDR_FREE.
+ */
+static int
+check_decode(XDR *xdrs, char **v, u_int n, const char *what, int seed)
+{
+    char **dv;
+    u_int dn;
+    int bad;
+
+    bad = 0;
+    dv = NULL;
+    dn = 0;
+    if (!xdr_strarray(xdrs, &dv, &dn, MAXLEN, MAXSIZE)) {
+        fprintf(stderr, "%s: seed %d: decode failed\n", what, seed);
+        return (1);
+    }
+    if (dn != n || !same_strings(v, dv, n)) {
+        fprintf(stderr, "%s: seed %d: decoded the wrong strings\n", what, seed);
+        ++bad;
+    }
+    if (n == 0 && dv != NULL) {
+        fprintf(stderr, "%s: seed %d: empty array allocated\n", what, seed);
+        ++bad;
+    }
+    xdrs->x_op = XDR_FREE;
+    if (!xdr_strarray(xdrs, &dv, &dn, MAXLEN, MAXSIZE) || dv != NULL) {
+        fprintf(stderr, "%s: seed %d: XDR_FREE failed\n", what, seed);
+        ++bad;
+    }
+    return (bad);
+}
+
+static int
+check_refused(const char *what, u_int maxlen, u_int maxsize)
+{
+    char **v;
+    char **dv;
+    XDR xdrs;
+    u_int n;
+    u_int dn;
+    int bad;
+
+    bad = 0;
+    n = 20;
+    v = (char **)calloc(n + 1, sizeof (char *));
+    for (dn = 0; dn < n; ++dn) {
+        v[dn] = strdup("refused");
+    }
+    xdrmem_create(&xdrs, encbuf, sizeof (encbuf), XDR_ENCODE);
+    (void) xdr_array(&xdrs, (char **)&v, &n, MAXLEN,
+        sizeof (char *), (xdrproc_t)xdr_wrapstring);
+    xdrmem_create(&xdrs, encbuf, XDR_GETPOS(&xdrs), XDR_DECODE);
+    dv = NULL;
+    if (xdr_strarray(&xdrs, &dv, &dn, maxlen, maxsize) || dv != NULL) {
+        fprintf(stderr, "%s: not refused\n", what);
+        ++bad;
+    }
+    free_strings(v, n);
+    return (bad);
+}
+
+int
+main(void)
+{
+    char **v;
+    XDR xdrs;
+    u_int n;
+    u_int na;
+    u_int nb;
+    int seed;
+    int bad;
+
+    bad = 0;
+    for (seed = 0; seed < 300; ++seed) {
+        srand((unsigned int)seed);
+        n = (u_int)rand() % (MAXLEN + 1);
+        if (seed == 0) {
+            n = 0;
+        }
+        v = make_strings(n, MAXSIZE);
+
+        xdrmem_create(&xdrs, encbuf, sizeof (encbuf), XDR_ENCODE);
+        if (!xdr_array(&xdrs, (char **)&v, &n, MAXLEN,
+                sizeof (char *), (xdrproc_t)xdr_wrapstring)) {
+            fprintf(stderr, "seed %d: xdr_array encode failed\n", seed);
+            return (2);
+        }
+        na = XDR_GETPOS(&xdrs);
+        xdrmem_create(&xdrs, strbuf, sizeof (strbuf), XDR_ENCODE);
+        if (!xdr_strarray(&xdrs, &v, &n, MAXLEN, MAXSIZE)) {
+            fprintf(stderr, "seed %d: xdr_strarray encode failed\n", seed);
+            return (2);
+        }
+        nb = XDR_GETPOS(&xdrs);
+        if (na != nb || memcmp(encbuf, strbuf, na) != 0) {
+            fprintf(stderr, "seed %d: encodings differ\n", seed);
+            ++bad;
+        }
+
+        xdrmem_create(&xdrs, encbuf, na, XDR_DECODE);
+        bad += check_decode(&xdrs, v, n, "xdrmem", seed);
+
+        pipe_wpos = pipe_rpos = 0;
+        xdrrec_create(&xdrs, 100, 100, NULL, pipe_read, pipe_write);
+        xdrs.x_op = XDR_ENCODE;
+        (void) xdr_array(&xdrs, (char **)&v, &n, MAXLEN,
+            sizeof (char *), (xdrproc_t)xdr_wrapstring);
+        (void) xdrrec_endofrecord(&xdrs, TRUE);
+        xdrs.x_op = XDR_DECODE;
+        (void) xdrrec_skiprecord(&xdrs);
+        bad += check_decode(&xdrs, v, n, "xdrrec", seed);
+        xdr_destroy(&xdrs);
+
+        free_strings(v, n);
+    }
+
+    bad += check_refused("array longer than maxlen", 10, MAXSIZE);
+    bad += check_refused("string longer than maxsize", MAXLEN, 1);
+
+    printf("strarray: %s\n", bad ? "FAIL" : "ok");
+    return (bad != 0);
+}